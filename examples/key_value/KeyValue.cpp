@@ -1,3 +1,4 @@
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
@@ -8,9 +9,11 @@
 #include "glog/logging.h"
 #include "pipeline/RedisHandler.h"
 #include "pipeline/RedisPipelineBootstrap.h"
+#include "pipeline/TtlCompactionFilter.h"
 #include "rocksdb/options.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/status.h"
+#include "rocksdb/write_batch.h"
 
 namespace key_value {
 
@@ -22,8 +25,13 @@ class KeyValueHandler: public pipeline::RedisHandler {
 
   const CommandHandlerTable& getCommandHandlerTable() const override {
     static const CommandHandlerTable commandHandlerTable(mergeWithDefaultCommandHandlerTable({
-        {"get", {static_cast<CommandHandlerFunc>(&KeyValueHandler::getCommand), 1, 1}},  // requires 1 parameter
-        {"set", {static_cast<CommandHandlerFunc>(&KeyValueHandler::setCommand), 2, 2}},  // requires 2 parameters
+        // requires 1 parameter, and the key at position 1 is routed to its owner when cluster support is enabled
+        {"get", {static_cast<CommandHandlerFunc>(&KeyValueHandler::getCommand), 1, 1, false, 1}},
+        // requires 2 parameters, and it is a write command subject to write stall backpressure
+        {"set", {static_cast<CommandHandlerFunc>(&KeyValueHandler::setCommand), 2, 2, true, 1}},
+        {"setex", {static_cast<CommandHandlerFunc>(&KeyValueHandler::setexCommand), 3, 3, true, 1}},
+        {"expire", {static_cast<CommandHandlerFunc>(&KeyValueHandler::expireCommand), 2, 2, true, 1}},
+        {"ttl", {static_cast<CommandHandlerFunc>(&KeyValueHandler::ttlCommand), 1, 1, false, 1}},
     }));
     return commandHandlerTable;
   }
@@ -33,7 +41,8 @@ class KeyValueHandler: public pipeline::RedisHandler {
     rocksdb::Slice key = rocksdb::Slice(cmd[1]);
 
     std::string value;
-    rocksdb::Status status = db()->Get(rocksdb::ReadOptions(), key, &value);
+    // values are stored in TTL envelopes and expired values are hidden until compaction drops them
+    rocksdb::Status status = databaseManager()->getWithTtl(db()->DefaultColumnFamily(), key, &value);
 
     if (status.ok()) {
       return codec::RedisValue(codec::RedisValue::Type::kBulkString, std::move(value));
@@ -47,8 +56,59 @@ class KeyValueHandler: public pipeline::RedisHandler {
   }
 
   codec::RedisValue setCommand(const std::vector<std::string>& cmd, Context* ctx) {
-    rocksdb::Slice key = rocksdb::Slice(cmd[1]);
-    rocksdb::Status status = db()->Put(rocksdb::WriteOptions(), key, cmd[2]);
+    // same as redis, SET discards any previous expiration
+    return put(cmd[1], cmd[2], pipeline::TtlEnvelope::kNoExpiration);
+  }
+
+  codec::RedisValue setexCommand(const std::vector<std::string>& cmd, Context* ctx) {
+    int64_t seconds;
+    if (!parseInt(cmd[2], &seconds)) return errorInvalidInteger();
+    int64_t expireAtMs;
+    if (seconds <= 0 || !getExpireAtMs(seconds, &expireAtMs)) return errorResp("Invalid expire time in setex");
+
+    return put(cmd[1], cmd[3], expireAtMs);
+  }
+
+  codec::RedisValue expireCommand(const std::vector<std::string>& cmd, Context* ctx) {
+    int64_t seconds;
+    if (!parseInt(cmd[2], &seconds)) return errorInvalidInteger();
+    int64_t expireAtMs;
+    if (!getExpireAtMs(seconds, &expireAtMs)) return errorResp("Invalid expire time in expire");
+
+    rocksdb::Status status = databaseManager()->expireWithTtl(db()->DefaultColumnFamily(), cmd[1], expireAtMs);
+    if (status.ok()) return codec::RedisValue(1);
+    if (status.IsNotFound()) return codec::RedisValue(0);
+
+    return errorResp(folly::sformat("RocksDB error: {}", status.ToString()));
+  }
+
+  codec::RedisValue ttlCommand(const std::vector<std::string>& cmd, Context* ctx) {
+    std::string value;
+    int64_t expireAtMs;
+    rocksdb::Status status = databaseManager()->getWithTtl(db()->DefaultColumnFamily(), cmd[1], &value, &expireAtMs);
+    // same as redis, -2 for missing keys and -1 for keys without expiration
+    if (status.IsNotFound()) return codec::RedisValue(-2);
+    if (!status.ok()) return errorResp(folly::sformat("RocksDB error: {}", status.ToString()));
+    if (expireAtMs == pipeline::TtlEnvelope::kNoExpiration) return codec::RedisValue(-1);
+
+    // round up so that a key about to expire does not report 0
+    return codec::RedisValue((expireAtMs - nowMs() + 999) / 1000);
+  }
+
+  // Convert a relative expiration into an absolute one. Return false when it does not fit in 64 bits.
+  static bool getExpireAtMs(int64_t seconds, int64_t* expireAtMs) {
+    int64_t now = nowMs();
+    if (seconds > (std::numeric_limits<int64_t>::max() - now) / 1000) return false;
+    // same as redis, a non-positive expiration removes the key right away
+    *expireAtMs = seconds > 0 ? now + seconds * 1000 : now;
+    return true;
+  }
+
+  codec::RedisValue put(const std::string& key, const std::string& value, int64_t expireAtMs) {
+    rocksdb::ColumnFamilyHandle* columnFamily = db()->DefaultColumnFamily();
+    rocksdb::WriteBatch writeBatch;
+    databaseManager()->putWithTtl(&writeBatch, columnFamily, key, value, expireAtMs);
+    rocksdb::Status status = databaseManager()->db(columnFamily)->Write(rocksdb::WriteOptions(), &writeBatch);
 
     if (status.ok()) {
       return simpleStringOk();
@@ -58,12 +118,19 @@ class KeyValueHandler: public pipeline::RedisHandler {
   }
 };
 
+static void configureDefaultColumnFamily(int blockCacheSizeMb, rocksdb::ColumnFamilyOptions* options) {
+  // keep the default point lookup optimization while dropping expired values during compaction
+  options->OptimizeForPointLookup(blockCacheSizeMb);
+  pipeline::TtlCompactionFilter::configure(options);
+}
+
 static pipeline::RedisPipelineBootstrap::Config config{
   redisHandlerFactory : [](const pipeline::RedisPipelineBootstrap::OptionalComponents& optionalComponents) {
     std::shared_ptr<pipeline::RedisHandler> handler =
         std::make_shared<KeyValueHandler>(optionalComponents.databaseManager);
     return handler;
   },
+  rocksDbCfConfiguratorMap : {{pipeline::DatabaseManager::defaultColumnFamilyName(), &configureDefaultColumnFamily}},
 };
 
 static auto redisPipelineBootstrap = pipeline::RedisPipelineBootstrap::create(config);
@@ -0,0 +1,245 @@
+#ifndef INFRA_KEYBUILDER_H_
+#define INFRA_KEYBUILDER_H_
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "boost/endian/conversion.hpp"
+#include "glog/logging.h"
+#include "infra/SmyteId.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/slice_transform.h"
+
+namespace infra {
+
+// Order-preserving encoding of composite keys, so that the bytewise order of encoded keys is the order of their
+// component tuples. Components are encoded as:
+//
+//   - integers in big endian with the sign bit flipped for signed types, so negative values sort first
+//   - strings with 0x00 escaped as 0x00 0xFF and terminated by 0x00 0x01, so a string sorts before its extensions
+//   - smyte ids and timestamps in big endian, byte-for-byte the same as SmyteId::appendAsBinary and
+//     ScheduledTask::encodeTimestamp, so existing keys can be read and extended
+//
+// NOTE: DatabaseManager::escapeKeyStr is not order-preserving because `%` sorts after control characters and spaces
+// once escaped, which is fine for point lookups but not for range scans over string components.
+//
+// KeyBuilder writes into a caller-supplied buffer, typically on the stack, and never allocates. Appending past the
+// capacity marks the builder as failed instead of overflowing, so check ok() before using the key.
+class KeyBuilder {
+ public:
+  static constexpr char kEscape = '\x00';
+  static constexpr char kEscapedZero = '\xff';
+  static constexpr char kTerminator = '\x01';
+  // Encoded size of a string terminator
+  static constexpr size_t kTerminatorSize = 2;
+
+  // Encoded size of a fixed-width component
+  template <typename T>
+  static constexpr size_t encodedSize() {
+    return std::is_same<T, SmyteId>::value ? sizeof(int64_t) : sizeof(T);
+  }
+
+  KeyBuilder(char* buf, size_t capacity) : buf_(buf), capacity_(capacity), size_(0), ok_(true) {}
+
+  template <size_t N>
+  explicit KeyBuilder(char (&buf)[N]) : KeyBuilder(buf, N) {}
+
+  template <typename T>
+  KeyBuilder& appendInt(T value) {
+    static_assert(std::is_integral<T>::value, "appendInt requires an integral type");
+    using Unsigned = typename std::make_unsigned<T>::type;
+    Unsigned bits = static_cast<Unsigned>(value);
+    if (std::is_signed<T>::value) bits ^= static_cast<Unsigned>(Unsigned(1) << (sizeof(T) * 8 - 1));
+    bits = boost::endian::native_to_big(bits);
+    return appendRaw(reinterpret_cast<const char*>(&bits), sizeof(bits));
+  }
+
+  KeyBuilder& appendString(const rocksdb::Slice& str) {
+    const char* p = str.data();
+    const char* end = p + str.size();
+    while (ok_) {
+      const char* zero = static_cast<const char*>(memchr(p, kEscape, end - p));
+      if (zero == nullptr) {
+        appendRaw(p, end - p);
+        break;
+      }
+      appendRaw(p, zero - p);
+      const char escaped[] = {kEscape, kEscapedZero};
+      appendRaw(escaped, sizeof(escaped));
+      p = zero + 1;
+    }
+    const char terminator[] = {kEscape, kTerminator};
+    return appendRaw(terminator, sizeof(terminator));
+  }
+
+  KeyBuilder& appendSmyteId(const SmyteId& smyteId) {
+    int64_t bits = boost::endian::native_to_big(smyteId.asInt());
+    return appendRaw(reinterpret_cast<const char*>(&bits), sizeof(bits));
+  }
+
+  // Timestamps must not be negative, like in ScheduledTask::encodeTimestamp
+  KeyBuilder& appendTimestamp(int64_t timestampMs) {
+    CHECK_GE(timestampMs, 0);
+    int64_t bits = boost::endian::native_to_big(timestampMs);
+    return appendRaw(reinterpret_cast<const char*>(&bits), sizeof(bits));
+  }
+
+  // Append bytes as they are, e.g., a trailing component that needs no terminator
+  KeyBuilder& appendRaw(const char* data, size_t size) {
+    if (!ok_ || size > capacity_ - size_) {
+      ok_ = false;
+      return *this;
+    }
+    memcpy(buf_ + size_, data, size);
+    size_ += size;
+    return *this;
+  }
+
+  bool ok() const { return ok_; }
+  size_t size() const { return size_; }
+
+  rocksdb::Slice slice() const {
+    DCHECK(ok_) << "Key exceeds the buffer capacity " << capacity_;
+    return rocksdb::Slice(buf_, size_);
+  }
+
+ private:
+  char* const buf_;
+  const size_t capacity_;
+  size_t size_;
+  bool ok_;
+};
+
+// Read back the components of a key encoded by KeyBuilder in the same order. Each read returns false without
+// consuming anything when the remaining bytes do not hold a valid component of the requested type.
+class KeyReader {
+ public:
+  explicit KeyReader(const rocksdb::Slice& key) : key_(key) {}
+
+  template <typename T>
+  bool readInt(T* value) {
+    static_assert(std::is_integral<T>::value, "readInt requires an integral type");
+    using Unsigned = typename std::make_unsigned<T>::type;
+    Unsigned bits;
+    if (key_.size() < sizeof(bits)) return false;
+    memcpy(&bits, key_.data(), sizeof(bits));
+    bits = boost::endian::big_to_native(bits);
+    if (std::is_signed<T>::value) bits ^= static_cast<Unsigned>(Unsigned(1) << (sizeof(T) * 8 - 1));
+    *value = static_cast<T>(bits);
+    key_.remove_prefix(sizeof(bits));
+    return true;
+  }
+
+  bool readString(std::string* str) {
+    str->clear();
+    const char* p = key_.data();
+    const char* end = p + key_.size();
+    while (true) {
+      const char* escape = static_cast<const char*>(memchr(p, KeyBuilder::kEscape, end - p));
+      if (escape == nullptr || escape + 1 == end) return false;
+      str->append(p, escape - p);
+      if (escape[1] == KeyBuilder::kTerminator) {
+        key_.remove_prefix(escape + KeyBuilder::kTerminatorSize - key_.data());
+        return true;
+      }
+      if (escape[1] != KeyBuilder::kEscapedZero) return false;
+      str->push_back(KeyBuilder::kEscape);
+      p = escape + 2;
+    }
+  }
+
+  bool readSmyteId(SmyteId* smyteId) {
+    if (key_.size() < sizeof(int64_t)) return false;
+    *smyteId = SmyteId(key_.data());
+    key_.remove_prefix(sizeof(int64_t));
+    return true;
+  }
+
+  bool readTimestamp(int64_t* timestampMs) {
+    int64_t bits;
+    if (key_.size() < sizeof(bits)) return false;
+    memcpy(&bits, key_.data(), sizeof(bits));
+    *timestampMs = boost::endian::big_to_native(bits);
+    key_.remove_prefix(sizeof(bits));
+    return true;
+  }
+
+  // The bytes not read yet, e.g., a trailing raw component
+  rocksdb::Slice remaining() const { return key_; }
+  bool done() const { return key_.empty(); }
+
+ private:
+  rocksdb::Slice key_;
+};
+
+// Prefix extractors for column families keyed by KeyBuilder, so that they can enable prefix bloom filters and
+// prefix seeks, e.g., in a column family configurator:
+//
+//   options->prefix_extractor.reset(KeyPrefix::newFixedPrefix<int64_t, SmyteId>());
+//   options->memtable_prefix_bloom_size_ratio = 0.1;
+//
+// Block-based tables then build their bloom filters on the prefixes instead of the whole keys.
+class KeyPrefix {
+ public:
+  // The prefix made of the given leading fixed-width components
+  template <typename... Components>
+  static const rocksdb::SliceTransform* newFixedPrefix() {
+    return rocksdb::NewFixedPrefixTransform(sumEncodedSizes<Components...>());
+  }
+
+  // The prefix made of fixedSize bytes of leading fixed-width components followed by one string component, e.g.,
+  // newStringPrefix(KeyBuilder::encodedSize<int32_t>()) for keys starting with (int32_t, string)
+  static const rocksdb::SliceTransform* newStringPrefix(size_t fixedSize = 0) {
+    return new StringPrefixTransform(fixedSize);
+  }
+
+ private:
+  class StringPrefixTransform : public rocksdb::SliceTransform {
+   public:
+    explicit StringPrefixTransform(size_t fixedSize)
+        : fixedSize_(fixedSize), name_("smyte.StringPrefix." + std::to_string(fixedSize)) {}
+
+    const char* Name() const override { return name_.c_str(); }
+
+    rocksdb::Slice Transform(const rocksdb::Slice& key) const override {
+      return rocksdb::Slice(key.data(), prefixSize(key));
+    }
+
+    bool InDomain(const rocksdb::Slice& key) const override { return prefixSize(key) > 0; }
+
+    bool InRange(const rocksdb::Slice& prefix) const override { return prefixSize(prefix) == prefix.size(); }
+
+    bool SameResultWhenAppended(const rocksdb::Slice& prefix) const override { return InRange(prefix); }
+
+   private:
+    // Size of the prefix through the string terminator, or 0 when the key does not contain a whole prefix
+    size_t prefixSize(const rocksdb::Slice& key) const {
+      if (key.size() < fixedSize_ + KeyBuilder::kTerminatorSize) return 0;
+      for (size_t i = fixedSize_; i + 1 < key.size(); i++) {
+        if (key[i] != KeyBuilder::kEscape) continue;
+        if (key[i + 1] == KeyBuilder::kTerminator) return i + KeyBuilder::kTerminatorSize;
+        // skip the escaped zero
+        i++;
+      }
+      return 0;
+    }
+
+    const size_t fixedSize_;
+    const std::string name_;
+  };
+
+  template <typename... Components>
+  static constexpr typename std::enable_if<sizeof...(Components) == 0, size_t>::type sumEncodedSizes() {
+    return 0;
+  }
+
+  template <typename First, typename... Rest>
+  static constexpr size_t sumEncodedSizes() {
+    return KeyBuilder::encodedSize<First>() + sumEncodedSizes<Rest...>();
+  }
+};
+
+}  // namespace infra
+
+#endif  // INFRA_KEYBUILDER_H_
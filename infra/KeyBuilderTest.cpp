@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "infra/KeyBuilder.h"
+#include "infra/ScheduledTask.h"
+
+namespace infra {
+
+namespace {
+
+using KeyTuple = std::tuple<int32_t, std::string, int64_t>;
+
+std::string encode(const KeyTuple& tuple) {
+  char buf[64];
+  KeyBuilder keyBuilder(buf);
+  keyBuilder.appendInt(std::get<0>(tuple)).appendString(std::get<1>(tuple)).appendInt(std::get<2>(tuple));
+  EXPECT_TRUE(keyBuilder.ok());
+  return keyBuilder.slice().ToString();
+}
+
+}  // namespace
+
+TEST(KeyBuilderTest, PreserveOrder) {
+  std::vector<KeyTuple> tuples;
+  for (int32_t i : {std::numeric_limits<int32_t>::min(), -1, 0, 1, std::numeric_limits<int32_t>::max()}) {
+    for (const std::string& str : {std::string(), std::string("\0", 1), std::string("\0\0", 2),
+                                   std::string("\0\xff", 2), std::string("\x01"), std::string("a"),
+                                   std::string("a\0", 2), std::string("ab"), std::string("\xff")}) {
+      for (int64_t j : {std::numeric_limits<int64_t>::min(), int64_t(-256), int64_t(0), int64_t(255)}) {
+        tuples.emplace_back(i, str, j);
+      }
+    }
+  }
+  // std::string compares as unsigned bytes, like the default RocksDB comparator
+  for (const auto& lhs : tuples) {
+    for (const auto& rhs : tuples) {
+      EXPECT_EQ(lhs < rhs, encode(lhs) < encode(rhs));
+    }
+  }
+}
+
+TEST(KeyBuilderTest, ReadBack) {
+  char buf[64];
+  KeyBuilder keyBuilder(buf);
+  keyBuilder.appendInt(int16_t(-2))
+      .appendString(std::string("a\0b", 3))
+      .appendSmyteId(SmyteId(12345))
+      .appendTimestamp(1500000000000L)
+      .appendInt(uint8_t(7))
+      .appendRaw("tail", 4);
+  ASSERT_TRUE(keyBuilder.ok());
+
+  KeyReader keyReader(keyBuilder.slice());
+  int16_t i;
+  std::string str;
+  SmyteId smyteId(0);
+  int64_t timestampMs;
+  uint8_t u;
+  ASSERT_TRUE(keyReader.readInt(&i));
+  EXPECT_EQ(-2, i);
+  ASSERT_TRUE(keyReader.readString(&str));
+  EXPECT_EQ(std::string("a\0b", 3), str);
+  ASSERT_TRUE(keyReader.readSmyteId(&smyteId));
+  EXPECT_EQ(SmyteId(12345), smyteId);
+  ASSERT_TRUE(keyReader.readTimestamp(&timestampMs));
+  EXPECT_EQ(1500000000000L, timestampMs);
+  ASSERT_TRUE(keyReader.readInt(&u));
+  EXPECT_EQ(7, u);
+  EXPECT_EQ("tail", keyReader.remaining().ToString());
+  EXPECT_FALSE(keyReader.readInt(&timestampMs));
+  EXPECT_FALSE(keyReader.readString(&str));
+}
+
+TEST(KeyBuilderTest, CompatibleEncodings) {
+  char buf[16];
+  KeyBuilder keyBuilder(buf);
+  keyBuilder.appendSmyteId(SmyteId(12345)).appendTimestamp(1500000000000L);
+  std::string timestamp;
+  ScheduledTask::encodeTimestamp(1500000000000L, &timestamp);
+  EXPECT_EQ(SmyteId(12345).asBinary() + timestamp, keyBuilder.slice().ToString());
+}
+
+TEST(KeyBuilderTest, Overflow) {
+  char buf[4];
+  KeyBuilder keyBuilder(buf);
+  keyBuilder.appendString("ab");
+  EXPECT_TRUE(keyBuilder.ok());
+  EXPECT_EQ(4, keyBuilder.size());
+  keyBuilder.appendInt(uint8_t(1));
+  EXPECT_FALSE(keyBuilder.ok());
+  EXPECT_EQ(4, keyBuilder.size());
+}
+
+TEST(KeyBuilderTest, InvalidString) {
+  std::string str;
+  EXPECT_FALSE(KeyReader(rocksdb::Slice("abc")).readString(&str));
+  EXPECT_FALSE(KeyReader(rocksdb::Slice("abc\0", 4)).readString(&str));
+  EXPECT_FALSE(KeyReader(rocksdb::Slice("abc\0\x02", 5)).readString(&str));
+}
+
+TEST(KeyBuilderTest, StringPrefix) {
+  std::unique_ptr<const rocksdb::SliceTransform> prefixExtractor(
+      KeyPrefix::newStringPrefix(KeyBuilder::encodedSize<int32_t>()));
+  char buf[64];
+  KeyBuilder keyBuilder(buf);
+  keyBuilder.appendInt(int32_t(1)).appendString(std::string("a\0b", 3)).appendInt(int64_t(2));
+  rocksdb::Slice key = keyBuilder.slice();
+
+  ASSERT_TRUE(prefixExtractor->InDomain(key));
+  rocksdb::Slice prefix = prefixExtractor->Transform(key);
+  // 4 bytes of int32_t, 4 bytes of the escaped string and the terminator
+  EXPECT_EQ(10, prefix.size());
+  EXPECT_TRUE(prefixExtractor->InRange(prefix));
+  EXPECT_FALSE(prefixExtractor->InRange(key));
+  EXPECT_FALSE(prefixExtractor->InDomain(rocksdb::Slice(key.data(), 9)));
+}
+
+TEST(KeyBuilderTest, FixedPrefix) {
+  std::unique_ptr<const rocksdb::SliceTransform> prefixExtractor(KeyPrefix::newFixedPrefix<int32_t, SmyteId>());
+  char buf[64];
+  KeyBuilder keyBuilder(buf);
+  keyBuilder.appendInt(int32_t(1)).appendSmyteId(SmyteId(12345)).appendString("abc");
+  EXPECT_EQ(12, prefixExtractor->Transform(keyBuilder.slice()).size());
+}
+
+}  // namespace infra
@@ -27,8 +27,43 @@ class ScheduledTask {
     return boost::endian::detail::load_big_endian<int64_t, sizeof(int64_t)>(buf);
   }
 
-  ScheduledTask(int64_t scheduledTimeMs, std::string dataKey, std::string value)
-      : scheduledTimeMs_(scheduledTimeMs), dataKey_(std::move(dataKey)), value_(std::move(value)), completed_(false) {
+  // In queues with a retry policy, values of tasks that have failed start with this marker followed by the attempt
+  // count in big endian
+  static const std::string& retryMarker() {
+    static std::string marker("\0\0retry\0", 8);
+    return marker;
+  }
+
+  // Encode the value stored for a task in a queue with a retry policy. It only carries the attempt count once the
+  // task has failed, so that tasks that never failed keep the value as given, unless the value itself starts with the
+  // marker, which is then encoded with no attempt so that it decodes unchanged.
+  static std::string encodeValue(const std::string& value, int attempts) {
+    if (attempts == 0 && !rocksdb::Slice(value).starts_with(retryMarker())) return value;
+    boost::endian::big_int32_buf_t encodedAttempts(attempts);
+    std::string storedValue = retryMarker();
+    storedValue.append(encodedAttempts.data(), sizeof(int32_t));
+    storedValue.append(value);
+    return storedValue;
+  }
+
+  // Decode a stored value into the value given to the task and its attempt count
+  static std::string decodeValue(const rocksdb::Slice& storedValue, int* attempts) {
+    size_t headerSize = retryMarker().size() + sizeof(int32_t);
+    if (storedValue.size() < headerSize || !storedValue.starts_with(retryMarker())) {
+      *attempts = 0;
+      return storedValue.ToString();
+    }
+    *attempts = boost::endian::detail::load_big_endian<int32_t, sizeof(int32_t)>(
+        storedValue.data() + retryMarker().size());
+    return std::string(storedValue.data() + headerSize, storedValue.size() - headerSize);
+  }
+
+  ScheduledTask(int64_t scheduledTimeMs, std::string dataKey, std::string value, int attempts = 0)
+      : scheduledTimeMs_(scheduledTimeMs),
+        dataKey_(std::move(dataKey)),
+        value_(std::move(value)),
+        attempts_(attempts),
+        completed_(false) {
     CHECK(!dataKey_.empty()) << "A ScheduledTask requires non-empty `dataKey`";
     encodeTimestamp(scheduledTimeMs, &key_);
     key_.append(dataKey_);
@@ -47,6 +82,14 @@ class ScheduledTask {
   const std::string& value() const {
     return value_;
   }
+  // Number of times the task has failed before
+  int attempts() const {
+    return attempts_;
+  }
+  // Value stored in a queue with a retry policy, see encodeValue
+  std::string storedValue() const {
+    return encodeValue(value_, attempts_);
+  }
   bool completed() const {
     return completed_;
   }
@@ -58,7 +101,8 @@ class ScheduledTask {
 
   bool operator==(const ScheduledTask& rhs) const {
     // no need to check `key`, since it's derivative
-    return scheduledTimeMs() == rhs.scheduledTimeMs() && dataKey() == rhs.dataKey() && value() == rhs.value();
+    return scheduledTimeMs() == rhs.scheduledTimeMs() && dataKey() == rhs.dataKey() && value() == rhs.value() &&
+           attempts() == rhs.attempts();
   }
 
   bool operator!=(const ScheduledTask& rhs) const {
@@ -71,6 +115,7 @@ class ScheduledTask {
   const std::string dataKey_;
   // Optional value for user-supplied data
   const std::string value_;
+  const int attempts_;
   // Whether this task has been completed
   bool completed_;
   // Key for the task itself, which is combination of scheduledTimeMs and dataKey
@@ -16,6 +16,7 @@ class ScheduledTaskProcessor {
 
   // Process a batch of pending tasks. Successfully processed tasks should be marked as completed.
   // The given write batch allows atomic operations on both task processing and the task completion in one transaction.
+  // Queues with multiple workers call this concurrently, each with its own write batch and with disjoint data keys.
   virtual void processPendingTasks(std::vector<ScheduledTask>* tasks, rocksdb::WriteBatch* writeBatch) = 0;
 
   // Generate task objects from an opaque key/value fair.
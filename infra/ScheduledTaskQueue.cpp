@@ -4,11 +4,17 @@
 
 #include <algorithm>
 #include <chrono>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include "folly/Conv.h"
 #include "glog/logging.h"
 #include "rocksdb/iterator.h"
 #include "rocksdb/options.h"
@@ -19,69 +25,646 @@ namespace infra {
 
 using std::chrono::milliseconds;
 
+namespace {
+
+int64_t nowMs() {
+  return std::chrono::duration_cast<milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Decode a task stored with the given key and value
+ScheduledTask decodeTask(const rocksdb::Slice& taskKey, const rocksdb::Slice& storedValue) {
+  rocksdb::Slice dataKey = taskKey;
+  dataKey.remove_prefix(sizeof(int64_t));
+  int attempts;
+  std::string value = ScheduledTask::decodeValue(storedValue, &attempts);
+  return ScheduledTask(ScheduledTask::decodeTimestamp(taskKey.data()), dataKey.ToString(), std::move(value), attempts);
+}
+
+// Collect the keys put into one column family by a write batch
+class PutKeyCollector : public rocksdb::WriteBatch::Handler {
+ public:
+  PutKeyCollector(uint32_t columnFamilyId, std::set<std::string>* keys)
+      : columnFamilyId_(columnFamilyId), keys_(keys) {}
+
+  rocksdb::Status PutCF(uint32_t columnFamilyId, const rocksdb::Slice& key, const rocksdb::Slice& value) override {
+    if (columnFamilyId == columnFamilyId_) keys_->insert(key.ToString());
+    return rocksdb::Status::OK();
+  }
+  // the defaults reject non-default column families, which would stop the iteration
+  rocksdb::Status DeleteCF(uint32_t columnFamilyId, const rocksdb::Slice& key) override {
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status SingleDeleteCF(uint32_t columnFamilyId, const rocksdb::Slice& key) override {
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status DeleteRangeCF(uint32_t columnFamilyId, const rocksdb::Slice& beginKey,
+                                const rocksdb::Slice& endKey) override {
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status MergeCF(uint32_t columnFamilyId, const rocksdb::Slice& key, const rocksdb::Slice& value) override {
+    return rocksdb::Status::OK();
+  }
+
+ private:
+  const uint32_t columnFamilyId_;
+  std::set<std::string>* keys_;
+};
+
+}  // namespace
+
+const prometheus::Histogram::BucketBoundaries& ScheduledTaskQueue::dispatchDelayBucketsSeconds() {
+  static prometheus::Histogram::BucketBoundaries buckets = {0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 60, 600};
+  return buckets;
+}
+
+void ScheduledTaskQueue::notifyScheduled(int64_t scheduledTimeMs) {
+  // the task is committed, so a scan that started before is not going to move the cursor past it
+  lowerScanCursor(scheduledTimeMs);
+  std::lock_guard<std::mutex> guard(wakeUpMutex_);
+  if (scheduledTimeMs < nextDueTimeMs_) {
+    nextDueTimeMs_ = scheduledTimeMs;
+    wakeUpCv_.notify_one();
+  }
+}
+
+bool ScheduledTaskQueue::cancel(const std::string& dataKey) {
+  CHECK(indexColumnFamily_) << "Cancelling tasks requires the index";
+  std::lock_guard<std::mutex> guard(indexMutex_);
+  int64_t scheduledTimeMs;
+  if (!getIndexedTimeMs(dataKey, &scheduledTimeMs)) return false;
+  ScheduledTask task(scheduledTimeMs, dataKey, "");
+  bool exists = taskExists(task.key());
+  rocksdb::WriteBatch writeBatch;
+  writeBatch.Delete(indexColumnFamily_, dataKey);
+  if (exists) {
+    writeBatch.Delete(columnFamily_, task.key());
+    countTasks(-1, &writeBatch);
+  }
+  rocksdb::Status status = db_->Write(rocksdb::WriteOptions(), &writeBatch);
+  if (!status.ok()) {
+    LOG(ERROR) << "Failed to cancel scheduled task: " << status.ToString();
+    return false;
+  }
+  return exists;
+}
+
+bool ScheduledTaskQueue::reschedule(const std::string& dataKey, int64_t scheduledTimeMs) {
+  CHECK(indexColumnFamily_) << "Rescheduling tasks requires the index";
+  {
+    std::lock_guard<std::mutex> guard(indexMutex_);
+    int64_t previousTimeMs;
+    if (!getIndexedTimeMs(dataKey, &previousTimeMs)) return false;
+    ScheduledTask previousTask(previousTimeMs, dataKey, "");
+    std::string value;
+    rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), columnFamily_, previousTask.key(), &value);
+    if (status.IsNotFound()) return false;
+    if (!status.ok()) {
+      LOG(ERROR) << "Failed to read scheduled task: " << status.ToString();
+      return false;
+    }
+    if (previousTimeMs == scheduledTimeMs) return true;
+
+    ScheduledTask task(scheduledTimeMs, dataKey, std::move(value));
+    rocksdb::WriteBatch writeBatch;
+    writeBatch.Delete(columnFamily_, previousTask.key());
+    // overwriting a replaced task of the data key leaves one task less
+    if (taskExists(task.key())) {
+      countTasks(-1, &writeBatch);
+    }
+    writeBatch.Put(columnFamily_, task.key(), task.value());
+    indexTask(task, &writeBatch);
+    trackScheduledTime(scheduledTimeMs);
+    status = db_->Write(rocksdb::WriteOptions(), &writeBatch);
+    if (!status.ok()) {
+      LOG(ERROR) << "Failed to reschedule task: " << status.ToString();
+      return false;
+    }
+  }
+  notifyScheduled(scheduledTimeMs);
+  return true;
+}
+
 void ScheduledTaskQueue::start() {
   CHECK(executionThread_ == nullptr) << "Execution thread already started";
 
-  CHECK_EQ(outstandingTaskCount_, 0);
-  outstandingTaskCount_ = accurateOutstandingTaskCountSlow();
+  initializeTaskCount();
+
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Worker* worker = workers_[i].get();
+    worker->thread.reset(new std::thread([this, worker]() { this->runWorker(worker); }));
+    pthread_setname_np(worker->thread->native_handle(), folly::to<std::string>("sched-worker-", i).c_str());
+  }
 
   executionThread_.reset(new std::thread([this]() {
     while (this->run_) {
+      {
+        // tasks notified from now on may be committed too late for the scan below
+        std::lock_guard<std::mutex> guard(wakeUpMutex_);
+        nextDueTimeMs_ = std::numeric_limits<int64_t>::max();
+      }
       // scan up to the next millisecond
-      int64_t maxTimestampMs =
-        std::chrono::duration_cast<milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() + 1;
+      int64_t maxTimestampMs = nowMs() + 1;
       // loop until the queue is exhausted
-      while (this->batchProcessing(maxTimestampMs) == scanBatchSize_) {}
-      std::this_thread::sleep_for(milliseconds(kCheckIntervalMs));
+      if (this->workers_.empty()) {
+        while (this->batchProcessing(maxTimestampMs) == scanBatchSize_) {}
+      } else {
+        while (this->dispatchPendingTasks(maxTimestampMs)) {}
+      }
+      this->waitForNextDueTime(maxTimestampMs);
     }
   }));
   pthread_setname_np(executionThread_->native_handle(), "scheduled-task");
 
-  LOG(INFO) << "ScheduledTaskQueue execution thread started";
+  LOG(INFO) << "ScheduledTaskQueue execution thread started with " << workerCount() << " workers";
+}
+
+void ScheduledTaskQueue::stop() {
+  run_ = false;
+  // take the locks so that no thread misses the wakeup between checking run_ and waiting
+  {
+    std::lock_guard<std::mutex> guard(wakeUpMutex_);
+    wakeUpCv_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    std::lock_guard<std::mutex> guard(worker->mutex);
+    worker->cv.notify_all();
+  }
+  std::lock_guard<std::mutex> guard(inFlightMutex_);
+  inFlightCv_.notify_all();
+}
+
+void ScheduledTaskQueue::destroy() {
+  CHECK(executionThread_ != nullptr) << "Execution thread has not been created";
+
+  stop();
+
+  if (executionThread_->joinable()) {
+    executionThread_->join();
+  }
+  for (auto& worker : workers_) {
+    if (worker->thread->joinable()) {
+      worker->thread->join();
+    }
+  }
+
+  if (!taskCounter_) persistTaskCount();
+
+  LOG(INFO) << "Scheduled tasks execution thread destroyed";
 }
 
 size_t ScheduledTaskQueue::batchProcessing(int64_t maxTimestampMs) {
+  int64_t scanTimeMs = nowMs();
+  int64_t cursorMs = scanCursorMs_;
+  int64_t scanStartMs = getScanStartMs(cursorMs);
   std::vector<ScheduledTask> tasks;
-  size_t count = scanPendingTasks(maxTimestampMs, scanBatchSize_, &tasks);
+  size_t count = scanPendingTasks(scanStartMs, maxTimestampMs, scanBatchSize_, &tasks, nullptr);
+  // every task before the end of an exhausted scan has completed, otherwise stop at the last task scanned
+  int64_t nextCursorMs = count < scanBatchSize_ ? maxTimestampMs : tasks.back().scheduledTimeMs();
   if (count > 0) {
     DLOG(INFO) << "Found " << count << " pending tasks";
+    int64_t earliestRetryTimeMs = std::numeric_limits<int64_t>::max();
+    processTasks(&tasks, &earliestRetryTimeMs);
+    // failed tasks may be rescheduled before the end of the scan
+    nextCursorMs = std::min(nextCursorMs, earliestRetryTimeMs);
+    for (const auto& task : tasks) {
+      if (!task.completed()) {
+        nextCursorMs = std::min(nextCursorMs, task.scheduledTimeMs());
+        break;
+      }
+    }
+  }
+  moveScanCursor(cursorMs, nextCursorMs, scanStartMs, scanTimeMs);
+  return count;
+}
+
+size_t ScheduledTaskQueue::processTasks(std::vector<ScheduledTask>* tasks, int64_t* earliestRetryTimeMs) {
+  if (dispatchDelayHistogram_) {
+    int64_t processingTimeMs = nowMs();
+    for (const auto& task : *tasks) {
+      dispatchDelayHistogram_->Observe(std::max<int64_t>(processingTimeMs - task.scheduledTimeMs(), 0) / 1000.0);
+    }
+  }
+
+  // writing column families of other RocksDB instances CHECK-fails
+  pipeline::DatabaseManager::InstanceWriteBatch writeBatch(databaseManager_.get());
+  if (indexColumnFamily_) {
+    processIndexedTasks(tasks, &writeBatch);
+  } else {
+    processor_->processPendingTasks(tasks, &writeBatch);
+  }
+
+  std::set<std::string> reindexedDataKeys;
+  if (indexColumnFamily_) {
+    // a task scheduled by the processor keeps the index entry of its data key
+    PutKeyCollector collector(indexColumnFamily_->GetID(), &reindexedDataKeys);
+    rocksdb::Status status = writeBatch.Iterate(&collector);
+    CHECK(status.ok()) << "Reading the write batch of scheduled task processing failed: " << status.ToString();
+  }
+  // scheduling checks whether a task key exists before committing, see commitScheduledTasks
+  std::unique_lock<std::mutex> indexLock(indexMutex_);
+
+  size_t numFailed = 0;
+  for (const auto& task : *tasks) {
+    if (!task.completed()) numFailed++;
+  }
+  int64_t numAdded = 0;
+  int64_t retryTimeMs = std::numeric_limits<int64_t>::max();
+  if (maxAttempts_ > 0 && numFailed > 0) {
+    numAdded = retryFailedTasks(tasks, &reindexedDataKeys, &writeBatch, &retryTimeMs);
+  }
+  if (earliestRetryTimeMs) *earliestRetryTimeMs = retryTimeMs;
+
+  int64_t numDeleted = 0;
+  for (const auto& task : *tasks) {
+    if (!task.completed()) continue;
+    if (indexColumnFamily_) {
+      // cancelled or rescheduled since the scan
+      if (!taskExists(task.key())) continue;
+      int64_t indexedTimeMs;
+      if (getIndexedTimeMs(task.dataKey(), &indexedTimeMs) && indexedTimeMs == task.scheduledTimeMs() &&
+          reindexedDataKeys.count(task.dataKey()) == 0) {
+        writeBatch.Delete(indexColumnFamily_, task.dataKey());
+      }
+    }
+    numDeleted++;
+    writeBatch.Delete(columnFamily_, task.key());
+  }
+  if (numAdded != numDeleted) {
+    countTasks(numAdded - numDeleted, &writeBatch);
+  }
+  rocksdb::Status status = db_->Write(rocksdb::WriteOptions(), &writeBatch);
+  CHECK(status.ok()) << "Fail to persist results of scheduled task processing: " << status.ToString();
+  indexLock.unlock();
+
+  size_t numCompleted = tasks->size() - numFailed;
+  if (numFailed > 0) {
+    // not all pending tasks completed, they will be retried in next batch, or after a backoff with a retry policy.
+    // TODO(yunjing): report the lag of processing pending tasks and repeatedly retried failed tasks
+    LOG(WARNING) << numFailed << " out of " << tasks->size() << " pending tasks not completed";
+  } else {
+    DLOG(INFO) << "Completed " << numCompleted << " pending tasks";
+  }
+  return numCompleted;
+}
+
+int64_t ScheduledTaskQueue::retryFailedTasks(std::vector<ScheduledTask>* tasks,
+                                             std::set<std::string>* indexedDataKeys, rocksdb::WriteBatch* writeBatch,
+                                             int64_t* earliestRetryTimeMs) {
+  int64_t currentTimeMs = nowMs();
+  int64_t numAdded = 0;
+  std::set<std::string> retryKeys;
+  for (auto& task : *tasks) {
+    if (task.completed()) continue;
+    task.markCompleted();
+    // cancelled or rescheduled since the scan
+    if (indexColumnFamily_ && !taskExists(task.key())) continue;
+
+    int attempts = task.attempts() + 1;
+    if (attempts >= maxAttempts_) {
+      LOG(WARNING) << "Task of " << task.dataKey() << " failed " << attempts << " times, moving it to dead letters";
+      writeBatch->Put(deadLetterColumnFamily_, task.key(), ScheduledTask::encodeValue(task.value(), attempts));
+      continue;
+    }
+    // tasks of the same data key may fail in the same batch or be scheduled at the retry time
+    int64_t retryTimeMs = currentTimeMs + getRetryBackoffMs(attempts);
+    while (true) {
+      std::string retryKey = ScheduledTask(retryTimeMs, task.dataKey(), "").key();
+      if (retryKeys.count(retryKey) == 0 && !taskExists(retryKey)) {
+        retryKeys.insert(std::move(retryKey));
+        break;
+      }
+      retryTimeMs++;
+    }
+    ScheduledTask retry(retryTimeMs, task.dataKey(), task.value(), attempts);
+    *earliestRetryTimeMs = std::min(*earliestRetryTimeMs, retry.scheduledTimeMs());
+    writeBatch->Put(columnFamily_, retry.key(), retry.storedValue());
+    numAdded++;
+    if (indexColumnFamily_) {
+      int64_t indexedTimeMs;
+      if (indexedDataKeys->count(task.dataKey()) == 0 && getIndexedTimeMs(task.dataKey(), &indexedTimeMs) &&
+          indexedTimeMs == task.scheduledTimeMs()) {
+        indexTask(retry, writeBatch);
+        indexedDataKeys->insert(task.dataKey());
+      }
+    }
+  }
+  return numAdded;
+}
+
+int64_t ScheduledTaskQueue::getRetryBackoffMs(int attempts) const {
+  int64_t backoffMs = retryBackoffMs_;
+  for (int i = 1; i < attempts && backoffMs < maxRetryBackoffMs_; i++) {
+    backoffMs *= 2;
+  }
+  return std::min(backoffMs, maxRetryBackoffMs_);
+}
+
+size_t ScheduledTaskQueue::scanDeadLetters(size_t limit, std::vector<ScheduledTask>* tasks) {
+  CHECK(deadLetterColumnFamily_) << "Dead letters require a retry policy";
+  auto iter = std::unique_ptr<rocksdb::Iterator>(db_->NewIterator(rocksdb::ReadOptions(), deadLetterColumnFamily_));
+  size_t count = 0;
+  for (iter->SeekToFirst(); iter->Valid() && (limit == 0 || count < limit); iter->Next()) {
+    count++;
+    if (tasks) tasks->push_back(decodeTask(iter->key(), iter->value()));
+  }
+  CHECK(iter->status().ok()) << "Scanning dead letters failed: " << iter->status().ToString();
+  return count;
+}
+
+size_t ScheduledTaskQueue::requeueDeadLetters(const std::string& dataKey) {
+  return forEachDeadLetterChunk(dataKey, [this](const std::vector<ScheduledTask>& deadLetters) {
+    // Dead-letter keys are unique, so keeping them requeues every dead letter of a data key. They are in the past,
+    // so they are due right away.
+    std::vector<ScheduledTask> tasks;
     rocksdb::WriteBatch writeBatch;
-    processor_->processPendingTasks(&tasks, &writeBatch);
+    int64_t earliestTimeMs = std::numeric_limits<int64_t>::max();
+    for (const auto& deadLetter : deadLetters) {
+      tasks.emplace_back(deadLetter.scheduledTimeMs(), deadLetter.dataKey(), deadLetter.value());
+      earliestTimeMs = std::min(earliestTimeMs, deadLetter.scheduledTimeMs());
+      writeBatch.Delete(deadLetterColumnFamily_, deadLetter.key());
+    }
+    scheduleWithWriteBatch(tasks, &writeBatch);
+    rocksdb::Status status = commitScheduledTasks(tasks, &writeBatch);
+    CHECK(status.ok()) << "Requeueing dead letters failed: " << status.ToString();
+    notifyScheduled(earliestTimeMs);
+  });
+}
 
-    size_t numCompleted = 0;
-    for (const auto& task : tasks) {
-      if (task.completed()) {
-        numCompleted++;
-        writeBatch.Delete(columnFamily_, task.key());
+size_t ScheduledTaskQueue::purgeDeadLetters(const std::string& dataKey) {
+  return forEachDeadLetterChunk(dataKey, [this](const std::vector<ScheduledTask>& deadLetters) {
+    rocksdb::WriteBatch writeBatch;
+    for (const auto& deadLetter : deadLetters) {
+      writeBatch.Delete(deadLetterColumnFamily_, deadLetter.key());
+    }
+    rocksdb::Status status = db_->Write(rocksdb::WriteOptions(), &writeBatch);
+    CHECK(status.ok()) << "Purging dead letters failed: " << status.ToString();
+  });
+}
+
+size_t ScheduledTaskQueue::forEachDeadLetterChunk(
+    const std::string& dataKey, const std::function<void(const std::vector<ScheduledTask>&)>& callback) {
+  CHECK(deadLetterColumnFamily_) << "Dead letters require a retry policy";
+  rocksdb::ReadOptions readOptions;
+  // a full scan should not evict the working set from the block cache
+  readOptions.fill_cache = false;
+  auto iter = std::unique_ptr<rocksdb::Iterator>(db_->NewIterator(readOptions, deadLetterColumnFamily_));
+  size_t count = 0;
+  std::vector<ScheduledTask> chunk;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    rocksdb::Slice taskDataKey = iter->key();
+    taskDataKey.remove_prefix(sizeof(int64_t));
+    if (!dataKey.empty() && taskDataKey != rocksdb::Slice(dataKey)) continue;
+    chunk.push_back(decodeTask(iter->key(), iter->value()));
+    if (chunk.size() == kScanBatchSize) {
+      callback(chunk);
+      count += chunk.size();
+      chunk.clear();
+    }
+  }
+  CHECK(iter->status().ok()) << "Scanning dead letters failed: " << iter->status().ToString();
+  if (!chunk.empty()) {
+    callback(chunk);
+    count += chunk.size();
+  }
+  return count;
+}
+
+void ScheduledTaskQueue::processIndexedTasks(std::vector<ScheduledTask>* tasks, rocksdb::WriteBatch* writeBatch) {
+  std::vector<ScheduledTask> liveTasks;
+  std::vector<size_t> livePositions;
+  {
+    // checked right before dispatching, so that a task cancelled or rescheduled since the scan is not processed
+    std::lock_guard<std::mutex> guard(indexMutex_);
+    for (size_t i = 0; i < tasks->size(); i++) {
+      const ScheduledTask& task = (*tasks)[i];
+      if (!taskExists(task.key())) continue;
+      int64_t indexedTimeMs;
+      // tasks without an entry were scheduled before the index was enabled
+      if (!getIndexedTimeMs(task.dataKey(), &indexedTimeMs) || indexedTimeMs == task.scheduledTimeMs()) {
+        liveTasks.push_back(task);
+        livePositions.push_back(i);
       }
     }
-    rocksdb::Status status = databaseManager_->db()->Write(rocksdb::WriteOptions(), &writeBatch);
-    CHECK(status.ok()) << "Fail to persist results of scheduled task processing: " << status.ToString();
+  }
+  if (liveTasks.size() < tasks->size()) {
+    DLOG(INFO) << "Dropping " << tasks->size() - liveTasks.size() << " cancelled or replaced tasks";
+  }
+  if (!liveTasks.empty()) processor_->processPendingTasks(&liveTasks, writeBatch);
 
-    outstandingTaskCount_ -= numCompleted;
-    if (numCompleted < tasks.size()) {
-      // not all pending tasks completed, they will be retried in next batch.
-      // TODO(yunjing): report the lag of processing pending tasks and repeatedly retried failed tasks
-      LOG(WARNING) << tasks.size() - numCompleted << " out of " << tasks.size() << " pending tasks not completed";
+  // cancelled and replaced tasks complete without being processed
+  size_t next = 0;
+  for (size_t i = 0; i < tasks->size(); i++) {
+    if (next < livePositions.size() && livePositions[next] == i) {
+      if (liveTasks[next].completed()) (*tasks)[i].markCompleted();
+      next++;
     } else {
-      DLOG(INFO) << "Completed " << numCompleted << " pending tasks";
+      (*tasks)[i].markCompleted();
     }
   }
-  return count;
 }
 
-size_t ScheduledTaskQueue::scanPendingTasks(int64_t maxTimestampMs, size_t limit, std::vector<ScheduledTask>* tasks) {
+rocksdb::Status ScheduledTaskQueue::commitScheduledTasks(const std::vector<ScheduledTask>& tasks,
+                                                         rocksdb::WriteBatch* writeBatch) {
+  std::lock_guard<std::mutex> guard(indexMutex_);
+  int64_t numDeleted = 0;
+  std::set<std::string> deletedTaskKeys;
+  for (const auto& task : tasks) {
+    if (!indexColumnFamily_) {
+      // a task overwriting one of the same key, in the database or earlier in the batch, was counted again
+      if (!deletedTaskKeys.insert(task.key()).second || taskExists(task.key())) numDeleted++;
+      continue;
+    }
+    int64_t previousTimeMs;
+    if (!getIndexedTimeMs(task.dataKey(), &previousTimeMs)) continue;
+    std::string previousTaskKey = ScheduledTask(previousTimeMs, task.dataKey(), "").key();
+    if (deletedTaskKeys.count(previousTaskKey) > 0 || !taskExists(previousTaskKey)) continue;
+    deletedTaskKeys.insert(previousTaskKey);
+    // a task with the same key is overwritten and was counted again by scheduleWithWriteBatch
+    if (previousTimeMs != task.scheduledTimeMs()) writeBatch->Delete(columnFamily_, previousTaskKey);
+    numDeleted++;
+  }
+  if (numDeleted > 0) {
+    countTasks(-numDeleted, writeBatch);
+  }
+  return db_->Write(rocksdb::WriteOptions(), writeBatch);
+}
+
+bool ScheduledTaskQueue::getIndexedTimeMs(const std::string& dataKey, int64_t* scheduledTimeMs) {
+  std::string value;
+  rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), indexColumnFamily_, dataKey, &value);
+  if (status.IsNotFound()) return false;
+  CHECK(status.ok()) << "Reading task index failed: " << status.ToString();
+  CHECK_EQ(sizeof(int64_t), value.size()) << "Invalid task index entry for " << dataKey;
+  *scheduledTimeMs = ScheduledTask::decodeTimestamp(value.data());
+  return true;
+}
+
+bool ScheduledTaskQueue::taskExists(const std::string& taskKey) {
+  std::string value;
+  rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), columnFamily_, taskKey, &value);
+  if (status.IsNotFound()) return false;
+  CHECK(status.ok()) << "Reading scheduled task failed: " << status.ToString();
+  return true;
+}
+
+bool ScheduledTaskQueue::dispatchPendingTasks(int64_t maxTimestampMs) {
+  std::vector<ScheduledTask> tasks;
+  size_t limit;
+  {
+    std::unique_lock<std::mutex> lock(inFlightMutex_);
+    // each worker holds about one scan worth of tasks at most
+    size_t maxInFlight = scanBatchSize_ * workers_.size();
+    inFlightCv_.wait(lock, [this, maxInFlight]() { return !run_ || inFlightTaskKeys_.size() < maxInFlight; });
+    if (!run_) return false;
+
+    // Scanning under the lock guarantees that tasks leaving the in-flight set have been committed before the scan
+    // starts, so a completed task is never dispatched again and the outstanding task count is decremented once.
+    int64_t scanTimeMs = nowMs();
+    int64_t cursorMs = scanCursorMs_;
+    int64_t scanStartMs = getScanStartMs(cursorMs);
+    limit = std::min(scanBatchSize_, maxInFlight - inFlightTaskKeys_.size());
+    scanPendingTasks(scanStartMs, maxTimestampMs, limit, &tasks, &inFlightTaskKeys_);
+    for (const auto& task : tasks) {
+      inFlightTaskKeys_.insert(task.key());
+    }
+    // workers may fail any of the tasks in flight, so the cursor stops at the earliest one
+    int64_t nextCursorMs = tasks.size() < limit ? maxTimestampMs : tasks.back().scheduledTimeMs();
+    if (!inFlightTaskKeys_.empty()) {
+      nextCursorMs = std::min(nextCursorMs, ScheduledTask::decodeTimestamp(inFlightTaskKeys_.begin()->data()));
+    }
+    moveScanCursor(cursorMs, nextCursorMs, scanStartMs, scanTimeMs);
+  }
+  size_t count = tasks.size();
+  if (count == 0) return false;
+  DLOG(INFO) << "Dispatching " << count << " pending tasks";
+
+  // tasks are scanned in the order of their scheduled time, which is kept within each partition
+  std::vector<std::vector<ScheduledTask>> partitions(workers_.size());
+  for (auto& task : tasks) {
+    partitions[pipeline::DatabaseManager::getShardNum(task.dataKey(), workers_.size())].push_back(std::move(task));
+  }
+  for (size_t i = 0; i < workers_.size(); i++) {
+    if (partitions[i].empty()) continue;
+    Worker* worker = workers_[i].get();
+    std::lock_guard<std::mutex> guard(worker->mutex);
+    worker->batches.push_back(std::move(partitions[i]));
+    worker->cv.notify_one();
+  }
+  return count == limit;
+}
+
+void ScheduledTaskQueue::runWorker(Worker* worker) {
+  while (true) {
+    std::vector<ScheduledTask> tasks;
+    {
+      std::unique_lock<std::mutex> lock(worker->mutex);
+      worker->cv.wait(lock, [this, worker]() { return !run_ || !worker->batches.empty(); });
+      if (!run_) return;
+      tasks = std::move(worker->batches.front());
+      worker->batches.pop_front();
+    }
+
+    processTasks(&tasks);
+
+    // uncompleted tasks are left in the database and dispatched again by a later scan
+    std::lock_guard<std::mutex> guard(inFlightMutex_);
+    for (const auto& task : tasks) {
+      inFlightTaskKeys_.erase(task.key());
+    }
+    inFlightCv_.notify_one();
+  }
+}
+
+void ScheduledTaskQueue::trackScheduledTime(int64_t scheduledTimeMs) {
+  lowerScanCursor(scheduledTimeMs);
+  // A task scheduled in the future cannot be behind a scan unless its commit takes longer than kMaxCommitDelayMs,
+  // but one scheduled in the past may be behind the scans and even the sealed time already
+  int64_t currentTimeMs = nowMs();
+  if (scheduledTimeMs >= currentTimeMs) return;
+  std::lock_guard<std::mutex> guard(pastScheduleMutex_);
+  auto result = pastScheduleTimeMs_.emplace(currentTimeMs / 1000, scheduledTimeMs);
+  result.first->second = std::min(result.first->second, scheduledTimeMs);
+  if (scheduledTimeMs < sealedTimeMs_) sealedTimeMs_ = scheduledTimeMs;
+}
+
+void ScheduledTaskQueue::lowerScanCursor(int64_t scheduledTimeMs) {
+  int64_t cursorMs = scanCursorMs_;
+  while (scheduledTimeMs < cursorMs && !scanCursorMs_.compare_exchange_weak(cursorMs, scheduledTimeMs)) {}
+}
+
+int64_t ScheduledTaskQueue::getScanStartMs(int64_t cursorMs) {
+  int64_t currentTimeMs = nowMs();
+  if (currentTimeMs - lastRewindTimeMs_ < checkIntervalMs_) return cursorMs;
+  lastRewindTimeMs_ = currentTimeMs;
+  return std::min(sealedTimeMs_.load(), cursorMs);
+}
+
+void ScheduledTaskQueue::moveScanCursor(int64_t fromMs, int64_t toMs, int64_t scanStartMs, int64_t scanTimeMs) {
+  if (toMs < fromMs) {
+    lowerScanCursor(toMs);
+  } else {
+    // fails when a task scheduled during the scan has lowered the cursor, which then stays
+    scanCursorMs_.compare_exchange_strong(fromMs, toMs);
+  }
+  // A task may have been committed behind the cursor by a late writer, but not behind the sealed time. Only a scan
+  // starting from the sealed time has seen every task up to the cursor, so only such a scan advances it.
+  if (scanStartMs > sealedTimeMs_) return;
+  // under the lock, so that a task scheduled meanwhile behind the sealed time lowers it afterwards
+  std::lock_guard<std::mutex> guard(pastScheduleMutex_);
+  int64_t sealedTimeMs = std::min(getSealedTimeMs(scanTimeMs), scanCursorMs_.load());
+  if (sealedTimeMs > sealedTimeMs_) sealedTimeMs_ = sealedTimeMs;
+}
+
+int64_t ScheduledTaskQueue::getSealedTimeMs(int64_t timeMs) {
+  int64_t sealedTimeMs = timeMs - kMaxCommitDelayMs;
+  // drop the seconds in which every task scheduled has been committed by now
+  while (!pastScheduleTimeMs_.empty() && (pastScheduleTimeMs_.begin()->first + 1) * 1000 <= sealedTimeMs) {
+    pastScheduleTimeMs_.erase(pastScheduleTimeMs_.begin());
+  }
+  for (const auto& entry : pastScheduleTimeMs_) {
+    sealedTimeMs = std::min(sealedTimeMs, entry.second);
+  }
+  return sealedTimeMs;
+}
+
+void ScheduledTaskQueue::waitForNextDueTime(int64_t scannedTimestampMs) {
+  // Tasks due before scannedTimestampMs have been processed or dispatched. Those still left are retried after the
+  // check interval, which also covers tasks committed without notification.
+  int64_t nextDueTimeMs = findNextDueTimeMs(scannedTimestampMs);
+  int64_t waitStartMs = nowMs();
+  std::unique_lock<std::mutex> lock(wakeUpMutex_);
+  while (run_) {
+    int64_t wakeUpTimeMs = std::min({nextDueTimeMs, nextDueTimeMs_, waitStartMs + checkIntervalMs_.load()});
+    if (nowMs() >= wakeUpTimeMs) break;
+    wakeUpCv_.wait_until(lock, std::chrono::system_clock::time_point(milliseconds(wakeUpTimeMs)));
+  }
+}
+
+int64_t ScheduledTaskQueue::findNextDueTimeMs(int64_t minTimestampMs) {
+  std::string buf;
+  auto iter = std::unique_ptr<rocksdb::Iterator>(db_->NewIterator(rocksdb::ReadOptions(), columnFamily_));
+  iter->Seek(ScheduledTask::encodeTimestamp(minTimestampMs, &buf));
+  if (!iter->Valid()) return std::numeric_limits<int64_t>::max();
+  return ScheduledTask::decodeTimestamp(iter->key().data());
+}
+
+size_t ScheduledTaskQueue::scanPendingTasks(int64_t minTimestampMs, int64_t maxTimestampMs, size_t limit,
+                                            std::vector<ScheduledTask>* tasks,
+                                            const std::set<std::string>* skippedTaskKeys) {
   rocksdb::ReadOptions readOptions;
   readOptions.total_order_seek = true;  // unnecessary as long as not using hash index; keep it here for safety
   std::string buf;
   rocksdb::Slice maxTimestamp = ScheduledTask::encodeTimestamp(maxTimestampMs, &buf);
   readOptions.iterate_upper_bound = &maxTimestamp;
-  auto iter = std::unique_ptr<rocksdb::Iterator>(databaseManager_->db()->NewIterator(readOptions, columnFamily_));
+  auto iter = std::unique_ptr<rocksdb::Iterator>(db_->NewIterator(readOptions, columnFamily_));
   size_t count = 0;
-  // seek from beginning until reaching maxTimestampMs
-  for (iter->SeekToFirst(); iter->Valid() && (limit == 0 || count < limit); iter->Next()) {
+  // seek from minTimestampMs until reaching maxTimestampMs; RocksDB 5.7 has no iterate_lower_bound to do it instead
+  std::string minBuf;
+  iter->Seek(ScheduledTask::encodeTimestamp(minTimestampMs, &minBuf));
+  for (; iter->Valid() && (limit == 0 || count < limit); iter->Next()) {
     // task key <=> (timestamp, data key)
     rocksdb::Slice taskKey = iter->key();
+    if (skippedTaskKeys && skippedTaskKeys->count(taskKey.ToString()) > 0) continue;
     rocksdb::Slice timestamp = taskKey;
     timestamp.remove_suffix(taskKey.size() - sizeof(maxTimestampMs));
     rocksdb::Slice dataKey = taskKey;
@@ -89,15 +672,102 @@ size_t ScheduledTaskQueue::scanPendingTasks(int64_t maxTimestampMs, size_t limit
 
     count++;
     if (tasks) {
-      tasks->emplace_back(ScheduledTask::decodeTimestamp(timestamp.data()), dataKey.ToString(),
-                          iter->value().ToString());
+      int attempts;
+      std::string value = decodeStoredValue(iter->value(), &attempts);
+      tasks->emplace_back(ScheduledTask::decodeTimestamp(timestamp.data()), dataKey.ToString(), std::move(value),
+                          attempts);
     }
   }
 
   return count;
 }
 
+size_t ScheduledTaskQueue::outstandingTaskCount() const {
+  if (!taskCounter_) return std::max<int64_t>(outstandingTaskCount_, 0);
+  std::string value;
+  rocksdb::Status status =
+      db_->Get(rocksdb::ReadOptions(), databaseManager_->getMetadataColumnFamily(), taskCountKey_, &value);
+  if (status.IsNotFound()) return 0;
+  CHECK(status.ok()) << "Reading task count failed: " << status.ToString();
+  int64_t count;
+  CHECK(pipeline::CounterMergeOperator::parseCounter(value, &count)) << "Invalid task count: " << value;
+  return count > 0 ? count : 0;
+}
+
+void ScheduledTaskQueue::initializeTaskCount() {
+  if (!taskCounter_) {
+    std::string value;
+    int64_t count;
+    rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), databaseManager_->getMetadataColumnFamily(),
+                                      taskCountKey_, &value);
+    if (status.ok() && pipeline::CounterMergeOperator::parseCounter(value, &count) && count >= 0) {
+      outstandingTaskCount_ = count;
+    } else {
+      if (!status.ok() && !status.IsNotFound()) LOG(ERROR) << "Loading task count failed: " << status.ToString();
+      LOG(INFO) << "No persisted task count for " << columnFamily_->GetName() << ", counting outstanding tasks";
+      outstandingTaskCount_ = accurateOutstandingTaskCountSlow();
+    }
+    if (status.IsNotFound()) return;
+    // the count becomes stale as soon as tasks are scheduled or processed, so a crash before the next graceful
+    // shutdown must fall back to scanning
+    rocksdb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    status = db_->Delete(writeOptions, databaseManager_->getMetadataColumnFamily(), taskCountKey_);
+    CHECK(status.ok()) << "Removing persisted task count failed: " << status.ToString();
+    if (hasCounterMergeOperator(databaseManager_.get())) {
+      // the deletion hides merge operands left by the counter, and compacting the range of the key drops them from
+      // the files. It only runs once, since the next start finds no key.
+      rocksdb::Slice key(taskCountKey_);
+      status = db_->CompactRange(rocksdb::CompactRangeOptions(), databaseManager_->getMetadataColumnFamily(), &key,
+                                 &key);
+      if (!status.ok()) LOG(ERROR) << "Compacting task count failed: " << status.ToString();
+    }
+    return;
+  }
+
+  // Tasks committed after the snapshot are missed by the scan, but their merges apply on top of the count written
+  // below. Tasks committed before are counted by the scan, and their merges would have created the counter.
+  const rocksdb::Snapshot* snapshot = db_->GetSnapshot();
+  rocksdb::ReadOptions readOptions;
+  readOptions.snapshot = snapshot;
+  std::string value;
+  rocksdb::Status status = db_->Get(readOptions, databaseManager_->getMetadataColumnFamily(), taskCountKey_, &value);
+  if (!status.IsNotFound()) {
+    db_->ReleaseSnapshot(snapshot);
+    CHECK(status.ok()) << "Reading task count failed: " << status.ToString();
+    return;
+  }
+
+  LOG(INFO) << "No task count for " << columnFamily_->GetName() << ", counting outstanding tasks";
+  // a full scan should not evict the working set from the block cache
+  readOptions.fill_cache = false;
+  int64_t count = 0;
+  auto iter = std::unique_ptr<rocksdb::Iterator>(db_->NewIterator(readOptions, columnFamily_));
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  CHECK(iter->status().ok()) << "Counting tasks failed: " << iter->status().ToString();
+  iter.reset();
+  db_->ReleaseSnapshot(snapshot);
+
+  rocksdb::WriteBatch writeBatch;
+  writeBatch.Merge(databaseManager_->getMetadataColumnFamily(), taskCountKey_,
+                   pipeline::CounterMergeOperator::encodeDelta(count));
+  status = db_->Write(rocksdb::WriteOptions(), &writeBatch);
+  CHECK(status.ok()) << "Writing task count failed: " << status.ToString();
+  LOG(INFO) << "Counted " << count << " outstanding tasks for " << columnFamily_->GetName();
+}
+
+void ScheduledTaskQueue::persistTaskCount() {
+  rocksdb::Status status = db_->Put(rocksdb::WriteOptions(), databaseManager_->getMetadataColumnFamily(), taskCountKey_,
+                                    folly::to<std::string>(outstandingTaskCount()));
+  if (!status.ok()) LOG(ERROR) << "Persisting task count failed: " << status.ToString();
+}
+
 constexpr int64_t ScheduledTaskQueue::kCheckIntervalMs;
 constexpr size_t ScheduledTaskQueue::kScanBatchSize;
+constexpr int64_t ScheduledTaskQueue::kMaxCommitDelayMs;
+constexpr size_t ScheduledTaskQueue::kDeletionWindowSize;
+constexpr size_t ScheduledTaskQueue::kDeletionTrigger;
 
 }  // namespace infra
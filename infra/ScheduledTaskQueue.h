@@ -3,8 +3,15 @@
 
 #include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
 #include <vector>
@@ -12,12 +19,15 @@
 #include "glog/logging.h"
 #include "infra/ScheduledTask.h"
 #include "infra/ScheduledTaskProcessor.h"
+#include "pipeline/CounterMergeOperator.h"
 #include "pipeline/DatabaseManager.h"
+#include "prometheus/histogram.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/filter_policy.h"
 #include "rocksdb/options.h"
 #include "rocksdb/status.h"
 #include "rocksdb/table.h"
+#include "rocksdb/utilities/table_properties_collectors.h"
 #include "rocksdb/write_batch.h"
 #include "rocksdb/write_batch_base.h"
 
@@ -33,6 +43,11 @@ class ScheduledTaskQueue {
     return name;
   }
 
+  // Metadata key for the counter of outstanding tasks, see outstandingTaskCount
+  static std::string getTaskCountMetadataKey(const std::string& columnFamilyName) {
+    return "~scheduled-task-count~" + columnFamilyName;
+  }
+
   // Optimize the RocksDb column family used for scheduled tasks persistence.
   // The goal is to support total (ascending) order seek of timestamps represented by int64_t.
   static void optimizeColumnFamily(int _, rocksdb::ColumnFamilyOptions* options) {
@@ -47,80 +62,211 @@ class ScheduledTaskQueue {
     blockBasedOptions.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10));
     // create block-based table
     options->table_factory.reset(rocksdb::NewBlockBasedTableFactory(blockBasedOptions));
+    // Completed tasks leave runs of tombstones behind the scan cursor, so compact files dense with deletions early
+    // instead of waiting for them to reach the bottommost level
+    options->table_properties_collector_factories.emplace_back(
+        rocksdb::NewCompactOnDeletionCollectorFactory(kDeletionWindowSize, kDeletionTrigger));
+  }
+
+  // Name for the optional column family indexing the tasks of the given column family by data key, see enableIndex
+  static std::string indexColumnFamilyName(const std::string& columnFamilyName) {
+    return columnFamilyName + "-index";
+  }
+
+  // The index is only read with point lookups by data key
+  static void optimizeIndexColumnFamily(int blockCacheSizeMb, rocksdb::ColumnFamilyOptions* options) {
+    options->OptimizeForPointLookup(blockCacheSizeMb);
+  }
+
+  // Name for the column family receiving the tasks of the given column family that keep failing, see setRetryPolicy
+  static std::string deadLetterColumnFamilyName(const std::string& columnFamilyName) {
+    return columnFamilyName + "-dead-letter";
   }
 
+  // Buckets of the dispatch delay histogram, i.e., the time from when a task is due until it is processed
+  static const prometheus::Histogram::BucketBoundaries& dispatchDelayBucketsSeconds();
+
   // Persistence of scheduled tasks is maintained in the give column family of RocksDB.
   // Using a non-default column family allows to avoid key conflicts, but any column family, including the default
-  // one, suffices here.
+  // one, suffices here. It must be in the same RocksDB instance as the metadata column family, and so must the column
+  // families written by the processor, because they are all committed in a single write batch.
+  //
+  // With more than one worker, the execution thread only scans pending tasks and partitions them by the hash of their
+  // data keys over a pool of worker threads, each processing its share and committing its own write batch. Tasks with
+  // the same data key always go to the same worker and are processed in the order of their scheduled time, but the
+  // processor must be safe to call from multiple threads.
   ScheduledTaskQueue(std::shared_ptr<ScheduledTaskProcessor> processor,
                      std::shared_ptr<pipeline::DatabaseManager> databaseManager,
-                     rocksdb::ColumnFamilyHandle* columnFamily)
+                     rocksdb::ColumnFamilyHandle* columnFamily, size_t workerCount = 1)
       : processor_(processor),
         databaseManager_(databaseManager),
         columnFamily_(columnFamily),
+        db_(databaseManager->db({columnFamily, databaseManager->getMetadataColumnFamily()})),
         scanBatchSize_(std::min(processor->getMaxBatchSize(), kScanBatchSize)),
         run_(true),
-        outstandingTaskCount_(0) {}
+        checkIntervalMs_(kCheckIntervalMs),
+        taskCountKey_(getTaskCountMetadataKey(columnFamily->GetName())),
+        taskCounter_(hasCounterMergeOperator(databaseManager.get())),
+        outstandingTaskCount_(0),
+        indexColumnFamily_(nullptr),
+        retryBackoffMs_(0),
+        maxRetryBackoffMs_(0),
+        maxAttempts_(0),
+        deadLetterColumnFamily_(nullptr),
+        nextDueTimeMs_(std::numeric_limits<int64_t>::max()),
+        dispatchDelayHistogram_(nullptr),
+        scanCursorMs_(0),
+        sealedTimeMs_(0),
+        lastRewindTimeMs_(0) {
+    CHECK_GT(workerCount, 0);
+    if (!taskCounter_) {
+      LOG(WARNING) << "The metadata column family has no pipeline::CounterMergeOperator, so the tasks of "
+                   << columnFamily_->GetName() << " are counted in memory";
+    }
+    if (workerCount > 1) {
+      for (size_t i = 0; i < workerCount; i++) {
+        workers_.emplace_back(new Worker());
+      }
+    }
+  }
 
-  // Start the background thread for processing scheduled tasks
-  void start();
+  // Count the outstanding tasks in memory and persist the count on graceful shutdown, without merging into the
+  // counter in the metadata column family. The counter is removed at start, and its merge operands are compacted
+  // away, so that a version without pipeline::CounterMergeOperator can open the database after a graceful shutdown.
+  // Set it before start.
+  void disableTaskCounter() {
+    taskCounter_ = false;
+  }
 
-  // Stop the run loop for checking pending tasks
-  void stop() {
-    run_ = false;
+  // Maintain an index from data keys to the scheduled time of their latest task in the given column family, written
+  // in the same write batches as the tasks. Enable it before scheduling or starting.
+  //
+  // With the index, each data key has at most one live task. Scheduling a task for a data key replaces its previous
+  // task, which is dropped without being processed, and tasks can be cancelled or rescheduled by data key alone.
+  // Tasks scheduled before the index was enabled have no entry and are processed as usual.
+  void enableIndex(rocksdb::ColumnFamilyHandle* indexColumnFamily) {
+    indexColumnFamily_ = CHECK_NOTNULL(indexColumnFamily);
+    CHECK(databaseManager_->db(indexColumnFamily_) == db_) << "The index must be in the RocksDB instance of the queue";
   }
 
-  void destroy() {
-    CHECK(executionThread_ != nullptr) << "Execution thread has not been created";
+  bool indexEnabled() const {
+    return indexColumnFamily_ != nullptr;
+  }
 
-    stop();
+  // Remove the task of the given data key. Return false if the data key has no task. Require the index. A task that
+  // the processor already has is still processed.
+  bool cancel(const std::string& dataKey);
 
-    if (executionThread_->joinable()) {
-      executionThread_->join();
-    }
+  // Move the task of the given data key to a new scheduled time, keeping its value. Return false if the data key has
+  // no task. Require the index.
+  bool reschedule(const std::string& dataKey, int64_t scheduledTimeMs);
+
+  // Reschedule the tasks left uncompleted by the processor after a backoff starting at retryBackoffMs and doubling
+  // up to maxRetryBackoffMs, instead of retrying them at every check. The attempt count is kept in the stored value,
+  // see ScheduledTask::encodeValue, which is only decoded by queues with a retry policy, so set it before scheduling
+  // tasks and keep it. Tasks failing maxAttempts times move to the dead-letter column family, keyed by their last
+  // scheduled time and data key, where they stay until requeued or purged. Set it before start.
+  void setRetryPolicy(int64_t retryBackoffMs, int64_t maxRetryBackoffMs, int maxAttempts,
+                      rocksdb::ColumnFamilyHandle* deadLetterColumnFamily) {
+    CHECK_GT(retryBackoffMs, 0);
+    CHECK_GE(maxRetryBackoffMs, retryBackoffMs);
+    CHECK_GT(maxAttempts, 0);
+    retryBackoffMs_ = retryBackoffMs;
+    maxRetryBackoffMs_ = maxRetryBackoffMs;
+    maxAttempts_ = maxAttempts;
+    deadLetterColumnFamily_ = CHECK_NOTNULL(deadLetterColumnFamily);
+    CHECK(databaseManager_->db(deadLetterColumnFamily_) == db_)
+        << "Dead letters must be in the RocksDB instance of the queue";
+  }
 
-    LOG(INFO) << "Scheduled tasks execution thread destroyed";
+  bool retryEnabled() const {
+    return maxAttempts_ > 0;
   }
 
-  // Process one batch of pending tasks with a scheduled time up to the given maxTimestampMs.
+  // Delay before the given attempt of a failed task
+  int64_t getRetryBackoffMs(int attempts) const;
+
+  // Copy up to limit tasks from the dead-letter column family, 0 meaning unlimited. Return how many there are up to
+  // the limit. Require the retry policy.
+  size_t scanDeadLetters(size_t limit, std::vector<ScheduledTask>* tasks);
+
+  // Schedule the dead-letter tasks of the given data key, or all of them if empty, with their attempt count reset, and
+  // remove them from the dead-letter column family. Every dead letter is requeued at its last scheduled time, so it is
+  // due right away and tasks of the same data key stay apart. With the index, a data key keeps only its latest task.
+  // Return the number requeued.
+  size_t requeueDeadLetters(const std::string& dataKey);
+
+  // Remove the dead-letter tasks of the given data key, or all of them if empty. Return the number removed.
+  size_t purgeDeadLetters(const std::string& dataKey);
+
+  // Start the background threads for processing scheduled tasks. A column family without a task counter yet, i.e.,
+  // written by an older version, is counted with a full scan once.
+  //
+  // Between scans, the execution thread sleeps until the earliest task in the database is due, a task is notified to
+  // be due earlier, or the check interval passes, whichever comes first.
+  void start();
+
+  // Stop the run loop for checking pending tasks. Workers finish the batch at hand and leave the rest of their
+  // tasks in the database for the next start.
+  void stop();
+
+  void destroy();
+
+  // Process one batch of pending tasks with a scheduled time up to the given maxTimestampMs in the calling thread.
+  // The scan starts from a cursor past the completed tasks instead of the tombstones they left at the head of the
+  // column family.
   size_t batchProcessing(int64_t maxTimestampMs);
 
   // Scan pending tasks with a scheduled time up to the given maxTimestampMs and return how many are pending.
   // Optionally, pending tasks are copied into the given task vector, though tasks are NOT removed from the database.
   // Because task data may be copied, a limit parameter is provided to cap memory usage. 0 means unlimited.
-  size_t scanPendingTasks(int64_t maxTimestampMs, size_t limit = 0, std::vector<ScheduledTask>* tasks = nullptr);
+  size_t scanPendingTasks(int64_t maxTimestampMs, size_t limit = 0, std::vector<ScheduledTask>* tasks = nullptr) {
+    return scanPendingTasks(0, maxTimestampMs, limit, tasks, nullptr);
+  }
 
   // Schedule a task using the given write batch.
   // It is safe and cheap to call it many times for different tasks with the same WriteBatch.
-  // NOTE: The owner of the write batch is responsible for committing the changes.
+  // NOTE: The owner of the write batch is responsible for committing the changes, and then calling notifyScheduled
+  // with the earliest scheduled time for the tasks to be processed on time. Otherwise, they are only picked up by the
+  // next check, i.e., up to checkIntervalMs late. The write batch should be committed within kMaxCommitDelayMs, since
+  // scans only go back that far behind their cursor.
+  // With the index, the previous task of the data key stays in the database until it is due and then dropped, since
+  // deleting it could race with its processing. The last batch committed for a data key wins.
   void scheduleWithWriteBatch(const ScheduledTask& task, rocksdb::WriteBatchBase* writeBatch) {
-    writeBatch->Put(columnFamily_, task.key(), task.value());
-    // We may be over counting here because until the caller commits the write batch, the tasks are not persistent
-    // in the database. In the case of error, e.g., the caller failed to commit the write batch, the expected behavior
-    // is to terminate the program.
-    outstandingTaskCount_++;
+    writeBatch->Put(columnFamily_, task.key(), getStoredValue(task));
+    indexTask(task, writeBatch);
+    trackScheduledTime(task.scheduledTimeMs());
+    // counted in the same write batch, so the count only changes when the task is committed
+    countTasks(1, writeBatch);
   }
 
   // Schedule a list of tasks using the given write batch.
   void scheduleWithWriteBatch(const std::vector<ScheduledTask>& tasks, rocksdb::WriteBatchBase* writeBatch) {
+    if (tasks.empty()) return;
     for (const auto& task : tasks) {
-      writeBatch->Put(columnFamily_, task.key(), task.value());
-      outstandingTaskCount_++;
+      writeBatch->Put(columnFamily_, task.key(), getStoredValue(task));
+      indexTask(task, writeBatch);
+      trackScheduledTime(task.scheduledTimeMs());
     }
+    countTasks(static_cast<int64_t>(tasks.size()), writeBatch);
   }
 
   // Same as scheduleWithWriteBatch but passing the opaque key/value to a custom function to generate task objects.
   // In addition, clients may also specify an optional kafka offset to indicate the version of the key/value pair.
-  // Use -1 to represent null value for kafka offset.
+  // Use -1 to represent null value for kafka offset. The earliest scheduled time of the generated tasks is optionally
+  // returned for notifyScheduled.
   // Return the number tasks scheduled or -1 to indicate an error.
   int scheduleOpaqueWithWriteBatch(const std::string& opaqueKey, const std::string& opaqueValue, int64_t kafkaOffset,
-                                   rocksdb::WriteBatchBase* writeBatch) {
+                                   rocksdb::WriteBatchBase* writeBatch, int64_t* earliestScheduledTimeMs = nullptr) {
     std::vector<ScheduledTask> tasks;
     int ret = processor_->generateTasks(opaqueKey, opaqueValue, kafkaOffset, &tasks);
     if (ret > 0) {
       LOG(INFO) << ret << " tasks generated";
       for (const auto& task : tasks) {
         scheduleWithWriteBatch(task, writeBatch);
+        if (earliestScheduledTimeMs) {
+          *earliestScheduledTimeMs = std::min(*earliestScheduledTimeMs, task.scheduledTimeMs());
+        }
       }
     }
     // NOTE: the actual number of tasks may be smaller than reported because user-defined generateTasks may generate
@@ -129,12 +275,14 @@ class ScheduledTaskQueue {
   }
 
   // Schedule a single task without batching. The task is committed to database if this function succeeds.
+  // With the index, the previous task of the data key is removed in the same write.
   // Return true when the task is scheduled successfully.
   bool schedule(const ScheduledTask& task) {
     rocksdb::WriteBatch writeBatch;
     scheduleWithWriteBatch(task, &writeBatch);
-    rocksdb::Status status = databaseManager_->db()->Write(rocksdb::WriteOptions(), &writeBatch);
+    rocksdb::Status status = commitScheduledTasks({task}, &writeBatch);
     if (status.ok()) {
+      notifyScheduled(task.scheduledTimeMs());
       return true;
     } else {
       LOG(ERROR) << "Failed to scheduled a single Task: " << status.ToString();
@@ -145,14 +293,22 @@ class ScheduledTaskQueue {
   // Same as schedule but generate and schedule one task as a single batch.
   // Return the number tasks scheduled or negative to indicate an error.
   int scheduleOpaque(const std::string& opaqueKey, const std::string& opaqueValue, int64_t kafkaOffset) {
-    rocksdb::WriteBatch writeBatch;
-    int ret = scheduleOpaqueWithWriteBatch(opaqueKey, opaqueValue, kafkaOffset, &writeBatch);
+    std::vector<ScheduledTask> tasks;
+    int ret = processor_->generateTasks(opaqueKey, opaqueValue, kafkaOffset, &tasks);
     if (ret <= 0) {
       return ret;
     }
+    LOG(INFO) << ret << " tasks generated";
 
-    rocksdb::Status status = databaseManager_->db()->Write(rocksdb::WriteOptions(), &writeBatch);
+    rocksdb::WriteBatch writeBatch;
+    int64_t earliestScheduledTimeMs = std::numeric_limits<int64_t>::max();
+    for (const auto& task : tasks) {
+      scheduleWithWriteBatch(task, &writeBatch);
+      earliestScheduledTimeMs = std::min(earliestScheduledTimeMs, task.scheduledTimeMs());
+    }
+    rocksdb::Status status = commitScheduledTasks(tasks, &writeBatch);
     if (status.ok()) {
+      notifyScheduled(earliestScheduledTimeMs);
       return ret;
     } else {
       LOG(ERROR) << "Failed to schedule tasks with opaque key/value: " << status.ToString();
@@ -160,33 +316,217 @@ class ScheduledTaskQueue {
     }
   }
 
-  // Return the outstanding tasks in the database, which may be larger than the actual value.
-  // Use accurateOutstandingTaskCountSlow when more accurate counting is needed.
-  size_t outstandingTaskCount() const {
-    return outstandingTaskCount_;
-  }
+  // Wake up the execution thread if the given time is earlier than its next wake-up. Call it only after the tasks
+  // have been committed, since the execution thread does not look for them again until the next check.
+  void notifyScheduled(int64_t scheduledTimeMs);
+
+  // Return the outstanding tasks in the database from a counter that is updated in the same write batches as the
+  // tasks, so it stays exact across crashes. Tasks overwriting one with the same key are only counted once when they
+  // are committed by the queue, i.e., by schedule and scheduleOpaque. Write batches from scheduleWithWriteBatch
+  // committed by the caller count them twice, which accurateOutstandingTaskCountSlow corrects with a full scan.
+  // Without the counter, the count in memory may also include tasks whose write batch has not been committed yet.
+  size_t outstandingTaskCount() const;
 
   // Accurate count of outstanding tasks in the database. It can be slow when there are many tasks pending.
   size_t accurateOutstandingTaskCountSlow() {
     return scanPendingTasks(std::numeric_limits<int64_t>::max());
   }
 
+  // Maximum interval between checks for pending tasks, adjustable at runtime. It bounds how late uncompleted tasks are
+  // retried and tasks committed without notification are picked up.
+  int64_t checkIntervalMs() const {
+    return checkIntervalMs_;
+  }
+  void setCheckIntervalMs(int64_t checkIntervalMs) {
+    CHECK_GT(checkIntervalMs, 0);
+    checkIntervalMs_ = checkIntervalMs;
+    // a shorter interval takes effect right away
+    std::lock_guard<std::mutex> guard(wakeUpMutex_);
+    wakeUpCv_.notify_all();
+  }
+
+  // Observe how late tasks are processed after their scheduled time in the given histogram. Set it before start.
+  void setDispatchDelayHistogram(prometheus::Histogram* histogram) {
+    dispatchDelayHistogram_ = histogram;
+  }
+
+  size_t workerCount() const {
+    return std::max(workers_.size(), static_cast<size_t>(1));
+  }
+
+  // Upper bound on the delay between scheduling a task with a write batch and committing the batch. Tasks older than
+  // that, and older than any task scheduled in the past within that time, cannot be committed behind a scan anymore,
+  // so scans do not go back past them.
+  static constexpr int64_t kMaxCommitDelayMs = 10000;
+
  private:
-  // Check pending tasks every 1 second
+  struct Worker {
+    std::mutex mutex;
+    std::condition_variable cv;
+    // batches of tasks handed over by the execution thread, processed in order
+    std::deque<std::vector<ScheduledTask>> batches;
+    std::unique_ptr<std::thread> thread;
+  };
+
+  // Check pending tasks at least every 1 second by default
   static constexpr int64_t kCheckIntervalMs = 1000;
+  // Mark a table file for compaction when any window of this many entries has at least the trigger of deletions
+  static constexpr size_t kDeletionWindowSize = 1024;
+  static constexpr size_t kDeletionTrigger = 512;
   // Batch size limit for each scan
   static constexpr size_t kScanBatchSize = 10000;
 
+  // Same as scanPendingTasks, but starting from minTimestampMs and skipping the given task keys, which do not count
+  // towards the limit either
+  size_t scanPendingTasks(int64_t minTimestampMs, int64_t maxTimestampMs, size_t limit,
+                          std::vector<ScheduledTask>* tasks, const std::set<std::string>* skippedTaskKeys);
+
+  // Process the given tasks, then delete the completed ones in the same write batch. Each task is deleted by key, so
+  // a task committed behind the scan is never removed without being processed. The earliest time failed tasks are
+  // rescheduled at is optionally returned. Return the number completed.
+  size_t processTasks(std::vector<ScheduledTask>* tasks, int64_t* earliestRetryTimeMs = nullptr);
+
+  // Reschedule the uncompleted tasks with a backoff, or move them to the dead-letter column family after the last
+  // attempt, and mark them completed so that their current keys are deleted. A retry whose key is taken by another
+  // task is delayed by a millisecond at a time instead of overwriting it. Data keys whose index entry is moved are
+  // added to indexedDataKeys. Return the number of tasks added to the column family. Require indexMutex_.
+  int64_t retryFailedTasks(std::vector<ScheduledTask>* tasks, std::set<std::string>* indexedDataKeys,
+                           rocksdb::WriteBatch* writeBatch, int64_t* earliestRetryTimeMs);
+
+  // Scan the dead-letter tasks of the given data key, or all of them if empty, in chunks of kScanBatchSize, and call
+  // the given function on each chunk
+  size_t forEachDeadLetterChunk(const std::string& dataKey,
+                                const std::function<void(const std::vector<ScheduledTask>&)>& callback);
+
+  // Process the tasks that are still in the database and the latest of their data keys in the index, checked under
+  // indexMutex_ right before dispatching, and mark the cancelled and replaced ones completed. A task cancelled while
+  // the processor already has it is still processed.
+  void processIndexedTasks(std::vector<ScheduledTask>* tasks, rocksdb::WriteBatch* writeBatch);
+
+  // Values carry the attempt count only with a retry policy, so that other queues store them as given
+  std::string getStoredValue(const ScheduledTask& task) const {
+    return retryEnabled() ? task.storedValue() : task.value();
+  }
+
+  // Decode a value stored by getStoredValue into the value given to the task and its attempt count
+  std::string decodeStoredValue(const rocksdb::Slice& storedValue, int* attempts) const {
+    if (retryEnabled()) return ScheduledTask::decodeValue(storedValue, attempts);
+    *attempts = 0;
+    return storedValue.ToString();
+  }
+
+  void indexTask(const ScheduledTask& task, rocksdb::WriteBatchBase* writeBatch) {
+    if (!indexColumnFamily_) return;
+    std::string buf;
+    writeBatch->Put(indexColumnFamily_, task.dataKey(), ScheduledTask::encodeTimestamp(task.scheduledTimeMs(), &buf));
+  }
+
+  // Commit the write batch scheduling the given tasks. With the index, the previous tasks of their data keys are
+  // removed in the same write. Tasks overwriting one with the same key are uncounted under indexMutex_, which
+  // processing also holds while deleting tasks.
+  rocksdb::Status commitScheduledTasks(const std::vector<ScheduledTask>& tasks, rocksdb::WriteBatch* writeBatch);
+
+  // Scheduled time of the latest task of the given data key in the index, or false if it has none
+  bool getIndexedTimeMs(const std::string& dataKey, int64_t* scheduledTimeMs);
+
+  // Whether the given task key is still in the database. Deleting a task only after checking it under indexMutex_
+  // keeps the task count exact when cancels, replacements and processing race to delete the same task.
+  bool taskExists(const std::string& taskKey);
+
+  // Lower the scan cursor for a task about to be committed, and remember tasks scheduled in the past so that the
+  // sealed time stays behind them
+  void trackScheduledTime(int64_t scheduledTimeMs);
+  void lowerScanCursor(int64_t scheduledTimeMs);
+
+  // Where the next scan starts: the cursor, or the sealed time once every check interval in case a task has been
+  // committed behind the cursor after the scan that moved it past the task
+  int64_t getScanStartMs(int64_t cursorMs);
+
+  // Move the cursor from the value read before a scan to the given one, unless a task scheduled meanwhile lowered it,
+  // and advance the sealed time after a scan from the sealed time
+  void moveScanCursor(int64_t fromMs, int64_t toMs, int64_t scanStartMs, int64_t scanTimeMs);
+
+  // Time before which no task can be committed anymore, as of the given time. Require pastScheduleMutex_.
+  int64_t getSealedTimeMs(int64_t timeMs);
+
+  // Scan pending tasks that are not in flight yet and hand them over to the workers. Block while the workers already
+  // hold as many tasks as one scan per worker. Return true when the scan stopped at its limit, i.e., more tasks may be
+  // pending.
+  bool dispatchPendingTasks(int64_t maxTimestampMs);
+
+  void runWorker(Worker* worker);
+
+  // Sleep until the next task after scannedTimestampMs is due, an earlier task is notified, or the check interval
+  // passes
+  void waitForNextDueTime(int64_t scannedTimestampMs);
+
+  // Scheduled time of the first task at or after minTimestampMs, or the max int64_t when there is none
+  int64_t findNextDueTimeMs(int64_t minTimestampMs);
+
+  // Count the tasks with a full scan when the column family has no task counter yet. Without the counter, load the
+  // count persisted by the last graceful shutdown instead, and remove it.
+  void initializeTaskCount();
+  void persistTaskCount();
+
+  static bool hasCounterMergeOperator(pipeline::DatabaseManager* databaseManager) {
+    auto mergeOperator = databaseManager->db()->GetOptions(databaseManager->getMetadataColumnFamily()).merge_operator;
+    return mergeOperator && strcmp(mergeOperator->Name(), pipeline::CounterMergeOperator::getInstance()->Name()) == 0;
+  }
+
+  // Add to the outstanding task count, with a merge in the given write batch when the counter is enabled
+  void countTasks(int64_t delta, rocksdb::WriteBatchBase* writeBatch) {
+    if (taskCounter_) {
+      writeBatch->Merge(databaseManager_->getMetadataColumnFamily(), taskCountKey_,
+                        pipeline::CounterMergeOperator::encodeDelta(delta));
+    } else {
+      outstandingTaskCount_ += delta;
+    }
+  }
+
   std::shared_ptr<ScheduledTaskProcessor> processor_;
   std::shared_ptr<pipeline::DatabaseManager> databaseManager_;
   rocksdb::ColumnFamilyHandle* columnFamily_;
+  // RocksDB instance of the queue and the metadata column family
+  rocksdb::DB* db_;
   size_t scanBatchSize_;
-  bool run_;
-  std::atomic_size_t outstandingTaskCount_;
-  // Background thread that executes tasks at schedule time.
-  // TODO(yunjing): consider a multi-threaded design for higher throughput. The idea is to use one thread to pick up
-  // pending tasks and then distribute the tasks to a pool of worker threads
+  std::atomic<bool> run_;
+  std::atomic<int64_t> checkIntervalMs_;
+  const std::string taskCountKey_;
+  // Whether the outstanding tasks are counted with merges into the metadata column family or in memory
+  bool taskCounter_;
+  std::atomic<int64_t> outstandingTaskCount_;
+  rocksdb::ColumnFamilyHandle* indexColumnFamily_;
+  // Serializes the writes of the queue that delete or overwrite tasks after checking whether they exist, including
+  // processing
+  std::mutex indexMutex_;
+  int64_t retryBackoffMs_;
+  int64_t maxRetryBackoffMs_;
+  // 0 when failed tasks are retried at every check
+  int maxAttempts_;
+  rocksdb::ColumnFamilyHandle* deadLetterColumnFamily_;
+  // Background thread that executes tasks at schedule time, or picks up pending tasks for the workers if there are any
   std::unique_ptr<std::thread> executionThread_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Keys of the tasks handed over to workers but not committed yet, which must not be dispatched again. They are
+  // ordered so that the scan cursor never moves past the earliest one.
+  std::mutex inFlightMutex_;
+  std::condition_variable inFlightCv_;
+  std::set<std::string> inFlightTaskKeys_;
+  // Earliest scheduled time notified since the last scan
+  std::mutex wakeUpMutex_;
+  std::condition_variable wakeUpCv_;
+  int64_t nextDueTimeMs_;
+  prometheus::Histogram* dispatchDelayHistogram_;
+  // Scheduled time before which all tasks have completed, as far as the scans have seen
+  std::atomic<int64_t> scanCursorMs_;
+  // Scheduled time before which all tasks have completed and no task can be committed anymore, unless scheduled in
+  // the past, which lowers it
+  std::atomic<int64_t> sealedTimeMs_;
+  std::atomic<int64_t> lastRewindTimeMs_;
+  // Earliest scheduled time of the tasks scheduled in the past, by the second they were scheduled in. The mutex also
+  // serializes updates of the sealed time.
+  std::mutex pastScheduleMutex_;
+  std::map<int64_t, int64_t> pastScheduleTimeMs_;
 };
 
 }  // namespace infra
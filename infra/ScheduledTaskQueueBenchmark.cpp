@@ -0,0 +1,168 @@
+// Measure how the cost of a processing round grows as a backlog of scheduled tasks drains.
+//
+// A backlog of due tasks is written to a fresh database, then drained one scan batch at a time. The `head` mode scans
+// from the first key of the column family every round and deletes completed tasks one by one, as the queue used to,
+// so every round skips over the tombstones of all the rounds before it until compactions remove them. The `cursor`
+// mode runs ScheduledTaskQueue::batchProcessing, which scans from the cursor past those tombstones. For each mode it
+// reports the average round latency at each tenth of the backlog.
+//
+// Usage: scheduled_task_queue_benchmark [--tasks=1000000] [--batch_size=1000] [--modes=head,cursor]
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "folly/Conv.h"
+#include "folly/Format.h"
+#include "folly/String.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "infra/ScheduledTaskProcessor.h"
+#include "infra/ScheduledTaskQueue.h"
+#include "pipeline/DatabaseManager.h"
+#include "rocksdb/db.h"
+#include "rocksdb/options.h"
+#include "rocksdb/write_batch.h"
+
+DEFINE_int32(tasks, 1000000, "Number of tasks in the backlog");
+DEFINE_int32(batch_size, 1000, "Number of tasks processed in each round");
+DEFINE_string(modes, "head,cursor", "Comma separated modes to compare");
+DEFINE_string(db_dir, "/tmp", "Directory for temporary databases");
+
+namespace {
+
+constexpr int kCheckpoints = 10;
+constexpr char kColumnFamilyName[] = "scheduled-tasks";
+
+class CompletingScheduledTaskProcessor : public infra::ScheduledTaskProcessor {
+ public:
+  void processPendingTasks(std::vector<infra::ScheduledTask>* tasks, rocksdb::WriteBatch* writeBatch) override {
+    for (auto& task : (*tasks)) {
+      task.markCompleted();
+    }
+  }
+
+  int generateTasks(const std::string& opaqueKey, const std::string& opaqueValue, int64_t kafkaOffset,
+                    std::vector<infra::ScheduledTask>* tasks) override {
+    return 0;
+  }
+
+  size_t getMaxBatchSize() const override { return static_cast<size_t>(FLAGS_batch_size); }
+};
+
+// Average round latency in milliseconds for each tenth of the backlog
+std::vector<double> runMode(const std::string& mode) {
+  boost::filesystem::path dbPath =
+      boost::filesystem::path(FLAGS_db_dir) / boost::filesystem::unique_path("scheduled_task_benchmark.%%%%%%%%");
+
+  rocksdb::Options options;
+  options.create_if_missing = true;
+  rocksdb::DB* db;
+  rocksdb::Status status = rocksdb::DB::Open(options, dbPath.native(), &db);
+  CHECK(status.ok()) << "Opening database failed: " << status.ToString();
+  std::unique_ptr<rocksdb::DB> dbGuard(db);
+
+  pipeline::DatabaseManager::ColumnFamilyMap columnFamilyMap;
+  columnFamilyMap["default"] = db->DefaultColumnFamily();
+  std::vector<std::string> names = {pipeline::DatabaseManager::metadataColumnFamilyName(), kColumnFamilyName};
+  for (const auto& name : names) {
+    rocksdb::ColumnFamilyOptions columnFamilyOptions(options);
+    if (name == kColumnFamilyName) infra::ScheduledTaskQueue::optimizeColumnFamily(8, &columnFamilyOptions);
+    rocksdb::ColumnFamilyHandle* columnFamily;
+    status = db->CreateColumnFamily(columnFamilyOptions, name, &columnFamily);
+    CHECK(status.ok()) << "Creating column family `" << name << "` failed: " << status.ToString();
+    columnFamilyMap[name] = columnFamily;
+  }
+  auto databaseManager = std::make_shared<pipeline::DatabaseManager>(columnFamilyMap, true, db);
+  auto processor = std::make_shared<CompletingScheduledTaskProcessor>();
+  rocksdb::ColumnFamilyHandle* columnFamily = columnFamilyMap[kColumnFamilyName];
+
+  // a day old, so that the whole backlog is sealed
+  int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::system_clock::now().time_since_epoch()).count();
+  int64_t firstTimestampMs = nowMs - 86400000L;
+  {
+    // loaded by another queue, like tasks left by a previous run
+    infra::ScheduledTaskQueue queue(processor, databaseManager, columnFamily);
+    for (int i = 0; i < FLAGS_tasks; i += FLAGS_batch_size) {
+      rocksdb::WriteBatch writeBatch;
+      for (int j = i; j < std::min(i + FLAGS_batch_size, FLAGS_tasks); j++) {
+        queue.scheduleWithWriteBatch(infra::ScheduledTask(firstTimestampMs + j, folly::to<std::string>("key", j), ""),
+                                     &writeBatch);
+      }
+      status = db->Write(rocksdb::WriteOptions(), &writeBatch);
+      CHECK(status.ok()) << "Write failed: " << status.ToString();
+    }
+  }
+
+  infra::ScheduledTaskQueue queue(processor, databaseManager, columnFamily);
+  std::vector<double> roundMillis(kCheckpoints);
+  std::vector<int> rounds(kCheckpoints);
+  int processed = 0;
+  while (processed < FLAGS_tasks) {
+    auto start = std::chrono::steady_clock::now();
+    size_t count;
+    if (mode == "cursor") {
+      count = queue.batchProcessing(nowMs);
+    } else {
+      CHECK_EQ("head", mode) << "Unknown mode: " << mode;
+      std::vector<infra::ScheduledTask> tasks;
+      count = queue.scanPendingTasks(nowMs, FLAGS_batch_size, &tasks);
+      rocksdb::WriteBatch writeBatch;
+      processor->processPendingTasks(&tasks, &writeBatch);
+      for (const auto& task : tasks) {
+        writeBatch.Delete(columnFamily, task.key());
+      }
+      status = db->Write(rocksdb::WriteOptions(), &writeBatch);
+      CHECK(status.ok()) << "Write failed: " << status.ToString();
+    }
+    auto end = std::chrono::steady_clock::now();
+    CHECK_GT(count, 0) << "Backlog drained early after " << processed << " tasks";
+
+    int checkpoint = static_cast<int64_t>(processed) * kCheckpoints / FLAGS_tasks;
+    roundMillis[checkpoint] += std::chrono::duration<double, std::milli>(end - start).count();
+    rounds[checkpoint]++;
+    processed += count;
+  }
+  for (int i = 0; i < kCheckpoints; i++) {
+    if (rounds[i] > 0) roundMillis[i] /= rounds[i];
+  }
+
+  for (const auto& entry : columnFamilyMap) {
+    if (entry.second != db->DefaultColumnFamily()) db->DestroyColumnFamilyHandle(entry.second);
+  }
+  dbGuard.reset();
+  boost::filesystem::remove_all(dbPath);
+  return roundMillis;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_tasks, 0);
+  CHECK_GT(FLAGS_batch_size, 0);
+
+  std::vector<std::string> modes;
+  folly::split(',', FLAGS_modes, modes, true);
+
+  std::cout << folly::sformat("{:<8}", "mode");
+  for (int i = 1; i <= kCheckpoints; i++) {
+    std::cout << folly::sformat("{:>10}", folly::sformat("{}%_ms", i * 100 / kCheckpoints));
+  }
+  std::cout << std::endl;
+  for (const auto& mode : modes) {
+    std::cout << folly::sformat("{:<8}", mode);
+    for (double millis : runMode(mode)) {
+      std::cout << folly::sformat("{:>10.2f}", millis);
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
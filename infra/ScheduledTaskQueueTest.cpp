@@ -1,11 +1,19 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "folly/Conv.h"
 #include "gtest/gtest.h"
 #include "infra/ScheduledTaskProcessor.h"
 #include "infra/ScheduledTaskQueue.h"
+#include "prometheus/histogram_builder.h"
+#include "prometheus/registry.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/status.h"
 #include "rocksdb/write_batch.h"
@@ -15,7 +23,8 @@ namespace infra {
 
 class ScheduledTaskQueueTest : public stesting::TestWithRocksDb {
  protected:
-  ScheduledTaskQueueTest() : stesting::TestWithRocksDb({ "scheduled-tasks" }) {}
+  ScheduledTaskQueueTest() : stesting::TestWithRocksDb({ "scheduled-tasks", "scheduled-tasks-index",
+                                                                 "scheduled-tasks-dead-letter" }) {}
 };
 
 class TestScheduledTaskProcessor : public ScheduledTaskProcessor {
@@ -39,6 +48,75 @@ class TestScheduledTaskProcessor : public ScheduledTaskProcessor {
   }
 };
 
+// Record the processing order of tasks by data key and fail every task of a key on its first attempt
+class RecordingScheduledTaskProcessor : public ScheduledTaskProcessor {
+ public:
+  void processPendingTasks(std::vector<ScheduledTask>* tasks, rocksdb::WriteBatch* writeBatch) override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (auto& task : (*tasks)) {
+      if (failedDataKeys_.insert(task.dataKey()).second) continue;
+      processedTimestamps_[task.dataKey()].push_back(task.scheduledTimeMs());
+      threads_[task.dataKey()].insert(std::this_thread::get_id());
+      task.markCompleted();
+    }
+  }
+
+  std::map<std::string, std::vector<int64_t>> processedTimestamps() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return processedTimestamps_;
+  }
+
+  std::map<std::string, std::set<std::thread::id>> threads() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return threads_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::set<std::string> failedDataKeys_;
+  std::map<std::string, std::vector<int64_t>> processedTimestamps_;
+  std::map<std::string, std::set<std::thread::id>> threads_;
+};
+
+// Fail the tasks of the given data keys, scanning a few tasks at a time
+class FailingScheduledTaskProcessor : public ScheduledTaskProcessor {
+ public:
+  void processPendingTasks(std::vector<ScheduledTask>* tasks, rocksdb::WriteBatch* writeBatch) override {
+    for (auto& task : (*tasks)) {
+      if (failedDataKeys.count(task.dataKey()) > 0) continue;
+      processedDataKeys.push_back(task.dataKey());
+      task.markCompleted();
+    }
+  }
+
+  size_t getMaxBatchSize() const override { return 100; }
+
+  std::set<std::string> failedDataKeys;
+  std::vector<std::string> processedDataKeys;
+};
+
+// Record the processed tasks and schedule the `recurring` data key again in the same write batch
+class RecurringScheduledTaskProcessor : public ScheduledTaskProcessor {
+ public:
+  void processPendingTasks(std::vector<ScheduledTask>* tasks, rocksdb::WriteBatch* writeBatch) override {
+    for (auto& task : (*tasks)) {
+      processedTasks.emplace_back(task.scheduledTimeMs(), task.dataKey(), task.value());
+      if (task.dataKey() == "recurring") queue->scheduleWithWriteBatch({ nextTimeMs, "recurring", "" }, writeBatch);
+      task.markCompleted();
+    }
+  }
+
+  int generateTasks(const std::string& opaqueKey, const std::string& opaqueValue, int64_t kafkaOffset,
+                    std::vector<ScheduledTask>* tasks) override {
+    tasks->emplace_back(folly::to<int64_t>(opaqueValue), opaqueKey, "");
+    return 1;
+  }
+
+  ScheduledTaskQueue* queue = nullptr;
+  int64_t nextTimeMs = 0;
+  std::vector<ScheduledTask> processedTasks;
+};
+
 TEST_F(ScheduledTaskQueueTest, ScheduleWithWriteBatch) {
   ScheduledTask task1{ 1472295107012L, "key1", "value1" };
   ScheduledTask task2{ 1462295107012L, "key2", "value2" };
@@ -180,4 +258,406 @@ TEST_F(ScheduledTaskQueueTest, BatchProcessing) {
   EXPECT_EQ(0, queue.outstandingTaskCount());
 }
 
+TEST_F(ScheduledTaskQueueTest, ScanCursor) {
+  const int64_t timestampMs = 1472295107012L;
+  {
+    // scheduled long enough ago that no task can be committed behind the sealed time anymore
+    ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                             columnFamily("scheduled-tasks"));
+    rocksdb::WriteBatch writeBatch;
+    for (int i = 0; i < 150; i++) {
+      queue.scheduleWithWriteBatch(ScheduledTask(timestampMs + i, folly::to<std::string>("key", i), ""), &writeBatch);
+    }
+    commitWriteBatch(&writeBatch);
+  }
+
+  auto processor = std::make_shared<FailingScheduledTaskProcessor>();
+  processor->failedDataKeys.insert("key120");
+  ScheduledTaskQueue queue(processor, databaseManager(), columnFamily("scheduled-tasks"));
+  // only the first scan starts from the sealed time until the interval is shortened
+  queue.setCheckIntervalMs(3600000);
+  EXPECT_EQ(100, queue.batchProcessing(1682295107012L));
+  EXPECT_EQ(50, queue.batchProcessing(1682295107012L));
+  EXPECT_EQ(149, processor->processedDataKeys.size());
+  EXPECT_EQ(1, queue.accurateOutstandingTaskCountSlow());
+
+  // the cursor stays at the failed task, and a task scheduled behind it is still found
+  ASSERT_TRUE(queue.schedule(ScheduledTask(timestampMs + 50, "late", "")));
+  processor->processedDataKeys.clear();
+  EXPECT_EQ(2, queue.batchProcessing(1682295107012L));
+  EXPECT_EQ(std::vector<std::string>({"late"}), processor->processedDataKeys);
+
+  // a task committed without notification after a scan moved the cursor past it is found by the next scan from the
+  // sealed time
+  rocksdb::WriteBatch writeBatch;
+  queue.scheduleWithWriteBatch(ScheduledTask(timestampMs + 110, "orphan", ""), &writeBatch);
+  processor->processedDataKeys.clear();
+  EXPECT_EQ(1, queue.batchProcessing(1682295107012L));
+  commitWriteBatch(&writeBatch);
+  EXPECT_EQ(1, queue.batchProcessing(1682295107012L));
+  queue.setCheckIntervalMs(1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  EXPECT_EQ(2, queue.batchProcessing(1682295107012L));
+  EXPECT_EQ(std::vector<std::string>({"orphan"}), processor->processedDataKeys);
+
+  processor->failedDataKeys.clear();
+  processor->processedDataKeys.clear();
+  EXPECT_EQ(1, queue.batchProcessing(1682295107012L));
+  EXPECT_EQ(std::vector<std::string>({"key120"}), processor->processedDataKeys);
+  EXPECT_EQ(0, queue.batchProcessing(1682295107012L));
+  EXPECT_EQ(0, queue.accurateOutstandingTaskCountSlow());
+}
+
+TEST_F(ScheduledTaskQueueTest, WorkerPool) {
+  {
+    ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                             columnFamily("scheduled-tasks"));
+    rocksdb::WriteBatch writeBatch;
+    for (int i = 0; i < 1000; i++) {
+      queue.scheduleWithWriteBatch(ScheduledTask(1472295107012L + i, folly::to<std::string>("key", i % 20), ""),
+                                   &writeBatch);
+    }
+    commitWriteBatch(&writeBatch);
+  }
+
+  auto processor = std::make_shared<RecordingScheduledTaskProcessor>();
+  ScheduledTaskQueue queue(processor, databaseManager(), columnFamily("scheduled-tasks"), 4);
+  EXPECT_EQ(4, queue.workerCount());
+  queue.setCheckIntervalMs(10);
+  queue.start();
+  for (int i = 0; i < 1000 && queue.outstandingTaskCount() > 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  queue.destroy();
+
+  // failed tasks are retried and every task completes exactly once
+  EXPECT_EQ(0, queue.outstandingTaskCount());
+  EXPECT_EQ(0, queue.accurateOutstandingTaskCountSlow());
+  auto processedTimestamps = processor->processedTimestamps();
+  ASSERT_EQ(20, processedTimestamps.size());
+  for (const auto& entry : processedTimestamps) {
+    // the failed first task of each key may come late, but the rest are processed in order
+    const std::vector<int64_t>& timestamps = entry.second;
+    EXPECT_EQ(std::set<int64_t>(timestamps.begin(), timestamps.end()).size(), timestamps.size());
+    EXPECT_EQ(50, timestamps.size());
+    std::vector<int64_t> completedInOrder;
+    for (int64_t timestampMs : timestamps) {
+      if ((timestampMs - 1472295107012L) >= 20) completedInOrder.push_back(timestampMs);
+    }
+    EXPECT_TRUE(std::is_sorted(completedInOrder.begin(), completedInOrder.end())) << entry.first;
+  }
+  // tasks of the same key always run on the same worker
+  for (const auto& entry : processor->threads()) {
+    EXPECT_EQ(1, entry.second.size()) << entry.first;
+  }
+}
+
+TEST_F(ScheduledTaskQueueTest, WakeUpAtNextDueTime) {
+  int64_t startMs = nowMs();
+  {
+    // committed before the queue starts, so the queue finds it when looking for the next due time
+    ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                             columnFamily("scheduled-tasks"));
+    ASSERT_TRUE(queue.schedule(ScheduledTask(startMs + 1000, "key1", "")));
+  }
+
+  prometheus::Registry registry;
+  auto& family = prometheus::BuildHistogram().Name("dispatch_delay_seconds").Help("").Register(registry);
+  ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                           columnFamily("scheduled-tasks"));
+  queue.setDispatchDelayHistogram(&family.Add({}, ScheduledTaskQueue::dispatchDelayBucketsSeconds()));
+  // periodic checks alone would not process any task before the test times out
+  queue.setCheckIntervalMs(3600000);
+  queue.start();
+
+  // an earlier task wakes up the queue sleeping until the first one is due
+  ASSERT_TRUE(queue.schedule(ScheduledTask(startMs + 100, "key2", "")));
+  std::this_thread::sleep_for(std::chrono::milliseconds(startMs + 500 - nowMs()));
+  EXPECT_EQ(1, queue.outstandingTaskCount());
+
+  for (int i = 0; i < 500 && queue.outstandingTaskCount() > 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(0, queue.outstandingTaskCount());
+  EXPECT_GE(nowMs(), startMs + 1000);
+  queue.destroy();
+
+  auto families = registry.Collect();
+  ASSERT_EQ(1, families.size());
+  EXPECT_EQ(2, families[0].metric(0).histogram().sample_count());
+}
+
+TEST_F(ScheduledTaskQueueTest, TaskCount) {
+  // far in the future so that the tasks stay outstanding while the queue runs
+  ScheduledTask task1{ 4102444800000L, "key1", "value1" };
+  ScheduledTask task2{ 4102444800001L, "key2", "value2" };
+  ScheduledTask task3{ 4102444800002L, "key3", "value3" };
+  std::string key = ScheduledTaskQueue::getTaskCountMetadataKey("scheduled-tasks");
+  std::string value;
+
+  {
+    ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                             columnFamily("scheduled-tasks"));
+    queue.schedule(task1);
+    queue.schedule(task2);
+    // scheduling a task again with the same key overwrites it
+    queue.schedule(task2);
+    // tasks are only counted once committed
+    rocksdb::WriteBatch writeBatch;
+    queue.scheduleWithWriteBatch(task3, &writeBatch);
+    EXPECT_EQ(2, queue.outstandingTaskCount());
+  }
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), key, &value).ok());
+  EXPECT_EQ("2", value);
+
+  {
+    // without a counter, e.g., written by an older version, the tasks are counted by a full scan
+    ASSERT_TRUE(db()->Delete(rocksdb::WriteOptions(), metadataColumnFamily(), key).ok());
+    ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                             columnFamily("scheduled-tasks"));
+    EXPECT_EQ(0, queue.outstandingTaskCount());
+    queue.start();
+    EXPECT_EQ(2, queue.outstandingTaskCount());
+    queue.destroy();
+  }
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), key, &value).ok());
+  EXPECT_EQ("2", value);
+
+  // the counter is used instead of scanning, and it keeps counting as tasks complete
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), metadataColumnFamily(), key, "5").ok());
+  ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                           columnFamily("scheduled-tasks"));
+  queue.start();
+  EXPECT_EQ(5, queue.outstandingTaskCount());
+  queue.destroy();
+  EXPECT_EQ(2, queue.batchProcessing(4102444800002L));
+  EXPECT_EQ(3, queue.outstandingTaskCount());
+}
+
+TEST_F(ScheduledTaskQueueTest, Index) {
+  const int64_t timestampMs = nowMs() - 60000;
+  const int64_t futureTimestampMs = 4102444800000L;
+  auto processor = std::make_shared<RecurringScheduledTaskProcessor>();
+  {
+    // scheduled before the index is enabled
+    ScheduledTaskQueue queue(processor, databaseManager(), columnFamily("scheduled-tasks"));
+    queue.schedule({ timestampMs, "legacy", "" });
+  }
+  ScheduledTaskQueue queue(processor, databaseManager(), columnFamily("scheduled-tasks"));
+  queue.enableIndex(columnFamily(ScheduledTaskQueue::indexColumnFamilyName("scheduled-tasks")));
+  processor->queue = &queue;
+  processor->nextTimeMs = futureTimestampMs;
+  EXPECT_TRUE(queue.indexEnabled());
+
+  // scheduling replaces the previous task of the data key right away
+  EXPECT_TRUE(queue.schedule({ timestampMs + 1, "a", "1" }));
+  EXPECT_TRUE(queue.schedule({ timestampMs + 2, "a", "2" }));
+  EXPECT_TRUE(queue.schedule({ timestampMs + 2, "a", "3" }));
+  EXPECT_EQ(2, queue.outstandingTaskCount());
+  EXPECT_EQ(2, queue.accurateOutstandingTaskCountSlow());
+
+  // with write batches, the previous task is only dropped when due
+  for (int64_t i = 3; i <= 4; i++) {
+    rocksdb::WriteBatch writeBatch;
+    queue.scheduleWithWriteBatch({ timestampMs + i, "b", folly::to<std::string>(i) }, &writeBatch);
+    commitWriteBatch(&writeBatch);
+  }
+  EXPECT_TRUE(queue.schedule({ timestampMs + 5, "recurring", "" }));
+  EXPECT_EQ(5, queue.outstandingTaskCount());
+
+  queue.batchProcessing(nowMs());
+  std::vector<ScheduledTask> expectedTasks = {
+      { timestampMs, "legacy", "" }, { timestampMs + 2, "a", "3" }, { timestampMs + 4, "b", "4" },
+      { timestampMs + 5, "recurring", "" } };
+  EXPECT_EQ(expectedTasks, processor->processedTasks);
+  EXPECT_EQ(1, queue.outstandingTaskCount());
+
+  // the task the processor scheduled again keeps its index entry
+  EXPECT_TRUE(queue.cancel("recurring"));
+  EXPECT_FALSE(queue.cancel("recurring"));
+  EXPECT_FALSE(queue.cancel("a"));
+  EXPECT_FALSE(queue.cancel("missing"));
+  EXPECT_EQ(0, queue.outstandingTaskCount());
+  EXPECT_EQ(0, queue.accurateOutstandingTaskCountSlow());
+
+  // rescheduling keeps the value
+  EXPECT_TRUE(queue.schedule({ futureTimestampMs, "c", "value" }));
+  EXPECT_TRUE(queue.reschedule("c", timestampMs));
+  EXPECT_TRUE(queue.reschedule("c", timestampMs));
+  EXPECT_FALSE(queue.reschedule("missing", timestampMs));
+  std::vector<ScheduledTask> pendingTasks;
+  queue.scanPendingTasks(futureTimestampMs + 1, 0, &pendingTasks);
+  ASSERT_EQ(1, pendingTasks.size());
+  EXPECT_EQ(ScheduledTask(timestampMs, "c", "value"), pendingTasks[0]);
+  EXPECT_EQ(1, queue.outstandingTaskCount());
+
+  // scheduling with an opaque key/value replaces the task as well
+  EXPECT_EQ(1, queue.scheduleOpaque("c", folly::to<std::string>(timestampMs + 1), -1));
+  EXPECT_EQ(1, queue.outstandingTaskCount());
+  EXPECT_EQ(1, queue.accurateOutstandingTaskCountSlow());
+}
+
+TEST_F(ScheduledTaskQueueTest, RetryBackoff) {
+  const int64_t timestampMs = nowMs() - 60000;
+  const int64_t futureTimestampMs = 4102444800000L;
+  auto processor = std::make_shared<FailingScheduledTaskProcessor>();
+  processor->failedDataKeys = { "bad", "cancelled" };
+  ScheduledTaskQueue queue(processor, databaseManager(), columnFamily("scheduled-tasks"));
+  queue.enableIndex(columnFamily("scheduled-tasks-index"));
+  queue.setRetryPolicy(1000, 4000, 3,
+                       columnFamily(ScheduledTaskQueue::deadLetterColumnFamilyName("scheduled-tasks")));
+  EXPECT_EQ(1000, queue.getRetryBackoffMs(1));
+  EXPECT_EQ(2000, queue.getRetryBackoffMs(2));
+  EXPECT_EQ(4000, queue.getRetryBackoffMs(3));
+  EXPECT_EQ(4000, queue.getRetryBackoffMs(100));
+
+  queue.schedule({ timestampMs, "ok", "" });
+  queue.schedule({ timestampMs, "bad", "value" });
+  queue.schedule({ timestampMs, "cancelled", "" });
+  int64_t processingTimeMs = nowMs();
+  queue.batchProcessing(processingTimeMs);
+  EXPECT_EQ(std::vector<std::string>({ "ok" }), processor->processedDataKeys);
+
+  // failed tasks are rescheduled after the backoff instead of at the next check
+  EXPECT_EQ(0, queue.scanPendingTasks(processingTimeMs + 1000));
+  std::vector<ScheduledTask> pendingTasks;
+  queue.scanPendingTasks(futureTimestampMs, 0, &pendingTasks);
+  ASSERT_EQ(2, pendingTasks.size());
+  EXPECT_EQ("bad", pendingTasks[0].dataKey());
+  EXPECT_EQ("value", pendingTasks[0].value());
+  EXPECT_EQ(1, pendingTasks[0].attempts());
+  EXPECT_EQ(2, queue.outstandingTaskCount());
+  // the index follows the rescheduled task
+  EXPECT_TRUE(queue.cancel("cancelled"));
+  EXPECT_EQ(1, queue.outstandingTaskCount());
+
+  // moved to dead letters after the last attempt
+  queue.batchProcessing(futureTimestampMs);
+  queue.batchProcessing(futureTimestampMs);
+  EXPECT_EQ(0, queue.accurateOutstandingTaskCountSlow());
+  EXPECT_EQ(0, queue.outstandingTaskCount());
+  std::vector<ScheduledTask> deadLetters;
+  EXPECT_EQ(1, queue.scanDeadLetters(0, &deadLetters));
+  ASSERT_EQ(1, deadLetters.size());
+  EXPECT_EQ("bad", deadLetters[0].dataKey());
+  EXPECT_EQ("value", deadLetters[0].value());
+  EXPECT_EQ(3, deadLetters[0].attempts());
+  EXPECT_FALSE(queue.cancel("bad"));
+
+  // requeued to run now with a fresh attempt count
+  EXPECT_EQ(0, queue.requeueDeadLetters("other"));
+  EXPECT_EQ(1, queue.requeueDeadLetters("bad"));
+  EXPECT_EQ(0, queue.scanDeadLetters(0, nullptr));
+  pendingTasks.clear();
+  queue.scanPendingTasks(futureTimestampMs, 0, &pendingTasks);
+  ASSERT_EQ(1, pendingTasks.size());
+  EXPECT_EQ(ScheduledTask(pendingTasks[0].scheduledTimeMs(), "bad", "value"), pendingTasks[0]);
+  EXPECT_EQ(1, queue.outstandingTaskCount());
+
+  for (int i = 0; i < 3; i++) {
+    queue.batchProcessing(futureTimestampMs);
+  }
+  EXPECT_EQ(1, queue.scanDeadLetters(0, nullptr));
+  EXPECT_EQ(1, queue.purgeDeadLetters(""));
+  EXPECT_EQ(0, queue.scanDeadLetters(0, nullptr));
+  EXPECT_EQ(0, queue.outstandingTaskCount());
+}
+
+TEST_F(ScheduledTaskQueueTest, RetryMarkerInValues) {
+  const int64_t futureTimestampMs = 4102444800000L;
+  std::string markedValue = ScheduledTask::retryMarker() + "1234value";
+  std::vector<ScheduledTask> pendingTasks;
+  {
+    // queues without a retry policy store values as given
+    ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                             columnFamily("scheduled-tasks"));
+    queue.schedule({ futureTimestampMs, "plain", markedValue });
+    queue.scanPendingTasks(futureTimestampMs + 1, 0, &pendingTasks);
+    ASSERT_EQ(1, pendingTasks.size());
+    EXPECT_EQ(ScheduledTask(futureTimestampMs, "plain", markedValue), pendingTasks[0]);
+    std::string value;
+    ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), columnFamily("scheduled-tasks"), pendingTasks[0].key(), &value).ok());
+    EXPECT_EQ(markedValue, value);
+    ASSERT_TRUE(db()->Delete(rocksdb::WriteOptions(), columnFamily("scheduled-tasks"), pendingTasks[0].key()).ok());
+  }
+
+  ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                           columnFamily("scheduled-tasks"));
+  queue.setRetryPolicy(1000, 4000, 3,
+                       columnFamily(ScheduledTaskQueue::deadLetterColumnFamilyName("scheduled-tasks")));
+  queue.schedule({ futureTimestampMs, "retried", markedValue });
+  pendingTasks.clear();
+  queue.scanPendingTasks(futureTimestampMs + 1, 0, &pendingTasks);
+  ASSERT_EQ(1, pendingTasks.size());
+  EXPECT_EQ(ScheduledTask(futureTimestampMs, "retried", markedValue), pendingTasks[0]);
+}
+
+TEST_F(ScheduledTaskQueueTest, RetryKeyCollision) {
+  const int64_t timestampMs = nowMs() - 60000;
+  auto processor = std::make_shared<FailingScheduledTaskProcessor>();
+  processor->failedDataKeys = { "bad" };
+  ScheduledTaskQueue queue(processor, databaseManager(), columnFamily("scheduled-tasks"));
+  queue.setRetryPolicy(1000, 4000, 3,
+                       columnFamily(ScheduledTaskQueue::deadLetterColumnFamilyName("scheduled-tasks")));
+  queue.schedule({ timestampMs, "bad", "first" });
+  queue.schedule({ timestampMs + 1, "bad", "second" });
+  queue.batchProcessing(nowMs());
+
+  // both tasks fail with the same backoff, and neither retry overwrites the other
+  std::vector<ScheduledTask> pendingTasks;
+  queue.scanPendingTasks(4102444800000L, 0, &pendingTasks);
+  ASSERT_EQ(2, pendingTasks.size());
+  EXPECT_NE(pendingTasks[0].scheduledTimeMs(), pendingTasks[1].scheduledTimeMs());
+  EXPECT_EQ(2, queue.outstandingTaskCount());
+  EXPECT_EQ(2, queue.accurateOutstandingTaskCountSlow());
+}
+
+TEST_F(ScheduledTaskQueueTest, TaskCountInMemory) {
+  std::string key = ScheduledTaskQueue::getTaskCountMetadataKey("scheduled-tasks");
+  std::string value;
+  {
+    ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                             columnFamily("scheduled-tasks"));
+    queue.schedule({ 4102444800000L, "key1", "value1" });
+  }
+
+  // the count left by the counter is loaded and removed, so that no merge operand is left after the shutdown
+  ScheduledTaskQueue queue(std::make_unique<TestScheduledTaskProcessor>(), databaseManager(),
+                           columnFamily("scheduled-tasks"));
+  queue.disableTaskCounter();
+  queue.start();
+  EXPECT_EQ(1, queue.outstandingTaskCount());
+  EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), key, &value).IsNotFound());
+  queue.schedule({ 4102444800001L, "key2", "value2" });
+  queue.schedule({ 4102444800001L, "key2", "value2" });
+  EXPECT_EQ(2, queue.outstandingTaskCount());
+  EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), key, &value).IsNotFound());
+  queue.destroy();
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), key, &value).ok());
+  EXPECT_EQ("2", value);
+}
+
+TEST_F(ScheduledTaskQueueTest, RequeueEveryDeadLetter) {
+  const int64_t timestampMs = nowMs() - 60000;
+  auto processor = std::make_shared<FailingScheduledTaskProcessor>();
+  processor->failedDataKeys = { "bad" };
+  ScheduledTaskQueue queue(processor, databaseManager(), columnFamily("scheduled-tasks"));
+  queue.setRetryPolicy(1000, 4000, 1,
+                       columnFamily(ScheduledTaskQueue::deadLetterColumnFamilyName("scheduled-tasks")));
+  queue.schedule({ timestampMs, "bad", "first" });
+  queue.schedule({ timestampMs + 1, "bad", "second" });
+  queue.batchProcessing(nowMs());
+  EXPECT_EQ(2, queue.scanDeadLetters(0, nullptr));
+
+  // dead letters of the same data key are all requeued
+  EXPECT_EQ(2, queue.requeueDeadLetters("bad"));
+  EXPECT_EQ(0, queue.scanDeadLetters(0, nullptr));
+  EXPECT_EQ(2, queue.outstandingTaskCount());
+  processor->failedDataKeys.clear();
+  processor->processedDataKeys.clear();
+  EXPECT_EQ(2, queue.batchProcessing(nowMs()));
+  EXPECT_EQ(std::vector<std::string>({ "bad", "bad" }), processor->processedDataKeys);
+  EXPECT_EQ(0, queue.accurateOutstandingTaskCountSlow());
+}
+
 }  // namespace infra
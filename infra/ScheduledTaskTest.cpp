@@ -77,6 +77,34 @@ TEST(ScheduledTaskTest, TaskComparison) {
   EXPECT_EQ(task1, task3);
 }
 
+TEST(ScheduledTaskTest, EncodeValue) {
+  int attempts;
+  // tasks that never failed keep the value as given
+  EXPECT_EQ("value", ScheduledTask::encodeValue("value", 0));
+  EXPECT_EQ("value", ScheduledTask::decodeValue("value", &attempts));
+  EXPECT_EQ(0, attempts);
+  // too short for an attempt count
+  EXPECT_EQ(ScheduledTask::retryMarker(), ScheduledTask::decodeValue(ScheduledTask::retryMarker(), &attempts));
+  EXPECT_EQ(0, attempts);
+
+  std::string storedValue = ScheduledTask::encodeValue("value", 3);
+  EXPECT_EQ(ScheduledTask::retryMarker().size() + sizeof(int32_t) + 5, storedValue.size());
+  EXPECT_EQ("value", ScheduledTask::decodeValue(storedValue, &attempts));
+  EXPECT_EQ(3, attempts);
+  EXPECT_EQ("", ScheduledTask::decodeValue(ScheduledTask::encodeValue("", 1), &attempts));
+  EXPECT_EQ(1, attempts);
+
+  // values starting with the marker are encoded so that they decode unchanged
+  std::string markedValue = ScheduledTask::retryMarker() + "1234value";
+  EXPECT_NE(markedValue, ScheduledTask::encodeValue(markedValue, 0));
+  EXPECT_EQ(markedValue, ScheduledTask::decodeValue(ScheduledTask::encodeValue(markedValue, 0), &attempts));
+  EXPECT_EQ(0, attempts);
+
+  ScheduledTask task{ 1472295107012L, "key", "value", 3 };
+  EXPECT_EQ(storedValue, task.storedValue());
+  EXPECT_NE(task, ScheduledTask(1472295107012L, "key", "value"));
+}
+
 TEST(ScheduledTaskTest, MarkCompleted) {
   ScheduledTask task{ 1472295107012L, "key", "value" };
 
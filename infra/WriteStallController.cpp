@@ -0,0 +1,130 @@
+#include "infra/WriteStallController.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace infra {
+
+constexpr double WriteStallController::kDelayedPressure;
+constexpr double WriteStallController::kStoppedPressure;
+
+void WriteStallController::start(rocksdb::DB* db, ColumnFamilyProvider columnFamilyProvider, int64_t pollIntervalMs,
+                                 DbResolver dbResolver) {
+  CHECK(!run_) << "Write stall controller is already running";
+  CHECK_GT(pollIntervalMs, 0);
+  db_ = db;
+  columnFamilyProvider_ = std::move(columnFamilyProvider);
+  dbResolver_ = std::move(dbResolver);
+  run_ = true;
+  pollThread_.reset(new std::thread([this, pollIntervalMs]() {
+    pthread_setname_np(pthread_self(), "write-stall");
+    while (run_) {
+      poll();
+      std::this_thread::sleep_for(std::chrono::milliseconds(pollIntervalMs));
+    }
+  }));
+  LOG(INFO) << "Started write stall controller polling every " << pollIntervalMs << "ms";
+}
+
+void WriteStallController::stop() {
+  if (!run_) return;
+  run_ = false;
+  pollThread_->join();
+  pollThread_.reset();
+}
+
+void WriteStallController::poll() {
+  double propertyPressure = 0;
+  for (auto columnFamily : columnFamilyProvider_()) {
+    propertyPressure = std::max(propertyPressure, getColumnFamilyPressure(columnFamily));
+  }
+  updatePressure(propertyPressure);
+}
+
+double WriteStallController::getColumnFamilyPressure(rocksdb::ColumnFamilyHandle* columnFamily) {
+  rocksdb::DB* db = dbResolver_ ? dbResolver_(columnFamily) : db_;
+  // options may be changed at runtime with CONFIG SET, so always read the latest
+  rocksdb::Options options = db->GetOptions(columnFamily);
+  double pressure = 0;
+  uint64_t value;
+  if (options.soft_pending_compaction_bytes_limit > 0 &&
+      db->GetIntProperty(columnFamily, "rocksdb.estimate-pending-compaction-bytes", &value)) {
+    pressure = std::max(pressure, static_cast<double>(value) / options.soft_pending_compaction_bytes_limit);
+  }
+  if (options.level0_slowdown_writes_trigger > 0 &&
+      db->GetIntProperty(columnFamily, "rocksdb.num-files-at-level0", &value)) {
+    pressure = std::max(pressure, static_cast<double>(value) / options.level0_slowdown_writes_trigger);
+  }
+  // writes stop once all the write buffers are full and waiting for flush
+  if (options.max_write_buffer_number > 1 &&
+      db->GetIntProperty(columnFamily, "rocksdb.num-immutable-mem-table", &value)) {
+    pressure = std::max(pressure, static_cast<double>(value) / (options.max_write_buffer_number - 1));
+  }
+  return pressure;
+}
+
+void WriteStallController::updatePressure(double propertyPressure) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  lastPropertyPressure_ = propertyPressure;
+  double pressure = propertyPressure;
+  for (const auto& entry : stallPressureMap_) {
+    pressure = std::max(pressure, entry.second);
+  }
+
+  double previousPressure = pressure_.exchange(pressure);
+  bool wasThrottling = previousPressure >= config_.consumerThrottleStart;
+  bool isThrottling = pressure >= config_.consumerThrottleStart;
+  if (wasThrottling != isThrottling) {
+    LOG(WARNING) << "Write pressure changed from " << previousPressure << " to " << pressure << ", "
+                 << (isThrottling ? "throttling" : "no longer throttling") << " writes";
+  }
+}
+
+int64_t WriteStallController::consumerDelayMs() const {
+  double pressure = pressure_;
+  if (pressure < config_.consumerThrottleStart) return 0;
+  if (pressure >= config_.clientDelayStart) return config_.maxConsumerDelayMs;
+  return std::max<int64_t>(1, (pressure - config_.consumerThrottleStart) /
+                                  (config_.clientDelayStart - config_.consumerThrottleStart) *
+                                  config_.maxConsumerDelayMs);
+}
+
+int64_t WriteStallController::clientWriteDelayMs() const {
+  double pressure = pressure_;
+  if (pressure < config_.clientDelayStart) return 0;
+  if (pressure >= config_.clientShedStart) return -1;
+  return std::max<int64_t>(1, (pressure - config_.clientDelayStart) /
+                                  (config_.clientShedStart - config_.clientDelayStart) * config_.maxClientDelayMs);
+}
+
+std::shared_ptr<rocksdb::EventListener> WriteStallController::getInstanceListener(const std::string& instanceName) {
+  return std::make_shared<InstanceListener>(shared_from_this(), instanceName);
+}
+
+void WriteStallController::onStallConditionsChanged(const std::string& instanceName,
+                                                    const rocksdb::WriteStallInfo& info) {
+  double stallPressure = 0;
+  if (info.condition.cur == rocksdb::WriteStallCondition::kDelayed) {
+    stallPressure = kDelayedPressure;
+  } else if (info.condition.cur == rocksdb::WriteStallCondition::kStopped) {
+    stallPressure = kStoppedPressure;
+  }
+
+  double propertyPressure;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stallPressureMap_[std::make_pair(instanceName, info.cf_name)] = stallPressure;
+    propertyPressure = lastPropertyPressure_;
+  }
+  // react right away instead of waiting for the next poll
+  updatePressure(propertyPressure);
+}
+
+}  // namespace infra
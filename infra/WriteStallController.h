@@ -0,0 +1,130 @@
+#ifndef INFRA_WRITESTALLCONTROLLER_H_
+#define INFRA_WRITESTALLCONTROLLER_H_
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rocksdb/db.h"
+#include "rocksdb/listener.h"
+
+namespace infra {
+
+// Apply backpressure to writers before RocksDB hard-stalls all of them.
+//
+// The controller tracks a single write pressure value, where 1.0 means RocksDB is about to (or already does) delay
+// writes. Pressure is the maximum over all column families of pending compaction bytes relative to
+// soft_pending_compaction_bytes_limit, L0 files relative to level0_slowdown_writes_trigger, and immutable memtables
+// relative to max_write_buffer_number, raised further by the stall conditions reported to OnStallConditionsChanged.
+//
+// Kafka consumers are slowed down first so that backfill absorbs the slowdown. Client writes are asked to back off for
+// gradually longer only once RocksDB starts delaying writes itself, and shed once the pressure keeps growing.
+class WriteStallController : public rocksdb::EventListener,
+                             public std::enable_shared_from_this<WriteStallController> {
+ public:
+  struct Config {
+    // Pressure at which consumers start to slow down. They reach maxConsumerDelayMs at clientDelayStart.
+    double consumerThrottleStart = 0.5;
+    int64_t maxConsumerDelayMs = 1000;
+    // Pressure at which client writes start to back off, reaching maxClientDelayMs right before clientShedStart
+    double clientDelayStart = 1.0;
+    // Pressure at which client writes are rejected
+    double clientShedStart = 1.5;
+    int64_t maxClientDelayMs = 50;
+  };
+
+  using ColumnFamilyProvider = std::function<std::vector<rocksdb::ColumnFamilyHandle*>()>;
+  // Find the RocksDB instance of a column family when there are several
+  using DbResolver = std::function<rocksdb::DB*(rocksdb::ColumnFamilyHandle*)>;
+
+  // Pressure contributed by stall conditions reported by RocksDB
+  static constexpr double kDelayedPressure = 1.0;
+  static constexpr double kStoppedPressure = 2.0;
+
+  explicit WriteStallController(Config config) : config_(config), pressure_(0), run_(false) {}
+
+  WriteStallController() : WriteStallController(Config()) {}
+
+  ~WriteStallController() {
+    stop();
+  }
+
+  // Start polling column family properties every pollIntervalMs. The provider is called on every poll so that the
+  // controller follows column families created or dropped at runtime. Without a resolver, all the column families
+  // belong to db.
+  void start(rocksdb::DB* db, ColumnFamilyProvider columnFamilyProvider, int64_t pollIntervalMs,
+             DbResolver dbResolver = nullptr);
+
+  // Stop polling and wait for the polling thread to exit
+  void stop();
+
+  // Recompute write pressure from column family properties and known stall conditions
+  void poll();
+
+  double pressure() const {
+    return pressure_;
+  }
+
+  // Delay a kafka consumer should wait before processing its next batch
+  int64_t consumerDelayMs() const;
+
+  // Delay a client should back off before retrying a write, 0 when the write is admitted, or -1 when writes are shed
+  int64_t clientWriteDelayMs() const;
+
+  // The controller itself listens to the primary RocksDB instance. Secondary instances report their stall
+  // conditions through their own listener, because column family names such as "default" repeat across instances.
+  // The controller must be owned by a shared_ptr.
+  std::shared_ptr<rocksdb::EventListener> getInstanceListener(const std::string& instanceName);
+
+  void OnStallConditionsChanged(const rocksdb::WriteStallInfo& info) override {
+    onStallConditionsChanged("", info);
+  }
+
+ private:
+  class InstanceListener : public rocksdb::EventListener {
+   public:
+    InstanceListener(std::shared_ptr<WriteStallController> controller, std::string instanceName)
+        : controller_(std::move(controller)), instanceName_(std::move(instanceName)) {}
+
+    void OnStallConditionsChanged(const rocksdb::WriteStallInfo& info) override {
+      controller_->onStallConditionsChanged(instanceName_, info);
+    }
+
+   private:
+    std::shared_ptr<WriteStallController> controller_;
+    const std::string instanceName_;
+  };
+
+  // Track the stall condition of a column family of the named instance, empty for the primary one
+  void onStallConditionsChanged(const std::string& instanceName, const rocksdb::WriteStallInfo& info);
+
+  // Pressure derived from the properties of a single column family
+  double getColumnFamilyPressure(rocksdb::ColumnFamilyHandle* columnFamily);
+
+  // Update pressure with the latest polled pressure and stall conditions
+  void updatePressure(double propertyPressure);
+
+  const Config config_;
+  rocksdb::DB* db_ = nullptr;
+  ColumnFamilyProvider columnFamilyProvider_;
+  DbResolver dbResolver_;
+
+  std::atomic<double> pressure_;
+  double lastPropertyPressure_ = 0;
+  // Latest stall condition pressure by instance name and column family name, updated from RocksDB background threads
+  std::map<std::pair<std::string, std::string>, double> stallPressureMap_;
+  std::mutex mutex_;
+
+  std::atomic<bool> run_;
+  std::unique_ptr<std::thread> pollThread_;
+};
+
+}  // namespace infra
+
+#endif  // INFRA_WRITESTALLCONTROLLER_H_
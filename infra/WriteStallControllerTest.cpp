@@ -0,0 +1,136 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "folly/Conv.h"
+#include "gtest/gtest.h"
+#include "infra/WriteStallController.h"
+#include "rocksdb/listener.h"
+#include "rocksdb/options.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace infra {
+
+static void configureColumnFamily(int blockCacheSizeMb, rocksdb::ColumnFamilyOptions* options) {
+  // keep every flushed file in L0 so that the tests control the L0 file count
+  options->disable_auto_compactions = true;
+  options->level0_slowdown_writes_trigger = 4;
+  options->level0_stop_writes_trigger = 8;
+}
+
+class WriteStallControllerTest : public stesting::TestWithRocksDb {
+ protected:
+  WriteStallControllerTest() : stesting::TestWithRocksDb({"stalled"}, {{"stalled", &configureColumnFamily}}) {}
+
+  void flushNewL0File(int index) {
+    auto key = folly::to<std::string>("key", index);
+    ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), columnFamily("stalled"), key, "value").ok());
+    ASSERT_TRUE(db()->Flush(rocksdb::FlushOptions(), columnFamily("stalled")).ok());
+  }
+
+  void startController(WriteStallController* controller) {
+    rocksdb::ColumnFamilyHandle* stalled = columnFamily("stalled");
+    // use a long interval so that the test drives polling explicitly
+    controller->start(db(), [stalled]() { return std::vector<rocksdb::ColumnFamilyHandle*>{stalled}; }, 3600000);
+  }
+};
+
+TEST_F(WriteStallControllerTest, PressureFromLevel0Files) {
+  WriteStallController controller;
+  startController(&controller);
+  controller.poll();
+  EXPECT_EQ(0, controller.pressure());
+  EXPECT_EQ(0, controller.consumerDelayMs());
+  EXPECT_EQ(0, controller.clientWriteDelayMs());
+
+  // 1 of 4 files before slowdown is not enough to throttle
+  flushNewL0File(0);
+  controller.poll();
+  EXPECT_DOUBLE_EQ(0.25, controller.pressure());
+  EXPECT_EQ(0, controller.consumerDelayMs());
+
+  // consumers are throttled first
+  flushNewL0File(1);
+  flushNewL0File(2);
+  controller.poll();
+  EXPECT_DOUBLE_EQ(0.75, controller.pressure());
+  EXPECT_EQ(500, controller.consumerDelayMs());
+  EXPECT_EQ(0, controller.clientWriteDelayMs());
+
+  // client writes are delayed once RocksDB slows down writes, and consumers are fully throttled
+  flushNewL0File(3);
+  flushNewL0File(4);
+  controller.poll();
+  EXPECT_DOUBLE_EQ(1.25, controller.pressure());
+  EXPECT_EQ(1000, controller.consumerDelayMs());
+  EXPECT_EQ(25, controller.clientWriteDelayMs());
+
+  // client writes are rejected when pressure keeps growing
+  flushNewL0File(5);
+  controller.poll();
+  EXPECT_DOUBLE_EQ(1.5, controller.pressure());
+  EXPECT_EQ(-1, controller.clientWriteDelayMs());
+
+  controller.stop();
+}
+
+TEST_F(WriteStallControllerTest, PressureFromStallConditions) {
+  WriteStallController::Config config;
+  config.maxClientDelayMs = 10;
+  WriteStallController controller(config);
+  startController(&controller);
+  controller.poll();
+  EXPECT_EQ(0, controller.pressure());
+
+  rocksdb::WriteStallInfo info;
+  info.cf_name = "stalled";
+  info.condition.prev = rocksdb::WriteStallCondition::kNormal;
+  info.condition.cur = rocksdb::WriteStallCondition::kDelayed;
+  controller.OnStallConditionsChanged(info);
+  EXPECT_EQ(WriteStallController::kDelayedPressure, controller.pressure());
+  EXPECT_EQ(1000, controller.consumerDelayMs());
+  EXPECT_EQ(1, controller.clientWriteDelayMs());
+
+  // the stall condition holds across polls until RocksDB reports a change
+  controller.poll();
+  EXPECT_EQ(WriteStallController::kDelayedPressure, controller.pressure());
+
+  info.condition.prev = rocksdb::WriteStallCondition::kDelayed;
+  info.condition.cur = rocksdb::WriteStallCondition::kStopped;
+  controller.OnStallConditionsChanged(info);
+  EXPECT_EQ(WriteStallController::kStoppedPressure, controller.pressure());
+  EXPECT_EQ(-1, controller.clientWriteDelayMs());
+
+  info.condition.prev = rocksdb::WriteStallCondition::kStopped;
+  info.condition.cur = rocksdb::WriteStallCondition::kNormal;
+  controller.OnStallConditionsChanged(info);
+  EXPECT_EQ(0, controller.pressure());
+  EXPECT_EQ(0, controller.consumerDelayMs());
+
+  controller.stop();
+}
+
+TEST_F(WriteStallControllerTest, StallConditionsByInstance) {
+  auto controller = std::make_shared<WriteStallController>();
+  startController(controller.get());
+  auto instanceListener = controller->getInstanceListener("remote");
+
+  rocksdb::WriteStallInfo info;
+  info.cf_name = "default";
+  info.condition.prev = rocksdb::WriteStallCondition::kNormal;
+  info.condition.cur = rocksdb::WriteStallCondition::kDelayed;
+  controller->OnStallConditionsChanged(info);
+  EXPECT_EQ(WriteStallController::kDelayedPressure, controller->pressure());
+
+  // the column family of the same name in another instance does not clear the stall of the primary one
+  info.condition.prev = rocksdb::WriteStallCondition::kDelayed;
+  info.condition.cur = rocksdb::WriteStallCondition::kNormal;
+  instanceListener->OnStallConditionsChanged(info);
+  EXPECT_EQ(WriteStallController::kDelayedPressure, controller->pressure());
+
+  controller->OnStallConditionsChanged(info);
+  EXPECT_EQ(0, controller->pressure());
+  controller->stop();
+}
+
+}  // namespace infra
@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 
+#include <algorithm>
 #include <memory>
 #include <chrono>
 #include <string>
@@ -10,6 +11,7 @@
 
 #include "glog/logging.h"
 #include "infra/kafka/ConsumerHelper.h"
+#include "infra/WriteStallController.h"
 
 namespace infra {
 namespace kafka {
@@ -58,6 +60,8 @@ class AbstractConsumer {
     // `this` pointer has a longer lifetime than the consumer thread, so it's okay just pass `this` to the thread
     consumerThread_.reset(new std::thread([this, timeoutMs]() {
       while (this->run()) {
+        // back off before writing more when the database is under write pressure
+        this->throttle();
         // process a batch of messages
         this->processBatch(timeoutMs);
       }
@@ -65,6 +69,11 @@ class AbstractConsumer {
     pthread_setname_np(consumerThread_->native_handle(), "kafka-consumer");
   }
 
+  // Slow down batch processing when the controller reports write pressure. Must be set before start.
+  void setWriteStallController(std::shared_ptr<infra::WriteStallController> writeStallController) {
+    writeStallController_ = writeStallController;
+  }
+
   // Stop the consumer. This function should NOT block.
   virtual void stop(void) {
     run_ = false;
@@ -96,6 +105,17 @@ class AbstractConsumer {
   bool initialized() const { return initialized_; }
   void setInitialized() { initialized_ = true; }
 
+  void throttle() {
+    if (!writeStallController_) return;
+    int64_t delayMs = writeStallController_->consumerDelayMs();
+    // sleep in small steps so that stopping the consumer is not delayed
+    while (delayMs > 0 && run()) {
+      int64_t sleepMs = std::min<int64_t>(delayMs, 100);
+      std::this_thread::sleep_for(std::chrono::milliseconds(sleepMs));
+      delayMs -= sleepMs;
+    }
+  }
+
  private:
   const std::string offsetKey_;
   const bool lowLatency_;
@@ -103,6 +123,7 @@ class AbstractConsumer {
   bool initialized_;
   bool run_;
   std::unique_ptr<std::thread> consumerThread_;
+  std::shared_ptr<infra::WriteStallController> writeStallController_;
 };
 
 }  // namespace kafka
@@ -139,6 +139,11 @@ class ConsumerHelper {
     return offsetKey;
   }
 
+  // Check if a consumer is linked to the offset key
+  bool isLinked(const std::string& offsetKey) const {
+    return topicPartitions_.find(offsetKey) != topicPartitions_.end();
+  }
+
   // Load kafka offset from rocksdb
   int64_t loadCommittedOffsetFromDb(const std::string& offsetKey);
 
@@ -232,7 +237,9 @@ class ConsumerHelper {
   static constexpr int kInt64MaxDigits = 20;
   static constexpr char kKafkaAndFileOffsetsFormat[] = "{:020d}:{:020d}";
 
-  // Commit offset to rocksdb using a write batch, which allows the caller to persist other data atomically.
+  // Commit offset to rocksdb using a write batch, which allows the caller to persist other data atomically. The batch
+  // is committed to the instance of the metadata column family, so it must not hold column families of other
+  // instances.
   bool commitRawOffsetValueWithWriteBatch(const std::string& offsetKey, const std::string& offsetValue,
                                           rocksdb::WriteBatchBase* writeBatch = nullptr);
 
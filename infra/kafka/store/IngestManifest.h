@@ -0,0 +1,74 @@
+#ifndef INFRA_KAFKA_STORE_INGESTMANIFEST_H_
+#define INFRA_KAFKA_STORE_INGESTMANIFEST_H_
+
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "folly/FileUtil.h"
+#include "folly/dynamic.h"
+#include "folly/json.h"
+#include "glog/logging.h"
+
+namespace infra {
+namespace kafka {
+namespace store {
+
+// Describe SST files built from kafka-store files for the INGEST command, which is written next to the SST files.
+// The offsets are those a kafka store consumer should continue from once the files are ingested.
+struct IngestManifest {
+  // SST file names relative to the manifest directory
+  std::vector<std::string> sstFiles;
+  int64_t nextKafkaOffset = 0;
+  int64_t nextFileOffset = 0;
+  // Raw consumer offset value committed at the time of an EXPORTSHARD, if any. IMPORTSHARD commits it as is, because
+  // it may come from any type of consumer, but only when it rewinds a plain kafka offset committed on the target.
+  std::string committedOffset;
+
+  static std::string getPath(const std::string& dir) {
+    return dir + "/INGEST_MANIFEST";
+  }
+
+  bool write(const std::string& dir) const {
+    folly::dynamic files = folly::dynamic::array;
+    for (const auto& sstFile : sstFiles) {
+      files.push_back(sstFile);
+    }
+    folly::dynamic json = folly::dynamic::object("sst_files", files)("next_kafka_offset", nextKafkaOffset)(
+        "next_file_offset", nextFileOffset)("committed_offset", committedOffset);
+    if (!folly::writeFile(folly::toPrettyJson(json), getPath(dir).c_str())) {
+      LOG(ERROR) << "Writing ingest manifest failed in " << dir;
+      return false;
+    }
+    return true;
+  }
+
+  bool read(const std::string& dir) {
+    std::string content;
+    if (!folly::readFile(getPath(dir).c_str(), content)) {
+      LOG(ERROR) << "Reading ingest manifest failed in " << dir;
+      return false;
+    }
+    try {
+      folly::dynamic json = folly::parseJson(content);
+      sstFiles.clear();
+      for (const auto& sstFile : json["sst_files"]) {
+        sstFiles.push_back(sstFile.getString());
+      }
+      nextKafkaOffset = json["next_kafka_offset"].getInt();
+      nextFileOffset = json["next_file_offset"].getInt();
+      // manifests of kafka_store_sst_builder have no committed offset
+      committedOffset = json.getDefault("committed_offset", "").getString();
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Invalid ingest manifest in " << dir << ": " << e.what();
+      return false;
+    }
+    return true;
+  }
+};
+
+}  // namespace store
+}  // namespace kafka
+}  // namespace infra
+
+#endif  // INFRA_KAFKA_STORE_INGESTMANIFEST_H_
@@ -0,0 +1,292 @@
+#include "infra/kafka/store/SstBuilder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#include "avro/DataFile.hh"
+#pragma GCC diagnostic pop
+#include "boost/filesystem.hpp"
+#include "folly/Conv.h"
+#include "folly/Format.h"
+#include "glog/logging.h"
+#include "rocksdb/env.h"
+#include "rocksdb/sst_file_writer.h"
+
+namespace infra {
+namespace kafka {
+namespace store {
+
+namespace {
+
+// A converted message as stored in spill files
+struct SpillRecord {
+  int64_t offset;
+  bool isDeletion;
+  std::string key;
+  std::string value;
+};
+
+void writeSpillRecord(const SpillRecord& record, std::ofstream* out) {
+  uint8_t isDeletion = record.isDeletion ? 1 : 0;
+  uint32_t keySize = record.key.size();
+  uint32_t valueSize = record.value.size();
+  out->write(reinterpret_cast<const char*>(&record.offset), sizeof(record.offset));
+  out->write(reinterpret_cast<const char*>(&isDeletion), sizeof(isDeletion));
+  out->write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+  out->write(reinterpret_cast<const char*>(&valueSize), sizeof(valueSize));
+  out->write(record.key.data(), keySize);
+  out->write(record.value.data(), valueSize);
+}
+
+bool readSpillRecord(std::ifstream* in, SpillRecord* record) {
+  uint8_t isDeletion;
+  uint32_t keySize;
+  uint32_t valueSize;
+  if (!in->read(reinterpret_cast<char*>(&record->offset), sizeof(record->offset))) return false;
+  CHECK(in->read(reinterpret_cast<char*>(&isDeletion), sizeof(isDeletion)));
+  CHECK(in->read(reinterpret_cast<char*>(&keySize), sizeof(keySize)));
+  CHECK(in->read(reinterpret_cast<char*>(&valueSize), sizeof(valueSize)));
+  record->isDeletion = isDeletion != 0;
+  record->key.resize(keySize);
+  record->value.resize(valueSize);
+  CHECK(in->read(&record->key[0], keySize));
+  CHECK(in->read(&record->value[0], valueSize));
+  return true;
+}
+
+// Run the given function for each worker in its own thread and return true if all of them succeeded
+bool runWorkers(int parallelism, std::function<bool(int)> func) {
+  // use char instead of bool so that workers write to separate bytes
+  std::vector<char> results(parallelism, 0);
+  std::vector<std::thread> threads;
+  for (int worker = 0; worker < parallelism; worker++) {
+    threads.emplace_back([worker, &func, &results]() { results[worker] = func(worker) ? 1 : 0; });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return std::all_of(results.begin(), results.end(), [](char result) { return result != 0; });
+}
+
+}  // namespace
+
+bool SstBuilder::convertKeyValue(const KafkaStoreMessage& msg, std::string* key, std::string* value,
+                                 bool* isDeletion) {
+  if (msg.key.is_null()) return false;
+
+  std::vector<uint8_t> keyBytes = msg.key.get_bytes();
+  key->assign(keyBytes.begin(), keyBytes.end());
+  *isDeletion = msg.value.is_null();
+  if (*isDeletion) {
+    value->clear();
+  } else {
+    std::vector<uint8_t> valueBytes = msg.value.get_bytes();
+    value->assign(valueBytes.begin(), valueBytes.end());
+  }
+  return true;
+}
+
+bool SstBuilder::parseFileOffset(const std::string& path, int64_t* fileOffset) {
+  std::string fileName = boost::filesystem::path(path).filename().native();
+  if (fileName.size() != 20 || !std::all_of(fileName.begin(), fileName.end(), ::isdigit)) return false;
+
+  *fileOffset = folly::to<int64_t>(fileName);
+  return true;
+}
+
+bool SstBuilder::build(const std::vector<std::string>& inputFilePaths, IngestManifest* manifest) {
+  CHECK_GT(config_.parallelism, 0);
+  CHECK_GT(config_.numRanges, 0);
+  if (inputFilePaths.empty()) {
+    LOG(ERROR) << "No kafka store files to build from";
+    return false;
+  }
+
+  std::vector<InputFile> inputFiles;
+  for (const auto& path : inputFilePaths) {
+    int64_t fileOffset;
+    if (!parseFileOffset(path, &fileOffset)) {
+      LOG(ERROR) << "Not a kafka store file: " << path;
+      return false;
+    }
+    inputFiles.push_back({path, fileOffset});
+  }
+  std::sort(inputFiles.begin(), inputFiles.end(),
+            [](const InputFile& a, const InputFile& b) { return a.fileOffset < b.fileOffset; });
+
+  boost::filesystem::create_directories(config_.outputDir);
+  spillDir_ = (boost::filesystem::path(config_.spillDir) / boost::filesystem::unique_path("sst-builder.%%%%%%%%"))
+                  .native();
+  boost::filesystem::create_directories(spillDir_);
+
+  std::vector<std::string> splitKeys = sampleSplitKeys(inputFiles);
+  int numRanges = splitKeys.size() + 1;
+  LOG(INFO) << "Building SST files from " << inputFiles.size() << " kafka store files in " << numRanges
+            << " key ranges";
+
+  std::vector<int64_t> recordCounts(inputFiles.size(), 0);
+  bool ok = runWorkers(config_.parallelism, [&](int worker) {
+    return spillInputFiles(worker, inputFiles, splitKeys, &recordCounts);
+  });
+
+  // kafka store files must be contiguous, otherwise the committed offsets would skip messages
+  for (size_t i = 1; ok && i < inputFiles.size(); i++) {
+    if (inputFiles[i - 1].fileOffset + recordCounts[i - 1] != inputFiles[i].fileOffset) {
+      LOG(ERROR) << "Kafka store file " << inputFiles[i].path << " does not follow " << inputFiles[i - 1].path;
+      ok = false;
+    }
+  }
+
+  std::vector<std::vector<std::string>> rangeSstFiles(numRanges);
+  if (ok) {
+    ok = runWorkers(config_.parallelism, [&](int worker) {
+      for (int range = worker; range < numRanges; range += config_.parallelism) {
+        if (!writeRange(range, &rangeSstFiles[range])) return false;
+      }
+      return true;
+    });
+  }
+  boost::filesystem::remove_all(spillDir_);
+  if (!ok) return false;
+
+  manifest->sstFiles.clear();
+  for (const auto& sstFiles : rangeSstFiles) {
+    manifest->sstFiles.insert(manifest->sstFiles.end(), sstFiles.begin(), sstFiles.end());
+  }
+  manifest->nextFileOffset = inputFiles.back().fileOffset + recordCounts.back();
+  manifest->nextKafkaOffset = manifest->nextFileOffset;
+  LOG(INFO) << "Built " << manifest->sstFiles.size() << " SST files up to kafka offset " << manifest->nextKafkaOffset;
+  return manifest->write(config_.outputDir);
+}
+
+std::vector<std::string> SstBuilder::sampleSplitKeys(const std::vector<InputFile>& inputFiles) {
+  std::vector<std::string> samples;
+  std::string key;
+  std::string value;
+  bool isDeletion;
+  for (const auto& inputFile : inputFiles) {
+    avro::DataFileReader<KafkaStoreMessage> reader(inputFile.path.c_str());
+    KafkaStoreMessage msg;
+    for (size_t i = 0; i < kSampleRecordsPerFile && reader.read(msg); i++) {
+      if (converter_(msg, &key, &value, &isDeletion)) samples.push_back(key);
+    }
+    reader.close();
+  }
+
+  std::sort(samples.begin(), samples.end());
+  samples.erase(std::unique(samples.begin(), samples.end()), samples.end());
+  std::vector<std::string> splitKeys;
+  for (int i = 1; i < config_.numRanges; i++) {
+    size_t index = samples.size() * i / config_.numRanges;
+    // skip duplicates when there are fewer samples than ranges
+    if (index < samples.size() && (splitKeys.empty() || splitKeys.back() < samples[index])) {
+      splitKeys.push_back(samples[index]);
+    }
+  }
+  return splitKeys;
+}
+
+bool SstBuilder::spillInputFiles(int worker, const std::vector<InputFile>& inputFiles,
+                                 const std::vector<std::string>& splitKeys, std::vector<int64_t>* recordCounts) {
+  std::vector<std::unique_ptr<std::ofstream>> spillFiles;
+  for (size_t range = 0; range <= splitKeys.size(); range++) {
+    spillFiles.emplace_back(new std::ofstream(getSpillPath(worker, range), std::ios::binary));
+    if (!*spillFiles.back()) {
+      LOG(ERROR) << "Cannot create spill file " << getSpillPath(worker, range);
+      return false;
+    }
+  }
+
+  SpillRecord record;
+  for (size_t i = worker; i < inputFiles.size(); i += config_.parallelism) {
+    avro::DataFileReader<KafkaStoreMessage> reader(inputFiles[i].path.c_str());
+    KafkaStoreMessage msg;
+    int64_t count = 0;
+    while (reader.read(msg)) {
+      record.offset = inputFiles[i].fileOffset + count++;
+      if (!converter_(msg, &record.key, &record.value, &record.isDeletion)) continue;
+      size_t range = std::upper_bound(splitKeys.begin(), splitKeys.end(), record.key) - splitKeys.begin();
+      writeSpillRecord(record, spillFiles[range].get());
+    }
+    reader.close();
+    (*recordCounts)[i] = count;
+  }
+
+  for (auto& spillFile : spillFiles) {
+    spillFile->close();
+    if (spillFile->fail()) {
+      LOG(ERROR) << "Writing spill files failed for worker " << worker;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SstBuilder::writeRange(int range, std::vector<std::string>* sstFiles) {
+  std::vector<SpillRecord> records;
+  for (int worker = 0; worker < config_.parallelism; worker++) {
+    std::ifstream in(getSpillPath(worker, range), std::ios::binary);
+    SpillRecord record;
+    while (readSpillRecord(&in, &record)) {
+      records.push_back(std::move(record));
+    }
+  }
+  std::sort(records.begin(), records.end(), [](const SpillRecord& a, const SpillRecord& b) {
+    return a.key < b.key || (a.key == b.key && a.offset < b.offset);
+  });
+
+  std::unique_ptr<rocksdb::SstFileWriter> writer;
+  int part = 0;
+  rocksdb::Status status;
+  for (size_t i = 0; i < records.size(); i++) {
+    // only the last message of each key matters
+    if (i + 1 < records.size() && records[i + 1].key == records[i].key) continue;
+    if (records[i].isDeletion) continue;
+
+    if (writer && writer->FileSize() >= config_.targetFileSizeBytes) {
+      rocksdb::ExternalSstFileInfo fileInfo;
+      status = writer->Finish(&fileInfo);
+      if (!status.ok()) break;
+      writer.reset();
+    }
+    if (!writer) {
+      std::string fileName = folly::sformat("{:06d}-{:06d}.sst", range, part++);
+      writer.reset(new rocksdb::SstFileWriter(rocksdb::EnvOptions(), options_));
+      status = writer->Open(config_.outputDir + "/" + fileName);
+      if (!status.ok()) break;
+      sstFiles->push_back(fileName);
+    }
+    status = writer->Put(records[i].key, records[i].value);
+    if (!status.ok()) break;
+  }
+  if (status.ok() && writer) {
+    rocksdb::ExternalSstFileInfo fileInfo;
+    status = writer->Finish(&fileInfo);
+  }
+
+  if (!status.ok()) {
+    LOG(ERROR) << "Writing SST files for range " << range << " failed: " << status.ToString();
+    return false;
+  }
+  LOG(INFO) << "Wrote " << sstFiles->size() << " SST files for range " << range << " from " << records.size()
+            << " messages";
+  return true;
+}
+
+std::string SstBuilder::getSpillPath(int worker, int range) const {
+  return folly::sformat("{}/{:04d}-{:06d}.spill", spillDir_, worker, range);
+}
+
+constexpr size_t SstBuilder::kSampleRecordsPerFile;
+
+}  // namespace store
+}  // namespace kafka
+}  // namespace infra
@@ -0,0 +1,86 @@
+#ifndef INFRA_KAFKA_STORE_SSTBUILDER_H_
+#define INFRA_KAFKA_STORE_SSTBUILDER_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "infra/kafka/store/IngestManifest.h"
+#include "infra/kafka/store/KafkaStoreMessageRecord.hh"
+#include "rocksdb/options.h"
+
+namespace infra {
+namespace kafka {
+namespace store {
+
+// Convert kafka-store files into sorted, non-overlapping SST files for the INGEST command. Bootstrapping a replica
+// this way avoids replaying every message through Consumer::processOne one write at a time.
+//
+// Building runs in two parallel phases. First, the input files are decoded and every message is converted into a
+// key value pair, which is spilled to a local file for its key range. Key ranges are picked from a sample of keys
+// read from the beginning of each input file. Then each range is loaded, sorted, and written to SST files of up to
+// targetFileSizeBytes. When a key appears more than once, the message with the largest offset wins.
+// Memory usage is bounded by the size of the largest range times parallelism.
+class SstBuilder {
+ public:
+  // Convert a message into a key value pair. Return false to skip the message. Set isDeletion to drop the key when
+  // no later message sets it again, e.g., for null values in compacted topics. SST files carry no deletions, so they
+  // are meant to be ingested into empty column families.
+  using Converter =
+      std::function<bool(const KafkaStoreMessage& msg, std::string* key, std::string* value, bool* isDeletion)>;
+
+  struct Config {
+    std::string outputDir;
+    // directory for intermediate files, which need about as much space as the input
+    std::string spillDir = "/tmp";
+    int parallelism = 4;
+    int numRanges = 16;
+    uint64_t targetFileSizeBytes = 256L * 1024 * 1024;
+  };
+
+  // Use the message key and value as they are, and delete keys with null values
+  static bool convertKeyValue(const KafkaStoreMessage& msg, std::string* key, std::string* value, bool* isDeletion);
+
+  // Parse the file offset from a kafka-store file name, which ends with the 20-digit file offset as returned by
+  // Consumer::getObjectName
+  static bool parseFileOffset(const std::string& path, int64_t* fileOffset);
+
+  SstBuilder(Config config, rocksdb::Options options, Converter converter)
+      : config_(std::move(config)), options_(std::move(options)), converter_(std::move(converter)) {}
+
+  // Build SST files from contiguous kafka-store files and write the manifest into the output directory
+  bool build(const std::vector<std::string>& inputFiles, IngestManifest* manifest);
+
+ private:
+  struct InputFile {
+    std::string path;
+    int64_t fileOffset;
+  };
+
+  static constexpr size_t kSampleRecordsPerFile = 1000;
+
+  // Pick numRanges - 1 split keys from samples at the beginning of every input file
+  std::vector<std::string> sampleSplitKeys(const std::vector<InputFile>& inputFiles);
+
+  // Convert the input files assigned to the given worker and spill them to one file per range. Fill the number of
+  // records of each input file assigned to the worker.
+  bool spillInputFiles(int worker, const std::vector<InputFile>& inputFiles, const std::vector<std::string>& splitKeys,
+                       std::vector<int64_t>* recordCounts);
+
+  // Sort and deduplicate the spilled records of a range and write them into SST files
+  bool writeRange(int range, std::vector<std::string>* sstFiles);
+
+  std::string getSpillPath(int worker, int range) const;
+
+  const Config config_;
+  const rocksdb::Options options_;
+  const Converter converter_;
+  std::string spillDir_;
+};
+
+}  // namespace store
+}  // namespace kafka
+}  // namespace infra
+
+#endif  // INFRA_KAFKA_STORE_SSTBUILDER_H_
@@ -0,0 +1,134 @@
+#include "infra/kafka/store/SstBuilder.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#include "avro/Compiler.hh"
+#include "avro/DataFile.hh"
+#pragma GCC diagnostic pop
+#include "boost/filesystem.hpp"
+#include "folly/Format.h"
+#include "gtest/gtest.h"
+#include "rocksdb/db.h"
+#include "rocksdb/options.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace infra {
+namespace kafka {
+namespace store {
+
+static const char kKafkaStoreMessageSchema[] = R"({
+  "type": "record",
+  "name": "KafkaStoreMessage",
+  "fields": [
+    {"name": "timestamp", "type": "long"},
+    {"name": "key", "type": ["null", "bytes"]},
+    {"name": "value", "type": ["null", "bytes"]}
+  ]
+})";
+
+class SstBuilderTest : public stesting::TestWithRocksDb {
+ protected:
+  void SetUp() override {
+    stesting::TestWithRocksDb::SetUp();
+    workDir_ = boost::filesystem::unique_path("sst_builder_test.%%%%%%%%");
+    boost::filesystem::create_directories(workDir_ / "input");
+  }
+
+  void TearDown() override {
+    boost::filesystem::remove_all(workDir_);
+    stesting::TestWithRocksDb::TearDown();
+  }
+
+  // Write a kafka store file starting at fileOffset. Empty values are written as null.
+  std::string writeKafkaStoreFile(int64_t fileOffset, const std::vector<std::pair<std::string, std::string>>& kvs) {
+    // kafka store files are named by their 20-digit file offsets
+    std::string path = (workDir_ / "input" / folly::sformat("{:020d}", fileOffset)).native();
+    avro::DataFileWriter<KafkaStoreMessage> writer(path.c_str(),
+                                                   avro::compileJsonSchemaFromString(kKafkaStoreMessageSchema));
+    for (const auto& kv : kvs) {
+      KafkaStoreMessage msg;
+      msg.key.set_bytes(std::vector<uint8_t>(kv.first.begin(), kv.first.end()));
+      if (kv.second.empty()) {
+        msg.value.set_null();
+      } else {
+        msg.value.set_bytes(std::vector<uint8_t>(kv.second.begin(), kv.second.end()));
+      }
+      writer.write(msg);
+    }
+    writer.close();
+    return path;
+  }
+
+  SstBuilder::Config getConfig() {
+    SstBuilder::Config config;
+    config.outputDir = (workDir_ / "output").native();
+    config.spillDir = workDir_.native();
+    config.parallelism = 2;
+    config.numRanges = 3;
+    return config;
+  }
+
+  boost::filesystem::path workDir_;
+};
+
+TEST(SstBuilder, ParseFileOffset) {
+  int64_t fileOffset;
+  ASSERT_TRUE(SstBuilder::parseFileOffset("/tmp/topic/000003/00000000000000012345", &fileOffset));
+  EXPECT_EQ(12345, fileOffset);
+  EXPECT_FALSE(SstBuilder::parseFileOffset("/tmp/topic/000003/12345", &fileOffset));
+  EXPECT_FALSE(SstBuilder::parseFileOffset("/tmp/topic/000003/0000000000000001234x", &fileOffset));
+}
+
+TEST_F(SstBuilderTest, BuildAndIngest) {
+  std::vector<std::string> inputFiles;
+  inputFiles.push_back(writeKafkaStoreFile(100, {{"a", "1"}, {"b", "1"}, {"c", "1"}, {"d", "1"}}));
+  // later messages overwrite or delete earlier ones
+  inputFiles.push_back(writeKafkaStoreFile(104, {{"b", "2"}, {"c", ""}, {"e", "2"}}));
+
+  SstBuilder builder(getConfig(), rocksdb::Options(), &SstBuilder::convertKeyValue);
+  IngestManifest manifest;
+  ASSERT_TRUE(builder.build(inputFiles, &manifest));
+  EXPECT_EQ(107, manifest.nextKafkaOffset);
+  EXPECT_EQ(107, manifest.nextFileOffset);
+  ASSERT_FALSE(manifest.sstFiles.empty());
+
+  IngestManifest loadedManifest;
+  ASSERT_TRUE(loadedManifest.read(getConfig().outputDir));
+  EXPECT_EQ(manifest.sstFiles, loadedManifest.sstFiles);
+  EXPECT_EQ(manifest.nextKafkaOffset, loadedManifest.nextKafkaOffset);
+
+  // files of different ranges do not overlap, so they can be ingested at once
+  std::vector<std::string> sstPaths;
+  for (const auto& sstFile : manifest.sstFiles) {
+    sstPaths.push_back(getConfig().outputDir + "/" + sstFile);
+  }
+  ASSERT_TRUE(db()->IngestExternalFile(sstPaths, rocksdb::IngestExternalFileOptions()).ok());
+
+  std::string value;
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), "a", &value).ok());
+  EXPECT_EQ("1", value);
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), "b", &value).ok());
+  EXPECT_EQ("2", value);
+  EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), "c", &value).IsNotFound());
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), "e", &value).ok());
+  EXPECT_EQ("2", value);
+  EXPECT_EQ(4, totalKeyCount(columnFamily("default")));
+}
+
+TEST_F(SstBuilderTest, RejectGaps) {
+  std::vector<std::string> inputFiles;
+  inputFiles.push_back(writeKafkaStoreFile(0, {{"a", "1"}, {"b", "1"}}));
+  inputFiles.push_back(writeKafkaStoreFile(3, {{"c", "1"}}));
+
+  SstBuilder builder(getConfig(), rocksdb::Options(), &SstBuilder::convertKeyValue);
+  IngestManifest manifest;
+  EXPECT_FALSE(builder.build(inputFiles, &manifest));
+}
+
+}  // namespace store
+}  // namespace kafka
+}  // namespace infra
@@ -0,0 +1,50 @@
+// Build SST files from kafka-store files for bootstrapping a replica with the INGEST command.
+//
+// Usage: kafka_store_sst_builder --input_dir=<downloaded kafka store files> --output_dir=<dir>
+//
+// Input files must be named by their 20-digit file offsets as in cold storage, e.g., 00000000000000012345, and be
+// contiguous. Message keys and values are used as database keys and values. Services storing messages differently
+// should link SstBuilder with their own converter instead.
+
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "infra/kafka/store/IngestManifest.h"
+#include "infra/kafka/store/SstBuilder.h"
+#include "rocksdb/options.h"
+
+DEFINE_string(input_dir, "", "Directory containing kafka store files");
+DEFINE_string(output_dir, "", "Directory for SST files and the ingest manifest");
+DEFINE_string(spill_dir, "/tmp", "Directory for intermediate files");
+DEFINE_int32(parallelism, 4, "Number of worker threads");
+DEFINE_int32(num_ranges, 16, "Number of key ranges. Memory usage is about input size / num_ranges * parallelism.");
+DEFINE_int32(target_file_size_mb, 256, "Target size of SST files");
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  CHECK(!FLAGS_input_dir.empty() && !FLAGS_output_dir.empty()) << "--input_dir and --output_dir are required";
+  std::vector<std::string> inputFiles;
+  for (const auto& entry : boost::filesystem::directory_iterator(FLAGS_input_dir)) {
+    if (boost::filesystem::is_regular_file(entry.path())) inputFiles.push_back(entry.path().native());
+  }
+
+  infra::kafka::store::SstBuilder::Config config;
+  config.outputDir = FLAGS_output_dir;
+  config.spillDir = FLAGS_spill_dir;
+  config.parallelism = FLAGS_parallelism;
+  config.numRanges = FLAGS_num_ranges;
+  config.targetFileSizeBytes = FLAGS_target_file_size_mb * 1024L * 1024L;
+  infra::kafka::store::SstBuilder builder(config, rocksdb::Options(),
+                                         &infra::kafka::store::SstBuilder::convertKeyValue);
+
+  infra::kafka::store::IngestManifest manifest;
+  CHECK(builder.build(inputFiles, &manifest)) << "Building SST files failed";
+  LOG(INFO) << "Ingest with: INGEST <column family> " << FLAGS_output_dir << " <kafka offset key>";
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include "pipeline/BackgroundJobRunner.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace pipeline {
+
+bool BackgroundJobRunner::startJob(const std::string& name, Job job, std::string* error) {
+  std::lock_guard<std::mutex> guard(threadMutex_);
+  if (running_) {
+    std::lock_guard<std::mutex> statusGuard(statusMutex_);
+    *error = "Another background job is still running: " + lastName_;
+    return false;
+  }
+  if (jobThread_) {
+    // the previous job has finished
+    jobThread_->join();
+    jobThread_.reset();
+  }
+
+  {
+    std::lock_guard<std::mutex> statusGuard(statusMutex_);
+    lastName_ = name;
+    lastStatus_ = "running";
+    lastResult_.clear();
+  }
+  running_ = true;
+  jobThread_.reset(new std::thread([this, name, job]() {
+    pthread_setname_np(pthread_self(), "background-job");
+    LOG(INFO) << "Starting background job: " << name;
+    std::string result;
+    bool ok = job(&result);
+    if (ok) {
+      LOG(INFO) << "Background job " << name << " finished";
+    } else {
+      LOG(ERROR) << "Background job " << name << " failed: " << result;
+    }
+    {
+      std::lock_guard<std::mutex> statusGuard(statusMutex_);
+      lastStatus_ = ok ? "ok" : "failed";
+      lastResult_ = std::move(result);
+    }
+    running_ = false;
+  }));
+  return true;
+}
+
+void BackgroundJobRunner::waitForJob() {
+  std::lock_guard<std::mutex> guard(threadMutex_);
+  if (jobThread_) {
+    jobThread_->join();
+    jobThread_.reset();
+  }
+}
+
+void BackgroundJobRunner::getLastJob(std::string* name, std::string* status, std::string* result) {
+  std::lock_guard<std::mutex> guard(statusMutex_);
+  *name = lastName_;
+  *status = lastStatus_;
+  *result = lastResult_;
+}
+
+void BackgroundJobRunner::appendStatsInRedisInfoFormat(std::stringstream* ss) {
+  std::string name, status, result;
+  getLastJob(&name, &status, &result);
+  (*ss) << "background_job_in_progress:" << (running_ ? 1 : 0) << std::endl;
+  (*ss) << "background_job_last_name:" << name << std::endl;
+  (*ss) << "background_job_last_status:" << status << std::endl;
+  // keep the INFO format line-based
+  std::replace(result.begin(), result.end(), '\n', ' ');
+  (*ss) << "background_job_last_result:" << result << std::endl;
+}
+
+}  // namespace pipeline
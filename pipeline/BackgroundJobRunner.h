@@ -0,0 +1,52 @@
+#ifndef PIPELINE_BACKGROUNDJOBRUNNER_H_
+#define PIPELINE_BACKGROUNDJOBRUNNER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace pipeline {
+
+// Run long administrative jobs, such as scanning a whole column family, on a background thread so that commands
+// starting them do not block IO threads. Jobs run one at a time and report their outcome in INFO.
+class BackgroundJobRunner {
+ public:
+  // A job returns true and fills the result on success, or returns false and fills the error message
+  using Job = std::function<bool(std::string* result)>;
+
+  BackgroundJobRunner() : running_(false), lastName_("none"), lastStatus_("none") {}
+
+  ~BackgroundJobRunner() {
+    waitForJob();
+  }
+
+  // Start a job in the background. Return false and fill the error message when another job is still running.
+  bool startJob(const std::string& name, Job job, std::string* error);
+
+  // Block until the running job, if any, finishes
+  void waitForJob();
+
+  bool isJobRunning() const { return running_; }
+
+  // Name, status ("running", "ok" or "failed") and result or error message of the running or the last job
+  void getLastJob(std::string* name, std::string* status, std::string* result);
+
+  void appendStatsInRedisInfoFormat(std::stringstream* ss);
+
+ private:
+  std::atomic<bool> running_;
+  std::string lastName_;
+  std::string lastStatus_;
+  std::string lastResult_;
+  std::mutex statusMutex_;
+  std::unique_ptr<std::thread> jobThread_;
+  std::mutex threadMutex_;
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_BACKGROUNDJOBRUNNER_H_
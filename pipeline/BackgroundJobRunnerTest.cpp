@@ -0,0 +1,48 @@
+#include "pipeline/BackgroundJobRunner.h"
+
+#include <future>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace pipeline {
+
+TEST(BackgroundJobRunnerTest, RunJobs) {
+  BackgroundJobRunner runner;
+  std::string name, status, result, error;
+  runner.getLastJob(&name, &status, &result);
+  EXPECT_EQ("none", status);
+
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked = unblock.get_future().share();
+  ASSERT_TRUE(runner.startJob("first", [unblocked](std::string* result) {
+    unblocked.wait();
+    *result = "done";
+    return true;
+  }, &error)) << error;
+  EXPECT_TRUE(runner.isJobRunning());
+  runner.getLastJob(&name, &status, &result);
+  EXPECT_EQ("first", name);
+  EXPECT_EQ("running", status);
+  // only one job runs at a time
+  EXPECT_FALSE(runner.startJob("second", [](std::string* result) { return true; }, &error));
+
+  unblock.set_value();
+  runner.waitForJob();
+  EXPECT_FALSE(runner.isJobRunning());
+  runner.getLastJob(&name, &status, &result);
+  EXPECT_EQ("ok", status);
+  EXPECT_EQ("done", result);
+
+  ASSERT_TRUE(runner.startJob("third", [](std::string* result) {
+    *result = "broken";
+    return false;
+  }, &error)) << error;
+  runner.waitForJob();
+  runner.getLastJob(&name, &status, &result);
+  EXPECT_EQ("third", name);
+  EXPECT_EQ("failed", status);
+  EXPECT_EQ("broken", result);
+}
+
+}  // namespace pipeline
@@ -0,0 +1,214 @@
+#include "pipeline/BackupManager.h"
+
+#include <pthread.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "folly/Format.h"
+#include "glog/logging.h"
+#include "rocksdb/env.h"
+#include "rocksdb/metadata.h"
+#include "rocksdb/utilities/checkpoint.h"
+
+namespace pipeline {
+
+BackupManager::BackupManager(rocksdb::DB* db, const Config& config)
+    : db_(db),
+      backupDir_(config.backupDir),
+      parallelism_(config.parallelism),
+      rateLimitBytesPerSec_(config.rateLimitBytesPerSec),
+      backupRunning_(false),
+      bytesCopied_(0),
+      liveBytes_(0),
+      startTimeMs_(0),
+      durationMs_(0),
+      lastBackupId_(0),
+      lastStatus_("none") {
+  CHECK(!backupDir_.empty()) << "Backup directory must be specified";
+  CHECK_GT(parallelism_, 0);
+}
+
+rocksdb::BackupableDBOptions BackupManager::getBackupableDBOptions(const std::string& backupDir,
+                                                                   uint64_t rateLimitBytesPerSec, int parallelism) {
+  rocksdb::BackupableDBOptions options(backupDir);
+  // share table files between backups so that only new files are copied
+  options.share_table_files = true;
+  options.share_files_with_checksum = true;
+  options.backup_rate_limit = rateLimitBytesPerSec;
+  options.restore_rate_limit = rateLimitBytesPerSec;
+  options.max_background_operations = parallelism;
+  return options;
+}
+
+int64_t BackupManager::nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+bool BackupManager::startBackup(bool flushBeforeBackup, std::string* error) {
+  std::lock_guard<std::mutex> guard(threadMutex_);
+  if (backupRunning_) {
+    *error = "Another backup is still running";
+    return false;
+  }
+  if (backupThread_) {
+    // the previous backup has finished
+    backupThread_->join();
+    backupThread_.reset();
+  }
+
+  backupRunning_ = true;
+  backupThread_.reset(new std::thread([this, flushBeforeBackup]() {
+    pthread_setname_np(pthread_self(), "backup");
+    runBackup(flushBeforeBackup);
+  }));
+  return true;
+}
+
+void BackupManager::waitForBackup() {
+  std::lock_guard<std::mutex> guard(threadMutex_);
+  if (backupThread_) {
+    backupThread_->join();
+    backupThread_.reset();
+  }
+}
+
+void BackupManager::runBackup(bool flushBeforeBackup) {
+  std::vector<rocksdb::LiveFileMetaData> liveFiles;
+  db_->GetLiveFilesMetaData(&liveFiles);
+  uint64_t liveBytes = 0;
+  for (const auto& liveFile : liveFiles) {
+    liveBytes += liveFile.size;
+  }
+  liveBytes_ = liveBytes;
+  bytesCopied_ = 0;
+  startTimeMs_ = nowMs();
+  {
+    std::lock_guard<std::mutex> guard(statusMutex_);
+    lastStatus_ = "running";
+  }
+
+  rocksdb::BackupableDBOptions options = getBackupableDBOptions(backupDir_, rateLimitBytesPerSec_, parallelism_);
+  rocksdb::BackupEngine* backupEngine;
+  rocksdb::Status status = rocksdb::BackupEngine::Open(rocksdb::Env::Default(), options, &backupEngine);
+  if (status.ok()) {
+    std::unique_ptr<rocksdb::BackupEngine> backupEngineGuard(backupEngine);
+    LOG(INFO) << "Starting backup to " << backupDir_ << " with " << liveBytes << " bytes of live table files";
+    // the callback is called every callback_trigger_interval_size bytes copied
+    uint64_t callbackIntervalBytes = options.callback_trigger_interval_size;
+    status = backupEngine->CreateNewBackup(db_, flushBeforeBackup,
+                                           [this, callbackIntervalBytes]() { bytesCopied_ += callbackIntervalBytes; });
+    if (status.ok()) {
+      std::vector<rocksdb::BackupInfo> backupInfos;
+      backupEngine->GetBackupInfo(&backupInfos);
+      if (!backupInfos.empty()) lastBackupId_ = backupInfos.back().backup_id;
+    }
+  }
+
+  durationMs_ = nowMs() - startTimeMs_;
+  {
+    std::lock_guard<std::mutex> guard(statusMutex_);
+    lastStatus_ = status.ok() ? "ok" : status.ToString();
+  }
+  if (status.ok()) {
+    LOG(INFO) << "Backup " << lastBackupId_ << " finished in " << durationMs_ << "ms";
+  } else {
+    LOG(ERROR) << "Backup failed: " << status.ToString();
+  }
+  backupRunning_ = false;
+}
+
+bool BackupManager::createCheckpoint(const std::string& checkpointDir, std::string* error) {
+  rocksdb::Checkpoint* checkpoint;
+  rocksdb::Status status = rocksdb::Checkpoint::Create(db_, &checkpoint);
+  if (status.ok()) {
+    std::unique_ptr<rocksdb::Checkpoint> checkpointGuard(checkpoint);
+    status = checkpoint->CreateCheckpoint(checkpointDir);
+  }
+  if (!status.ok()) {
+    *error = folly::sformat("Creating checkpoint failed: {}", status.ToString());
+    return false;
+  }
+  LOG(INFO) << "Created checkpoint in " << checkpointDir;
+  return true;
+}
+
+bool BackupManager::getBackupInfo(std::vector<rocksdb::BackupInfo>* backupInfos, std::string* error) {
+  // a read-only engine is safe to use while a backup is running
+  rocksdb::BackupEngineReadOnly* backupEngine;
+  rocksdb::Status status = rocksdb::BackupEngineReadOnly::Open(
+      rocksdb::Env::Default(), getBackupableDBOptions(backupDir_, rateLimitBytesPerSec_, parallelism_), &backupEngine);
+  if (!status.ok()) {
+    *error = folly::sformat("Opening backup engine failed: {}", status.ToString());
+    return false;
+  }
+  std::unique_ptr<rocksdb::BackupEngineReadOnly> backupEngineGuard(backupEngine);
+  backupEngine->GetBackupInfo(backupInfos);
+  return true;
+}
+
+bool BackupManager::purgeOldBackups(uint32_t numBackupsToKeep, std::string* error) {
+  // hold the thread lock so that no backup can start while purging
+  std::lock_guard<std::mutex> guard(threadMutex_);
+  if (backupRunning_) {
+    *error = "Cannot purge backups while a backup is running";
+    return false;
+  }
+
+  rocksdb::BackupEngine* backupEngine;
+  rocksdb::Status status = rocksdb::BackupEngine::Open(
+      rocksdb::Env::Default(), getBackupableDBOptions(backupDir_, rateLimitBytesPerSec_, parallelism_), &backupEngine);
+  if (status.ok()) {
+    std::unique_ptr<rocksdb::BackupEngine> backupEngineGuard(backupEngine);
+    status = backupEngine->PurgeOldBackups(numBackupsToKeep);
+  }
+  if (!status.ok()) {
+    *error = folly::sformat("Purging backups failed: {}", status.ToString());
+    return false;
+  }
+  return true;
+}
+
+void BackupManager::appendStatsInRedisInfoFormat(std::stringstream* ss) {
+  bool running = backupRunning_;
+  (*ss) << "backup_dir:" << backupDir_ << std::endl;
+  (*ss) << "backup_in_progress:" << (running ? 1 : 0) << std::endl;
+  (*ss) << "backup_rate_limit_bytes_per_sec:" << rateLimitBytesPerSec_ << std::endl;
+  (*ss) << "backup_last_id:" << lastBackupId_ << std::endl;
+  {
+    std::lock_guard<std::mutex> guard(statusMutex_);
+    (*ss) << "backup_last_status:" << lastStatus_ << std::endl;
+  }
+  // only new table files are copied by incremental backups, so the live size is an upper bound
+  (*ss) << "backup_live_bytes:" << liveBytes_ << std::endl;
+  (*ss) << "backup_copied_bytes:" << bytesCopied_ << std::endl;
+  (*ss) << "backup_duration_ms:" << (running ? nowMs() - startTimeMs_ : durationMs_.load()) << std::endl;
+}
+
+bool BackupManager::restore(const Config& config, const std::string& dbPath, uint32_t backupId, std::string* error,
+                            const std::string& walDir) {
+  rocksdb::BackupEngineReadOnly* backupEngine;
+  rocksdb::Status status = rocksdb::BackupEngineReadOnly::Open(
+      rocksdb::Env::Default(),
+      getBackupableDBOptions(config.backupDir, config.rateLimitBytesPerSec, config.parallelism), &backupEngine);
+  if (status.ok()) {
+    std::unique_ptr<rocksdb::BackupEngineReadOnly> backupEngineGuard(backupEngine);
+    LOG(INFO) << "Restoring " << (backupId == 0 ? "latest backup" : folly::sformat("backup {}", backupId)) << " from "
+              << config.backupDir << " into " << dbPath;
+    if (backupId == 0) {
+      status = backupEngine->RestoreDBFromLatestBackup(dbPath, walDir.empty() ? dbPath : walDir);
+    } else {
+      status = backupEngine->RestoreDBFromBackup(backupId, dbPath, walDir.empty() ? dbPath : walDir);
+    }
+  }
+  if (!status.ok()) {
+    *error = folly::sformat("Restoring backup failed: {}", status.ToString());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace pipeline
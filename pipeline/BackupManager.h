@@ -0,0 +1,100 @@
+#ifndef PIPELINE_BACKUPMANAGER_H_
+#define PIPELINE_BACKUPMANAGER_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rocksdb/db.h"
+#include "rocksdb/utilities/backupable_db.h"
+
+namespace pipeline {
+
+// Native database backups, which replace copying the files returned by FREEZE with an external script.
+//
+// Backups are taken with rocksdb::BackupEngine into a local or mounted directory. Table files are shared between
+// backups, so each backup after the first one only copies the files created since the previous backup. Copying runs
+// in the background and is throttled by a rate limiter so that it does not compete with foreground reads.
+// Checkpoints are hard-linked snapshots of the live files, which are nearly free when created on the same
+// filesystem as the database.
+class BackupManager {
+ public:
+  struct Config {
+    std::string backupDir;
+    // Maximum bytes per second to copy when backing up or restoring, 0 means no limit
+    uint64_t rateLimitBytesPerSec;
+    // Number of files copied in parallel
+    int parallelism;
+
+    Config(std::string _backupDir, uint64_t _rateLimitBytesPerSec, int _parallelism)
+        : backupDir(std::move(_backupDir)), rateLimitBytesPerSec(_rateLimitBytesPerSec), parallelism(_parallelism) {}
+  };
+
+  BackupManager(rocksdb::DB* db, const Config& config);
+
+  ~BackupManager() {
+    waitForBackup();
+  }
+
+  // Start an incremental backup in the background. Return false and fill the error message when another backup is
+  // still running.
+  bool startBackup(bool flushBeforeBackup, std::string* error);
+
+  // Block until the running backup, if any, finishes
+  void waitForBackup();
+
+  bool isBackupRunning() const { return backupRunning_; }
+
+  // Create a hard-linked checkpoint of the database in a directory that must not exist yet
+  bool createCheckpoint(const std::string& checkpointDir, std::string* error);
+
+  bool getBackupInfo(std::vector<rocksdb::BackupInfo>* backupInfos, std::string* error);
+
+  // Delete all but the latest numBackupsToKeep backups. It is rejected while a backup is running.
+  bool purgeOldBackups(uint32_t numBackupsToKeep, std::string* error);
+
+  // The rate limit applies to backups started after the change
+  uint64_t rateLimitBytesPerSec() const { return rateLimitBytesPerSec_; }
+  void setRateLimitBytesPerSec(uint64_t rateLimitBytesPerSec) { rateLimitBytesPerSec_ = rateLimitBytesPerSec; }
+
+  void appendStatsInRedisInfoFormat(std::stringstream* ss);
+
+  // Restore a backup into dbPath, which must not be opened. backupId 0 restores the latest backup. The WAL files go
+  // to walDir when the database keeps them in a separate directory.
+  static bool restore(const Config& config, const std::string& dbPath, uint32_t backupId, std::string* error,
+                      const std::string& walDir = "");
+
+ private:
+  static rocksdb::BackupableDBOptions getBackupableDBOptions(const std::string& backupDir,
+                                                             uint64_t rateLimitBytesPerSec, int parallelism);
+
+  static int64_t nowMs();
+
+  void runBackup(bool flushBeforeBackup);
+
+  rocksdb::DB* db_;
+  const std::string backupDir_;
+  const int parallelism_;
+  std::atomic<uint64_t> rateLimitBytesPerSec_;
+
+  // progress of the running or the last backup
+  std::atomic<bool> backupRunning_;
+  std::atomic<uint64_t> bytesCopied_;
+  std::atomic<uint64_t> liveBytes_;
+  std::atomic<int64_t> startTimeMs_;
+  std::atomic<int64_t> durationMs_;
+  std::atomic<uint32_t> lastBackupId_;
+  std::string lastStatus_;
+  std::mutex statusMutex_;
+  std::unique_ptr<std::thread> backupThread_;
+  std::mutex threadMutex_;
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_BACKUPMANAGER_H_
@@ -0,0 +1,114 @@
+#include "pipeline/BackupManager.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+#include "rocksdb/db.h"
+#include "rocksdb/options.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+class BackupManagerTest : public stesting::TestWithRocksDb {
+ protected:
+  void SetUp() override {
+    stesting::TestWithRocksDb::SetUp();
+    backupDir_ = boost::filesystem::unique_path("rocksdb_backup_test.%%%%%%%%");
+    backupManager_ = std::make_shared<BackupManager>(db(), BackupManager::Config(backupDir_.native(), 0, 2));
+  }
+
+  void TearDown() override {
+    backupManager_.reset();
+    boost::filesystem::remove_all(backupDir_);
+    stesting::TestWithRocksDb::TearDown();
+  }
+
+  void backup() {
+    std::string error;
+    ASSERT_TRUE(backupManager_->startBackup(true, &error)) << error;
+    backupManager_->waitForBackup();
+    EXPECT_FALSE(backupManager_->isBackupRunning());
+  }
+
+  // Open a restored or checkpointed database read-only and read a key from the default column family
+  static rocksdb::Status readFromCopy(const std::string& path, const std::string& key, std::string* value) {
+    std::vector<std::string> columnFamilyNames;
+    rocksdb::Status status = rocksdb::DB::ListColumnFamilies(rocksdb::DBOptions(), path, &columnFamilyNames);
+    if (!status.ok()) return status;
+    std::vector<rocksdb::ColumnFamilyDescriptor> columnFamilyDescriptors;
+    for (const auto& name : columnFamilyNames) {
+      columnFamilyDescriptors.emplace_back(name, rocksdb::ColumnFamilyOptions());
+    }
+    std::vector<rocksdb::ColumnFamilyHandle*> columnFamilyHandles;
+    rocksdb::DB* db;
+    status = rocksdb::DB::OpenForReadOnly(rocksdb::DBOptions(), path, columnFamilyDescriptors, &columnFamilyHandles,
+                                          &db);
+    if (!status.ok()) return status;
+    status = db->Get(rocksdb::ReadOptions(), key, value);
+    for (auto columnFamilyHandle : columnFamilyHandles) {
+      db->DestroyColumnFamilyHandle(columnFamilyHandle);
+    }
+    delete db;
+    return status;
+  }
+
+  boost::filesystem::path backupDir_;
+  std::shared_ptr<BackupManager> backupManager_;
+};
+
+TEST_F(BackupManagerTest, IncrementalBackupAndRestore) {
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), "key1", "value1").ok());
+  backup();
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), "key2", "value2").ok());
+  backup();
+
+  std::string error;
+  std::vector<rocksdb::BackupInfo> backupInfos;
+  ASSERT_TRUE(backupManager_->getBackupInfo(&backupInfos, &error)) << error;
+  ASSERT_EQ(2, backupInfos.size());
+
+  std::stringstream ss;
+  backupManager_->appendStatsInRedisInfoFormat(&ss);
+  EXPECT_NE(std::string::npos, ss.str().find("backup_last_status:ok"));
+  EXPECT_NE(std::string::npos, ss.str().find("backup_in_progress:0"));
+
+  // restore the first backup, which must not contain the second key
+  auto restorePath = boost::filesystem::unique_path("rocksdb_restore_test.%%%%%%%%");
+  BackupManager::Config config(backupDir_.native(), 0, 2);
+  ASSERT_TRUE(BackupManager::restore(config, restorePath.native(), backupInfos.front().backup_id, &error)) << error;
+  std::string value;
+  ASSERT_TRUE(readFromCopy(restorePath.native(), "key1", &value).ok());
+  EXPECT_EQ("value1", value);
+  EXPECT_TRUE(readFromCopy(restorePath.native(), "key2", &value).IsNotFound());
+  boost::filesystem::remove_all(restorePath);
+
+  // the latest backup is restored by default
+  ASSERT_TRUE(BackupManager::restore(config, restorePath.native(), 0, &error)) << error;
+  ASSERT_TRUE(readFromCopy(restorePath.native(), "key2", &value).ok());
+  EXPECT_EQ("value2", value);
+  boost::filesystem::remove_all(restorePath);
+
+  ASSERT_TRUE(backupManager_->purgeOldBackups(1, &error)) << error;
+  ASSERT_TRUE(backupManager_->getBackupInfo(&backupInfos, &error)) << error;
+  ASSERT_EQ(1, backupInfos.size());
+}
+
+TEST_F(BackupManagerTest, Checkpoint) {
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), "key", "value").ok());
+
+  auto checkpointPath = boost::filesystem::unique_path("rocksdb_checkpoint_test.%%%%%%%%");
+  std::string error;
+  ASSERT_TRUE(backupManager_->createCheckpoint(checkpointPath.native(), &error)) << error;
+  std::string value;
+  ASSERT_TRUE(readFromCopy(checkpointPath.native(), "key", &value).ok());
+  EXPECT_EQ("value", value);
+
+  // the checkpoint directory must not exist
+  EXPECT_FALSE(backupManager_->createCheckpoint(checkpointPath.native(), &error));
+  boost::filesystem::remove_all(checkpointPath);
+}
+
+}  // namespace pipeline
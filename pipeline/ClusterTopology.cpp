@@ -0,0 +1,119 @@
+#include "pipeline/ClusterTopology.h"
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "folly/Conv.h"
+#include "folly/Format.h"
+#include "folly/dynamic.h"
+#include "folly/json.h"
+#include "glog/logging.h"
+
+namespace pipeline {
+
+bool ClusterTopology::parseNodes(const std::string& json, std::vector<Node>* nodes, std::string* error) {
+  try {
+    folly::dynamic nodesJson = folly::parseJson(json);
+    for (const auto& entry : nodesJson.items()) {
+      Node node;
+      node.address = entry.first.getString();
+      int64_t start = entry.second["start_shard_index"].getInt();
+      int64_t count = entry.second["local_virtual_shard_count"].getInt();
+      int64_t increment = entry.second["shard_index_increment"].getInt();
+      for (int64_t i = 0; i < count; i++) {
+        int64_t shard = start + i * increment;
+        if (shard < 0 || shard >= infra::SmyteId::kVirtualShardCount) {
+          *error = folly::sformat("Virtual shard {} of node {} is out of range", shard, node.address);
+          return false;
+        }
+        node.shards.push_back(shard);
+      }
+      std::sort(node.shards.begin(), node.shards.end());
+      nodes->push_back(std::move(node));
+    }
+  } catch (const std::exception& e) {
+    *error = folly::sformat("Invalid cluster nodes: {}", e.what());
+    return false;
+  }
+  return true;
+}
+
+ClusterTopology::ClusterTopology(std::string selfAddress, std::shared_ptr<DatabaseManager> databaseManager,
+                                 std::string groupName, const std::vector<Node>& peers, ShardFunction shardFunction)
+    : selfAddress_(std::move(selfAddress)),
+      databaseManager_(databaseManager),
+      groupName_(std::move(groupName)),
+      shardFunction_(std::move(shardFunction)),
+      peerOwners_(infra::SmyteId::kVirtualShardCount) {
+  CHECK_GT(databaseManager_->columnFamilyGroupMap()->count(groupName_), 0)
+      << "Column family group not found: " << groupName_;
+  for (const auto& peer : peers) {
+    if (peer.address == selfAddress_) continue;
+    for (int shard : peer.shards) {
+      CHECK(peerOwners_[shard].empty()) << "Virtual shard " << shard << " is owned by both " << peerOwners_[shard]
+                                        << " and " << peer.address;
+      peerOwners_[shard] = peer.address;
+    }
+    peers_.push_back(peer);
+  }
+}
+
+std::shared_ptr<const ClusterTopology::Ownership> ClusterTopology::getOwnership() {
+  auto columnFamilyGroupMap = databaseManager_->columnFamilyGroupMap();
+  auto ownership = std::atomic_load(&ownership_);
+  if (ownership && ownership->columnFamilyGroupMap == columnFamilyGroupMap) return ownership;
+
+  // the group changed, rebuild from the shard numbers at the end of member names
+  auto newOwnership = std::make_shared<Ownership>();
+  newOwnership->columnFamilyGroupMap = columnFamilyGroupMap;
+  newOwnership->owned.resize(infra::SmyteId::kVirtualShardCount, false);
+  auto it = columnFamilyGroupMap->find(groupName_);
+  if (it != columnFamilyGroupMap->end()) {
+    for (auto columnFamily : it->second) {
+      const std::string& name = columnFamily->GetName();
+      std::string shardStr = name.substr(name.rfind('-') + 1);
+      if (shardStr.empty() || shardStr.size() > 9 || !std::all_of(shardStr.begin(), shardStr.end(), ::isdigit)) {
+        continue;
+      }
+      int shard = folly::to<int>(shardStr);
+      if (shard < infra::SmyteId::kVirtualShardCount) newOwnership->owned[shard] = true;
+    }
+  }
+  // concurrent rebuilds produce the same result, so the last one wins
+  std::atomic_store(&ownership_, std::shared_ptr<const Ownership>(newOwnership));
+  return newOwnership;
+}
+
+bool ClusterTopology::ownsShard(int shard, std::string* ownerAddress) {
+  CHECK(shard >= 0 && shard < infra::SmyteId::kVirtualShardCount);
+  if (getOwnership()->owned[shard]) return true;
+  *ownerAddress = peerOwners_[shard];
+  return false;
+}
+
+std::vector<ClusterTopology::Node> ClusterTopology::getNodes() {
+  Node self;
+  self.address = selfAddress_;
+  auto ownership = getOwnership();
+  for (int shard = 0; shard < infra::SmyteId::kVirtualShardCount; shard++) {
+    if (ownership->owned[shard]) self.shards.push_back(shard);
+  }
+  std::vector<Node> nodes = {self};
+  for (const auto& peer : peers_) {
+    // shards imported by this node are no longer served by the peers configured at startup
+    Node node;
+    node.address = peer.address;
+    for (int shard : peer.shards) {
+      if (!ownership->owned[shard]) node.shards.push_back(shard);
+    }
+    nodes.push_back(std::move(node));
+  }
+  return nodes;
+}
+
+}  // namespace pipeline
@@ -0,0 +1,74 @@
+#ifndef PIPELINE_CLUSTERTOPOLOGY_H_
+#define PIPELINE_CLUSTERTOPOLOGY_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "infra/SmyteId.h"
+#include "pipeline/DatabaseManager.h"
+
+namespace pipeline {
+
+// Ownership of virtual shards among the nodes of a cluster, which lets smart clients route requests directly instead
+// of going through a proxy.
+//
+// This node owns the virtual shards of the members of a column family group named `<group>-<shard>`, so ownership
+// follows members created or dropped at runtime, e.g., by IMPORTSHARD. The other nodes are configured statically.
+class ClusterTopology {
+ public:
+  using ShardFunction = std::function<int(const std::string& key)>;
+
+  struct Node {
+    // host:port announced to clients
+    std::string address;
+    // virtual shards in ascending order
+    std::vector<int> shards;
+  };
+
+  // Map a key to one of SmyteId::kVirtualShardCount virtual shards with murmurhash32
+  static int defaultShardFunction(const std::string& key) {
+    return DatabaseManager::getShardNum(key, infra::SmyteId::kVirtualShardCount);
+  }
+
+  // Parse nodes given in JSON with the same format as column family group configs, e.g.,
+  // {"10.0.0.2:9049": {"start_shard_index": 512, "local_virtual_shard_count": 512, "shard_index_increment": 1}}
+  static bool parseNodes(const std::string& json, std::vector<Node>* nodes, std::string* error);
+
+  ClusterTopology(std::string selfAddress, std::shared_ptr<DatabaseManager> databaseManager, std::string groupName,
+                  const std::vector<Node>& peers, ShardFunction shardFunction = &defaultShardFunction);
+
+  const std::string& selfAddress() const { return selfAddress_; }
+
+  int getShard(const std::string& key) const { return shardFunction_(key); }
+
+  // Return true if this node owns the virtual shard. Otherwise, fill the address of the owner or leave it empty when
+  // no node owns the shard.
+  bool ownsShard(int shard, std::string* ownerAddress);
+
+  // Return all the nodes including this one, this node first
+  std::vector<Node> getNodes();
+
+ private:
+  // Virtual shards owned by this node as of a snapshot of the column family groups
+  struct Ownership {
+    std::shared_ptr<const DatabaseManager::ColumnFamilyGroupMap> columnFamilyGroupMap;
+    std::vector<bool> owned;
+  };
+
+  std::shared_ptr<const Ownership> getOwnership();
+
+  const std::string selfAddress_;
+  std::shared_ptr<DatabaseManager> databaseManager_;
+  const std::string groupName_;
+  const ShardFunction shardFunction_;
+  std::vector<Node> peers_;
+  // owner address of every virtual shard among peers, empty when not owned by any peer
+  std::vector<std::string> peerOwners_;
+  std::shared_ptr<const Ownership> ownership_;
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_CLUSTERTOPOLOGY_H_
@@ -0,0 +1,70 @@
+#include "pipeline/ClusterTopology.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "rocksdb/db.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+class ClusterTopologyTest : public stesting::TestWithRocksDb {
+ protected:
+  ClusterTopologyTest() : stesting::TestWithRocksDb({"group"}, {}, {{"group", 2}}) {}
+};
+
+TEST_F(ClusterTopologyTest, ParseNodes) {
+  std::vector<ClusterTopology::Node> nodes;
+  std::string error;
+  ASSERT_TRUE(ClusterTopology::parseNodes(
+      R"({"peer:9049": {"start_shard_index": 2, "local_virtual_shard_count": 3, "shard_index_increment": 2}})",
+      &nodes, &error))
+      << error;
+  ASSERT_EQ(1, nodes.size());
+  EXPECT_EQ("peer:9049", nodes[0].address);
+  EXPECT_EQ(std::vector<int>({2, 4, 6}), nodes[0].shards);
+
+  nodes.clear();
+  EXPECT_FALSE(ClusterTopology::parseNodes(
+      R"({"peer:9049": {"start_shard_index": 2, "local_virtual_shard_count": 3, "shard_index_increment": 10000}})",
+      &nodes, &error));
+  EXPECT_FALSE(ClusterTopology::parseNodes("not json", &nodes, &error));
+}
+
+TEST_F(ClusterTopologyTest, Ownership) {
+  ClusterTopology topology("self:9049", databaseManager(), "group", {{"peer:9049", {2, 3}}},
+                           [](const std::string& key) { return std::stoi(key); });
+  EXPECT_EQ(5, topology.getShard("5"));
+
+  std::string ownerAddress;
+  EXPECT_TRUE(topology.ownsShard(0, &ownerAddress));
+  EXPECT_TRUE(topology.ownsShard(1, &ownerAddress));
+  EXPECT_FALSE(topology.ownsShard(2, &ownerAddress));
+  EXPECT_EQ("peer:9049", ownerAddress);
+  EXPECT_FALSE(topology.ownsShard(5, &ownerAddress));
+  EXPECT_EQ("", ownerAddress);
+
+  auto nodes = topology.getNodes();
+  ASSERT_EQ(2, nodes.size());
+  EXPECT_EQ("self:9049", nodes[0].address);
+  EXPECT_EQ(std::vector<int>({0, 1}), nodes[0].shards);
+  EXPECT_EQ("peer:9049", nodes[1].address);
+  EXPECT_EQ(std::vector<int>({2, 3}), nodes[1].shards);
+
+  // ownership follows the members of the group created at runtime
+  std::string error;
+  ASSERT_TRUE(databaseManager()->createColumnFamilyGroupMember("group", "group-2", &error)) << error;
+  rocksdb::ColumnFamilyHandle* created = databaseManager()->getColumnFamily("group-2");
+  EXPECT_TRUE(topology.ownsShard(2, &ownerAddress));
+  nodes = topology.getNodes();
+  EXPECT_EQ(std::vector<int>({0, 1, 2}), nodes[0].shards);
+  EXPECT_EQ(std::vector<int>({3}), nodes[1].shards);
+
+  ASSERT_TRUE(databaseManager()->dropColumnFamilyGroupMember("group", "group-2", &error)) << error;
+  EXPECT_FALSE(topology.ownsShard(2, &ownerAddress));
+  EXPECT_EQ("peer:9049", ownerAddress);
+  db()->DestroyColumnFamilyHandle(created);
+}
+
+}  // namespace pipeline
@@ -0,0 +1,47 @@
+#include "pipeline/CompressionProfile.h"
+
+#include <string>
+#include <vector>
+
+namespace pipeline {
+
+constexpr int CompressionProfile::kUncompressedLevels;
+constexpr uint32_t CompressionProfile::kMaxDictBytes;
+constexpr int CompressionProfile::kZstdLevel;
+
+const std::vector<std::string>& CompressionProfile::names() {
+  static const std::vector<std::string> profileNames = {"none", "snappy", "zstd", "zstd-dict"};
+  return profileNames;
+}
+
+bool CompressionProfile::apply(const std::string& name, rocksdb::ColumnFamilyOptions* options) {
+  if (name == "none") {
+    options->compression = rocksdb::kNoCompression;
+    options->compression_per_level.assign(options->num_levels, rocksdb::kNoCompression);
+  } else if (name == "snappy") {
+    setTieredCompression(rocksdb::kSnappyCompression, options);
+    options->compression_opts.max_dict_bytes = 0;
+  } else if (name == "zstd") {
+    setTieredCompression(rocksdb::kZSTD, options);
+    options->compression_opts.level = kZstdLevel;
+    options->compression_opts.max_dict_bytes = 0;
+  } else if (name == "zstd-dict") {
+    setTieredCompression(rocksdb::kZSTD, options);
+    options->compression_opts.level = kZstdLevel;
+    options->compression_opts.max_dict_bytes = kMaxDictBytes;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void CompressionProfile::setTieredCompression(rocksdb::CompressionType compression,
+                                              rocksdb::ColumnFamilyOptions* options) {
+  options->compression = compression;
+  options->compression_per_level.resize(options->num_levels);
+  for (int level = 0; level < options->num_levels; level++) {
+    options->compression_per_level[level] = level < kUncompressedLevels ? rocksdb::kNoCompression : compression;
+  }
+}
+
+}  // namespace pipeline
@@ -0,0 +1,39 @@
+#ifndef PIPELINE_COMPRESSIONPROFILE_H_
+#define PIPELINE_COMPRESSIONPROFILE_H_
+
+#include <string>
+#include <vector>
+
+#include "rocksdb/options.h"
+
+namespace pipeline {
+
+// Named compression settings that can be selected per column family or column family group, overriding the
+// compression set by RocksDbCfConfigurators and OptimizeLevelStyleCompaction.
+//
+// * none: no compression on any level
+// * snappy: no compression on L0 and L1, snappy below
+// * zstd: no compression on L0 and L1, zstd below
+// * zstd-dict: same as zstd, plus a shared compression dictionary of up to kMaxDictBytes. Small values such as avro
+//   or JSON blobs compress poorly block by block but well with a dictionary. RocksDB samples the dictionary from the
+//   data of each bottommost-level compaction.
+//
+// L0 and L1 are left uncompressed because their files are rewritten soon, so compressing them only costs CPU.
+class CompressionProfile {
+ public:
+  static constexpr int kUncompressedLevels = 2;
+  static constexpr uint32_t kMaxDictBytes = 16 * 1024;
+  static constexpr int kZstdLevel = 3;
+
+  static const std::vector<std::string>& names();
+
+  // Apply the named profile. Return false without changing options if the profile does not exist.
+  static bool apply(const std::string& name, rocksdb::ColumnFamilyOptions* options);
+
+ private:
+  static void setTieredCompression(rocksdb::CompressionType compression, rocksdb::ColumnFamilyOptions* options);
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_COMPRESSIONPROFILE_H_
@@ -0,0 +1,156 @@
+// Compare compression profiles on a sample of production values.
+//
+// The sample file contains one value per line, e.g., avro or JSON blobs dumped from a column family. Values are
+// written repeatedly with sequential keys until --min_data_mb is reached, then fully compacted so that every profile
+// is measured on bottommost-level files. For each profile it reports the total SST size, CPU time spent in the full
+// compaction, and the latency of random point lookups through a small block cache.
+//
+// Usage: compression_profile_benchmark --sample_file=values.txt [--profiles=none,zstd,zstd-dict]
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "folly/Format.h"
+#include "folly/String.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "pipeline/CompressionProfile.h"
+#include "rocksdb/cache.h"
+#include "rocksdb/db.h"
+#include "rocksdb/options.h"
+#include "rocksdb/table.h"
+#include "rocksdb/write_batch.h"
+
+DEFINE_string(sample_file, "", "File with one sample value per line");
+DEFINE_string(profiles, "none,snappy,zstd,zstd-dict", "Comma separated compression profiles to compare");
+DEFINE_int32(min_data_mb, 256, "Minimum amount of raw data to write for each profile");
+DEFINE_int32(reads, 100000, "Number of random point lookups for each profile");
+DEFINE_int32(block_cache_mb, 8, "Block cache size, kept small so that most reads decompress a block");
+DEFINE_string(db_dir, "/tmp", "Directory for temporary databases");
+
+namespace {
+
+struct Result {
+  std::string profile;
+  uint64_t rawBytes;
+  uint64_t sstBytes;
+  double compactionCpuSeconds;
+  double readMicrosP50;
+  double readMicrosP99;
+};
+
+double cpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+std::string makeKey(uint64_t index) {
+  return folly::sformat("key{:012d}", index);
+}
+
+Result runProfile(const std::string& profile, const std::vector<std::string>& samples) {
+  boost::filesystem::path dbPath =
+      boost::filesystem::path(FLAGS_db_dir) / boost::filesystem::unique_path("compression_benchmark.%%%%%%%%");
+
+  rocksdb::Options options;
+  options.create_if_missing = true;
+  options.OptimizeLevelStyleCompaction();
+  // measure compaction explicitly after loading
+  options.disable_auto_compactions = true;
+  rocksdb::BlockBasedTableOptions tableOptions;
+  tableOptions.block_size = 32 * 1024;
+  tableOptions.block_cache = rocksdb::NewLRUCache(FLAGS_block_cache_mb * 1024L * 1024L);
+  options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(tableOptions));
+  CHECK(pipeline::CompressionProfile::apply(profile, &options)) << "Unknown compression profile: " << profile;
+
+  rocksdb::DB* db;
+  rocksdb::Status status = rocksdb::DB::Open(options, dbPath.native(), &db);
+  CHECK(status.ok()) << "Opening database failed: " << status.ToString();
+  std::unique_ptr<rocksdb::DB> dbGuard(db);
+
+  Result result{profile, 0, 0, 0, 0, 0};
+  uint64_t keyCount = 0;
+  while (result.rawBytes < FLAGS_min_data_mb * 1024UL * 1024UL) {
+    rocksdb::WriteBatch writeBatch;
+    for (const auto& sample : samples) {
+      writeBatch.Put(makeKey(keyCount++), sample);
+      result.rawBytes += sample.size();
+    }
+    status = db->Write(rocksdb::WriteOptions(), &writeBatch);
+    CHECK(status.ok()) << "Write failed: " << status.ToString();
+  }
+  CHECK(db->Flush(rocksdb::FlushOptions()).ok());
+
+  double cpuStart = cpuSeconds();
+  rocksdb::CompactRangeOptions compactRangeOptions;
+  compactRangeOptions.bottommost_level_compaction = rocksdb::BottommostLevelCompaction::kForce;
+  status = db->CompactRange(compactRangeOptions, nullptr, nullptr);
+  CHECK(status.ok()) << "Compaction failed: " << status.ToString();
+  result.compactionCpuSeconds = cpuSeconds() - cpuStart;
+  CHECK(db->GetIntProperty("rocksdb.total-sst-files-size", &result.sstBytes));
+
+  std::mt19937_64 random(42);
+  std::uniform_int_distribution<uint64_t> keyDistribution(0, keyCount - 1);
+  std::vector<double> latencies;
+  latencies.reserve(FLAGS_reads);
+  std::string value;
+  for (int i = 0; i < FLAGS_reads; i++) {
+    std::string key = makeKey(keyDistribution(random));
+    auto start = std::chrono::steady_clock::now();
+    status = db->Get(rocksdb::ReadOptions(), key, &value);
+    auto end = std::chrono::steady_clock::now();
+    CHECK(status.ok()) << "Read failed: " << status.ToString();
+    latencies.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+  }
+  std::sort(latencies.begin(), latencies.end());
+  result.readMicrosP50 = latencies[latencies.size() / 2];
+  result.readMicrosP99 = latencies[latencies.size() * 99 / 100];
+
+  dbGuard.reset();
+  boost::filesystem::remove_all(dbPath);
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  CHECK(!FLAGS_sample_file.empty()) << "--sample_file is required";
+  std::ifstream sampleFile(FLAGS_sample_file);
+  CHECK(sampleFile) << "Cannot open sample file: " << FLAGS_sample_file;
+  std::vector<std::string> samples;
+  for (std::string line; std::getline(sampleFile, line);) {
+    if (!line.empty()) samples.push_back(std::move(line));
+  }
+  CHECK(!samples.empty()) << "No samples found in " << FLAGS_sample_file;
+  CHECK_GT(FLAGS_reads, 0);
+
+  std::vector<std::string> profiles;
+  folly::split(',', FLAGS_profiles, profiles, true);
+
+  std::cout << folly::sformat("{:<12}{:>14}{:>14}{:>8}{:>16}{:>12}{:>12}", "profile", "raw_mb", "sst_mb", "ratio",
+                              "compaction_cpu_s", "read_p50_us", "read_p99_us")
+            << std::endl;
+  for (const auto& profile : profiles) {
+    Result result = runProfile(profile, samples);
+    std::cout << folly::sformat("{:<12}{:>14.1f}{:>14.1f}{:>8.2f}{:>16.2f}{:>12.1f}{:>12.1f}", result.profile,
+                                result.rawBytes / 1048576.0, result.sstBytes / 1048576.0,
+                                static_cast<double>(result.rawBytes) / result.sstBytes, result.compactionCpuSeconds,
+                                result.readMicrosP50, result.readMicrosP99)
+              << std::endl;
+  }
+  return 0;
+}
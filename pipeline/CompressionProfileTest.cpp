@@ -0,0 +1,63 @@
+#include "pipeline/CompressionProfile.h"
+
+#include <string>
+
+#include "folly/Conv.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "rocksdb/options.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+static void configureZstdDict(int blockCacheSizeMb, rocksdb::ColumnFamilyOptions* options) {
+  CHECK(CompressionProfile::apply("zstd-dict", options));
+}
+
+class CompressionProfileTest : public stesting::TestWithRocksDb {
+ protected:
+  CompressionProfileTest() : stesting::TestWithRocksDb({"compressed"}, {{"compressed", &configureZstdDict}}) {}
+};
+
+TEST(CompressionProfile, Apply) {
+  rocksdb::ColumnFamilyOptions options;
+  options.num_levels = 5;
+
+  ASSERT_TRUE(CompressionProfile::apply("none", &options));
+  ASSERT_EQ(5, options.compression_per_level.size());
+  for (auto compression : options.compression_per_level) {
+    EXPECT_EQ(rocksdb::kNoCompression, compression);
+  }
+
+  ASSERT_TRUE(CompressionProfile::apply("zstd-dict", &options));
+  ASSERT_EQ(5, options.compression_per_level.size());
+  EXPECT_EQ(rocksdb::kNoCompression, options.compression_per_level[0]);
+  EXPECT_EQ(rocksdb::kNoCompression, options.compression_per_level[1]);
+  EXPECT_EQ(rocksdb::kZSTD, options.compression_per_level[2]);
+  EXPECT_EQ(rocksdb::kZSTD, options.compression_per_level[4]);
+  EXPECT_EQ(CompressionProfile::kMaxDictBytes, options.compression_opts.max_dict_bytes);
+
+  ASSERT_TRUE(CompressionProfile::apply("snappy", &options));
+  EXPECT_EQ(rocksdb::kSnappyCompression, options.compression_per_level[4]);
+  EXPECT_EQ(0, options.compression_opts.max_dict_bytes);
+
+  // unknown profiles leave options untouched
+  EXPECT_FALSE(CompressionProfile::apply("lz4", &options));
+  EXPECT_EQ(rocksdb::kSnappyCompression, options.compression_per_level[4]);
+}
+
+TEST_F(CompressionProfileTest, ReadAfterCompaction) {
+  auto compressed = columnFamily("compressed");
+  for (int i = 0; i < 1000; i++) {
+    std::string value = folly::to<std::string>("{\"id\":", i, ",\"type\":\"entity\",\"labels\":[\"a\",\"b\"]}");
+    ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), compressed, folly::to<std::string>("key", i), value).ok());
+  }
+  ASSERT_TRUE(databaseManager()->forceCompaction(compressed, nullptr, nullptr));
+
+  std::string value;
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), compressed, "key42", &value).ok());
+  EXPECT_EQ("{\"id\":42,\"type\":\"entity\",\"labels\":[\"a\",\"b\"]}", value);
+  EXPECT_EQ(1000, totalKeyCount(compressed));
+}
+
+}  // namespace pipeline
@@ -0,0 +1,52 @@
+#ifndef PIPELINE_COUNTERMERGEOPERATOR_H_
+#define PIPELINE_COUNTERMERGEOPERATOR_H_
+
+#include <memory>
+#include <string>
+
+#include "folly/Conv.h"
+#include "rocksdb/merge_operator.h"
+#include "rocksdb/slice.h"
+
+namespace pipeline {
+
+// Add signed 64-bit integers stored as decimal strings. Counters are updated with merges in the same write batch as
+// the data they count, without reading them first, while plain Get and Put still read and set them. The metadata
+// column family uses it, so every value merged into it must be a counter.
+class CounterMergeOperator : public rocksdb::AssociativeMergeOperator {
+ public:
+  static std::shared_ptr<rocksdb::MergeOperator> getInstance() {
+    static std::shared_ptr<rocksdb::MergeOperator> instance = std::make_shared<CounterMergeOperator>();
+    return instance;
+  }
+
+  // The operand adding the given delta to a counter
+  static std::string encodeDelta(int64_t delta) {
+    return folly::to<std::string>(delta);
+  }
+
+  static bool parseCounter(const rocksdb::Slice& value, int64_t* counter) {
+    try {
+      *counter = folly::to<int64_t>(folly::StringPiece(value.data(), value.size()));
+      return true;
+    } catch (folly::ConversionError&) {
+      return false;
+    }
+  }
+
+  bool Merge(const rocksdb::Slice& key, const rocksdb::Slice* existingValue, const rocksdb::Slice& value,
+             std::string* newValue, rocksdb::Logger* logger) const override {
+    int64_t counter = 0;
+    int64_t delta;
+    // failing the merge surfaces as a corruption on reads and compactions instead of a silently reset counter
+    if ((existingValue && !parseCounter(*existingValue, &counter)) || !parseCounter(value, &delta)) return false;
+    *newValue = encodeDelta(counter + delta);
+    return true;
+  }
+
+  const char* Name() const override { return "smyte.CounterMergeOperator"; }
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_COUNTERMERGEOPERATOR_H_
@@ -0,0 +1,65 @@
+#include "pipeline/CounterMergeOperator.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/status.h"
+#include "rocksdb/write_batch.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+class CounterMergeOperatorTest : public stesting::TestWithRocksDb {
+ protected:
+  std::string get(const std::string& key) {
+    std::string value;
+    rocksdb::Status status = db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), key, &value);
+    EXPECT_TRUE(status.ok()) << status.ToString();
+    return value;
+  }
+
+  void merge(const std::string& key, int64_t delta) {
+    rocksdb::WriteBatch writeBatch;
+    writeBatch.Merge(metadataColumnFamily(), key, CounterMergeOperator::encodeDelta(delta));
+    commitWriteBatch(&writeBatch);
+  }
+};
+
+TEST(CounterMergeOperator, Merge) {
+  CounterMergeOperator mergeOperator;
+  std::string value;
+  EXPECT_TRUE(mergeOperator.Merge("key", nullptr, "3", &value, nullptr));
+  EXPECT_EQ("3", value);
+  rocksdb::Slice existingValue("3");
+  EXPECT_TRUE(mergeOperator.Merge("key", &existingValue, "-5", &value, nullptr));
+  EXPECT_EQ("-2", value);
+
+  EXPECT_FALSE(mergeOperator.Merge("key", nullptr, "x", &value, nullptr));
+  rocksdb::Slice invalidValue("1x");
+  EXPECT_FALSE(mergeOperator.Merge("key", &invalidValue, "1", &value, nullptr));
+}
+
+TEST_F(CounterMergeOperatorTest, MetadataColumnFamily) {
+  merge("counter", 2);
+  merge("counter", 3);
+  EXPECT_EQ("5", get("counter"));
+  merge("counter", -4);
+  EXPECT_EQ("1", get("counter"));
+  ASSERT_TRUE(db()->Flush(rocksdb::FlushOptions(), metadataColumnFamily()).ok());
+  merge("counter", 1);
+  EXPECT_EQ("2", get("counter"));
+
+  // a counter set with put keeps counting
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), metadataColumnFamily(), "counter", "10").ok());
+  merge("counter", 1);
+  EXPECT_EQ("11", get("counter"));
+
+  // merging into a value that is not a counter fails
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), metadataColumnFamily(), "other", "value").ok());
+  merge("other", 1);
+  std::string value;
+  EXPECT_FALSE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), "other", &value).ok());
+}
+
+}  // namespace pipeline
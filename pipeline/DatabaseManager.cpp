@@ -1,19 +1,37 @@
 #include "pipeline/DatabaseManager.h"
 
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "folly/Format.h"
 #include "glog/logging.h"
+#include "rocksdb/convenience.h"
 #include "rocksdb/transaction_log.h"
 
 namespace pipeline {
 
 bool DatabaseManager::freeze(std::vector<std::string>* fileList) {
+  for (auto db : dbs()) {
+    if (!freezeInstance(db, db == db_ ? "" : db->GetName(), fileList)) return false;
+  }
+  return true;
+}
+
+bool DatabaseManager::freezeInstance(rocksdb::DB* db, const std::string& pathPrefix,
+                                     std::vector<std::string>* fileList) {
   rocksdb::Status status;
 
-  status = db_->DisableFileDeletions();
+  status = db->DisableFileDeletions();
   if (!status.ok()) {
     LOG(ERROR) << "RocksDB DisableFileDeletions Error: " << status.ToString();
     return false;
@@ -22,7 +40,7 @@ bool DatabaseManager::freeze(std::vector<std::string>* fileList) {
   // Fetch the live files without flushing the memtable
   std::vector<std::string> liveFiles;
   uint64_t manifestFileSize;
-  status = db_->GetLiveFiles(liveFiles, &manifestFileSize, false);
+  status = db->GetLiveFiles(liveFiles, &manifestFileSize, false);
   if (!status.ok()) {
     LOG(ERROR) << "RocksDB GetLiveFiles Error: " << status.ToString();
     return false;
@@ -30,56 +48,525 @@ bool DatabaseManager::freeze(std::vector<std::string>* fileList) {
 
   // Fetch all of the write-ahead log files
   std::vector<std::unique_ptr<rocksdb::LogFile>> walLogs;
-  status = db_->GetSortedWalFiles(walLogs);
+  status = db->GetSortedWalFiles(walLogs);
   if (!status.ok()) {
     LOG(ERROR) << "RocksDB GetSortedWalFiles Error: " << status.ToString();
     return false;
   }
 
-  fileList->reserve(fileList->size() + walLogs.size());
+  fileList->reserve(fileList->size() + liveFiles.size() + walLogs.size());
 
   std::string manifestPrefix = "/MANIFEST-";
   for (std::string liveFile : liveFiles) {
     if (std::equal(manifestPrefix.begin(), manifestPrefix.end(), liveFile.begin())) {
-      fileList->emplace_back(folly::sformat("{}:{}", liveFile, manifestFileSize));
+      fileList->emplace_back(folly::sformat("{}{}:{}", pathPrefix, liveFile, manifestFileSize));
     } else {
-      fileList->emplace_back(liveFile);
+      fileList->emplace_back(pathPrefix + liveFile);
     }
   }
   for (auto& log : walLogs) {
-    fileList->emplace_back(folly::sformat("{}:{}", log->PathName(), log->SizeFileBytes()));
+    fileList->emplace_back(folly::sformat("{}{}:{}", pathPrefix, log->PathName(), log->SizeFileBytes()));
   }
 
   return true;
 }
 
-// This implementation is a modified version of folly::uriEscape. The main difference is that it also escapes `~`.
-void DatabaseManager::escapeKeyStr(const std::string& str, std::string* out) {
-  static const char hexValues[] = "0123456789ABCDEF";
+void DatabaseManager::addRocksDbInstance(RocksDbInstance instance) {
+  std::lock_guard<std::mutex> guard(columnFamilyMutex_);
+  auto columnFamilyGroupMap = this->columnFamilyGroupMap();
+  auto newColumnFamilyDbMap = std::make_shared<ColumnFamilyDbMap>(*columnFamilyDbMap_);
+  for (const auto& groupName : instance.columnFamilyGroups) {
+    auto it = columnFamilyGroupMap->find(groupName);
+    CHECK(it != columnFamilyGroupMap->end()) << "Column family group not found: " << groupName;
+    for (auto columnFamily : it->second) {
+      (*newColumnFamilyDbMap)[columnFamily] = instance.db;
+    }
+  }
+  std::atomic_store(&columnFamilyDbMap_, std::shared_ptr<const ColumnFamilyDbMap>(newColumnFamilyDbMap));
+  LOG(INFO) << "Added RocksDB instance " << instance.name << " at " << instance.db->GetName();
+  rocksDbInstances_.push_back(std::move(instance));
+}
+
+rocksdb::Status DatabaseManager::getWithTtl(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key,
+                                            std::string* value, int64_t* expireAtMs) {
+  recordRead(columnFamily, key);
+  return readWithTtl(columnFamily, key, value, expireAtMs);
+}
+
+rocksdb::Status DatabaseManager::readWithTtl(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key,
+                                             std::string* value, int64_t* expireAtMs) {
+  std::string envelope;
+  rocksdb::Status status = db(columnFamily)->Get(rocksdb::ReadOptions(), columnFamily, key, &envelope);
+  if (!status.ok()) return status;
+
+  int64_t expireAt;
+  rocksdb::Slice rawValue;
+  if (!TtlEnvelope::decode(envelope, &expireAt, &rawValue)) {
+    // written before TTL was enabled for the column family
+    expireAt = TtlEnvelope::kNoExpiration;
+    rawValue = envelope;
+  }
+  if (TtlEnvelope::isExpired(expireAt, TtlEnvelope::nowMs())) {
+    return rocksdb::Status::NotFound("Value expired");
+  }
+
+  value->assign(rawValue.data(), rawValue.size());
+  if (expireAtMs) *expireAtMs = expireAt;
+  return status;
+}
+
+rocksdb::Status DatabaseManager::expireWithTtl(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key,
+                                               int64_t expireAtMs) {
+  std::string value;
+  rocksdb::Status status = readWithTtl(columnFamily, key, &value, nullptr);
+  if (!status.ok()) return status;
+
+  // the merge applies to whatever value is current when it is written, and leaves it alone if it expired meanwhile
+  return db(columnFamily)->Merge(rocksdb::WriteOptions(), columnFamily, key,
+                                 TtlEnvelope::encodeExpiration(TtlEnvelope::nowMs(), expireAtMs));
+}
+
+namespace {
+
+const char kHexValues[] = "0123456789ABCDEF";
+
+// Look up an option in RocksDB options serialized by GetStringFromDBOptions or GetStringFromColumnFamilyOptions
+rocksdb::Status findOption(const std::string& optionsStr, const std::string& name, std::string* value) {
+  std::unordered_map<std::string, std::string> optionsMap;
+  rocksdb::Status status = rocksdb::StringToMap(optionsStr, &optionsMap);
+  if (!status.ok()) return status;
+  auto it = optionsMap.find(name);
+  if (it == optionsMap.end()) return rocksdb::Status::NotFound(name);
+  *value = it->second;
+  return status;
+}
+
+// Set an option on count targets in order. getOption reads the current value of the target at the given index and
+// setOption changes it. SetOptions and SetDBOptions validate a value before applying it, so when a target fails only
+// the targets before it changed, and they are rolled back to their previous values.
+rocksdb::Status setOptionOnAll(
+    size_t count, const std::string& value,
+    const std::function<rocksdb::Status(size_t index, std::string* value)>& getOption,
+    const std::function<rocksdb::Status(size_t index, const std::string& value)>& setOption) {
+  std::vector<std::string> previousValues;
+  for (size_t i = 0; i < count; i++) {
+    std::string previousValue;
+    rocksdb::Status status = getOption(i, &previousValue);
+    if (status.ok()) status = setOption(i, value);
+    if (!status.ok()) {
+      for (size_t j = 0; j < previousValues.size(); j++) {
+        rocksdb::Status rollbackStatus = setOption(j, previousValues[j]);
+        if (!rollbackStatus.ok()) LOG(ERROR) << "Rolling back an option change failed: " << rollbackStatus.ToString();
+      }
+      return status;
+    }
+    previousValues.push_back(std::move(previousValue));
+  }
+  return rocksdb::Status::OK();
+}
+
+inline bool needsEscape(unsigned char v) {
+  return v < 33 || v > 125 || v == '%';
+}
+
+// Return the first character in [p, end) that needs escaping, or end. Key strings are mostly printable, so classify
+// 32 or 16 characters at a time. Compared as signed bytes, characters >= 128 are negative and fail the lower bound.
+const char* findEscapeChar(const char* p, const char* end) {
+#if defined(__AVX2__)
+  const __m256i lowerBound32 = _mm256_set1_epi8(32);
+  const __m256i upperBound32 = _mm256_set1_epi8(126);
+  const __m256i percent32 = _mm256_set1_epi8('%');
+  while (end - p >= 32) {
+    __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i printable =
+        _mm256_and_si256(_mm256_cmpgt_epi8(chars, lowerBound32), _mm256_cmpgt_epi8(upperBound32, chars));
+    __m256i clean = _mm256_andnot_si256(_mm256_cmpeq_epi8(chars, percent32), printable);
+    uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(clean));
+    if (mask != 0) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i lowerBound16 = _mm_set1_epi8(32);
+  const __m128i upperBound16 = _mm_set1_epi8(126);
+  const __m128i percent16 = _mm_set1_epi8('%');
+  while (end - p >= 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(chars, lowerBound16), _mm_cmplt_epi8(chars, upperBound16));
+    __m128i clean = _mm_andnot_si128(_mm_cmpeq_epi8(chars, percent16), printable);
+    uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_epi8(clean)) & 0xffff;
+    if (mask != 0) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (p != end && !needsEscape(static_cast<unsigned char>(*p))) {
+    ++p;
+  }
+  return p;
+}
+
+// Copy runs of normal characters at once and escape the characters in between
+void appendEscapedKeyStr(const std::string& str, std::string* out) {
   char esc[3];
   esc[0] = '%';
+  const char* p = str.data();
+  const char* end = p + str.size();
+  while (true) {
+    const char* next = findEscapeChar(p, end);
+    out->append(p, next - p);
+    if (next == end) break;
+    unsigned char v = static_cast<unsigned char>(*next);
+    esc[1] = kHexValues[v >> 4];
+    esc[2] = kHexValues[v & 0x0f];
+    out->append(esc, 3);
+    p = next + 1;
+  }
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+}  // namespace
+
+// This implementation is a modified version of folly::uriEscape. The main difference is that it also escapes `~`.
+void DatabaseManager::escapeKeyStr(const std::string& str, std::string* out) {
   // May need to escape 10% of the input string
   out->reserve(str.size() + out->size() + str.size() / 10);
-  auto p = str.begin();
-  auto last = p;
-  while (p != str.end()) {
-    char c = *p;
-    unsigned char v = static_cast<unsigned char>(c);
-    if (v < 33 || v > 125 || v == 37) {
-      out->append(&*last, p - last);
-      esc[1] = hexValues[v >> 4];
-      esc[2] = hexValues[v & 0x0f];
-      out->append(esc, 3);
-      ++p;
-      last = p;
+  appendEscapedKeyStr(str, out);
+}
+
+void DatabaseManager::escapeKeyStrs(const std::vector<std::string>& strs, std::string* out,
+                                    std::vector<size_t>* offsets) {
+  size_t totalSize = 0;
+  for (const auto& str : strs) {
+    totalSize += str.size();
+  }
+  out->reserve(out->size() + totalSize + totalSize / 10);
+  offsets->reserve(offsets->size() + strs.size());
+  for (const auto& str : strs) {
+    appendEscapedKeyStr(str, out);
+    offsets->push_back(out->size());
+  }
+}
+
+bool DatabaseManager::unescapeKeyStr(const std::string& str, std::string* out) {
+  out->reserve(out->size() + str.size());
+  const char* p = str.data();
+  const char* end = p + str.size();
+  while (true) {
+    // memchr is vectorized by libc, and escaped characters are rare
+    const char* next = static_cast<const char*>(memchr(p, '%', end - p));
+    if (next == nullptr) {
+      out->append(p, end - p);
+      return true;
+    }
+    out->append(p, next - p);
+    if (end - next < 3) return false;
+    int high = hexValue(next[1]);
+    int low = hexValue(next[2]);
+    if (high < 0 || low < 0) return false;
+    out->push_back(static_cast<char>((high << 4) | low));
+    p = next + 3;
+  }
+}
+
+bool DatabaseManager::initializeShardMappings(const std::unordered_map<std::string, ShardMapper::Mapping>& mappings,
+                                              const ShardKeyFunctionMap& shardKeyFunctions, std::string* error) {
+  auto columnFamilyGroupMap = this->columnFamilyGroupMap();
+  for (const auto& entry : mappings) {
+    if (columnFamilyGroupMap->count(entry.first) == 0) {
+      *error = folly::sformat("Column family group not found: {}", entry.first);
+      return false;
+    }
+  }
+  for (const auto& entry : shardKeyFunctions) {
+    if (columnFamilyGroupMap->count(entry.first) == 0) {
+      *error = folly::sformat("Column family group not found: {}", entry.first);
+      return false;
+    }
+  }
+
+  for (const auto& groupEntry : *columnFamilyGroupMap) {
+    const std::string& groupName = groupEntry.first;
+    std::string metadataKey = getShardMappingMetadataKey(groupName);
+    std::string recordedName;
+    ShardMapper::Mapping recorded = ShardMapper::Mapping::kModulo;
+    rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), metadataColumnFamily_, metadataKey, &recordedName);
+    if (status.ok()) {
+      if (!ShardMapper::parseMapping(recordedName, &recorded)) {
+        *error = folly::sformat("Unknown shard mapping recorded for {}: {}", groupName, recordedName);
+        return false;
+      }
+    } else if (!status.IsNotFound()) {
+      *error = folly::sformat("Reading the shard mapping of {} failed: {}", groupName, status.ToString());
+      return false;
+    }
+
+    auto it = mappings.find(groupName);
+    ShardMapper::Mapping mapping = it == mappings.end() ? recorded : it->second;
+    if (mapping != recorded) {
+      for (auto columnFamily : groupEntry.second) {
+        std::unique_ptr<rocksdb::Iterator> iter(db(columnFamily)->NewIterator(rocksdb::ReadOptions(), columnFamily));
+        iter->SeekToFirst();
+        if (iter->Valid()) {
+          *error = folly::sformat("Cannot change the shard mapping of {} from {} to {} because {} is not empty",
+                                  groupName, ShardMapper::getMappingName(recorded),
+                                  ShardMapper::getMappingName(mapping), columnFamily->GetName());
+          return false;
+        }
+      }
+    }
+    if (mapping != recorded || status.IsNotFound()) {
+      status = db_->Put(rocksdb::WriteOptions(), metadataColumnFamily_, metadataKey,
+                        ShardMapper::getMappingName(mapping));
+      if (!status.ok()) {
+        *error = folly::sformat("Recording the shard mapping of {} failed: {}", groupName, status.ToString());
+        return false;
+      }
+    }
+    shardMappings_[groupName] = mapping;
+    auto shardKeyFunctionIt = shardKeyFunctions.find(groupName);
+    if (shardKeyFunctionIt != shardKeyFunctions.end() && shardKeyFunctionIt->second) {
+      shardKeyFunctions_[groupName] = shardKeyFunctionIt->second;
+    }
+    LOG(INFO) << "Column family group " << groupName << " uses " << ShardMapper::getMappingName(mapping)
+              << " shard mapping";
+  }
+  return true;
+}
+
+std::vector<rocksdb::Status> DatabaseManager::multiGetFromGroup(const std::string& groupName,
+                                                                const rocksdb::ReadOptions& readOptions,
+                                                                const std::vector<rocksdb::Slice>& keys,
+                                                                std::vector<std::string>* values) {
+  auto columnFamilyGroup = getColumnFamilyGroup(groupName);
+  CHECK(!columnFamilyGroup->empty()) << "Column family group " << groupName << " has no members";
+  int shardCount = static_cast<int>(columnFamilyGroup->size());
+  return shardedExecutor_->multiGet(db(columnFamilyGroup->front()), readOptions, *columnFamilyGroup, keys, values,
+                                    [this, &groupName, &columnFamilyGroup, shardCount](const rocksdb::Slice& key) {
+                                      int shardNum = getGroupShardNum(groupName, key, shardCount);
+                                      recordRead((*columnFamilyGroup)[shardNum], key);
+                                      return static_cast<size_t>(shardNum);
+                                    });
+}
+
+bool DatabaseManager::resolveConfigTarget(const std::string& target,
+                                          std::vector<rocksdb::ColumnFamilyHandle*>* columnFamilies) {
+  rocksdb::ColumnFamilyHandle* columnFamily = getColumnFamily(target);
+  if (columnFamily) {
+    columnFamilies->push_back(columnFamily);
+    return true;
+  }
+  auto columnFamilyGroupMap = this->columnFamilyGroupMap();
+  auto it = columnFamilyGroupMap->find(target);
+  if (it != columnFamilyGroupMap->end() && !it->second.empty()) {
+    columnFamilies->insert(columnFamilies->end(), it->second.begin(), it->second.end());
+    return true;
+  }
+  return false;
+}
+
+bool DatabaseManager::getConfig(const std::string& name, const std::string& target, std::string* value,
+                                std::string* error) {
+  rocksdb::Status status;
+  if (target.empty()) {
+    auto it = serverOptionMap_.find(name);
+    if (it != serverOptionMap_.end()) {
+      *value = it->second.getter();
+      return true;
+    }
+    status = getDbOption(db_, name, value);
+  } else {
+    std::vector<rocksdb::ColumnFamilyHandle*> columnFamilies;
+    if (!resolveConfigTarget(target, &columnFamilies)) {
+      *error = folly::sformat("Column family or group not found: {}", target);
+      return false;
+    }
+    // members of a group share the same options unless changed individually, so report the first one
+    status = getColumnFamilyOption(columnFamilies.front(), name, value);
+  }
+  if (status.IsNotFound()) {
+    *error = folly::sformat("Unknown option: {}", name);
+    return false;
+  }
+  if (!status.ok()) {
+    *error = folly::sformat("RocksDB error: {}", status.ToString());
+    return false;
+  }
+  return true;
+}
+
+bool DatabaseManager::setConfig(const std::string& name, const std::string& value, const std::string& target,
+                                std::string* error) {
+  rocksdb::Status status;
+  if (target.empty()) {
+    auto it = serverOptionMap_.find(name);
+    if (it != serverOptionMap_.end()) {
+      if (!it->second.setter(value)) {
+        *error = folly::sformat("Invalid value for {}: {}", name, value);
+        return false;
+      }
     } else {
-      // advance first and copy an entire block of normal characters at once
-      ++p;
+      // keep the instances consistent, they are all opened with the same options
+      std::vector<rocksdb::DB*> dbs = this->dbs();
+      status = setOptionOnAll(
+          dbs.size(), value,
+          [&dbs, &name](size_t index, std::string* current) { return getDbOption(dbs[index], name, current); },
+          [&dbs, &name](size_t index, const std::string& newValue) {
+            return dbs[index]->SetDBOptions({{name, newValue}});
+          });
+    }
+  } else {
+    std::vector<rocksdb::ColumnFamilyHandle*> columnFamilies;
+    if (!resolveConfigTarget(target, &columnFamilies)) {
+      *error = folly::sformat("Column family or group not found: {}", target);
+      return false;
     }
+    // keep the members of a group consistent
+    status = setOptionOnAll(
+        columnFamilies.size(), value,
+        [this, &columnFamilies, &name](size_t index, std::string* current) {
+          return getColumnFamilyOption(columnFamilies[index], name, current);
+        },
+        [this, &columnFamilies, &name](size_t index, const std::string& newValue) {
+          return db(columnFamilies[index])->SetOptions(columnFamilies[index], {{name, newValue}});
+        });
   }
-  out->append(&*last, p - last);
+  if (status.IsNotFound()) {
+    *error = folly::sformat("Unknown option: {}", name);
+    return false;
+  }
+  if (!status.ok()) {
+    *error = folly::sformat("RocksDB error: {}", status.ToString());
+    return false;
+  }
+
+  LOG(INFO) << "Config " << name << " set to " << value << (target.empty() ? "" : " for ") << target;
+  status = db_->Put(rocksdb::WriteOptions(), metadataColumnFamily_, getConfigMetadataKey(target, name), value);
+  if (!status.ok()) {
+    // the change is in effect already, so only report the failure to record it
+    LOG(ERROR) << "Recording config change failed: " << status.ToString();
+  }
+  return true;
+}
+
+rocksdb::Status DatabaseManager::getDbOption(rocksdb::DB* db, const std::string& name, std::string* value) {
+  std::string optionsStr;
+  rocksdb::Status status = rocksdb::GetStringFromDBOptions(&optionsStr, db->GetDBOptions(), ";");
+  if (!status.ok()) return status;
+  return findOption(optionsStr, name, value);
 }
 
-const DatabaseManager::ColumnFamilyGroupMap DatabaseManager::kEmptyColumnFamilyGroupMap = {};
+rocksdb::Status DatabaseManager::getColumnFamilyOption(rocksdb::ColumnFamilyHandle* columnFamily,
+                                                       const std::string& name, std::string* value) {
+  std::string optionsStr;
+  rocksdb::Status status =
+      rocksdb::GetStringFromColumnFamilyOptions(&optionsStr, db(columnFamily)->GetOptions(columnFamily), ";");
+  if (!status.ok()) return status;
+  return findOption(optionsStr, name, value);
+}
+
+bool DatabaseManager::createColumnFamilyGroupMember(const std::string& groupName,
+                                                    const std::string& columnFamilyName, std::string* error) {
+  std::lock_guard<std::mutex> guard(columnFamilyMutex_);
+  auto columnFamilyGroupMap = this->columnFamilyGroupMap();
+  auto it = columnFamilyGroupMap->find(groupName);
+  if (it == columnFamilyGroupMap->end()) {
+    *error = folly::sformat("Column family group not found: {}", groupName);
+    return false;
+  }
+  if (it->second.empty()) {
+    *error = folly::sformat("Column family group has no member to copy options from: {}", groupName);
+    return false;
+  }
+  if (getColumnFamily(columnFamilyName)) {
+    *error = folly::sformat("Column family already exists: {}", columnFamilyName);
+    return false;
+  }
+  std::string expectedName = folly::sformat("{}-{}", groupName, it->second.size());
+  if (columnFamilyName != expectedName) {
+    *error = folly::sformat("The next member of group {} must be named {}", groupName, expectedName);
+    return false;
+  }
+
+  // options changed with CONFIG SET are carried over as well, and the member joins the instance of the group
+  rocksdb::DB* groupDb = db(it->second.front());
+  rocksdb::ColumnFamilyOptions options(groupDb->GetOptions(it->second.front()));
+  rocksdb::ColumnFamilyHandle* columnFamily;
+  rocksdb::Status status = groupDb->CreateColumnFamily(options, columnFamilyName, &columnFamily);
+  if (!status.ok()) {
+    *error = folly::sformat("Creating column family {} failed: {}", columnFamilyName, status.ToString());
+    return false;
+  }
+
+  auto newColumnFamilyMap = std::make_shared<ColumnFamilyMap>(*columnFamilyMap());
+  (*newColumnFamilyMap)[columnFamilyName] = columnFamily;
+  auto newColumnFamilyGroupMap = std::make_shared<ColumnFamilyGroupMap>(*columnFamilyGroupMap);
+  (*newColumnFamilyGroupMap)[groupName].push_back(columnFamily);
+  if (groupDb != db_) {
+    auto newColumnFamilyDbMap = std::make_shared<ColumnFamilyDbMap>(*columnFamilyDbMap_);
+    (*newColumnFamilyDbMap)[columnFamily] = groupDb;
+    std::atomic_store(&columnFamilyDbMap_, std::shared_ptr<const ColumnFamilyDbMap>(newColumnFamilyDbMap));
+  }
+  // publish the column family before the group so that group members can always be found by name
+  std::atomic_store(&columnFamilyMap_, std::shared_ptr<const ColumnFamilyMap>(newColumnFamilyMap));
+  std::atomic_store(&columnFamilyGroupMap_, std::shared_ptr<const ColumnFamilyGroupMap>(newColumnFamilyGroupMap));
+  LOG(INFO) << "Created column family " << columnFamilyName << " in group " << groupName;
+  return true;
+}
+
+bool DatabaseManager::dropColumnFamilyGroupMember(const std::string& groupName, const std::string& columnFamilyName,
+                                                  std::string* error) {
+  std::lock_guard<std::mutex> guard(columnFamilyMutex_);
+  auto columnFamilyGroupMap = this->columnFamilyGroupMap();
+  auto it = columnFamilyGroupMap->find(groupName);
+  if (it == columnFamilyGroupMap->end()) {
+    *error = folly::sformat("Column family group not found: {}", groupName);
+    return false;
+  }
+  if (it->second.empty() || it->second.back()->GetName() != columnFamilyName) {
+    *error = folly::sformat("Column family {} is not the last member of group {}", columnFamilyName, groupName);
+    return false;
+  }
+
+  rocksdb::ColumnFamilyHandle* columnFamily = it->second.back();
+  rocksdb::DB* groupDb = db(columnFamily);
+  rocksdb::Status status = groupDb->DropColumnFamily(columnFamily);
+  if (!status.ok()) {
+    *error = folly::sformat("Dropping column family {} failed: {}", columnFamilyName, status.ToString());
+    return false;
+  }
+
+  auto newColumnFamilyGroupMap = std::make_shared<ColumnFamilyGroupMap>(*columnFamilyGroupMap);
+  (*newColumnFamilyGroupMap)[groupName].pop_back();
+  auto newColumnFamilyMap = std::make_shared<ColumnFamilyMap>(*columnFamilyMap());
+  newColumnFamilyMap->erase(columnFamilyName);
+  // unpublish in the reverse order of creation
+  std::atomic_store(&columnFamilyGroupMap_, std::shared_ptr<const ColumnFamilyGroupMap>(newColumnFamilyGroupMap));
+  std::atomic_store(&columnFamilyMap_, std::shared_ptr<const ColumnFamilyMap>(newColumnFamilyMap));
+  // readers may still hold the handle from an older snapshot, so only destroy it at shutdown
+  droppedColumnFamilies_.emplace_back(groupDb, columnFamily);
+  LOG(INFO) << "Dropped column family " << columnFamilyName << " from group " << groupName;
+  return true;
+}
+
+void DatabaseManager::destroyColumnFamilyHandles() {
+  std::lock_guard<std::mutex> guard(columnFamilyMutex_);
+  auto columnFamilyMap = this->columnFamilyMap();
+  for (const auto& entry : *columnFamilyMap) {
+    db(entry.second)->DestroyColumnFamilyHandle(entry.second);
+  }
+  for (const auto& entry : droppedColumnFamilies_) {
+    entry.first->DestroyColumnFamilyHandle(entry.second);
+  }
+  droppedColumnFamilies_.clear();
+  std::atomic_store(&columnFamilyMap_, std::make_shared<const ColumnFamilyMap>());
+  std::atomic_store(&columnFamilyGroupMap_, std::make_shared<const ColumnFamilyGroupMap>());
+  std::atomic_store(&columnFamilyDbMap_, std::make_shared<const ColumnFamilyDbMap>());
+}
 
 }  // namespace pipeline
@@ -2,17 +2,31 @@
 #define PIPELINE_DATABASEMANAGER_H_
 
 #include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "folly/Conv.h"
+#include "folly/Format.h"
 #include "glog/logging.h"
+#include "infra/WriteStallController.h"
 #include "murmurhash3/MurmurHash3.h"
+#include "pipeline/BackgroundJobRunner.h"
+#include "pipeline/BackupManager.h"
+#include "pipeline/HotKeySampler.h"
+#include "pipeline/ShardMapper.h"
+#include "pipeline/ShardedExecutor.h"
+#include "pipeline/TtlCompactionFilter.h"
 #include "rocksdb/db.h"
 #include "rocksdb/options.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/status.h"
+#include "rocksdb/write_batch.h"
 
 namespace pipeline {
 
@@ -20,6 +34,112 @@ class DatabaseManager {
  public:
   using ColumnFamilyMap = std::unordered_map<std::string, rocksdb::ColumnFamilyHandle*>;
   using ColumnFamilyGroupMap = std::unordered_map<std::string, std::vector<rocksdb::ColumnFamilyHandle*>>;
+  // Map column family group names to the functions extracting the shard keys of their stored keys
+  using ShardKeyFunctionMap = std::unordered_map<std::string, ShardMapper::ShardKeyFunction>;
+  // Column families of secondary RocksDB instances and the instance each belongs to
+  using ColumnFamilyDbMap = std::unordered_map<rocksdb::ColumnFamilyHandle*, rocksdb::DB*>;
+
+  // A secondary RocksDB instance holding whole column family groups, with its own WAL, write queue and manifest. The
+  // primary instance returned by db() holds everything else, including the metadata column family.
+  struct RocksDbInstance {
+    std::string name;
+    rocksdb::DB* db;
+    std::vector<std::string> columnFamilyGroups;
+    // optional, set when backups are enabled
+    std::shared_ptr<BackupManager> backupManager;
+  };
+
+  // A WriteBatch bound to the RocksDB instance of the column families written to it. Writing column families of two
+  // instances into the same batch CHECK-fails, because a batch is only atomic within a single instance. Commit it
+  // with db(), which is the primary instance until a column family is written.
+  class InstanceWriteBatch : public rocksdb::WriteBatch {
+   public:
+    explicit InstanceWriteBatch(const DatabaseManager* databaseManager)
+        : databaseManager_(databaseManager), db_(nullptr) {}
+
+    rocksdb::DB* db() const { return db_ ? db_ : databaseManager_->db(); }
+
+    using rocksdb::WriteBatch::Put;
+    using rocksdb::WriteBatch::Delete;
+    using rocksdb::WriteBatch::SingleDelete;
+    using rocksdb::WriteBatch::DeleteRange;
+    using rocksdb::WriteBatch::Merge;
+
+    rocksdb::Status Put(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key,
+                        const rocksdb::Slice& value) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::Put(columnFamily, key, value);
+    }
+
+    rocksdb::Status Put(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::SliceParts& key,
+                        const rocksdb::SliceParts& value) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::Put(columnFamily, key, value);
+    }
+
+    rocksdb::Status Delete(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::Delete(columnFamily, key);
+    }
+
+    rocksdb::Status Delete(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::SliceParts& key) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::Delete(columnFamily, key);
+    }
+
+    rocksdb::Status SingleDelete(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::SingleDelete(columnFamily, key);
+    }
+
+    rocksdb::Status SingleDelete(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::SliceParts& key) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::SingleDelete(columnFamily, key);
+    }
+
+    rocksdb::Status DeleteRange(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& beginKey,
+                                const rocksdb::Slice& endKey) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::DeleteRange(columnFamily, beginKey, endKey);
+    }
+
+    rocksdb::Status DeleteRange(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::SliceParts& beginKey,
+                                const rocksdb::SliceParts& endKey) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::DeleteRange(columnFamily, beginKey, endKey);
+    }
+
+    rocksdb::Status Merge(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key,
+                          const rocksdb::Slice& value) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::Merge(columnFamily, key, value);
+    }
+
+    rocksdb::Status Merge(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::SliceParts& key,
+                          const rocksdb::SliceParts& value) override {
+      route(columnFamily);
+      return rocksdb::WriteBatch::Merge(columnFamily, key, value);
+    }
+
+   private:
+    // A null column family is the default column family of the primary instance
+    void route(rocksdb::ColumnFamilyHandle* columnFamily) {
+      rocksdb::DB* db = columnFamily ? databaseManager_->db(columnFamily) : databaseManager_->db();
+      if (!db_) db_ = db;
+      CHECK(db == db_) << "WriteBatch spans RocksDB instances " << db_->GetName() << " and " << db->GetName();
+    }
+
+    const DatabaseManager* databaseManager_;
+    rocksdb::DB* db_;
+  };
+
+  // A server-side tunable that can be read and adjusted at runtime with CONFIG GET/SET.
+  // The setter returns false when the given value is rejected.
+  struct ServerOption {
+    std::function<std::string()> getter;
+    std::function<bool(const std::string&)> setter;
+  };
+  using ServerOptionMap = std::unordered_map<std::string, ServerOption>;
 
   static const char* defaultColumnFamilyName() {
     return "default";
@@ -61,54 +181,150 @@ class DatabaseManager {
   // Escape non-printable characters, %, and ~ using percent-encoding for strings to be used as database keys
   static void escapeKeyStr(const std::string& str, std::string* out);
 
+  // Escape the strings back to back into out with a single allocation, and append to offsets the end of each escaped
+  // string in out
+  static void escapeKeyStrs(const std::vector<std::string>& strs, std::string* out, std::vector<size_t>* offsets);
+
+  // Reverse escapeKeyStr. Return false when str contains a truncated or invalid escape sequence.
+  static bool unescapeKeyStr(const std::string& str, std::string* out);
+
+  // Metadata key recording the shard mapping of a column family group
+  static std::string getShardMappingMetadataKey(const std::string& groupName) {
+    return folly::sformat("~shardmapping~{}", groupName);
+  }
+
+  // Metadata key recording the last value set through CONFIG SET for the given target and option name
+  static std::string getConfigMetadataKey(const std::string& target, const std::string& name) {
+    return folly::sformat("~config~{}~{}", target.empty() ? "global" : target, name);
+  }
+
   DatabaseManager(const ColumnFamilyMap& columnFamilyMap, bool masterReplica, rocksdb::DB* db)
-      : columnFamilyMap_(columnFamilyMap),
-        columnFamilyGroupMap_(kEmptyColumnFamilyGroupMap),
+      : columnFamilyMap_(std::make_shared<const ColumnFamilyMap>(columnFamilyMap)),
+        columnFamilyGroupMap_(std::make_shared<const ColumnFamilyGroupMap>()),
+        columnFamilyDbMap_(std::make_shared<const ColumnFamilyDbMap>()),
         masterReplica_(masterReplica),
         db_(db),
-        metadataColumnFamily_(CHECK_NOTNULL(getColumnFamily(metadataColumnFamilyName()))) {}
+        metadataColumnFamily_(CHECK_NOTNULL(getColumnFamily(metadataColumnFamilyName()))),
+        hotKeySampler_(std::make_shared<HotKeySampler>(db, metadataColumnFamily_)),
+        shardedExecutor_(std::make_shared<ShardedExecutor>(0)),
+        backgroundJobRunner_(std::make_shared<BackgroundJobRunner>()) {
+    hotKeySampler_->setDbResolver([this](rocksdb::ColumnFamilyHandle* columnFamily) { return this->db(columnFamily); });
+  }
 
   DatabaseManager(const ColumnFamilyMap& columnFamilyMap, const ColumnFamilyGroupMap& columnFamilyGroupMap,
                   bool masterReplica, rocksdb::DB* db)
-      : columnFamilyMap_(columnFamilyMap),
-        columnFamilyGroupMap_(columnFamilyGroupMap),
+      : columnFamilyMap_(std::make_shared<const ColumnFamilyMap>(columnFamilyMap)),
+        columnFamilyGroupMap_(std::make_shared<const ColumnFamilyGroupMap>(columnFamilyGroupMap)),
+        columnFamilyDbMap_(std::make_shared<const ColumnFamilyDbMap>()),
         masterReplica_(masterReplica),
         db_(db),
-        metadataColumnFamily_(CHECK_NOTNULL(getColumnFamily(metadataColumnFamilyName()))) {}
+        metadataColumnFamily_(CHECK_NOTNULL(getColumnFamily(metadataColumnFamilyName()))),
+        hotKeySampler_(std::make_shared<HotKeySampler>(db, metadataColumnFamily_)),
+        shardedExecutor_(std::make_shared<ShardedExecutor>(0)),
+        backgroundJobRunner_(std::make_shared<BackgroundJobRunner>()) {
+    hotKeySampler_->setDbResolver([this](rocksdb::ColumnFamilyHandle* columnFamily) { return this->db(columnFamily); });
+  }
 
   virtual ~DatabaseManager() {}
 
   virtual void start() {}
   virtual void destroy() {}
 
+  // The primary RocksDB instance
   rocksdb::DB* db() const { return db_; }
 
-  const ColumnFamilyMap& columnFamilyMap() const { return columnFamilyMap_; }
+  // The RocksDB instance a column family belongs to. Always go through it when accessing members of column family
+  // groups, and keep every WriteBatch within a single instance because batches are not atomic across instances.
+  rocksdb::DB* db(rocksdb::ColumnFamilyHandle* columnFamily) const {
+    if (rocksDbInstances_.empty()) return db_;
+    auto columnFamilyDbMap = std::atomic_load(&columnFamilyDbMap_);
+    auto it = columnFamilyDbMap->find(columnFamily);
+    return it != columnFamilyDbMap->end() ? it->second : db_;
+  }
+
+  // The single RocksDB instance holding all the given column families. CHECK-fails when they span instances, so use
+  // it to pick the instance for a WriteBatch whose column families are known upfront.
+  rocksdb::DB* db(std::initializer_list<rocksdb::ColumnFamilyHandle*> columnFamilies) const {
+    rocksdb::DB* commonDb = nullptr;
+    for (auto columnFamily : columnFamilies) {
+      rocksdb::DB* columnFamilyDb = db(columnFamily);
+      CHECK(!commonDb || commonDb == columnFamilyDb)
+          << "Column family " << columnFamily->GetName() << " is not in RocksDB instance " << commonDb->GetName();
+      commonDb = columnFamilyDb;
+    }
+    return commonDb ? commonDb : db_;
+  }
+
+  // Add a secondary RocksDB instance with all the members of its column family groups. The groups must already be
+  // in the group map. Only call it during startup before serving requests.
+  void addRocksDbInstance(RocksDbInstance instance);
+
+  const std::vector<RocksDbInstance>& rocksDbInstances() const { return rocksDbInstances_; }
+
+  // The primary instance followed by the secondary ones
+  std::vector<rocksdb::DB*> dbs() const {
+    std::vector<rocksdb::DB*> dbs = {db_};
+    for (const auto& instance : rocksDbInstances_) {
+      dbs.push_back(instance.db);
+    }
+    return dbs;
+  }
+
+  // Column family maps are immutable snapshots replaced as a whole when group members are created or dropped at
+  // runtime. Loading a snapshot is an atomic shared_ptr load, which takes a short internal lock with libstdc++, but
+  // readers never wait for a change in progress and may keep using a snapshot as long as they need. Handles of
+  // dropped column families stay valid until destroyColumnFamilyHandles is called at shutdown.
+  std::shared_ptr<const ColumnFamilyMap> columnFamilyMap() const { return std::atomic_load(&columnFamilyMap_); }
 
   rocksdb::ColumnFamilyHandle* getMetadataColumnFamily() const { return metadataColumnFamily_; }
 
   rocksdb::ColumnFamilyHandle* getColumnFamily(const std::string& columnFamilyName) {
-    auto entry = columnFamilyMap().find(columnFamilyName);
-    return entry != columnFamilyMap().end() ? entry->second : nullptr;
+    auto columnFamilyMap = this->columnFamilyMap();
+    auto entry = columnFamilyMap->find(columnFamilyName);
+    return entry != columnFamilyMap->end() ? entry->second : nullptr;
   }
 
-  const ColumnFamilyGroupMap& columnFamilyGroupMap() const { return columnFamilyGroupMap_; }
+  std::shared_ptr<const ColumnFamilyGroupMap> columnFamilyGroupMap() const {
+    return std::atomic_load(&columnFamilyGroupMap_);
+  }
 
-  const std::vector<rocksdb::ColumnFamilyHandle*>& getColumnFamilyGroup(const std::string& name) {
-    auto it = columnFamilyGroupMap().find(name);
-    CHECK(it != columnFamilyGroupMap().end());
-    return it->second;
+  // Members of a group in the current snapshot, which the returned pointer keeps alive without copying it
+  std::shared_ptr<const std::vector<rocksdb::ColumnFamilyHandle*>> getColumnFamilyGroup(const std::string& name) {
+    auto columnFamilyGroupMap = this->columnFamilyGroupMap();
+    auto it = columnFamilyGroupMap->find(name);
+    CHECK(it != columnFamilyGroupMap->end());
+    return std::shared_ptr<const std::vector<rocksdb::ColumnFamilyHandle*>>(columnFamilyGroupMap, &it->second);
   }
 
+  // Create a column family with the options of the first member of the group and append it to the group. Members
+  // are sharded by their position in the group, so the name must be `<group>-<position>`, e.g., group-2 for a group
+  // of two members, which lets the bootstrap put the member back in place after a restart. Return false and fill the
+  // error message on failure.
+  bool createColumnFamilyGroupMember(const std::string& groupName, const std::string& columnFamilyName,
+                                     std::string* error);
+
+  // Drop the last member of a group. Only the last member can be dropped so that other members keep their indices
+  // in the group. Return false and fill the error message on failure.
+  bool dropColumnFamilyGroupMember(const std::string& groupName, const std::string& columnFamilyName,
+                                   std::string* error);
+
+  // Destroy the handles of all the current and dropped column families before closing the database
+  void destroyColumnFamilyHandles();
+
+  // Disable file deletions of all the instances and list their live files. Files of secondary instances are prefixed
+  // with the path of their instance.
   bool freeze(std::vector<std::string>* fileList);
 
   bool thaw() {
-    rocksdb::Status status = db_->EnableFileDeletions();
-    if (!status.ok()) {
-      LOG(ERROR) << "RocksDB EnableFileDeletions Error: " << status.ToString();
-      return false;
+    bool success = true;
+    for (auto db : dbs()) {
+      rocksdb::Status status = db->EnableFileDeletions();
+      if (!status.ok()) {
+        LOG(ERROR) << "RocksDB EnableFileDeletions Error: " << status.ToString();
+        success = false;
+      }
     }
-    return true;
+    return success;
   }
 
   bool forceCompaction(rocksdb::ColumnFamilyHandle* columnFamily,
@@ -118,7 +334,7 @@ class DatabaseManager {
     options.change_level = true;
     // make sure all levels are forced to compact
     options.bottommost_level_compaction = rocksdb::BottommostLevelCompaction::kForce;
-    rocksdb::Status status = db_->CompactRange(options, columnFamily, begin, end);
+    rocksdb::Status status = db(columnFamily)->CompactRange(options, columnFamily, begin, end);
     if (!status.ok()) {
       LOG(ERROR) << "RocksDB CompactRange Error: " << status.ToString();
       return false;
@@ -131,14 +347,146 @@ class DatabaseManager {
     return masterReplica_;
   }
 
+  // Read a value from a column family configured with TtlCompactionFilter. Expired values are reported as not found
+  // even before compaction drops them, and values written without an envelope never expire. expireAtMs is optional
+  // and set to TtlEnvelope::kNoExpiration for values that never expire.
+  rocksdb::Status getWithTtl(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key, std::string* value,
+                             int64_t* expireAtMs = nullptr);
+
+  // Write a value to a column family configured with TtlCompactionFilter
+  void putWithTtl(rocksdb::WriteBatch* writeBatch, rocksdb::ColumnFamilyHandle* columnFamily,
+                  const rocksdb::Slice& key, const rocksdb::Slice& value, int64_t expireAtMs) {
+    writeBatch->Put(columnFamily, key, TtlEnvelope::encode(value, expireAtMs));
+  }
+
+  // Change the expiration of an existing value with a TtlMergeOperator merge, so it is safe with concurrent writes
+  // to the same key. Return NotFound when the value does not exist or already expired.
+  rocksdb::Status expireWithTtl(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key,
+                                int64_t expireAtMs);
+
+  // Register a server-side option for CONFIG GET/SET. Only call it during startup before serving requests.
+  void registerServerOption(const std::string& name, ServerOption option) {
+    CHECK(serverOptionMap_.emplace(name, std::move(option)).second) << "Server option already registered: " << name;
+  }
+
+  const ServerOptionMap& serverOptionMap() const { return serverOptionMap_; }
+
+  // Optional backpressure for client writes. Only set it during startup before serving requests.
+  void setWriteStallController(std::shared_ptr<infra::WriteStallController> writeStallController) {
+    writeStallController_ = writeStallController;
+  }
+
+  std::shared_ptr<infra::WriteStallController> writeStallController() const { return writeStallController_; }
+
+  // Optional native backups for the BACKUP command. Only set it during startup before serving requests.
+  void setBackupManager(std::shared_ptr<BackupManager> backupManager) {
+    backupManager_ = backupManager;
+  }
+
+  std::shared_ptr<BackupManager> backupManager() const { return backupManager_; }
+
+  // Backups of a secondary RocksDB instance, set along with the primary backup manager
+  void setRocksDbInstanceBackupManager(const std::string& name, std::shared_ptr<BackupManager> backupManager) {
+    for (auto& instance : rocksDbInstances_) {
+      if (instance.name == name) instance.backupManager = backupManager;
+    }
+  }
+
+  // Sampling of client reads for warming up the block cache, off until its sample rate is set. Reads through
+  // getWithTtl and multiGetFromGroup are sampled, the ones updating a value such as expireWithTtl are not.
+  std::shared_ptr<HotKeySampler> hotKeySampler() const { return hotKeySampler_; }
+
+  // Record a client read for cache warm-up. Call it from command handlers reading from RocksDB directly.
+  void recordRead(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key) {
+    hotKeySampler_->record(columnFamily, key);
+  }
+
+  // Fan out multi-key requests over the members of column family groups. Without threads set during startup, it runs
+  // every shard serially on the calling thread.
+  void setShardedExecutor(std::shared_ptr<ShardedExecutor> shardedExecutor) {
+    shardedExecutor_ = shardedExecutor;
+  }
+
+  std::shared_ptr<ShardedExecutor> shardedExecutor() const { return shardedExecutor_; }
+
+  // Read keys of a column family group, each from the member chosen by getGroupShardNum, with the shards read in
+  // parallel on the sharded executor. Values and statuses are in the order of the keys.
+  std::vector<rocksdb::Status> multiGetFromGroup(const std::string& groupName, const rocksdb::ReadOptions& readOptions,
+                                                 const std::vector<rocksdb::Slice>& keys,
+                                                 std::vector<std::string>* values);
+
+  // Long administrative jobs started by commands, such as exporting a shard, run here instead of on IO threads
+  std::shared_ptr<BackgroundJobRunner> backgroundJobRunner() const { return backgroundJobRunner_; }
+
+  // Select how keys map to the members of column family groups and record it in the metadata column family. Groups
+  // not given keep their recorded mapping, or modulo by default. Changing the recorded mapping of a group that has
+  // data would misplace most of its keys, so it fails unless the group is empty. Groups whose keys are not sharded by
+  // the whole key provide the function extracting their shard keys. Only call it during startup.
+  bool initializeShardMappings(const std::unordered_map<std::string, ShardMapper::Mapping>& mappings,
+                               const ShardKeyFunctionMap& shardKeyFunctions, std::string* error);
+
+  ShardMapper::Mapping getShardMapping(const std::string& groupName) const {
+    auto it = shardMappings_.find(groupName);
+    return it == shardMappings_.end() ? ShardMapper::Mapping::kModulo : it->second;
+  }
+
+  // The function extracting the shard keys of a column family group, or null when the whole key is the shard key
+  ShardMapper::ShardKeyFunction getShardKeyFunction(const std::string& groupName) const {
+    auto it = shardKeyFunctions_.find(groupName);
+    return it == shardKeyFunctions_.end() ? nullptr : it->second;
+  }
+
+  // Shard a stored key over shardCount members of a column family group with the shard key function and the mapping
+  // of the group
+  int getGroupShardNum(const std::string& groupName, const rocksdb::Slice& key, int shardCount) const {
+    auto it = shardKeyFunctions_.find(groupName);
+    rocksdb::Slice shardKey = it == shardKeyFunctions_.end() ? key : it->second(key);
+    return ShardMapper::getShardNum(getShardMapping(groupName), shardKey, shardCount);
+  }
+
+  // Read the current value of an option. The target is either a column family name, a column family group name,
+  // or empty for server options and DB-level RocksDB options. Return false and fill the error message on failure.
+  bool getConfig(const std::string& name, const std::string& target, std::string* value, std::string* error);
+
+  // Change an option at runtime. Column family options are applied with DB::SetOptions to the named column family
+  // or every member of the named group, DB-level options with DB::SetDBOptions to every RocksDB instance. When a
+  // member or an instance rejects the change, the ones already changed are rolled back. Every successful change is
+  // recorded in the metadata column family. Return false and fill the error message on failure.
+  bool setConfig(const std::string& name, const std::string& value, const std::string& target, std::string* error);
+
  private:
-  static const ColumnFamilyGroupMap kEmptyColumnFamilyGroupMap;
+  // Current value of a DB-level or column family option, NotFound for unknown options
+  static rocksdb::Status getDbOption(rocksdb::DB* db, const std::string& name, std::string* value);
+  rocksdb::Status getColumnFamilyOption(rocksdb::ColumnFamilyHandle* columnFamily, const std::string& name,
+                                        std::string* value);
+
+  // getWithTtl without sampling the read
+  rocksdb::Status readWithTtl(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key, std::string* value,
+                              int64_t* expireAtMs);
+
+  bool freezeInstance(rocksdb::DB* db, const std::string& pathPrefix, std::vector<std::string>* fileList);
+
+  // Resolve a config target into the column families it covers. Return false when the target does not exist.
+  bool resolveConfigTarget(const std::string& target, std::vector<rocksdb::ColumnFamilyHandle*>* columnFamilies);
 
-  const ColumnFamilyMap& columnFamilyMap_;
-  const ColumnFamilyGroupMap& columnFamilyGroupMap_;
+  std::shared_ptr<const ColumnFamilyMap> columnFamilyMap_;
+  std::shared_ptr<const ColumnFamilyGroupMap> columnFamilyGroupMap_;
+  std::shared_ptr<const ColumnFamilyDbMap> columnFamilyDbMap_;
+  std::vector<RocksDbInstance> rocksDbInstances_;
+  // serialize changes to column families
+  std::mutex columnFamilyMutex_;
+  std::vector<std::pair<rocksdb::DB*, rocksdb::ColumnFamilyHandle*>> droppedColumnFamilies_;
   const bool masterReplica_;
   rocksdb::DB* db_;
   rocksdb::ColumnFamilyHandle* metadataColumnFamily_;
+  ServerOptionMap serverOptionMap_;
+  std::shared_ptr<infra::WriteStallController> writeStallController_;
+  std::shared_ptr<BackupManager> backupManager_;
+  std::shared_ptr<HotKeySampler> hotKeySampler_;
+  std::shared_ptr<ShardedExecutor> shardedExecutor_;
+  std::shared_ptr<BackgroundJobRunner> backgroundJobRunner_;
+  std::unordered_map<std::string, ShardMapper::Mapping> shardMappings_;
+  ShardKeyFunctionMap shardKeyFunctions_;
 };
 
 }  // namespace pipeline
@@ -1,10 +1,24 @@
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "boost/filesystem.hpp"
 #include "gtest/gtest.h"
 #include "pipeline/DatabaseManager.h"
+#include "rocksdb/db.h"
+#include "rocksdb/options.h"
+#include "rocksdb/status.h"
+#include "rocksdb/write_batch.h"
+#include "stesting/TestWithRocksDb.h"
 
 namespace pipeline {
 
+class DatabaseManagerWithRocksDbTest : public stesting::TestWithRocksDb {
+ protected:
+  DatabaseManagerWithRocksDbTest() : stesting::TestWithRocksDb({"group"}, {}, {{"group", 2}}) {}
+};
+
 TEST(DatabaseManagerTest, EscapeKeyStr) {
   // empty string
   std::string out;
@@ -30,6 +44,253 @@ TEST(DatabaseManagerTest, EscapeKeyStr) {
   out.clear();
   DatabaseManager::escapeKeyStr("abc~123 def\t789\n", &out);
   EXPECT_EQ("abc%7E123%20def%09789%0A", out);
+
+  // characters to escape at every position of strings longer than the vector width
+  for (size_t i = 0; i < 70; i++) {
+    std::string str(70, 'a');
+    str[i] = '\xff';
+    out.clear();
+    DatabaseManager::escapeKeyStr(str, &out);
+    EXPECT_EQ(std::string(i, 'a') + "%FF" + std::string(69 - i, 'a'), out);
+  }
+  out.clear();
+  DatabaseManager::escapeKeyStr("0123456789abcdef}~\x7f\x80 %", &out);
+  EXPECT_EQ("0123456789abcdef}%7E%7F%80%20%25", out);
+}
+
+TEST(DatabaseManagerTest, UnescapeKeyStr) {
+  std::string binary;
+  for (int i = 0; i < 256; i++) {
+    binary.push_back(static_cast<char>(i));
+  }
+  for (const std::string& str : {std::string(), std::string("abc~123 def\t789\n"), binary + binary}) {
+    std::string escaped;
+    DatabaseManager::escapeKeyStr(str, &escaped);
+    std::string out;
+    EXPECT_TRUE(DatabaseManager::unescapeKeyStr(escaped, &out));
+    EXPECT_EQ(str, out);
+  }
+
+  // lower case hex digits are accepted
+  std::string out;
+  EXPECT_TRUE(DatabaseManager::unescapeKeyStr("abc%7e", &out));
+  EXPECT_EQ("abc~", out);
+
+  EXPECT_FALSE(DatabaseManager::unescapeKeyStr("abc%7", &out));
+  EXPECT_FALSE(DatabaseManager::unescapeKeyStr("abc%", &out));
+  EXPECT_FALSE(DatabaseManager::unescapeKeyStr("abc%7G", &out));
+}
+
+TEST(DatabaseManagerTest, EscapeKeyStrs) {
+  std::string out = "foo";
+  std::vector<size_t> offsets;
+  DatabaseManager::escapeKeyStrs({"abc", "", "a~b"}, &out, &offsets);
+  EXPECT_EQ("fooabca%7Eb", out);
+  EXPECT_EQ(std::vector<size_t>({6, 6, 11}), offsets);
+}
+
+TEST_F(DatabaseManagerWithRocksDbTest, ColumnFamilyConfig) {
+  std::string value;
+  std::string error;
+  EXPECT_TRUE(databaseManager()->setConfig("write_buffer_size", "1048576", "default", &error));
+  EXPECT_TRUE(databaseManager()->getConfig("write_buffer_size", "default", &value, &error));
+  EXPECT_EQ("1048576", value);
+  EXPECT_EQ(1048576, db()->GetOptions(columnFamily("default")).write_buffer_size);
+
+  // apply to all members of a group
+  EXPECT_TRUE(databaseManager()->setConfig("level0_slowdown_writes_trigger", "40", "group", &error));
+  EXPECT_EQ(40, db()->GetOptions(columnFamily("group", 0)).level0_slowdown_writes_trigger);
+  EXPECT_EQ(40, db()->GetOptions(columnFamily("group", 1)).level0_slowdown_writes_trigger);
+
+  // changes are recorded in metadata
+  rocksdb::Status status = db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(),
+                                     DatabaseManager::getConfigMetadataKey("group", "level0_slowdown_writes_trigger"),
+                                     &value);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ("40", value);
+
+  // errors
+  EXPECT_FALSE(databaseManager()->setConfig("write_buffer_size", "1048576", "nonexistent", &error));
+  EXPECT_FALSE(databaseManager()->setConfig("no_such_option", "1", "default", &error));
+  EXPECT_FALSE(databaseManager()->getConfig("no_such_option", "default", &value, &error));
+  // a rejected value leaves every member of a group unchanged
+  EXPECT_FALSE(databaseManager()->setConfig("level0_slowdown_writes_trigger", "abc", "group", &error));
+  EXPECT_EQ(40, db()->GetOptions(columnFamily("group", 0)).level0_slowdown_writes_trigger);
+  EXPECT_EQ(40, db()->GetOptions(columnFamily("group", 1)).level0_slowdown_writes_trigger);
+}
+
+TEST_F(DatabaseManagerWithRocksDbTest, DbConfig) {
+  std::string value;
+  std::string error;
+  EXPECT_TRUE(databaseManager()->setConfig("max_total_wal_size", "2147483648", "", &error));
+  EXPECT_TRUE(databaseManager()->getConfig("max_total_wal_size", "", &value, &error));
+  EXPECT_EQ("2147483648", value);
+}
+
+TEST_F(DatabaseManagerWithRocksDbTest, ServerConfig) {
+  int64_t knob = 1;
+  databaseManager()->registerServerOption(
+      "knob", {[&knob]() { return folly::to<std::string>(knob); },
+               [&knob](const std::string& value) { return DatabaseManager::parseInt(value, &knob) && knob > 0; }});
+
+  std::string value;
+  std::string error;
+  EXPECT_TRUE(databaseManager()->getConfig("knob", "", &value, &error));
+  EXPECT_EQ("1", value);
+  EXPECT_TRUE(databaseManager()->setConfig("knob", "5", "", &error));
+  EXPECT_EQ(5, knob);
+  EXPECT_FALSE(databaseManager()->setConfig("knob", "abc", "", &error));
+  EXPECT_EQ(5, knob);
+}
+
+TEST_F(DatabaseManagerWithRocksDbTest, CreateAndDropGroupMember) {
+  std::string error;
+  auto columnFamilyGroupMap = databaseManager()->columnFamilyGroupMap();
+  EXPECT_TRUE(databaseManager()->setConfig("level0_slowdown_writes_trigger", "40", "group", &error));
+
+  // members are named after their position in the group
+  EXPECT_FALSE(databaseManager()->createColumnFamilyGroupMember("group", "group-3", &error));
+  EXPECT_FALSE(databaseManager()->createColumnFamilyGroupMember("group", "other", &error));
+  ASSERT_TRUE(databaseManager()->createColumnFamilyGroupMember("group", "group-2", &error)) << error;
+  auto group = *databaseManager()->getColumnFamilyGroup("group");
+  ASSERT_EQ(3, group.size());
+  EXPECT_EQ("group-2", group[2]->GetName());
+  EXPECT_EQ(group[2], databaseManager()->getColumnFamily("group-2"));
+  // options are copied from the first member, including runtime changes
+  EXPECT_EQ(40, db()->GetOptions(group[2]).level0_slowdown_writes_trigger);
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), group[2], "key", "value").ok());
+  // snapshots taken earlier are not affected
+  EXPECT_EQ(2, columnFamilyGroupMap->at("group").size());
+
+  EXPECT_FALSE(databaseManager()->createColumnFamilyGroupMember("group", "group-2", &error));
+  EXPECT_FALSE(databaseManager()->createColumnFamilyGroupMember("nonexistent", "nonexistent-0", &error));
+  // only the last member can be dropped
+  EXPECT_FALSE(databaseManager()->dropColumnFamilyGroupMember("group", "group-1", &error));
+
+  ASSERT_TRUE(databaseManager()->dropColumnFamilyGroupMember("group", "group-2", &error)) << error;
+  EXPECT_EQ(2, databaseManager()->getColumnFamilyGroup("group")->size());
+  EXPECT_EQ(nullptr, databaseManager()->getColumnFamily("group-2"));
+  // the handle of the dropped column family stays valid until shutdown
+  EXPECT_EQ("group-2", group[2]->GetName());
+  db()->DestroyColumnFamilyHandle(group[2]);
+}
+
+TEST_F(DatabaseManagerWithRocksDbTest, MultiGetFromGroup) {
+  std::string error;
+  ASSERT_TRUE(databaseManager()->initializeShardMappings({{"group", ShardMapper::Mapping::kJumpConsistentHash}}, {},
+                                                         &error)) << error;
+  databaseManager()->setShardedExecutor(std::make_shared<ShardedExecutor>(2, 1));
+  auto group = *databaseManager()->getColumnFamilyGroup("group");
+  std::vector<std::string> keys;
+  for (int i = 0; i < 100; i++) {
+    keys.push_back(std::to_string(i));
+    // write only even keys so that odd keys are not found
+    if (i % 2 == 1) continue;
+    rocksdb::ColumnFamilyHandle* member = group[databaseManager()->getGroupShardNum("group", keys.back(), 2)];
+    ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), member, keys.back(), "value" + keys.back()).ok());
+  }
+
+  std::vector<rocksdb::Slice> keySlices(keys.begin(), keys.end());
+  std::vector<std::string> values;
+  auto statuses = databaseManager()->multiGetFromGroup("group", rocksdb::ReadOptions(), keySlices, &values);
+  ASSERT_EQ(100, statuses.size());
+  for (int i = 0; i < 100; i++) {
+    if (i % 2 == 0) {
+      ASSERT_TRUE(statuses[i].ok()) << statuses[i].ToString();
+      EXPECT_EQ("value" + keys[i], values[i]);
+    } else {
+      EXPECT_TRUE(statuses[i].IsNotFound());
+    }
+  }
+}
+
+TEST_F(DatabaseManagerWithRocksDbTest, SampleReads) {
+  auto hotKeySampler = databaseManager()->hotKeySampler();
+  std::string value;
+  EXPECT_TRUE(databaseManager()->getWithTtl(columnFamily("default"), "off", &value).IsNotFound());
+  EXPECT_TRUE(hotKeySampler->getHotKeys("default").empty());
+
+  hotKeySampler->setSampleRate(1);
+  EXPECT_TRUE(databaseManager()->getWithTtl(columnFamily("default"), "read", &value).IsNotFound());
+  // updates read the value too but are not client reads
+  EXPECT_TRUE(databaseManager()->expireWithTtl(columnFamily("default"), "expired", 0).IsNotFound());
+  EXPECT_EQ(std::vector<std::string>({"read"}), hotKeySampler->getHotKeys("default"));
+
+  std::vector<rocksdb::Slice> keys = {"a", "b"};
+  std::vector<std::string> values;
+  databaseManager()->multiGetFromGroup("group", rocksdb::ReadOptions(), keys, &values);
+  auto group = *databaseManager()->getColumnFamilyGroup("group");
+  for (const auto& key : keys) {
+    auto member = group[databaseManager()->getGroupShardNum("group", key, 2)];
+    auto hotKeys = hotKeySampler->getHotKeys(member->GetName());
+    EXPECT_NE(hotKeys.end(), std::find(hotKeys.begin(), hotKeys.end(), key.ToString()));
+  }
+}
+
+TEST_F(DatabaseManagerWithRocksDbTest, SecondaryRocksDbInstance) {
+  auto instancePath = boost::filesystem::unique_path("rocksdb_instance_test.%%%%%%%%");
+  rocksdb::Options options;
+  options.create_if_missing = true;
+  rocksdb::DB* instanceDb;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  ASSERT_TRUE(rocksdb::DB::Open(options, instancePath.native(), {{"default", options}}, &handles, &instanceDb).ok());
+  std::vector<rocksdb::ColumnFamilyHandle*> remoteGroup(2);
+  ASSERT_TRUE(instanceDb->CreateColumnFamily(options, "remote-0", &remoteGroup[0]).ok());
+  ASSERT_TRUE(instanceDb->CreateColumnFamily(options, "remote-1", &remoteGroup[1]).ok());
+
+  DatabaseManager::ColumnFamilyMap columnFamilyMap = {{"default", columnFamily("default")},
+                                                      {"smyte-metadata", metadataColumnFamily()},
+                                                      {"remote-0", remoteGroup[0]},
+                                                      {"remote-1", remoteGroup[1]}};
+  DatabaseManager databaseManager(columnFamilyMap, {{"remote", remoteGroup}}, true, db());
+  databaseManager.addRocksDbInstance({"remote", instanceDb, {"remote"}, nullptr});
+  EXPECT_EQ(db(), databaseManager.db(columnFamily("default")));
+  EXPECT_EQ(instanceDb, databaseManager.db(remoteGroup[1]));
+  EXPECT_EQ(2, databaseManager.dbs().size());
+
+  std::string value;
+  int64_t expireAtMs;
+  rocksdb::WriteBatch writeBatch;
+  databaseManager.putWithTtl(&writeBatch, remoteGroup[1], "key", "value", nowMs() + 60000);
+  ASSERT_TRUE(databaseManager.db(remoteGroup[1])->Write(rocksdb::WriteOptions(), &writeBatch).ok());
+  EXPECT_TRUE(databaseManager.getWithTtl(remoteGroup[1], "key", &value, &expireAtMs).ok());
+  EXPECT_EQ("value", value);
+
+  // write batches follow the instance of their column families and cannot span instances
+  DatabaseManager::InstanceWriteBatch instanceWriteBatch(&databaseManager);
+  EXPECT_EQ(db(), instanceWriteBatch.db());
+  instanceWriteBatch.Put(remoteGroup[0], "key", "value");
+  EXPECT_EQ(instanceDb, instanceWriteBatch.db());
+  instanceWriteBatch.Delete(remoteGroup[1], "key");
+  EXPECT_DEATH(instanceWriteBatch.Put(metadataColumnFamily(), "key", "value"), "spans RocksDB instances");
+  EXPECT_EQ(instanceDb, databaseManager.db({remoteGroup[0], remoteGroup[1]}));
+  EXPECT_DEATH(databaseManager.db({remoteGroup[0], metadataColumnFamily()}), "is not in RocksDB instance");
+
+  // new members are created in the instance of their group
+  std::string error;
+  ASSERT_TRUE(databaseManager.createColumnFamilyGroupMember("remote", "remote-2", &error)) << error;
+  auto newMember = databaseManager.getColumnFamily("remote-2");
+  EXPECT_EQ(instanceDb, databaseManager.db(newMember));
+  EXPECT_TRUE(instanceDb->Put(rocksdb::WriteOptions(), newMember, "key", "value").ok());
+
+  // freeze covers the files of all the instances
+  std::vector<std::string> fileList;
+  ASSERT_TRUE(databaseManager.freeze(&fileList));
+  EXPECT_TRUE(std::any_of(fileList.begin(), fileList.end(), [&](const std::string& file) {
+    return file.compare(0, instanceDb->GetName().size(), instanceDb->GetName()) == 0;
+  }));
+  EXPECT_TRUE(std::any_of(fileList.begin(), fileList.end(), [](const std::string& file) {
+    return file.compare(0, 10, "/MANIFEST-") == 0;
+  }));
+  EXPECT_TRUE(databaseManager.thaw());
+
+  // the fixture owns the column families of the primary instance
+  for (auto handle : *databaseManager.getColumnFamilyGroup("remote")) {
+    instanceDb->DestroyColumnFamilyHandle(handle);
+  }
+  instanceDb->DestroyColumnFamilyHandle(handles[0]);
+  delete instanceDb;
+  boost::filesystem::remove_all(instancePath);
 }
 
 }  // namespace pipeline
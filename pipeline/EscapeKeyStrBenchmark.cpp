@@ -0,0 +1,123 @@
+// Compare DatabaseManager::escapeKeyStr with the byte-at-a-time implementation it replaced.
+//
+// Keys are generated once per input profile: `ascii` keys are printable with an occasional character to escape, like
+// ids and emails derived from user strings, while `binary` keys are random bytes where most characters need escaping.
+// For each profile it reports the throughput of the scalar version, the vectorized version and the batch API.
+//
+// Usage: escape_key_str_benchmark [--keys=100000] [--key_size=64] [--rounds=20]
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "folly/Format.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "pipeline/DatabaseManager.h"
+
+DEFINE_int32(keys, 100000, "Number of keys for each input profile");
+DEFINE_int32(key_size, 64, "Size of each key in bytes");
+DEFINE_int32(rounds, 20, "Number of times all the keys are escaped for each implementation");
+
+namespace {
+
+// The implementation of DatabaseManager::escapeKeyStr before it was vectorized
+void scalarEscapeKeyStr(const std::string& str, std::string* out) {
+  static const char hexValues[] = "0123456789ABCDEF";
+  char esc[3];
+  esc[0] = '%';
+  out->reserve(str.size() + out->size() + str.size() / 10);
+  auto p = str.begin();
+  auto last = p;
+  while (p != str.end()) {
+    unsigned char v = static_cast<unsigned char>(*p);
+    if (v < 33 || v > 125 || v == 37) {
+      out->append(&*last, p - last);
+      esc[1] = hexValues[v >> 4];
+      esc[2] = hexValues[v & 0x0f];
+      out->append(esc, 3);
+      ++p;
+      last = p;
+    } else {
+      ++p;
+    }
+  }
+  out->append(&*last, p - last);
+}
+
+std::vector<std::string> generateKeys(bool binary) {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::uniform_int_distribution<int> printable(33, 125);
+  std::vector<std::string> keys(FLAGS_keys);
+  for (auto& key : keys) {
+    key.reserve(FLAGS_key_size);
+    for (int i = 0; i < FLAGS_key_size; i++) {
+      // about one in 32 characters is a random byte, which mostly needs escaping like spaces and `~` separators
+      key.push_back(static_cast<char>(binary || generator() % 32 == 0 ? byte(generator) : printable(generator)));
+    }
+  }
+  return keys;
+}
+
+// Return the throughput in MB/s of the input keys
+template <typename Function>
+double measure(const std::vector<std::string>& keys, Function function) {
+  size_t outputBytes = 0;
+  auto startTime = std::chrono::steady_clock::now();
+  for (int round = 0; round < FLAGS_rounds; round++) {
+    outputBytes += function(keys);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  // keep the output alive so that the work cannot be optimized away
+  CHECK_GT(outputBytes, 0);
+  return static_cast<double>(keys.size()) * FLAGS_key_size * FLAGS_rounds / seconds / (1024 * 1024);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_keys, 0);
+  CHECK_GT(FLAGS_key_size, 0);
+  CHECK_GT(FLAGS_rounds, 0);
+
+  std::cout << folly::sformat("{:<8} {:>14} {:>14} {:>14}", "input", "scalar MB/s", "vector MB/s", "batch MB/s")
+            << std::endl;
+  for (bool binary : {false, true}) {
+    auto keys = generateKeys(binary);
+    double scalar = measure(keys, [](const std::vector<std::string>& keys) {
+      size_t outputBytes = 0;
+      std::string out;
+      for (const auto& key : keys) {
+        out.clear();
+        scalarEscapeKeyStr(key, &out);
+        outputBytes += out.size();
+      }
+      return outputBytes;
+    });
+    double vector = measure(keys, [](const std::vector<std::string>& keys) {
+      size_t outputBytes = 0;
+      std::string out;
+      for (const auto& key : keys) {
+        out.clear();
+        pipeline::DatabaseManager::escapeKeyStr(key, &out);
+        outputBytes += out.size();
+      }
+      return outputBytes;
+    });
+    double batch = measure(keys, [](const std::vector<std::string>& keys) {
+      std::string out;
+      std::vector<size_t> offsets;
+      pipeline::DatabaseManager::escapeKeyStrs(keys, &out, &offsets);
+      return out.size();
+    });
+    std::cout << folly::sformat("{:<8} {:>14.1f} {:>14.1f} {:>14.1f}", binary ? "binary" : "ascii", scalar, vector,
+                                batch)
+              << std::endl;
+  }
+  return 0;
+}
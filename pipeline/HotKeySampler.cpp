@@ -0,0 +1,206 @@
+#include "pipeline/HotKeySampler.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "folly/Bits.h"
+#include "glog/logging.h"
+#include "rocksdb/write_batch.h"
+
+namespace pipeline {
+
+constexpr size_t HotKeySampler::kDefaultMaxKeys;
+
+std::string HotKeySampler::encodeKeys(const std::vector<std::string>& keys) {
+  std::string value;
+  for (const auto& key : keys) {
+    uint32_t size = folly::Endian::little(static_cast<uint32_t>(key.size()));
+    value.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    value.append(key);
+  }
+  return value;
+}
+
+bool HotKeySampler::decodeKeys(const rocksdb::Slice& value, std::vector<std::string>* keys) {
+  size_t pos = 0;
+  while (pos < value.size()) {
+    uint32_t size;
+    if (pos + sizeof(size) > value.size()) return false;
+    std::memcpy(&size, value.data() + pos, sizeof(size));
+    size = folly::Endian::little(size);
+    pos += sizeof(size);
+    if (pos + size > value.size()) return false;
+    keys->emplace_back(value.data() + pos, size);
+    pos += size;
+  }
+  return true;
+}
+
+void HotKeySampler::addSample(const std::string& columnFamilyName, const rocksdb::Slice& key) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto& counts = sampleCounts_[columnFamilyName];
+  counts[key.ToString()]++;
+  // prune lazily so that the cost is amortized over many samples
+  if (counts.size() >= maxKeys_ * 2) prune(&counts);
+}
+
+void HotKeySampler::prune(std::unordered_map<std::string, uint64_t>* counts) {
+  std::vector<std::pair<std::string, uint64_t>> entries(counts->begin(), counts->end());
+  size_t keep = std::min<size_t>(maxKeys_, entries.size());
+  std::partial_sort(entries.begin(), entries.begin() + keep, entries.end(),
+                    [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+                      return a.second > b.second;
+                    });
+  counts->clear();
+  for (size_t i = 0; i < keep; i++) {
+    // keep counts above zero so that surviving keys are not evicted by the next key sampled once
+    (*counts)[std::move(entries[i].first)] = (entries[i].second + 1) / 2;
+  }
+}
+
+std::vector<std::string> HotKeySampler::getHotKeys(const std::string& columnFamilyName) {
+  std::vector<std::pair<std::string, uint64_t>> entries;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = sampleCounts_.find(columnFamilyName);
+    if (it == sampleCounts_.end()) return {};
+    entries.assign(it->second.begin(), it->second.end());
+  }
+
+  size_t count = std::min<size_t>(maxKeys_, entries.size());
+  std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+                    [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+                      return a.second > b.second;
+                    });
+  std::vector<std::string> keys;
+  keys.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    keys.push_back(std::move(entries[i].first));
+  }
+  return keys;
+}
+
+bool HotKeySampler::persist() {
+  std::vector<std::string> columnFamilyNames;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& entry : sampleCounts_) {
+      columnFamilyNames.push_back(entry.first);
+    }
+  }
+
+  rocksdb::WriteBatch writeBatch;
+  for (const auto& columnFamilyName : columnFamilyNames) {
+    writeBatch.Put(metadataColumnFamily_, getMetadataKey(columnFamilyName), encodeKeys(getHotKeys(columnFamilyName)));
+  }
+  rocksdb::Status status = getDb(metadataColumnFamily_)->Write(rocksdb::WriteOptions(), &writeBatch);
+  if (!status.ok()) {
+    LOG(ERROR) << "Persisting hot keys failed: " << status.ToString();
+    return false;
+  }
+  return true;
+}
+
+void HotKeySampler::start(int64_t persistIntervalMs) {
+  CHECK(!run_) << "Hot key sampler is already running";
+  CHECK_GT(persistIntervalMs, 0);
+  run_ = true;
+  persistThread_.reset(new std::thread([this, persistIntervalMs]() {
+    pthread_setname_np(pthread_self(), "hot-key-persist");
+    auto nextPersistTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(persistIntervalMs);
+    while (run_) {
+      // sleep in short steps to stop promptly
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      if (std::chrono::steady_clock::now() >= nextPersistTime) {
+        persist();
+        nextPersistTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(persistIntervalMs);
+      }
+    }
+  }));
+}
+
+void HotKeySampler::stop() {
+  if (!run_) return;
+  run_ = false;
+  persistThread_->join();
+  persistThread_.reset();
+  persist();
+}
+
+uint64_t HotKeySampler::warmUp(const ColumnFamilyMap& columnFamilyMap, int parallelism, int64_t budgetMs) {
+  CHECK_GT(parallelism, 0);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budgetMs);
+
+  // load all persisted keys first so that the threads can share the work evenly
+  std::vector<std::pair<rocksdb::ColumnFamilyHandle*, std::string>> reads;
+  for (const auto& entry : columnFamilyMap) {
+    std::string value;
+    rocksdb::Status status =
+        db_->Get(rocksdb::ReadOptions(), metadataColumnFamily_, getMetadataKey(entry.first), &value);
+    if (!status.ok()) {
+      if (!status.IsNotFound()) LOG(ERROR) << "Loading hot keys failed: " << status.ToString();
+      continue;
+    }
+    std::vector<std::string> keys;
+    if (!decodeKeys(value, &keys)) {
+      LOG(ERROR) << "Invalid hot keys persisted for " << entry.first;
+      continue;
+    }
+    for (auto& key : keys) {
+      reads.emplace_back(entry.second, std::move(key));
+    }
+  }
+  LOG(INFO) << "Warming up block cache with " << reads.size() << " hot keys in " << budgetMs << "ms";
+
+  std::atomic<uint64_t> keysRead(0);
+  std::atomic<size_t> nextRead(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < parallelism; i++) {
+    threads.emplace_back([this, &reads, &nextRead, &keysRead, deadline]() {
+      std::string value;
+      for (size_t index = nextRead++; index < reads.size(); index = nextRead++) {
+        if (std::chrono::steady_clock::now() >= deadline) break;
+        // the value is not needed, only the blocks loaded into the cache along the way
+        getDb(reads[index].first)->Get(rocksdb::ReadOptions(), reads[index].first, reads[index].second, &value);
+        keysRead++;
+        warmUpKeysRead_++;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  LOG(INFO) << "Warmed up block cache with " << keysRead << " of " << reads.size() << " hot keys";
+  return keysRead;
+}
+
+void HotKeySampler::startWarmUp(const ColumnFamilyMap& columnFamilyMap, int parallelism, int64_t budgetMs) {
+  CHECK(!warmUpThread_) << "Warm up already started";
+  warmingUp_ = true;
+  warmUpThread_.reset(new std::thread([this, columnFamilyMap, parallelism, budgetMs]() {
+    pthread_setname_np(pthread_self(), "cache-warm-up");
+    warmUp(columnFamilyMap, parallelism, budgetMs);
+    warmingUp_ = false;
+  }));
+}
+
+void HotKeySampler::waitForWarmUp() {
+  if (warmUpThread_) {
+    warmUpThread_->join();
+    warmUpThread_.reset();
+  }
+}
+
+void HotKeySampler::appendStatsInRedisInfoFormat(std::stringstream* ss) {
+  (*ss) << "hot_key_sample_rate:" << sampleRate_ << std::endl;
+  (*ss) << "cache_warm_up_in_progress:" << (warmingUp_ ? 1 : 0) << std::endl;
+  (*ss) << "cache_warm_up_keys_read:" << warmUpKeysRead_ << std::endl;
+}
+
+}  // namespace pipeline
@@ -0,0 +1,133 @@
+#ifndef PIPELINE_HOTKEYSAMPLER_H_
+#define PIPELINE_HOTKEYSAMPLER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "rocksdb/db.h"
+#include "rocksdb/slice.h"
+
+namespace pipeline {
+
+// Sample keys read by clients and warm up the block cache with them after a restart.
+//
+// One in every sampleRate recorded reads is counted, and none while the sample rate is 0. The most frequently read
+// keys of each column family are periodically persisted in the metadata column family. On startup, the persisted keys
+// are read back by parallel background threads until all of them are read or the time budget runs out, which loads
+// their data, index and filter blocks into the block cache.
+class HotKeySampler {
+ public:
+  using ColumnFamilyMap = std::unordered_map<std::string, rocksdb::ColumnFamilyHandle*>;
+  // Find the RocksDB instance of a column family when there are several
+  using DbResolver = std::function<rocksdb::DB*(rocksdb::ColumnFamilyHandle*)>;
+
+  static std::string getMetadataKey(const std::string& columnFamilyName) {
+    return "~hot-keys~" + columnFamilyName;
+  }
+
+  // Encode keys as a sequence of 4-byte little-endian sizes followed by key bytes
+  static std::string encodeKeys(const std::vector<std::string>& keys);
+  static bool decodeKeys(const rocksdb::Slice& value, std::vector<std::string>* keys);
+
+  static constexpr size_t kDefaultMaxKeys = 10000;
+
+  // Sampling is off until a sample rate is set
+  HotKeySampler(rocksdb::DB* db, rocksdb::ColumnFamilyHandle* metadataColumnFamily)
+      : HotKeySampler(db, metadataColumnFamily, 0, kDefaultMaxKeys) {}
+
+  // sampleRate 0 disables sampling. maxKeys is the number of keys persisted for each column family.
+  HotKeySampler(rocksdb::DB* db, rocksdb::ColumnFamilyHandle* metadataColumnFamily, int sampleRate, size_t maxKeys)
+      : db_(db),
+        metadataColumnFamily_(metadataColumnFamily),
+        maxKeys_(maxKeys),
+        sampleRate_(sampleRate),
+        run_(false),
+        warmingUp_(false),
+        warmUpKeysRead_(0) {}
+
+  ~HotKeySampler() {
+    stop();
+    waitForWarmUp();
+  }
+
+  // Record a read. It is cheap for the reads that are not sampled.
+  void record(rocksdb::ColumnFamilyHandle* columnFamily, const rocksdb::Slice& key) {
+    int sampleRate = sampleRate_;
+    if (sampleRate <= 0) return;
+    thread_local uint64_t readCount = 0;
+    if (++readCount % sampleRate == 0) {
+      addSample(columnFamily->GetName(), key);
+    }
+  }
+
+  // Warm up column families of other RocksDB instances than the one of the metadata column family. Only set it before
+  // the warm-up starts.
+  void setDbResolver(DbResolver dbResolver) { dbResolver_ = dbResolver; }
+
+  int sampleRate() const { return sampleRate_; }
+  void setSampleRate(int sampleRate) { sampleRate_ = sampleRate; }
+
+  size_t maxKeys() const { return maxKeys_; }
+  void setMaxKeys(size_t maxKeys) { maxKeys_ = maxKeys; }
+
+  // Get the hottest sampled keys of a column family, most frequent first
+  std::vector<std::string> getHotKeys(const std::string& columnFamilyName);
+
+  // Persist the hottest sampled keys of every column family
+  bool persist();
+
+  // Persist every persistIntervalMs in a background thread
+  void start(int64_t persistIntervalMs);
+
+  // Stop the persisting thread and persist one last time
+  void stop();
+
+  // Read the persisted keys of the given column families with parallel threads until budgetMs elapses.
+  // Return the number of keys read.
+  uint64_t warmUp(const ColumnFamilyMap& columnFamilyMap, int parallelism, int64_t budgetMs);
+
+  // Run warmUp in a background thread. isWarmingUp is true until it finishes.
+  void startWarmUp(const ColumnFamilyMap& columnFamilyMap, int parallelism, int64_t budgetMs);
+  void waitForWarmUp();
+  bool isWarmingUp() const { return warmingUp_; }
+
+  void appendStatsInRedisInfoFormat(std::stringstream* ss);
+
+ private:
+  void addSample(const std::string& columnFamilyName, const rocksdb::Slice& key);
+
+  // Keep the hottest maxKeys_ keys and halve their counts so that keys that cooled down eventually get evicted
+  void prune(std::unordered_map<std::string, uint64_t>* counts);
+
+  rocksdb::DB* getDb(rocksdb::ColumnFamilyHandle* columnFamily) const {
+    return dbResolver_ ? dbResolver_(columnFamily) : db_;
+  }
+
+  rocksdb::DB* db_;
+  rocksdb::ColumnFamilyHandle* metadataColumnFamily_;
+  DbResolver dbResolver_;
+  std::atomic<size_t> maxKeys_;
+  std::atomic<int> sampleRate_;
+
+  // sampled read counts by column family name and key
+  std::unordered_map<std::string, std::unordered_map<std::string, uint64_t>> sampleCounts_;
+  std::mutex mutex_;
+
+  std::atomic<bool> run_;
+  std::unique_ptr<std::thread> persistThread_;
+
+  std::atomic<bool> warmingUp_;
+  std::atomic<uint64_t> warmUpKeysRead_;
+  std::unique_ptr<std::thread> warmUpThread_;
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_HOTKEYSAMPLER_H_
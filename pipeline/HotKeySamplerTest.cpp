@@ -0,0 +1,76 @@
+#include "pipeline/HotKeySampler.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "rocksdb/db.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+class HotKeySamplerTest : public stesting::TestWithRocksDb {
+ protected:
+  HotKeySampler::ColumnFamilyMap getColumnFamilyMap() {
+    return {{"default", columnFamily("default")}};
+  }
+};
+
+TEST(HotKeySampler, EncodeDecodeKeys) {
+  std::vector<std::string> keys = {"a", "", std::string("b\0c", 3), std::string(300, 'x')};
+  std::vector<std::string> decodedKeys;
+  ASSERT_TRUE(HotKeySampler::decodeKeys(HotKeySampler::encodeKeys(keys), &decodedKeys));
+  EXPECT_EQ(keys, decodedKeys);
+
+  std::string value = HotKeySampler::encodeKeys({"abc"});
+  decodedKeys.clear();
+  EXPECT_FALSE(HotKeySampler::decodeKeys(rocksdb::Slice(value.data(), value.size() - 1), &decodedKeys));
+}
+
+TEST_F(HotKeySamplerTest, SampleAndPrune) {
+  HotKeySampler sampler(db(), metadataColumnFamily(), 1, 2);
+  for (int i = 0; i < 3; i++) sampler.record(columnFamily("default"), "hot");
+  for (int i = 0; i < 2; i++) sampler.record(columnFamily("default"), "warm");
+  sampler.record(columnFamily("default"), "cold");
+  EXPECT_EQ(std::vector<std::string>({"hot", "warm"}), sampler.getHotKeys("default"));
+  EXPECT_TRUE(sampler.getHotKeys("unknown").empty());
+
+  // reaching twice the maximum number of keys prunes the coldest ones
+  sampler.record(columnFamily("default"), "colder");
+  EXPECT_EQ(std::vector<std::string>({"hot", "warm"}), sampler.getHotKeys("default"));
+
+  sampler.setSampleRate(0);
+  for (int i = 0; i < 10; i++) sampler.record(columnFamily("default"), "ignored");
+  EXPECT_EQ(std::vector<std::string>({"hot", "warm"}), sampler.getHotKeys("default"));
+}
+
+TEST_F(HotKeySamplerTest, PersistAndWarmUp) {
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), "a", "1").ok());
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), "b", "2").ok());
+
+  {
+    HotKeySampler sampler(db(), metadataColumnFamily(), 1, 10);
+    sampler.record(columnFamily("default"), "a");
+    sampler.record(columnFamily("default"), "b");
+    sampler.record(columnFamily("default"), "missing");
+    ASSERT_TRUE(sampler.persist());
+  }
+
+  std::string value;
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), HotKeySampler::getMetadataKey("default"),
+                        &value).ok());
+  std::vector<std::string> keys;
+  ASSERT_TRUE(HotKeySampler::decodeKeys(value, &keys));
+  EXPECT_EQ(3, keys.size());
+
+  HotKeySampler sampler(db(), metadataColumnFamily(), 1, 10);
+  EXPECT_EQ(3, sampler.warmUp(getColumnFamilyMap(), 2, 10000));
+  // no time budget reads nothing
+  EXPECT_EQ(0, sampler.warmUp(getColumnFamilyMap(), 2, 0));
+
+  sampler.startWarmUp(getColumnFamilyMap(), 2, 10000);
+  sampler.waitForWarmUp();
+  EXPECT_FALSE(sampler.isWarmingUp());
+}
+
+}  // namespace pipeline
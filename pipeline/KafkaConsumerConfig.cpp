@@ -2,6 +2,7 @@
 
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "folly/dynamic.h"
 #include "glog/logging.h"
@@ -48,9 +49,20 @@ KafkaConsumerConfig KafkaConsumerConfig::createFromJson(const folly::dynamic& co
     lowLatency = config["low_latency"].getBool();
   }
 
+  // optional list of the column family groups written by the consumer
+  bool columnFamilyGroupsSpecified = false;
+  std::vector<std::string> columnFamilyGroups;
+  if (config.get_ptr("column_family_groups")) {
+    columnFamilyGroupsSpecified = true;
+    for (const auto& groupName : config["column_family_groups"]) {
+      columnFamilyGroups.push_back(groupName.getString());
+    }
+  }
+
   return KafkaConsumerConfig(std::move(consumerName), std::move(topic), partition, std::move(groupId),
                              std::move(offsetKeySuffix), consumeFromBeginningOneOff, initialOffsetOneOff,
-                             objectStoreBucketName, objectStoreObjectNamePrefix, lowLatency);
+                             objectStoreBucketName, objectStoreObjectNamePrefix, lowLatency,
+                             columnFamilyGroupsSpecified, std::move(columnFamilyGroups));
 }
 
 }  // namespace pipeline
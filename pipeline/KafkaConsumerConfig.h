@@ -3,6 +3,7 @@
 
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "folly/dynamic.h"
 
@@ -15,7 +16,8 @@ class KafkaConsumerConfig {
 
   KafkaConsumerConfig(std::string _consumerName, std::string _topic, int _partition, std::string _groupId,
                       std::string _offsetKeySuffix, bool _consumeFromBeginningOneoff, int64_t _initialOffsetOneoff,
-                      std::string _objectStoreBucketName, std::string _objectStoreObjectNamePrefix, bool _lowLatency)
+                      std::string _objectStoreBucketName, std::string _objectStoreObjectNamePrefix, bool _lowLatency,
+                      bool _columnFamilyGroupsSpecified, std::vector<std::string> _columnFamilyGroups)
       : consumerName(std::move(_consumerName)),
         topic(std::move(_topic)),
         partition(_partition),
@@ -25,7 +27,9 @@ class KafkaConsumerConfig {
         initialOffsetOneOff(_initialOffsetOneoff),
         objectStoreBucketName(_objectStoreBucketName),
         objectStoreObjectNamePrefix(_objectStoreObjectNamePrefix),
-        lowLatency(_lowLatency) {}
+        lowLatency(_lowLatency),
+        columnFamilyGroupsSpecified(_columnFamilyGroupsSpecified),
+        columnFamilyGroups(std::move(_columnFamilyGroups)) {}
 
   const std::string consumerName;
   const std::string topic;
@@ -37,6 +41,10 @@ class KafkaConsumerConfig {
   const std::string objectStoreBucketName;
   const std::string objectStoreObjectNamePrefix;
   const bool lowLatency;
+  // Column family groups written by the consumer, required when there are secondary RocksDB instances because
+  // consumed data must be committed with the offsets in the primary instance
+  const bool columnFamilyGroupsSpecified;
+  const std::vector<std::string> columnFamilyGroups;
 };
 
 }  // namespace pipeline
@@ -1,5 +1,8 @@
 #include "pipeline/KafkaConsumerConfig.h"
 
+#include <string>
+#include <vector>
+
 #include "folly/dynamic.h"
 #include "gtest/gtest.h"
 #include "librdkafka/rdkafkacpp.h"
@@ -19,6 +22,7 @@ TEST(KafkaConsumerConfig, CreateFromJsonDefaultOptionalFields) {
   EXPECT_TRUE(config.objectStoreBucketName.empty());
   EXPECT_TRUE(config.objectStoreObjectNamePrefix.empty());
   EXPECT_FALSE(config.lowLatency);
+  EXPECT_FALSE(config.columnFamilyGroupsSpecified);
 }
 
 TEST(KafkaConsumerConfig, CreateFromJsonConflictingOffsets) {
@@ -44,13 +48,16 @@ TEST(KafkaConsumerConfig, CreateFromJsonOptionalFields) {
       ("initial_offset_one_off", 123)
       ("object_store_bucket_name", "kafka")
       ("object_store_object_name_prefix", "raw/")
-      ("low_latency", true));
+      ("low_latency", true)
+      ("column_family_groups", folly::dynamic::array("entityList")));
   EXPECT_EQ("day", config.offsetKeySuffix);
   EXPECT_FALSE(config.consumeFromBeginningOneOff);
   EXPECT_EQ(123L, config.initialOffsetOneOff);
   EXPECT_EQ("kafka", config.objectStoreBucketName);
   EXPECT_EQ("raw/", config.objectStoreObjectNamePrefix);
   EXPECT_TRUE(config.lowLatency);
+  EXPECT_TRUE(config.columnFamilyGroupsSpecified);
+  EXPECT_EQ(std::vector<std::string>({"entityList"}), config.columnFamilyGroups);
 }
 
 }  // namespace pipeline
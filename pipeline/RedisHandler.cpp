@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <sstream>
@@ -14,7 +15,10 @@
 #include "folly/Format.h"
 #include "folly/String.h"
 #include "glog/logging.h"
+#include "infra/kafka/store/IngestManifest.h"
 #include "pipeline/BuildVersion.h"
+#include "pipeline/ShardMapper.h"
+#include "pipeline/ShardTransfer.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/db.h"
 #include "rocksdb/statistics.h"
@@ -49,12 +53,84 @@ void RedisHandler::read(Context* ctx, codec::RedisMessage req) {
   }
 }
 
+void RedisHandler::transportActive(Context* ctx) {
+  size_t maxConnections = maxConnections_;
+  if (maxConnections > 0 && getConnectionCount() > maxConnections) {
+    LOG(WARNING) << "Rejecting connection from " << getPeerAddressPortStr(ctx) << ": max number of clients reached";
+    write(ctx, codec::RedisMessage(-1, {codec::RedisValue::Type::kError, "ERR max number of clients reached"}));
+    close(ctx);
+    return;
+  }
+  ctx->fireTransportActive();
+}
+
+bool RedisHandler::admitKey(int64_t key, const std::string& dataKey, Context* ctx) {
+  int shard = clusterTopology_->getShard(dataKey);
+  std::string ownerAddress;
+  if (clusterTopology_->ownsShard(shard, &ownerAddress)) return true;
+
+  if (ownerAddress.empty()) {
+    writeError(key, folly::sformat("CLUSTERDOWN Virtual shard {} is not served", shard), ctx);
+  } else {
+    // redirects are expected while clients refresh their topology, so do not log them as errors
+    write(ctx, codec::RedisMessage(key, {codec::RedisValue::Type::kError,
+                                         folly::sformat("MOVED {} {}", shard, ownerAddress)}));
+  }
+  return false;
+}
+
+bool RedisHandler::forwardToShardOwner(int64_t key, CommandHandlerFunc handlerFunc, const std::string& dataKey,
+                                       const std::vector<std::string>& cmd, Context* ctx) {
+  size_t ownerThread = shardAffinity_->getShardThread(shardAffinity_->getShard(dataKey));
+  folly::EventBase* ownerEventBase = shardAffinity_->getThreadEventBase(ownerThread);
+  if (ownerEventBase->isInEventBaseThread()) {
+    shardAffinity_->recordCommand(false);
+    return false;
+  }
+
+  shardAffinity_->recordCommand(true);
+  folly::EventBase* connectionEventBase = ctx->getTransport()->getEventBase();
+  // keep the pipeline alive in case the connection closes while the command is in flight
+  auto pipeline = ctx->getPipelineShared();
+  std::shared_ptr<RedisHandler> ownerHandler = shardOwnerHandlers_[ownerThread];
+  ownerEventBase->runInEventBaseThread([this, key, ownerHandler, handlerFunc, cmd, ctx, connectionEventBase,
+                                        pipeline]() {
+    // Only the command crosses threads. This handler and the context belong to the connection thread, so the owner
+    // runs the command with its own handler, and the result is processed back on the connection thread.
+    auto result = std::make_shared<codec::RedisValue>((ownerHandler.get()->*handlerFunc)(cmd, nullptr));
+    CHECK(result->type() != codec::RedisValue::Type::kAsyncResult)
+        << "Commands with keys must reply synchronously with shard affinity";
+    connectionEventBase->runInEventBaseThread([this, key, result, ctx, pipeline]() {
+      processCommandHandlerResult(key, std::move(*result), ctx);
+    });
+  });
+  return true;
+}
+
+bool RedisHandler::admitWrite(int64_t key, const std::string& cmdNameLower, Context* ctx) {
+  auto writeStallController = databaseManager_->writeStallController();
+  if (!writeStallController) return true;
+
+  int64_t delayMs = writeStallController->clientWriteDelayMs();
+  if (delayMs == 0) return true;
+
+  // Never block the IO thread, which serves many other connections. Clients back off and retry instead.
+  // do not use writeError here since it logs every rejected write
+  LOG_EVERY_N(WARNING, 1000) << "Rejecting writes under write pressure " << writeStallController->pressure();
+  std::string retryAfter = delayMs < 0 ? "later" : folly::sformat("in {}ms", delayMs);
+  write(ctx, codec::RedisMessage(key, {codec::RedisValue::Type::kError,
+                                       folly::sformat("TRYAGAIN Write rejected for '{}' command: database is under "
+                                                      "write pressure, retry {}", cmdNameLower, retryAfter)}));
+  return false;
+}
+
 codec::RedisValue RedisHandler::infoCommand(const std::vector<std::string>& cmd, Context* ctx) {
   std::stringstream ss;
   if (cmd.size() >= 2 && cmd[1] == "dbstats") {
-    for (const auto& entry : databaseManager_->columnFamilyMap()) {
+    auto columnFamilyMap = databaseManager_->columnFamilyMap();
+    for (const auto& entry : *columnFamilyMap) {
       std::string dbStats;
-      db()->GetProperty(entry.second, "rocksdb.stats", &dbStats);
+      databaseManager_->db(entry.second)->GetProperty(entry.second, "rocksdb.stats", &dbStats);
       ss << dbStats;
     }
   } else {
@@ -78,27 +154,33 @@ void RedisHandler::appendToInfoOutput(std::stringstream* ss) {
 
   uint64_t value;
   // estimate live data size
-  db()->GetIntProperty(rocksdb::DB::Properties::kEstimateLiveDataSize, &value);
-  (*ss) << "estimate_live_data_size:" << value << std::endl;
-  (*ss) << "estimate_live_data_size_human:" << (value >> 20) << 'M' << std::endl;
+  uint64_t liveDataSize = 0;
+  uint64_t numKeys = 0;
+  for (auto db : databaseManager_->dbs()) {
+    if (db->GetIntProperty(rocksdb::DB::Properties::kEstimateLiveDataSize, &value)) liveDataSize += value;
+    if (db->GetIntProperty(rocksdb::DB::Properties::kEstimateNumKeys, &value)) numKeys += value;
+  }
+  (*ss) << "estimate_live_data_size:" << liveDataSize << std::endl;
+  (*ss) << "estimate_live_data_size_human:" << (liveDataSize >> 20) << 'M' << std::endl;
 
   // estimate number of keys
-  db()->GetIntProperty(rocksdb::DB::Properties::kEstimateNumKeys, &value);
-  (*ss) << "estimate_num_keys:" << value << std::endl;
+  (*ss) << "estimate_num_keys:" << numKeys << std::endl;
 
   // memory usage
   uint64_t totalUsedMemory = 0;
-  for (const auto& entry : databaseManager_->columnFamilyMap()) {
+  auto columnFamilyMap = databaseManager_->columnFamilyMap();
+  for (const auto& entry : *columnFamilyMap) {
     rocksdb::ColumnFamilyHandle* columnFamily = entry.second;
+    rocksdb::DB* db = databaseManager_->db(columnFamily);
     uint64_t usedMemory = 0;
-    db()->GetIntProperty(columnFamily, rocksdb::DB::Properties::kEstimateTableReadersMem, &value);
+    db->GetIntProperty(columnFamily, rocksdb::DB::Properties::kEstimateTableReadersMem, &value);
     (*ss) << columnFamily->GetName() << "_cf_table_reader_memory:" << value << std::endl;
     (*ss) << columnFamily->GetName() << "_cf_table_reader_human:" << (value >> 20) << 'M' << std::endl;
     usedMemory += value;
-    db()->GetIntProperty(columnFamily, rocksdb::DB::Properties::kSizeAllMemTables, &value);
+    db->GetIntProperty(columnFamily, rocksdb::DB::Properties::kSizeAllMemTables, &value);
     usedMemory += value;
     // block cache usage
-    std::shared_ptr<rocksdb::TableFactory> tableFactory = db()->GetOptions(columnFamily).table_factory;
+    std::shared_ptr<rocksdb::TableFactory> tableFactory = db->GetOptions(columnFamily).table_factory;
     if (strcmp(tableFactory->Name(), "BlockBasedTable") == 0) {
       rocksdb::BlockBasedTableOptions* tableOptions = static_cast<rocksdb::BlockBasedTableOptions*>(
           tableFactory->GetOptions());
@@ -121,6 +203,17 @@ void RedisHandler::appendToInfoOutput(std::stringstream* ss) {
   uint64_t blockCacheHit = statistics->getTickerCount(rocksdb::Tickers::BLOCK_CACHE_HIT);
   uint64_t blockCacheMiss = statistics->getTickerCount(rocksdb::Tickers::BLOCK_CACHE_MISS);
   (*ss) << "block_cache_hit_ratio:" << double(blockCacheHit) / (blockCacheHit + blockCacheMiss) << std::endl;
+  // index and filter blocks only go through the block cache when they are partitioned or cached explicitly
+  uint64_t indexHit = statistics->getTickerCount(rocksdb::Tickers::BLOCK_CACHE_INDEX_HIT);
+  uint64_t indexMiss = statistics->getTickerCount(rocksdb::Tickers::BLOCK_CACHE_INDEX_MISS);
+  if (indexHit + indexMiss > 0) {
+    (*ss) << "block_cache_index_hit_ratio:" << double(indexHit) / (indexHit + indexMiss) << std::endl;
+  }
+  uint64_t filterHit = statistics->getTickerCount(rocksdb::Tickers::BLOCK_CACHE_FILTER_HIT);
+  uint64_t filterMiss = statistics->getTickerCount(rocksdb::Tickers::BLOCK_CACHE_FILTER_MISS);
+  if (filterHit + filterMiss > 0) {
+    (*ss) << "block_cache_filter_hit_ratio:" << double(filterHit) / (filterHit + filterMiss) << std::endl;
+  }
 
   rocksdb::HistogramData histData;
   // get time histogram
@@ -135,10 +228,42 @@ void RedisHandler::appendToInfoOutput(std::stringstream* ss) {
   statistics->histogramData(rocksdb::Histograms::COMPACTION_TIME, &histData);
   outputStatistics("compaction", histData, ss);
 
+  auto writeStallController = databaseManager_->writeStallController();
+  if (writeStallController) {
+    (*ss) << "write_stall_pressure:" << writeStallController->pressure() << std::endl;
+    (*ss) << "write_stall_consumer_delay_ms:" << writeStallController->consumerDelayMs() << std::endl;
+    (*ss) << "write_stall_client_delay_ms:" << writeStallController->clientWriteDelayMs() << std::endl;
+  }
+
   if (consumerHelper_) {
     (*ss) << std::endl << "# Kafka" << std::endl;
     consumerHelper_->appendStatsInRedisInfoFormat(ss);
   }
+
+  auto hotKeySampler = databaseManager_->hotKeySampler();
+  if (hotKeySampler->sampleRate() > 0 || hotKeySampler->isWarmingUp()) {
+    (*ss) << std::endl << "# Cache" << std::endl;
+    hotKeySampler->appendStatsInRedisInfoFormat(ss);
+  }
+
+  if (shardAffinity_) {
+    (*ss) << std::endl << "# ShardAffinity" << std::endl;
+    shardAffinity_->appendStatsInRedisInfoFormat(ss);
+  }
+
+  auto backupManager = databaseManager_->backupManager();
+  if (backupManager) {
+    (*ss) << std::endl << "# Backup" << std::endl;
+    backupManager->appendStatsInRedisInfoFormat(ss);
+  }
+  for (const auto& instance : databaseManager_->rocksDbInstances()) {
+    if (!instance.backupManager) continue;
+    (*ss) << std::endl << "# Backup " << instance.name << std::endl;
+    instance.backupManager->appendStatsInRedisInfoFormat(ss);
+  }
+
+  (*ss) << std::endl << "# Background job" << std::endl;
+  databaseManager_->backgroundJobRunner()->appendStatsInRedisInfoFormat(ss);
 }
 
 void RedisHandler::outputStatistics(const std::string& name, const rocksdb::HistogramData& histData,
@@ -184,6 +309,183 @@ codec::RedisValue RedisHandler::thawCommand(const std::vector<std::string>& cmd,
   return simpleStringOk();
 }
 
+// BACKUP [INSTANCE <name>] CREATE [FLUSH]
+// BACKUP [INSTANCE <name>] LIST
+// BACKUP [INSTANCE <name>] PURGE <number of backups to keep>
+// BACKUP [INSTANCE <name>] CHECKPOINT <directory>
+//
+// Each RocksDB instance is backed up on its own into its own backup directory with its own backup ids. Backups of
+// different instances are not taken at the same point in time, so the commands only cover the primary instance unless
+// a secondary instance is named with INSTANCE.
+codec::RedisValue RedisHandler::backupCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  auto backupManager = databaseManager()->backupManager();
+  if (!backupManager) return errorResp("Backups are not enabled");
+
+  // the subcommand and its arguments
+  std::vector<std::string> args(cmd.begin() + 1, cmd.end());
+  if (boost::to_lower_copy(args[0]) == "instance") {
+    if (args.size() < 3) return errorResp(folly::sformat(kWrongNumArgsTemplate, "backup instance"));
+    backupManager = nullptr;
+    for (const auto& instance : databaseManager()->rocksDbInstances()) {
+      if (instance.name == args[1]) backupManager = instance.backupManager;
+    }
+    if (!backupManager) return errorResp(folly::sformat("Unknown RocksDB instance: '{}'", args[1]));
+    args.erase(args.begin(), args.begin() + 2);
+  }
+
+  std::string subCommand = boost::to_lower_copy(args[0]);
+  std::string error;
+  if (subCommand == "create") {
+    if (args.size() > 2) return errorResp(folly::sformat(kWrongNumArgsTemplate, "backup create"));
+    bool flushBeforeBackup = args.size() == 2 && boost::to_lower_copy(args[1]) == "flush";
+    if (args.size() == 2 && !flushBeforeBackup) return errorResp(folly::sformat("Unknown option: '{}'", args[1]));
+    if (!backupManager->startBackup(flushBeforeBackup, &error)) return errorResp(std::move(error));
+    // the backup runs in the background, check INFO for its progress
+    return simpleStringOk();
+  } else if (subCommand == "list") {
+    if (args.size() != 1) return errorResp(folly::sformat(kWrongNumArgsTemplate, "backup list"));
+    std::vector<rocksdb::BackupInfo> backupInfos;
+    if (!backupManager->getBackupInfo(&backupInfos, &error)) return errorResp(std::move(error));
+    std::vector<std::string> result;
+    for (const auto& backupInfo : backupInfos) {
+      result.push_back(folly::sformat("id:{} timestamp:{} size:{} files:{}", backupInfo.backup_id,
+                                      backupInfo.timestamp, backupInfo.size, backupInfo.number_files));
+    }
+    return codec::RedisValue(std::move(result));
+  } else if (subCommand == "purge") {
+    int64_t numBackupsToKeep;
+    if (args.size() != 2 || !parseInt(args[1], &numBackupsToKeep) || numBackupsToKeep < 1) {
+      return errorResp("BACKUP PURGE requires a positive number of backups to keep");
+    }
+    if (!backupManager->purgeOldBackups(numBackupsToKeep, &error)) return errorResp(std::move(error));
+    return simpleStringOk();
+  } else if (subCommand == "checkpoint") {
+    if (args.size() != 2) return errorResp(folly::sformat(kWrongNumArgsTemplate, "backup checkpoint"));
+    if (!backupManager->createCheckpoint(args[1], &error)) return errorResp(std::move(error));
+    return simpleStringOk();
+  }
+
+  return errorResp(folly::sformat("Unknown BACKUP subcommand: '{}'", subCommand));
+}
+
+// CFGROUP MEMBERS <group>
+// CFGROUP CREATE <group> <column family>
+// CFGROUP DROP <group> <column family>
+// CFGROUP MAPPING <group>
+// CFGROUP RESHARDPLAN <group> <member count>
+//
+// Grow or shrink a column family group without a restart. New members are appended to the group and only the last
+// member can be dropped. New members must be named `<group>-<member count>`, which puts them back in place on restart.
+// RESHARDPLAN starts a background job scanning the group with its shard key function, reported in INFO. The result
+// is the number of keys and of keys that would move with the given number of members, followed by
+// `<source member>-><target member index>:<key count>` for every pair of members that keys move between.
+codec::RedisValue RedisHandler::cfGroupCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  std::string subCommand = boost::to_lower_copy(cmd[1]);
+  std::string error;
+  if (subCommand == "members") {
+    if (cmd.size() != 3) return errorResp(folly::sformat(kWrongNumArgsTemplate, "cfgroup members"));
+    auto columnFamilyGroupMap = databaseManager()->columnFamilyGroupMap();
+    auto it = columnFamilyGroupMap->find(cmd[2]);
+    if (it == columnFamilyGroupMap->end()) {
+      return errorResp(folly::sformat("Column family group not found: {}", cmd[2]));
+    }
+    std::vector<std::string> result;
+    for (auto columnFamily : it->second) {
+      result.push_back(columnFamily->GetName());
+    }
+    return codec::RedisValue(std::move(result));
+  } else if (subCommand == "create" || subCommand == "drop") {
+    if (cmd.size() != 4) return errorResp(folly::sformat(kWrongNumArgsTemplate, "cfgroup " + subCommand));
+    bool ok = subCommand == "create" ? databaseManager()->createColumnFamilyGroupMember(cmd[2], cmd[3], &error)
+                                     : databaseManager()->dropColumnFamilyGroupMember(cmd[2], cmd[3], &error);
+    if (!ok) return errorResp(std::move(error));
+    return simpleStringOk();
+  } else if (subCommand == "mapping") {
+    if (cmd.size() != 3) return errorResp(folly::sformat(kWrongNumArgsTemplate, "cfgroup mapping"));
+    if (databaseManager()->columnFamilyGroupMap()->count(cmd[2]) == 0) {
+      return errorResp(folly::sformat("Column family group not found: {}", cmd[2]));
+    }
+    return codec::RedisValue(codec::RedisValue::Type::kSimpleString,
+                             ShardMapper::getMappingName(databaseManager()->getShardMapping(cmd[2])));
+  } else if (subCommand == "reshardplan") {
+    int64_t memberCount;
+    if (cmd.size() != 4 || !parseInt(cmd[3], &memberCount) || memberCount < 1 ||
+        memberCount > std::numeric_limits<int>::max()) {
+      return errorResp("CFGROUP RESHARDPLAN requires a group and a positive number of members");
+    }
+    auto columnFamilyGroupMap = databaseManager()->columnFamilyGroupMap();
+    auto it = columnFamilyGroupMap->find(cmd[2]);
+    if (it == columnFamilyGroupMap->end() || it->second.empty()) {
+      return errorResp(folly::sformat("Column family group not found: {}", cmd[2]));
+    }
+    auto databaseManager = this->databaseManager();
+    // dropped members stay valid until shutdown, which waits for the job
+    std::vector<rocksdb::ColumnFamilyHandle*> columnFamilyGroup = it->second;
+    std::string groupName = cmd[2];
+    bool started = databaseManager->backgroundJobRunner()->startJob(
+        folly::sformat("reshardplan {} {}", groupName, memberCount),
+        [databaseManager, columnFamilyGroup, groupName, memberCount](std::string* result) {
+          ShardMapper::ReshardPlan plan;
+          if (!ShardMapper::planReshard(databaseManager->db(columnFamilyGroup[0]), columnFamilyGroup,
+                                        databaseManager->getShardMapping(groupName), static_cast<int>(memberCount),
+                                        &plan, result, databaseManager->getShardKeyFunction(groupName))) {
+            return false;
+          }
+          *result = folly::sformat("keys:{} moved_keys:{}", plan.keyCount, plan.movedKeyCount);
+          for (const auto& move : plan.moves) {
+            *result += folly::sformat(" {}->{}:{}", columnFamilyGroup[move.first.first]->GetName(), move.first.second,
+                                      move.second);
+          }
+          return true;
+        },
+        &error);
+    if (!started) return errorResp(std::move(error));
+    return simpleStringOk();
+  }
+
+  return errorResp(folly::sformat("Unknown CFGROUP subcommand: '{}'", subCommand));
+}
+
+// CLUSTER SLOTS
+// CLUSTER KEYSLOT <key>
+//
+// Similar to redis cluster, but slots are virtual shards. SLOTS replies with an array of [first shard, last shard,
+// [host, port]] for every range of consecutive virtual shards owned by a node, starting with this node.
+codec::RedisValue RedisHandler::clusterCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  if (!clusterTopology_) return errorResp("Cluster support is not enabled");
+
+  std::string subCommand = boost::to_lower_copy(cmd[1]);
+  if (subCommand == "slots") {
+    if (cmd.size() != 2) return errorResp(folly::sformat(kWrongNumArgsTemplate, "cluster slots"));
+    std::vector<codec::RedisValue> result;
+    for (const auto& node : clusterTopology_->getNodes()) {
+      size_t pos = node.address.rfind(':');
+      std::string host = node.address.substr(0, pos);
+      int64_t port = 0;
+      if (pos != std::string::npos) parseInt(node.address.substr(pos + 1), &port);
+      for (size_t i = 0; i < node.shards.size();) {
+        size_t j = i;
+        while (j + 1 < node.shards.size() && node.shards[j + 1] == node.shards[j] + 1) j++;
+        std::vector<codec::RedisValue> address;
+        address.emplace_back(codec::RedisValue::Type::kBulkString, std::string(host));
+        address.emplace_back(port);
+        std::vector<codec::RedisValue> range;
+        range.emplace_back(static_cast<int64_t>(node.shards[i]));
+        range.emplace_back(static_cast<int64_t>(node.shards[j]));
+        range.emplace_back(std::move(address));
+        result.emplace_back(std::move(range));
+        i = j + 1;
+      }
+    }
+    return codec::RedisValue(std::move(result));
+  } else if (subCommand == "keyslot") {
+    if (cmd.size() != 3) return errorResp(folly::sformat(kWrongNumArgsTemplate, "cluster keyslot"));
+    return codec::RedisValue(static_cast<int64_t>(clusterTopology_->getShard(cmd[2])));
+  }
+
+  return errorResp(folly::sformat("Unknown CLUSTER subcommand: '{}'", subCommand));
+}
+
 codec::RedisValue RedisHandler::compactCommand(const std::vector<std::string>& cmd, Context* ctx) {
   int args = cmd.size();
   std::string columnFamilyName = args > 1 ? cmd[1] : rocksdb::kDefaultColumnFamilyName;
@@ -215,11 +517,226 @@ codec::RedisValue RedisHandler::compactCommand(const std::vector<std::string>& c
   return simpleStringOk();
 }
 
+// EXPORTSHARD <column family> <directory> [<kafka offset key>]
+//
+// Export a consistent snapshot of a column family and the consumer offset committed along with it into SST files in
+// a new directory for IMPORTSHARD on another node. The export runs as a background job reported in INFO, and the
+// manifest is only written once every SST file is complete.
+codec::RedisValue RedisHandler::exportShardCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  rocksdb::ColumnFamilyHandle* columnFamily = databaseManager()->getColumnFamily(cmd[1]);
+  if (!columnFamily) return errorResp(folly::sformat("Column family not found: {}", cmd[1]));
+  std::string offsetKey = cmd.size() == 4 ? cmd[3] : "";
+
+  auto databaseManager = this->databaseManager();
+  std::string dir = cmd[2];
+  std::string error;
+  bool started = databaseManager->backgroundJobRunner()->startJob(
+      folly::sformat("exportshard {}", cmd[1]),
+      [databaseManager, columnFamily, offsetKey, dir](std::string* result) {
+        infra::kafka::store::IngestManifest manifest;
+        if (!ShardTransfer::exportShard(databaseManager->db(columnFamily), columnFamily, databaseManager->db(),
+                                        databaseManager->getMetadataColumnFamily(), offsetKey, dir, &manifest,
+                                        result)) {
+          return false;
+        }
+        *result = folly::sformat("{} SST files in {}", manifest.sstFiles.size(), dir);
+        return true;
+      },
+      &error);
+  if (!started) return errorResp(std::move(error));
+  return simpleStringOk();
+}
+
+// IMPORTSHARD <column family group> <column family> <directory> [<kafka offset key>]
+//
+// Import a directory written by EXPORTSHARD into a member of a column family group, creating the member when it does
+// not exist yet. With an offset key, the consumer offset is rewound to the exported one so that the consumer catches
+// up from there once it starts. The files are copied by a background job reported in INFO.
+codec::RedisValue RedisHandler::importShardCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  std::string offsetKey = cmd.size() == 5 ? cmd[4] : "";
+  if (!offsetKey.empty() && consumerHelper_ && consumerHelper_->isLinked(offsetKey)) {
+    // a running consumer would overwrite the committed offset
+    return errorResp(folly::sformat("A consumer is running for offset key: {}", offsetKey));
+  }
+
+  auto databaseManager = this->databaseManager();
+  std::string groupName = cmd[1];
+  std::string columnFamilyName = cmd[2];
+  std::string dir = cmd[3];
+  std::string error;
+  bool started = databaseManager->backgroundJobRunner()->startJob(
+      folly::sformat("importshard {}", columnFamilyName),
+      [databaseManager, groupName, columnFamilyName, dir, offsetKey](std::string* result) {
+        if (!ShardTransfer::importShard(databaseManager, groupName, columnFamilyName, dir, offsetKey, result)) {
+          return false;
+        }
+        *result = folly::sformat("imported {} into {}", dir, columnFamilyName);
+        return true;
+      },
+      &error);
+  if (!started) return errorResp(std::move(error));
+  return simpleStringOk();
+}
+
+// INGEST <column family> <directory> <kafka offset key> [OVERWRITE]
+//
+// Ingest SST files built by kafka_store_sst_builder and commit the kafka and file offsets from their manifest, so
+// that the kafka store consumer with the given offset key continues right after the ingested messages. The files
+// carry no deletions and their values replace existing ones, so the column family must be empty unless OVERWRITE is
+// given. Ingesting again once the manifest offsets are committed does nothing. The files are copied by a background
+// job reported in INFO and stay in the directory, so a failed ingestion can be retried with OVERWRITE.
+codec::RedisValue RedisHandler::ingestCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  rocksdb::ColumnFamilyHandle* columnFamily = databaseManager()->getColumnFamily(cmd[1]);
+  if (!columnFamily) return errorResp(folly::sformat("Column family not found: {}", cmd[1]));
+  std::string dir = cmd[2];
+  std::string offsetKey = cmd[3];
+  bool overwrite = false;
+  if (cmd.size() == 5) {
+    if (boost::to_lower_copy(cmd[4]) != "overwrite") return errorResp(folly::sformat("Invalid option: {}", cmd[4]));
+    overwrite = true;
+  }
+  if (consumerHelper_ && consumerHelper_->isLinked(offsetKey)) {
+    // a running consumer would overwrite the committed offsets
+    return errorResp(folly::sformat("A consumer is running for offset key: {}", offsetKey));
+  }
+
+  infra::kafka::store::IngestManifest manifest;
+  if (!manifest.read(dir)) return errorResp(folly::sformat("Cannot read ingest manifest in {}", dir));
+  std::string offsets = infra::kafka::ConsumerHelper::encodeKafkaAndFileOffsets(manifest.nextKafkaOffset,
+                                                                                manifest.nextFileOffset);
+  std::string committedOffsets;
+  rocksdb::Status status =
+      db()->Get(rocksdb::ReadOptions(), databaseManager()->getMetadataColumnFamily(), offsetKey, &committedOffsets);
+  if (status.ok() && committedOffsets == offsets) {
+    LOG(INFO) << "Files in " << dir << " are already ingested into " << cmd[1];
+    return simpleStringOk();
+  }
+  if (!status.ok() && !status.IsNotFound()) {
+    return errorResp(folly::sformat("Reading committed offsets failed: {}", status.ToString()));
+  }
+  if (!overwrite) {
+    rocksdb::ReadOptions readOptions;
+    readOptions.fill_cache = false;
+    std::unique_ptr<rocksdb::Iterator> iter(databaseManager()->db(columnFamily)->NewIterator(readOptions,
+                                                                                              columnFamily));
+    iter->SeekToFirst();
+    if (iter->Valid()) {
+      return errorResp(folly::sformat("Column family {} is not empty, ingest with OVERWRITE to replace its values",
+                                      cmd[1]));
+    }
+  }
+
+  auto databaseManager = this->databaseManager();
+  std::string columnFamilyName = cmd[1];
+  std::string error;
+  bool started = databaseManager->backgroundJobRunner()->startJob(
+      folly::sformat("ingest {}", columnFamilyName),
+      [databaseManager, columnFamily, columnFamilyName, dir, offsetKey, offsets, manifest](std::string* result) {
+        std::vector<std::string> sstPaths;
+        for (const auto& sstFile : manifest.sstFiles) {
+          sstPaths.push_back(folly::sformat("{}/{}", dir, sstFile));
+        }
+        rocksdb::IngestExternalFileOptions options;
+        // copy the files so that they are still there when the command is retried
+        options.move_files = false;
+        rocksdb::Status status = databaseManager->db(columnFamily)->IngestExternalFile(columnFamily, sstPaths,
+                                                                                       options);
+        if (!status.ok()) {
+          *result = folly::sformat("Ingesting SST files failed: {}", status.ToString());
+          return false;
+        }
+
+        // RocksDB cannot ingest files and write offsets atomically, so offsets are committed only after the files
+        // are ingested
+        status = databaseManager->db()->Put(rocksdb::WriteOptions(), databaseManager->getMetadataColumnFamily(),
+                                            offsetKey, offsets);
+        if (!status.ok()) {
+          *result = folly::sformat("Committing offsets failed: {}", status.ToString());
+          return false;
+        }
+        *result = folly::sformat("ingested {} SST files into {}, next kafka offset {}", sstPaths.size(),
+                                 columnFamilyName, manifest.nextKafkaOffset);
+        return true;
+      },
+      &error);
+  if (!started) return errorResp(std::move(error));
+  return simpleStringOk();
+}
+
+// CONFIG GET <option> [column family or group]
+// CONFIG SET <option> <value> [column family or group]
+codec::RedisValue RedisHandler::configCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  std::string subCommand = boost::to_lower_copy(cmd[1]);
+  std::string error;
+  if (subCommand == "get") {
+    if (cmd.size() > 4) return errorResp(folly::sformat(kWrongNumArgsTemplate, "config get"));
+    std::string value;
+    if (!databaseManager()->getConfig(cmd[2], cmd.size() == 4 ? cmd[3] : "", &value, &error)) {
+      return errorResp(std::move(error));
+    }
+    // same reply format as redis: a pair of option name and value
+    return codec::RedisValue(std::vector<std::string>{cmd[2], std::move(value)});
+  } else if (subCommand == "set") {
+    if (cmd.size() < 4) return errorResp(folly::sformat(kWrongNumArgsTemplate, "config set"));
+    if (!databaseManager()->setConfig(cmd[2], cmd[3], cmd.size() == 5 ? cmd[4] : "", &error)) {
+      return errorResp(std::move(error));
+    }
+    return simpleStringOk();
+  }
+
+  return errorResp(folly::sformat("Unknown CONFIG subcommand: '{}'", subCommand));
+}
+
+// DEADLETTER LIST <scheduled task column family> [<count>]
+// DEADLETTER REQUEUE <scheduled task column family> [<data key>]
+// DEADLETTER PURGE <scheduled task column family> [<data key>]
+//
+// Inspect the tasks of a scheduled task queue that failed every attempt of its retry policy. LIST replies with
+// [data key, scheduled time in ms, attempts, value] for up to count tasks, 100 by default. REQUEUE schedules the tasks
+// of the data key, or all of them, to run now with a fresh attempt count, and PURGE drops them. Both reply with the
+// number of tasks.
+codec::RedisValue RedisHandler::deadLetterCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  std::string subCommand = boost::to_lower_copy(cmd[1]);
+  auto it = scheduledTaskQueues_.find(cmd[2]);
+  if (it == scheduledTaskQueues_.end() || !it->second->retryEnabled()) {
+    return errorResp(folly::sformat("No dead letters for scheduled task column family: {}", cmd[2]));
+  }
+  std::string dataKey = cmd.size() == 4 ? cmd[3] : "";
+  if (subCommand == "list") {
+    int64_t count = 100;
+    if (cmd.size() == 4 && (!parseInt(cmd[3], &count) || count < 1)) {
+      return errorResp("DEADLETTER LIST requires a positive count");
+    }
+    std::vector<infra::ScheduledTask> tasks;
+    it->second->scanDeadLetters(count, &tasks);
+    std::vector<codec::RedisValue> result;
+    for (const auto& task : tasks) {
+      std::vector<codec::RedisValue> entry;
+      entry.emplace_back(codec::RedisValue::Type::kBulkString, std::string(task.dataKey()));
+      entry.emplace_back(task.scheduledTimeMs());
+      entry.emplace_back(static_cast<int64_t>(task.attempts()));
+      entry.emplace_back(codec::RedisValue::Type::kBulkString, std::string(task.value()));
+      result.emplace_back(std::move(entry));
+    }
+    return codec::RedisValue(std::move(result));
+  } else if (subCommand == "requeue") {
+    return codec::RedisValue(static_cast<int64_t>(it->second->requeueDeadLetters(dataKey)));
+  } else if (subCommand == "purge") {
+    return codec::RedisValue(static_cast<int64_t>(it->second->purgeDeadLetters(dataKey)));
+  }
+
+  return errorResp(folly::sformat("Unknown DEADLETTER subcommand: '{}'", subCommand));
+}
+
 codec::RedisValue RedisHandler::pingCommand(const std::vector<std::string>& cmd, Context* ctx) {
   return { codec::RedisValue::Type::kSimpleString, "PONG" };
 }
 
 codec::RedisValue RedisHandler::readyCommand(const std::vector<std::string>& cmd, Context* ctx) {
+  if (databaseManager_->hotKeySampler()->isWarmingUp()) {
+    // Not ready until the block cache is warmed up or the warm-up budget runs out
+    return codec::RedisValue(0);
+  }
   if (consumerHelper_) {
     // Not ready if lagging
     return codec::RedisValue(consumerHelper_->isLagging() ? 0 : 1);
@@ -355,6 +872,11 @@ bool RedisHandler::validateArgCount(const std::vector<std::string>& cmd, int min
 constexpr char RedisHandler::kWrongNumArgsTemplate[];
 
 std::atomic<size_t> RedisHandler::connectionCount_;
+std::atomic<size_t> RedisHandler::maxConnections_;
+std::shared_ptr<ClusterTopology> RedisHandler::clusterTopology_;
+std::shared_ptr<ShardAffinity> RedisHandler::shardAffinity_;
+std::vector<std::shared_ptr<RedisHandler>> RedisHandler::shardOwnerHandlers_;
+RedisHandler::ScheduledTaskQueueMap RedisHandler::scheduledTaskQueues_;
 std::vector<RedisHandler::Context*> RedisHandler::monitors_;
 std::mutex RedisHandler::monitorMutex_;
 
@@ -15,10 +15,13 @@
 #include "folly/Conv.h"
 #include "folly/SocketAddress.h"
 #include "glog/logging.h"
+#include "infra/ScheduledTaskQueue.h"
 #include "infra/kafka/ConsumerHelper.h"
 #include "rocksdb/db.h"
 #include "rocksdb/statistics.h"
+#include "pipeline/ClusterTopology.h"
 #include "pipeline/DatabaseManager.h"
+#include "pipeline/ShardAffinity.h"
 #include "wangle/channel/Handler.h"
 
 namespace pipeline {
@@ -61,6 +64,35 @@ class RedisHandler : public wangle::HandlerAdapter<codec::RedisMessage> {
   static void connectionClosed() { connectionCount_--; }
   static size_t getConnectionCount() { return connectionCount_; }
 
+  // Limit the number of client connections. 0 means unlimited.
+  static void setMaxConnections(size_t maxConnections) { maxConnections_ = maxConnections; }
+  static size_t getMaxConnections() { return maxConnections_; }
+
+  // Redirect commands for keys of virtual shards owned by other nodes. Only set it during startup before serving
+  // requests.
+  static void setClusterTopology(std::shared_ptr<ClusterTopology> clusterTopology) {
+    clusterTopology_ = clusterTopology;
+  }
+  static std::shared_ptr<ClusterTopology> getClusterTopology() { return clusterTopology_; }
+
+  // Run commands with keys on the IO thread owning the virtual shard of the key, with the handler dedicated to that
+  // thread in ownerHandlers, which follows the order of the threads of the shard affinity. Only set it during startup
+  // before serving requests. Redis pipelines must then keep the responses in order with OrderedRedisMessageAdapter.
+  static void setShardAffinity(std::shared_ptr<ShardAffinity> shardAffinity,
+                               std::vector<std::shared_ptr<RedisHandler>> ownerHandlers) {
+    CHECK_EQ(shardAffinity->threadCount(), ownerHandlers.size());
+    shardAffinity_ = shardAffinity;
+    shardOwnerHandlers_ = std::move(ownerHandlers);
+  }
+  static std::shared_ptr<ShardAffinity> getShardAffinity() { return shardAffinity_; }
+
+  // Scheduled task queues by column family name, whose dead letters the DEADLETTER command inspects. Only set it
+  // during startup before serving requests.
+  using ScheduledTaskQueueMap = std::unordered_map<std::string, std::shared_ptr<infra::ScheduledTaskQueue>>;
+  static void setScheduledTaskQueues(const ScheduledTaskQueueMap& scheduledTaskQueues) {
+    scheduledTaskQueues_ = scheduledTaskQueues;
+  }
+
   // DatabaseManager is required while ConsumerHelper is optional
   RedisHandler(std::shared_ptr<DatabaseManager> databaseManager,
                std::shared_ptr<infra::kafka::ConsumerHelper> consumerHelper)
@@ -73,6 +105,9 @@ class RedisHandler : public wangle::HandlerAdapter<codec::RedisMessage> {
 
   void read(Context* ctx, codec::RedisMessage req) override;
 
+  // Reject new connections once the connection limit is reached
+  void transportActive(Context* ctx) override;
+
   void readEOF(Context* ctx) override { close(ctx); }
   void readException(Context* ctx, folly::exception_wrapper e) override { close(ctx); }
 
@@ -95,8 +130,12 @@ class RedisHandler : public wangle::HandlerAdapter<codec::RedisMessage> {
     auto handlerEntry = getCommandHandlerTable().find(cmdNameLower);
     if (handlerEntry == getCommandHandlerTable().end()) return false;
 
-    if (verifyCommandHandler(key, cmdNameLower, cmd, handlerEntry->second, ctx)) {
-      processCommandHandlerResult(key, (this->*(handlerEntry->second.handlerFunc))(cmd, ctx), ctx);
+    const auto& commandHandler = handlerEntry->second;
+    if (verifyCommandHandler(key, cmdNameLower, cmd, commandHandler, ctx)) {
+      if (commandHandler.keyIndex == 0 || !shardAffinity_ ||
+          !forwardToShardOwner(key, commandHandler.handlerFunc, cmd[commandHandler.keyIndex], cmd, ctx)) {
+        processCommandHandlerResult(key, (this->*(commandHandler.handlerFunc))(cmd, ctx), ctx);
+      }
     }
 
     // Verification may have failed, but it is a known command regardless. Return true to ask caller to stop searching.
@@ -117,8 +156,16 @@ class RedisHandler : public wangle::HandlerAdapter<codec::RedisMessage> {
     FuncType handlerFunc = nullptr;
     int minArgs = 0;
     int maxArgs = 0;
-    CommandHandler(FuncType _handlerFunc, int _minArgs, int _maxArgs)
-        : handlerFunc(_handlerFunc), minArgs(_minArgs), maxArgs(_maxArgs) {}
+    // Write commands are rejected under write stall backpressure. Leave it off for admin commands, which must keep
+    // working under pressure.
+    bool isWrite = false;
+    // Position of the key in the command for cluster routing and shard affinity, 0 for commands without keys. It must
+    // not exceed minArgs. Commands with keys may run on another IO thread than the one of the connection, with the
+    // handler of that thread and a null context, so they must not depend on the connection and must reply
+    // synchronously.
+    int keyIndex = 0;
+    CommandHandler(FuncType _handlerFunc, int _minArgs, int _maxArgs, bool _isWrite = false, int _keyIndex = 0)
+        : handlerFunc(_handlerFunc), minArgs(_minArgs), maxArgs(_maxArgs), isWrite(_isWrite), keyIndex(_keyIndex) {}
   };
   template <typename CommandHandlerFuncType>
   using GenericCommandHandlerTable = std::unordered_map<std::string, CommandHandler<CommandHandlerFuncType>>;
@@ -131,10 +178,18 @@ class RedisHandler : public wangle::HandlerAdapter<codec::RedisMessage> {
   static CommandHandlerTable mergeWithDefaultCommandHandlerTable(const CommandHandlerTable& newTable) {
     CommandHandlerTable baseTable({
       // default command handlers
+      { "backup", { &RedisHandler::backupCommand, 1, 4 } },
+      { "cfgroup", { &RedisHandler::cfGroupCommand, 2, 3 } },
+      { "cluster", { &RedisHandler::clusterCommand, 1, 2 } },
       { "compact", { &RedisHandler::compactCommand, 0, 3 } },
+      { "config", { &RedisHandler::configCommand, 2, 4 } },
+      { "deadletter", { &RedisHandler::deadLetterCommand, 2, 3 } },
+      { "exportshard", { &RedisHandler::exportShardCommand, 2, 3 } },
       { "freeze", { &RedisHandler::freezeCommand, 0, 0 } },
       { "getmeta", { &RedisHandler::getMetaCommand, 1, 1 } },
+      { "importshard", { &RedisHandler::importShardCommand, 3, 4 } },
       { "info", { &RedisHandler::infoCommand, 0, 1 } },
+      { "ingest", { &RedisHandler::ingestCommand, 3, 4 } },
       { "monitor", { &RedisHandler::monitorCommand, 0, 0 } },
       { "ping", { &RedisHandler::pingCommand, 0, 0 } },
       { "ready", { &RedisHandler::readyCommand, 0, 0 } },
@@ -159,7 +214,8 @@ class RedisHandler : public wangle::HandlerAdapter<codec::RedisMessage> {
     }
   }
 
-  // Verify command handler function. Currently it only checks argument count.
+  // Verify command handler function. It checks argument count, redirects keys owned by other nodes, and admits write
+  // commands under write pressure.
   template <typename CommandHandlerFuncType>
   bool verifyCommandHandler(int64_t key, const std::string& cmdNameLower, const std::vector<std::string>& cmd,
                             const CommandHandler<CommandHandlerFuncType>& commandHandler, Context* ctx) {
@@ -167,10 +223,27 @@ class RedisHandler : public wangle::HandlerAdapter<codec::RedisMessage> {
       writeError(key, folly::sformat(kWrongNumArgsTemplate, cmdNameLower), ctx);
       return false;
     }
+    if (commandHandler.keyIndex > 0 && clusterTopology_ && !admitKey(key, cmd[commandHandler.keyIndex], ctx)) {
+      return false;
+    }
 
-    return true;
+    return !commandHandler.isWrite || admitWrite(key, cmdNameLower, ctx);
   }
 
+  // Write a MOVED redirect, or a CLUSTERDOWN error when no node owns the key, to the client unless this node owns the
+  // key. Return true if the command may proceed.
+  bool admitKey(int64_t key, const std::string& dataKey, Context* ctx);
+
+  // Run the command with the handler of the IO thread owning the shard of the key, and process the result on the
+  // thread of the connection. Return false without running it when the current thread is the owner.
+  bool forwardToShardOwner(int64_t key, CommandHandlerFunc handlerFunc, const std::string& dataKey,
+                           const std::vector<std::string>& cmd, Context* ctx);
+
+  // Reject a write command with a retryable TRYAGAIN error written to the client when the database is under write
+  // pressure. The error tells how long to back off while the pressure is moderate. Return true if the write may
+  // proceed.
+  bool admitWrite(int64_t key, const std::string& cmdNameLower, Context* ctx);
+
   // Process the result returned from command handler function.
   virtual void processCommandHandlerResult(int64_t key, codec::RedisValue&& result, Context* ctx) {
     // A sync command writes result directly. An async command may do so at a later time.
@@ -208,11 +281,24 @@ class RedisHandler : public wangle::HandlerAdapter<codec::RedisMessage> {
   static std::vector<Context*> monitors_;
   static std::mutex monitorMutex_;
   static std::atomic<size_t> connectionCount_;
-
+  static std::atomic<size_t> maxConnections_;
+  static std::shared_ptr<ClusterTopology> clusterTopology_;
+  static std::shared_ptr<ShardAffinity> shardAffinity_;
+  static std::vector<std::shared_ptr<RedisHandler>> shardOwnerHandlers_;
+  static ScheduledTaskQueueMap scheduledTaskQueues_;
+
+  codec::RedisValue backupCommand(const std::vector<std::string>& cmd, Context* ctx);
+  codec::RedisValue cfGroupCommand(const std::vector<std::string>& cmd, Context* ctx);
+  codec::RedisValue clusterCommand(const std::vector<std::string>& cmd, Context* ctx);
   codec::RedisValue compactCommand(const std::vector<std::string>& cmd, Context* ctx);
+  codec::RedisValue configCommand(const std::vector<std::string>& cmd, Context* ctx);
+  codec::RedisValue deadLetterCommand(const std::vector<std::string>& cmd, Context* ctx);
+  codec::RedisValue exportShardCommand(const std::vector<std::string>& cmd, Context* ctx);
   codec::RedisValue freezeCommand(const std::vector<std::string>& cmd, Context* ctx);
   codec::RedisValue getMetaCommand(const std::vector<std::string>& cmd, Context* ctx);
+  codec::RedisValue importShardCommand(const std::vector<std::string>& cmd, Context* ctx);
   codec::RedisValue infoCommand(const std::vector<std::string>& cmd, Context* ctx);
+  codec::RedisValue ingestCommand(const std::vector<std::string>& cmd, Context* ctx);
   codec::RedisValue monitorCommand(const std::vector<std::string>& cmd, Context* ctx);
   codec::RedisValue pingCommand(const std::vector<std::string>& cmd, Context* ctx);
   codec::RedisValue readyCommand(const std::vector<std::string>& cmd, Context* ctx);
@@ -1,17 +1,27 @@
 #include "pipeline/RedisPipelineBootstrap.h"
 
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
 #include <csignal>
+#include <cstdlib>
+#include <limits>
 #include <memory>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "folly/Conv.h"
 #include "folly/Format.h"
+#include "folly/String.h"
+#include "folly/executors/IOThreadPoolExecutor.h"
+#include "folly/executors/NamedThreadFactory.h"
 #include "folly/init/Init.h"
 #include "folly/json.h"
 #include "gflags/gflags.h"
@@ -22,8 +32,15 @@
 #include "infra/kafka/Producer.h"
 #include "infra/ScheduledTaskQueue.h"
 #include "librdkafka/rdkafkacpp.h"
+#include "pipeline/ClusterTopology.h"
+#include "pipeline/CompressionProfile.h"
+#include "pipeline/CounterMergeOperator.h"
 #include "pipeline/KafkaConsumerConfig.h"
+#include "pipeline/ShardAffinity.h"
+#include "prometheus/histogram_builder.h"
+#include "rocksdb/cache.h"
 #include "rocksdb/db.h"
+#include "rocksdb/filter_policy.h"
 #include "rocksdb/options.h"
 #include "rocksdb/statistics.h"
 #include "rocksdb/status.h"
@@ -47,6 +64,7 @@ DEFINE_bool(master_replica, false, "Is this service replica the master replica")
 
 // socket settings
 DEFINE_int32(connection_idle_timeout_ms, 600000, "Connection idle timeout. 10 minutes by default.");
+DEFINE_int32(max_connections, 0, "Maximum number of client connections. 0 means unlimited.");
 
 
 
@@ -58,6 +76,8 @@ DEFINE_string(rocksdb_db_paths, "", "RocksDB data paths (sizes in MB)");
 
 DEFINE_int32(rocksdb_parallelism, std::thread::hardware_concurrency(), "Parallelism for flush and compaction");
 DEFINE_int32(rocksdb_block_cache_size_mb, 512, "RocksDB block cache size in MB");
+// Recommended for large databases: index and filter memory otherwise grows with the data size
+DEFINE_bool(rocksdb_partition_index_filters, false, "Use partitioned index and filter blocks cached in block cache");
 DEFINE_bool(rocksdb_create_if_missing_one_off, false, "Create database when missing");
 // Convenience parameter to bootstrap the database without checking version_timestamp_ms
 // NOTE: prefer the `_one_off` version in production
@@ -72,6 +92,58 @@ DEFINE_bool(rocksdb_create_if_missing, false, "Create database when missing with
 ///}
 DEFINE_string(rocksdb_cf_group_configs, "{}", "RocksDB column family group configurations");
 DEFINE_string(rocksdb_drop_cf_group_configs, "{}", "Same as rocksdb_cf_group_configs but specify the ones to drop");
+// Select how keys map to the members of column family groups, e.g., {"node-to-smyte": "jump"}. Groups not listed
+// keep their recorded mapping.
+DEFINE_string(rocksdb_cf_group_shard_mappings, "{}", "Shard mapping by column family group, `modulo` or `jump`");
+// Secondary RocksDB instances holding whole column family groups, e.g.,
+// {"remote": {"db_path": "/data/remote", "wal_dir": "/wal/remote", "cf_groups": ["node-to-smyte"]}}
+DEFINE_string(rocksdb_instances, "{}", "Secondary RocksDB instances holding column family groups in JSON");
+// Select compression profiles for column families or column family groups, e.g.,
+// {
+//    "node-to-smyte": "zstd-dict",
+//    "default": "zstd"
+// }
+// See CompressionProfile for available profiles. Column families not listed keep the compression set by their
+// configurators.
+DEFINE_string(rocksdb_compression_profiles, "{}", "RocksDB compression profiles by column family or group name");
+// native backups with the BACKUP command, stored in a local or mounted directory
+DEFINE_string(rocksdb_backup_dir, "", "Directory for RocksDB backups. Empty disables backups.");
+DEFINE_int64(rocksdb_backup_rate_limit_bytes_per_sec, 64 * 1024 * 1024, "Backup and restore rate limit, 0 for none");
+DEFINE_int32(rocksdb_backup_parallelism, 4, "Number of files copied in parallel by backups and restores");
+// Restore a backup from rocksdb_backup_dir into rocksdb_db_path before opening the database, overwriting its content
+DEFINE_bool(rocksdb_restore_backup_one_off, false, "Restore a backup before opening the database");
+DEFINE_int32(rocksdb_restore_backup_id, 0, "Id of the backup to restore. 0 restores the latest backup.");
+DEFINE_string(rocksdb_restore_instance_backup_ids, "{}",
+              "Ids of the backups to restore for every secondary RocksDB instance in JSON, e.g. {\"<name>\": 0}");
+// block cache warm-up from hot keys sampled from client reads and persisted in the metadata column family
+DEFINE_int64(hot_key_persist_interval_ms, 0,
+             "Interval for persisting sampled hot keys, e.g. 60000. 0 disables sampling and the cache warm-up.");
+DEFINE_int32(hot_key_sample_rate, 100, "Sample one in every this many client reads. 0 pauses sampling.");
+DEFINE_int32(hot_key_max_keys, 10000, "Maximum number of hot keys persisted for each column family");
+DEFINE_int64(cache_warm_up_budget_ms, 30000, "Time budget for warming up the block cache before reporting ready");
+DEFINE_int32(cache_warm_up_parallelism, 8, "Number of threads reading hot keys during the warm-up");
+DEFINE_int32(sharded_executor_threads, 8, "Threads fanning out multi-key requests over cf group members. 0 disables.");
+DEFINE_int32(scheduled_task_workers, 1, "Number of threads processing the tasks of each scheduled task queue");
+// failed scheduled tasks are retried at every check unless a number of attempts is given
+DEFINE_int32(scheduled_task_max_attempts, 0,
+             "Attempts before failed tasks move to dead letters, for queues with a dead-letter column family. "
+             "0 retries forever.");
+DEFINE_int64(scheduled_task_retry_backoff_ms, 1000, "Delay before retrying a failed task, doubled at every attempt");
+DEFINE_int64(scheduled_task_max_retry_backoff_ms, 3600000, "Maximum delay before retrying a failed task");
+// Downgrading to a version without the merge counter: run once with false and shut down gracefully, which leaves no
+// merge operand in the metadata column family that the older version could not read or compact
+DEFINE_bool(scheduled_task_merge_counter, true, "Count scheduled tasks with merges into the metadata column family");
+DEFINE_int32(shard_affinity_io_threads, 0, "Number of IO threads each owning a subset of virtual shards. 0 disables.");
+// cluster-aware routing: virtual shards owned by this node follow the members of a column family group
+DEFINE_string(cluster_cf_group, "", "Column family group whose members define owned virtual shards. Empty disables.");
+DEFINE_string(cluster_nodes, "{}", "Other nodes in JSON mapping host:port to their column family group config");
+DEFINE_string(cluster_announce_address, "", "host:port announced to clients. Defaults to the hostname and --port.");
+// write stall backpressure: consumers slow down first, then client writes are asked to back off and finally shed
+DEFINE_int64(write_stall_poll_interval_ms, 1000, "Interval for polling write pressure. 0 disables backpressure.");
+DEFINE_int64(write_stall_max_consumer_delay_ms, 1000, "Maximum delay between kafka consumer batches");
+DEFINE_int64(write_stall_max_client_delay_ms, 50, "Maximum back-off asked from client write commands before shedding");
+DEFINE_int64(rocksdb_metrics_interval_ms, 10000,
+             "Interval for exporting RocksDB statistics and properties to /metrics. 0 disables the export.");
 
 // kafka flags
 DEFINE_string(kafka_broker_list, "localhost:9092", "Kafka broker list");
@@ -87,10 +159,14 @@ DEFINE_string(kafka_broker_list, "localhost:9092", "Kafka broker list");
 //     "initial_offset_one_off": 1234,
 //     "object_store_bucket_name": "kafka",
 //     "object_store_object_name_prefix": "raw/",
-//     "low_latency": true
+//     "low_latency": true,
+//     "column_family_groups": ["entityList"]
 //   }
 // ]
 // Note that topic, partition, and group_id are required. The rest are optional. By default, low_latency is disabled.
+// column_family_groups lists the groups written by the consumer. It is required with --rocksdb_instances, because
+// consumed data is committed along with the offsets in the primary instance, so none of them may be in a secondary
+// instance.
 DEFINE_string(kafka_consumer_configs, "", "Kafka consumer configurations in JSON format");
 // Example for kafka producer configuration:
 // {
@@ -163,6 +239,68 @@ void RedisPipelineBootstrap::persistVersionTimestamp(int64_t versionTimestampMs)
   }
 }
 
+void RedisPipelineBootstrap::restoreRocksDbFromBackup(const std::string& dbPath, const std::string& backupDir,
+                                                      uint32_t backupId, const std::string& instanceBackupIds,
+                                                      uint64_t rateLimitBytesPerSec, int parallelism,
+                                                      int64_t versionTimestampMs) {
+  CHECK(rocksDb_ == nullptr) << "Cannot restore a backup into an opened database";
+  CHECK(!backupDir.empty()) << "Restoring a backup requires rocksdb_backup_dir";
+  if (!canApplyOneOffFlags(versionTimestampMs)) {
+    LOG(WARNING) << "Cannot restore a backup unless a valid version_timestamp_ms is specified";
+    return;
+  }
+
+  folly::dynamic instanceBackupIdsJson = folly::dynamic::object;
+  try {
+    instanceBackupIdsJson = folly::parseJson(instanceBackupIds);
+  } catch (const std::exception& e) {
+    LOG(FATAL) << "--rocksdb_restore_instance_backup_ids must be valid JSON: " << e.what();
+  }
+  // Backups of different instances are taken separately, so there is no backup id common to all of them. Make the
+  // operator pick the backup of every instance rather than restoring some of them to an unrelated point in time.
+  for (const auto& instance : rocksDbInstances_) {
+    CHECK(instanceBackupIdsJson.count(instance.name))
+        << "--rocksdb_restore_instance_backup_ids must give the backup to restore for RocksDB instance "
+        << instance.name;
+  }
+  CHECK_EQ(instanceBackupIdsJson.size(), rocksDbInstances_.size())
+      << "--rocksdb_restore_instance_backup_ids names unknown RocksDB instances";
+
+  LOG(WARNING) << "Restoring backup into " << dbPath << " as a one-off operation";
+  std::string error;
+  CHECK(BackupManager::restore(BackupManager::Config(backupDir, rateLimitBytesPerSec, parallelism), dbPath, backupId,
+                               &error)) << error;
+  for (const auto& instance : rocksDbInstances_) {
+    LOG(WARNING) << "Restoring backup into " << instance.dbPath << " as a one-off operation";
+    CHECK(BackupManager::restore(
+        BackupManager::Config(folly::sformat("{}/{}", backupDir, instance.name), rateLimitBytesPerSec, parallelism),
+        instance.dbPath, instanceBackupIdsJson[instance.name].asInt(), &error, instance.walDir)) << error;
+  }
+}
+
+void RedisPipelineBootstrap::initializeRocksDbInstances(const std::string& instanceConfigs) {
+  CHECK(rocksDb_ == nullptr) << "RocksDB instances must be initialized before opening the database";
+  folly::dynamic configJson = folly::dynamic::object;
+  try {
+    configJson = folly::parseJson(instanceConfigs);
+  } catch (const std::exception& e) {
+    LOG(FATAL) << "--rocksdb_instances must be valid JSON: " << e.what();
+  }
+  std::unordered_set<std::string> columnFamilyGroups;
+  for (const auto& entry : configJson.items()) {
+    RocksDbInstance instance;
+    instance.name = entry.first.getString();
+    instance.dbPath = entry.second["db_path"].getString();
+    instance.walDir = entry.second.getDefault("wal_dir", "").getString();
+    for (const auto& group : entry.second["cf_groups"]) {
+      CHECK(columnFamilyGroups.insert(group.getString()).second)
+          << "Column family group " << group.getString() << " is assigned to multiple RocksDB instances";
+      instance.columnFamilyGroups.push_back(group.getString());
+    }
+    rocksDbInstances_.push_back(std::move(instance));
+  }
+}
+
 void RedisPipelineBootstrap::processRocksDbColumnFamilyGroup(const std::string& groupName,
                                                              const RocksDbColumnFamilyGroupConfig& groupConfig,
                                                              std::function<void(const std::string&)> callback) {
@@ -174,9 +312,10 @@ void RedisPipelineBootstrap::processRocksDbColumnFamilyGroup(const std::string&
 
 void RedisPipelineBootstrap::initializeRocksDb(const std::string& dbPath, const std::string& dbPaths,
                                                const std::string& cfGroupConfigs,
-                                               const std::string& dropCfGroupConfigs, int parallelism,
-                                               int blockCacheSizeMb, bool createIfMissing, bool createIfMissingOneOff,
-                                               int64_t versionTimestampMs) {
+                                               const std::string& dropCfGroupConfigs,
+                                               const std::string& compressionProfiles, int parallelism,
+                                               int blockCacheSizeMb, bool partitionIndexFilters, bool createIfMissing,
+                                               bool createIfMissingOneOff, int64_t versionTimestampMs) {
   rocksdb::Options options;
   // Optimize RocksDB
   // Common options for all types of workloads
@@ -202,6 +341,15 @@ void RedisPipelineBootstrap::initializeRocksDb(const std::string& dbPath, const
   options.max_open_files = 2000;
   if (config_.rocksDbConfigurator) config_.rocksDbConfigurator(&options);
 
+  if (rocksDbMetrics_) {
+    // the configurator may have replaced statistics, so only attach the listener after it runs
+    rocksDbMetrics_->setStatistics(options.statistics);
+    options.listeners.push_back(rocksDbMetrics_);
+  }
+  if (writeStallController_) {
+    options.listeners.push_back(writeStallController_);
+  }
+
   auto cfGroupConfigMap = parseRocksDbColumnFamilyGroupConfigs(cfGroupConfigs);
   auto dropCfGroupConfigMap = parseRocksDbColumnFamilyGroupConfigs(dropCfGroupConfigs);
   std::unordered_map<std::string, rocksdb::ColumnFamilyOptions> dropColumnFamilyOptionsMap;
@@ -241,64 +389,66 @@ void RedisPipelineBootstrap::initializeRocksDb(const std::string& dbPath, const
     columnFamilyOptions.OptimizeForPointLookup(1);
     columnFamilyOptionsMap_[DatabaseManager::metadataColumnFamilyName()] = columnFamilyOptions;
   }
+  // scheduled task queues keep their task counters in the metadata column family, also when clients configure it.
+  // It stays installed with --scheduled_task_merge_counter=false, so that merge operands left by the counter can still
+  // be read and compacted.
+  auto& metadataColumnFamilyOptions = columnFamilyOptionsMap_[DatabaseManager::metadataColumnFamilyName()];
+  if (!metadataColumnFamilyOptions.merge_operator) {
+    metadataColumnFamilyOptions.merge_operator = CounterMergeOperator::getInstance();
+  }
 
-  optimizeBlockedBasedTable();
-
-  struct stat buf;
-  bool dbExists = (stat(folly::sformat("{}/CURRENT", dbPath).c_str(), &buf) == 0);
-  if (!dbExists) {
-    if (createIfMissing) {
-      LOG(WARNING) << "Setting RocksDB option create_if_missing";
-      options.create_if_missing = true;
-    } else if (createIfMissingOneOff) {
-      if (canApplyOneOffFlags(versionTimestampMs)) {
-        LOG(WARNING) << "Setting RocksDB option create_if_missing as a one-off operation";
-        options.create_if_missing = true;
-      } else {
-        LOG(WARNING) << "Cannot apply create_if_missing option unless a valid version_timestamp_ms is specified";
-      }
+  applyCompressionProfiles(compressionProfiles, cfGroupConfigMap);
+  optimizeBlockedBasedTable(partitionIndexFilters);
+
+  // column families of the groups held by secondary instances, by instance index
+  std::unordered_map<std::string, size_t> instanceColumnFamilies;
+  std::vector<RocksDbColumnFamilyGroupConfigMap> instanceCfGroupConfigMaps(rocksDbInstances_.size());
+  RocksDbColumnFamilyGroupConfigMap primaryCfGroupConfigMap = cfGroupConfigMap;
+  for (size_t i = 0; i < rocksDbInstances_.size(); i++) {
+    for (const auto& groupName : rocksDbInstances_[i].columnFamilyGroups) {
+      auto groupConfigIt = cfGroupConfigMap.find(groupName);
+      CHECK(groupConfigIt != cfGroupConfigMap.end())
+          << "Column family group of RocksDB instance " << rocksDbInstances_[i].name << " not found: " << groupName;
+      processRocksDbColumnFamilyGroup(groupName, groupConfigIt->second, [&](const std::string& cfName) mutable {
+        instanceColumnFamilies[cfName] = i;
+      });
+      instanceCfGroupConfigMaps[i].insert(*groupConfigIt);
+      primaryCfGroupConfigMap.erase(groupName);
     }
   }
 
-  std::vector<std::string> existingColumnFamilies;
-  std::vector<rocksdb::ColumnFamilyDescriptor> columnFamilyDescriptors;
   std::vector<rocksdb::ColumnFamilyHandle*> columnFamilyHandles;
-  if (dbExists) {
-    LOG(INFO) << "Loading existing database from " << dbPath;
-    // check column families
-    rocksdb::Status s = rocksdb::DB::ListColumnFamilies(options, dbPath, &existingColumnFamilies);
-    CHECK(s.ok()) << "Listing column families failed: " << s.ToString();
-  } else {
-    LOG(INFO) << "Creating initial database in " << dbPath;
-    // default column family is always created automatically when creating a new database
-    existingColumnFamilies.emplace_back(DatabaseManager::defaultColumnFamilyName());
-  }
-
-  // prepare descriptors for existing column families
-  for (const auto& name : existingColumnFamilies) {
-    if (columnFamilyOptionsMap_.find(name) != columnFamilyOptionsMap_.end()) {
-      // found a column family to open
-      columnFamilyDescriptors.emplace_back(name, columnFamilyOptionsMap_[name]);
-    } else if (dropColumnFamilyOptionsMap.find(name) != dropColumnFamilyOptionsMap.end()) {
-      // found a column family to drop
-      columnFamilyDescriptors.emplace_back(name, dropColumnFamilyOptionsMap[name]);
-    } else {
-      LOG(FATAL) << "Must define column family options for " << name;
+  AdoptedGroupMemberMap adoptedGroupMembers;
+  auto primaryOwnsColumnFamily = [&](const std::string& name) { return instanceColumnFamilies.count(name) == 0; };
+  rocksDb_ = openRocksDb(options, dbPath, "", primaryOwnsColumnFamily, dropColumnFamilyOptionsMap,
+                         primaryCfGroupConfigMap, parallelism, createIfMissing, createIfMissingOneOff,
+                         versionTimestampMs, &adoptedGroupMembers, &columnFamilyHandles);
+  for (size_t i = 0; i < rocksDbInstances_.size(); i++) {
+    auto& instance = rocksDbInstances_[i];
+    rocksdb::Options instanceOptions(options);
+    if (!instance.walDir.empty()) instanceOptions.wal_dir = instance.walDir;
+    // db_paths are for the primary instance
+    instanceOptions.db_paths.clear();
+    if (writeStallController_) {
+      // report stall conditions under the instance, its column family names may repeat those of other instances
+      std::replace(instanceOptions.listeners.begin(), instanceOptions.listeners.end(),
+                   std::shared_ptr<rocksdb::EventListener>(writeStallController_),
+                   writeStallController_->getInstanceListener(instance.name));
     }
-  }
-
-  // open DB
-  rocksdb::Status s = rocksdb::DB::Open(options, dbPath, columnFamilyDescriptors, &columnFamilyHandles, &rocksDb_);
-  CHECK(s.ok()) << "RocksDB initialization failed: " << s.ToString();
-
-  // Create missing column families
-  for (const auto& entry : columnFamilyOptionsMap_) {
-    auto it = find(existingColumnFamilies.cbegin(), existingColumnFamilies.cend(), entry.first);
-    if (it == existingColumnFamilies.cend()) {
-      rocksdb::ColumnFamilyHandle* cf;
-      rocksdb::Status s = rocksDb_->CreateColumnFamily(columnFamilyOptionsMap_[entry.first], entry.first, &cf);
-      CHECK(s.ok()) << "Creating column family `" << entry.first << "` failed: " << s.ToString();
-      columnFamilyHandles.push_back(cf);
+    auto instanceOwnsColumnFamily = [&](const std::string& name) {
+      auto it = instanceColumnFamilies.find(name);
+      return it != instanceColumnFamilies.end() && it->second == i;
+    };
+    std::vector<rocksdb::ColumnFamilyHandle*> instanceColumnFamilyHandles;
+    instance.db = openRocksDb(instanceOptions, instance.dbPath, "_" + instance.name, instanceOwnsColumnFamily, {},
+                              instanceCfGroupConfigMaps[i], parallelism, createIfMissing, createIfMissingOneOff,
+                              versionTimestampMs, &adoptedGroupMembers, &instanceColumnFamilyHandles);
+    for (auto cf : instanceColumnFamilyHandles) {
+      if (cf->GetName() == DatabaseManager::defaultColumnFamilyName()) {
+        instance.defaultColumnFamily = cf;
+      } else {
+        columnFamilyHandles.push_back(cf);
+      }
     }
   }
 
@@ -329,6 +479,13 @@ void RedisPipelineBootstrap::initializeRocksDb(const std::string& dbPath, const
       CHECK(it != columnFamilyMap_.end()) << "Column family not found: " << cfName;
       group.push_back(it->second);
     });
+    // members created at runtime follow the configured ones, named after their position in the group
+    for (const auto& member : adoptedGroupMembers[entry.first]) {
+      CHECK(member.first == static_cast<int>(group.size()))
+          << "Column family " << member.second << " created at runtime does not follow the last member of group "
+          << entry.first << ", expected " << getColumnFamilyNameInGroup(entry.first, group.size());
+      group.push_back(columnFamilyMap_.at(member.second));
+    }
     columnFamilyGroupMap_[entry.first] = std::move(group);
   }
 
@@ -347,6 +504,137 @@ void RedisPipelineBootstrap::initializeRocksDb(const std::string& dbPath, const
   }
 }
 
+bool RedisPipelineBootstrap::adoptColumnFamilyGroupMember(const std::string& name,
+                                                          const RocksDbColumnFamilyGroupConfigMap& cfGroupConfigMap,
+                                                          AdoptedGroupMemberMap* adoptedGroupMembers) {
+  size_t pos = name.rfind('-');
+  if (pos == std::string::npos || pos + 1 == name.size()) return false;
+  std::string groupName = name.substr(0, pos);
+  std::string shardStr = name.substr(pos + 1);
+  if (shardStr.size() > 9 || !std::all_of(shardStr.begin(), shardStr.end(), ::isdigit)) return false;
+
+  auto groupConfigIt = cfGroupConfigMap.find(groupName);
+  if (groupConfigIt == cfGroupConfigMap.end() || groupConfigIt->second.localVirtualShardCount <= 0) return false;
+  auto optionsIt =
+      columnFamilyOptionsMap_.find(getColumnFamilyNameInGroup(groupName, groupConfigIt->second.startShardIndex));
+  if (optionsIt == columnFamilyOptionsMap_.end()) return false;
+
+  LOG(WARNING) << "Adding column family " << name << " created at runtime to group " << groupName;
+  columnFamilyOptionsMap_[name] = optionsIt->second;
+  (*adoptedGroupMembers)[groupName][folly::to<int>(shardStr)] = name;
+  return true;
+}
+
+rocksdb::DB* RedisPipelineBootstrap::openRocksDb(
+    rocksdb::Options options, const std::string& dbPath, const std::string& phaseSuffix,
+    const std::function<bool(const std::string&)>& ownsColumnFamily,
+    const std::unordered_map<std::string, rocksdb::ColumnFamilyOptions>& dropColumnFamilyOptionsMap,
+    const RocksDbColumnFamilyGroupConfigMap& cfGroupConfigMap, int parallelism, bool createIfMissing,
+    bool createIfMissingOneOff, int64_t versionTimestampMs, AdoptedGroupMemberMap* adoptedGroupMembers,
+    std::vector<rocksdb::ColumnFamilyHandle*>* columnFamilyHandles) {
+  struct stat buf;
+  bool dbExists = (stat(folly::sformat("{}/CURRENT", dbPath).c_str(), &buf) == 0);
+  if (!dbExists) {
+    if (createIfMissing) {
+      LOG(WARNING) << "Setting RocksDB option create_if_missing";
+      options.create_if_missing = true;
+    } else if (createIfMissingOneOff) {
+      if (canApplyOneOffFlags(versionTimestampMs)) {
+        LOG(WARNING) << "Setting RocksDB option create_if_missing as a one-off operation";
+        options.create_if_missing = true;
+      } else {
+        LOG(WARNING) << "Cannot apply create_if_missing option unless a valid version_timestamp_ms is specified";
+      }
+    }
+  }
+
+  std::vector<std::string> existingColumnFamilies;
+  std::vector<rocksdb::ColumnFamilyDescriptor> columnFamilyDescriptors;
+  if (dbExists) {
+    LOG(INFO) << "Loading existing database from " << dbPath;
+    // check column families
+    rocksdb::Status s = rocksdb::DB::ListColumnFamilies(options, dbPath, &existingColumnFamilies);
+    CHECK(s.ok()) << "Listing column families failed: " << s.ToString();
+  } else {
+    LOG(INFO) << "Creating initial database in " << dbPath;
+    // default column family is always created automatically when creating a new database
+    existingColumnFamilies.emplace_back(DatabaseManager::defaultColumnFamilyName());
+  }
+
+  // prepare descriptors for existing column families
+  std::unordered_set<std::string> existingColumnFamilySet(existingColumnFamilies.begin(),
+                                                          existingColumnFamilies.end());
+  for (const auto& name : existingColumnFamilies) {
+    if (columnFamilyOptionsMap_.find(name) != columnFamilyOptionsMap_.end() &&
+        (ownsColumnFamily(name) || name == DatabaseManager::defaultColumnFamilyName())) {
+      // found a column family to open
+      columnFamilyDescriptors.emplace_back(name, columnFamilyOptionsMap_[name]);
+    } else if (dropColumnFamilyOptionsMap.find(name) != dropColumnFamilyOptionsMap.end()) {
+      // found a column family to drop
+      columnFamilyDescriptors.emplace_back(name, dropColumnFamilyOptionsMap.at(name));
+    } else if (adoptColumnFamilyGroupMember(name, cfGroupConfigMap, adoptedGroupMembers)) {
+      // found a group member created at runtime
+      columnFamilyDescriptors.emplace_back(name, columnFamilyOptionsMap_[name]);
+    } else if (columnFamilyOptionsMap_.find(name) != columnFamilyOptionsMap_.end()) {
+      // RocksDB cannot move column families between databases, and silently creating an empty one elsewhere would
+      // lose the data
+      LOG(FATAL) << "Column family " << name << " exists in " << dbPath << " but --rocksdb_instances assigns its group "
+                 << "to another RocksDB instance. Groups cannot move between instances in place. Restore the previous "
+                 << "--rocksdb_instances, or move the group offline: EXPORTSHARD every member with the previous "
+                 << "assignment, then IMPORTSHARD them into a node started with the new assignment on new database "
+                 << "directories";
+    } else {
+      LOG(FATAL) << "Must define column family options for " << name << " in " << dbPath;
+    }
+  }
+
+  // open DB
+  rocksdb::DB* db = nullptr;
+  startupTimer_.time("rocksdb_open" + phaseSuffix, [&]() {
+    rocksdb::Status s = rocksdb::DB::Open(options, dbPath, columnFamilyDescriptors, columnFamilyHandles, &db);
+    CHECK(s.ok()) << "RocksDB initialization failed: " << s.ToString();
+  });
+
+  // Create missing column families
+  std::vector<std::string> missingColumnFamilies;
+  for (const auto& entry : columnFamilyOptionsMap_) {
+    if (existingColumnFamilySet.count(entry.first) == 0 && ownsColumnFamily(entry.first)) {
+      missingColumnFamilies.push_back(entry.first);
+    }
+  }
+  startupTimer_.time("rocksdb_create_column_families" + phaseSuffix, [&]() {
+    createColumnFamilies(db, missingColumnFamilies, parallelism, columnFamilyHandles);
+  });
+  return db;
+}
+
+void RedisPipelineBootstrap::createColumnFamilies(rocksdb::DB* db, const std::vector<std::string>& names,
+                                                  int parallelism,
+                                                  std::vector<rocksdb::ColumnFamilyHandle*>* columnFamilyHandles) {
+  if (names.empty()) return;
+  LOG(INFO) << "Creating " << names.size() << " column families";
+
+  // each creation persists the manifest and the options file, so it adds up with many virtual shards; run them in
+  // parallel to overlap the I/O
+  std::vector<rocksdb::ColumnFamilyHandle*> createdHandles(names.size(), nullptr);
+  std::atomic<size_t> nextIndex(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < std::max(1, std::min(parallelism, static_cast<int>(names.size()))); i++) {
+    threads.emplace_back([&]() {
+      for (size_t index = nextIndex++; index < names.size(); index = nextIndex++) {
+        const std::string& name = names[index];
+        rocksdb::Status s =
+            db->CreateColumnFamily(columnFamilyOptionsMap_.at(name), name, &createdHandles[index]);
+        CHECK(s.ok()) << "Creating column family `" << name << "` failed: " << s.ToString();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  columnFamilyHandles->insert(columnFamilyHandles->end(), createdHandles.begin(), createdHandles.end());
+}
+
 RedisPipelineBootstrap::RocksDbColumnFamilyGroupConfigMap RedisPipelineBootstrap::parseRocksDbColumnFamilyGroupConfigs(
     const std::string& configs) {
   folly::dynamic configJson = folly::dynamic::object;
@@ -384,7 +672,38 @@ void RedisPipelineBootstrap::setDbPaths(const std::string& json, rocksdb::Option
 }
 
 
-void RedisPipelineBootstrap::optimizeBlockedBasedTable() {
+void RedisPipelineBootstrap::applyCompressionProfiles(const std::string& json,
+                                                      const RocksDbColumnFamilyGroupConfigMap& cfGroupConfigMap) {
+  folly::dynamic profilesJson = folly::dynamic::object;
+  try {
+    profilesJson = folly::parseJson(json);
+  } catch (const std::exception& e) {
+    LOG(FATAL) << "rocksdb_compression_profiles must be valid JSON: " << e.what();
+  }
+
+  for (const auto& entry : profilesJson.items()) {
+    const std::string& name = entry.first.getString();
+    const std::string& profile = entry.second.getString();
+    auto applyProfile = [&](const std::string& cfName) {
+      CHECK(CompressionProfile::apply(profile, &columnFamilyOptionsMap_[cfName]))
+          << "Unknown compression profile `" << profile << "`, must be one of: "
+          << folly::join(", ", CompressionProfile::names());
+      LOG(INFO) << "Using compression profile " << profile << " for column family " << cfName;
+    };
+
+    const auto groupConfigIt = cfGroupConfigMap.find(name);
+    if (groupConfigIt != cfGroupConfigMap.end()) {
+      processRocksDbColumnFamilyGroup(name, groupConfigIt->second, applyProfile);
+    } else {
+      CHECK_GT(columnFamilyOptionsMap_.count(name), 0) << "Compression profile set for unknown column family: " << name;
+      applyProfile(name);
+    }
+  }
+}
+
+void RedisPipelineBootstrap::optimizeBlockedBasedTable(bool partitionIndexFilters) {
+  // column families may share block caches, keep sharing them after replacing
+  std::unordered_map<rocksdb::Cache*, std::shared_ptr<rocksdb::Cache>> replacedBlockCaches;
   for (const auto& entry : columnFamilyOptionsMap_) {
     std::shared_ptr<rocksdb::TableFactory> tableFactory = entry.second.table_factory;
     if (strcmp(tableFactory->Name(), "BlockBasedTable") == 0) {
@@ -392,17 +711,162 @@ void RedisPipelineBootstrap::optimizeBlockedBasedTable() {
           tableFactory->GetOptions());
       // larger block size saves memory
       tableOptions->block_size = 32 * 1024;
+      if (partitionIndexFilters) {
+        partitionIndexAndFilterBlocks(entry.first, tableOptions, &replacedBlockCaches);
+      }
     }
   }
 }
 
+void RedisPipelineBootstrap::partitionIndexAndFilterBlocks(
+    const std::string& columnFamilyName, rocksdb::BlockBasedTableOptions* tableOptions,
+    std::unordered_map<rocksdb::Cache*, std::shared_ptr<rocksdb::Cache>>* replacedBlockCaches) {
+  if (tableOptions->index_type == rocksdb::BlockBasedTableOptions::kTwoLevelIndexSearch) {
+    // already partitioned, column families copying their options from each other share their table options
+    return;
+  }
+  if (tableOptions->index_type != rocksdb::BlockBasedTableOptions::kBinarySearch) {
+    // e.g. the hash index set by OptimizeForPointLookup
+    LOG(INFO) << "Index and filter blocks of column family " << columnFamilyName << " are not partitioned because "
+              << "it does not use a binary search index";
+    return;
+  }
+
+  // Only the top-level index of each file stays in table reader memory. Index and filter partitions are loaded
+  // through the block cache on demand, so their memory is bounded by the cache size instead of the data size.
+  tableOptions->index_type = rocksdb::BlockBasedTableOptions::kTwoLevelIndexSearch;
+  tableOptions->metadata_block_size = kMetadataBlockSize;
+  if (tableOptions->filter_policy != nullptr) {
+    // partitioned filters only work with full filters, which are built by the policies providing a bits builder
+    std::unique_ptr<rocksdb::FilterBitsBuilder> filterBitsBuilder(tableOptions->filter_policy->GetFilterBitsBuilder());
+    if (filterBitsBuilder) {
+      tableOptions->partition_filters = true;
+    } else {
+      LOG(WARNING) << "Filters of column family " << columnFamilyName << " are not partitioned because "
+                   << tableOptions->filter_policy->Name() << " builds block-based filters, configure full filters "
+                   << "instead, e.g. bloomfilter:10:false";
+    }
+  }
+  tableOptions->cache_index_and_filter_blocks = true;
+  tableOptions->cache_index_and_filter_blocks_with_high_priority = true;
+  // L0 files are searched on every lookup, keep their metadata in memory
+  tableOptions->pin_l0_filter_and_index_blocks_in_cache = true;
+
+  if (tableOptions->block_cache != nullptr) {
+    // index and filter blocks go to the high priority pool, so that scans over data blocks cannot evict them
+    auto it = replacedBlockCaches->find(tableOptions->block_cache.get());
+    if (it == replacedBlockCaches->end()) {
+      const rocksdb::Cache& configuredCache = *tableOptions->block_cache;
+      std::shared_ptr<rocksdb::Cache> blockCache =
+          rocksdb::NewLRUCache(configuredCache.GetCapacity(), getBlockCacheNumShardBits(configuredCache),
+                               configuredCache.HasStrictCapacityLimit(), kHighPriPoolRatio);
+      it = replacedBlockCaches->emplace(tableOptions->block_cache.get(), blockCache).first;
+    }
+    tableOptions->block_cache = it->second;
+  }
+}
+
+int RedisPipelineBootstrap::getBlockCacheNumShardBits(const rocksdb::Cache& cache) {
+  // the public Cache interface only exposes the number of shard bits in its printable options, e.g.
+  // "    num_shard_bits : 6\n"
+  static const std::string kNumShardBitsOption = "num_shard_bits : ";
+  std::string printableOptions = cache.GetPrintableOptions();
+  size_t pos = printableOptions.find(kNumShardBitsOption);
+  // -1 picks the default number of shard bits for the capacity
+  if (pos == std::string::npos) return -1;
+  return static_cast<int>(std::strtol(printableOptions.c_str() + pos + kNumShardBitsOption.size(), nullptr, 10));
+}
+
 void RedisPipelineBootstrap::initializeDatabaseManager(bool masterReplica) {
   CHECK_NOTNULL(rocksDb_);
   if (config_.databaseManagerFactory) {
     databaseManager_ = config_.databaseManagerFactory(columnFamilyMap_, masterReplica, rocksDb_, this);
   } else {
-    databaseManager_ = std::make_shared<DatabaseManager>(columnFamilyMap_, masterReplica, rocksDb_);
+    databaseManager_ =
+        std::make_shared<DatabaseManager>(columnFamilyMap_, columnFamilyGroupMap_, masterReplica, rocksDb_);
+  }
+  for (const auto& instance : rocksDbInstances_) {
+    databaseManager_->addRocksDbInstance({instance.name, instance.db, instance.columnFamilyGroups, nullptr});
   }
+  if (writeStallController_) databaseManager_->setWriteStallController(writeStallController_);
+}
+
+void RedisPipelineBootstrap::initializeBackupManager(const std::string& backupDir, uint64_t rateLimitBytesPerSec,
+                                                     int parallelism) {
+  CHECK_NOTNULL(databaseManager_.get());
+  if (backupDir.empty()) return;
+  backupManager_ = std::make_shared<BackupManager>(
+      rocksDb_, BackupManager::Config(backupDir, rateLimitBytesPerSec, parallelism));
+  databaseManager_->setBackupManager(backupManager_);
+  for (auto& instance : rocksDbInstances_) {
+    instance.backupManager = std::make_shared<BackupManager>(
+        instance.db,
+        BackupManager::Config(folly::sformat("{}/{}", backupDir, instance.name), rateLimitBytesPerSec, parallelism));
+    databaseManager_->setRocksDbInstanceBackupManager(instance.name, instance.backupManager);
+  }
+}
+
+void RedisPipelineBootstrap::initializeHotKeySampler(int64_t persistIntervalMs, int sampleRate, int maxKeys,
+                                                     int64_t warmUpBudgetMs, int warmUpParallelism) {
+  CHECK_NOTNULL(databaseManager_.get());
+  if (persistIntervalMs <= 0) return;
+  CHECK_GT(maxKeys, 0);
+  CHECK_GE(sampleRate, 0);
+  CHECK_GT(warmUpParallelism, 0);
+  auto hotKeySampler = databaseManager_->hotKeySampler();
+  hotKeySampler->setMaxKeys(maxKeys);
+  hotKeySampler->setSampleRate(sampleRate);
+  hotKeyPersistIntervalMs_ = persistIntervalMs;
+  cacheWarmUpBudgetMs_ = warmUpBudgetMs;
+  cacheWarmUpParallelism_ = warmUpParallelism;
+}
+
+void RedisPipelineBootstrap::initializeShardMappings(const std::string& shardMappings) {
+  CHECK_NOTNULL(databaseManager_.get());
+  folly::dynamic configJson = folly::dynamic::object;
+  try {
+    configJson = folly::parseJson(shardMappings);
+  } catch (const std::exception& e) {
+    LOG(FATAL) << "--rocksdb_cf_group_shard_mappings must be valid JSON: " << e.what();
+  }
+  std::unordered_map<std::string, ShardMapper::Mapping> mappings;
+  for (const auto& entry : configJson.items()) {
+    ShardMapper::Mapping mapping;
+    CHECK(ShardMapper::parseMapping(entry.second.getString(), &mapping))
+        << "Unknown shard mapping for " << entry.first.getString() << ": " << entry.second.getString();
+    mappings[entry.first.getString()] = mapping;
+  }
+  std::string error;
+  CHECK(databaseManager_->initializeShardMappings(mappings, config_.shardKeyFunctionMap, &error)) << error;
+}
+
+void RedisPipelineBootstrap::initializeShardedExecutor(int threadCount) {
+  CHECK_NOTNULL(databaseManager_.get());
+  CHECK_GE(threadCount, 0);
+  if (threadCount == 0) return;
+  databaseManager_->setShardedExecutor(std::make_shared<ShardedExecutor>(threadCount));
+}
+
+void RedisPipelineBootstrap::initializeClusterTopology(const std::string& groupName, const std::string& nodesJson,
+                                                       const std::string& announceAddress, int port) {
+  CHECK_NOTNULL(databaseManager_.get());
+  if (groupName.empty()) return;
+
+  std::vector<ClusterTopology::Node> peers;
+  std::string error;
+  CHECK(ClusterTopology::parseNodes(nodesJson, &peers, &error)) << "Invalid --cluster_nodes: " << error;
+
+  std::string selfAddress = announceAddress;
+  if (selfAddress.empty()) {
+    char hostname[256];
+    PCHECK(gethostname(hostname, sizeof(hostname)) == 0);
+    hostname[sizeof(hostname) - 1] = '\0';
+    selfAddress = folly::sformat("{}:{}", hostname, port);
+  }
+
+  RedisHandler::setClusterTopology(
+      std::make_shared<ClusterTopology>(selfAddress, databaseManager_, groupName, peers));
+  LOG(INFO) << "Cluster support enabled for " << selfAddress << " with " << peers.size() << " other nodes";
 }
 
 void RedisPipelineBootstrap::initializeKafkaProducers(const std::string& brokerList,
@@ -434,12 +898,36 @@ void RedisPipelineBootstrap::initializeKafkaProducers(const std::string& brokerL
   }
 }
 
-void RedisPipelineBootstrap::initializeScheduledTaskQueues() {
+void RedisPipelineBootstrap::initializeScheduledTaskQueues(int workerCount, int maxAttempts, int64_t retryBackoffMs,
+                                                           int64_t maxRetryBackoffMs, bool mergeCounter) {
   CHECK_NOTNULL(databaseManager_.get());
+  CHECK_GT(workerCount, 0) << "--scheduled_task_workers must be positive";
+  CHECK_GE(maxAttempts, 0) << "--scheduled_task_max_attempts must not be negative";
   for (auto& entry : config_.scheduledTaskProcessorFactoryMap) {
     rocksdb::ColumnFamilyHandle* columnFamily = getColumnFamily(entry.first);
-    scheduledTaskQueueMap_[entry.first] =
-        std::make_shared<infra::ScheduledTaskQueue>(entry.second(this), databaseManager_, columnFamily);
+    auto queue =
+        std::make_shared<infra::ScheduledTaskQueue>(entry.second(this), databaseManager_, columnFamily, workerCount);
+    // configuring the index column family of a queue enables its index
+    auto indexIt = columnFamilyMap_.find(infra::ScheduledTaskQueue::indexColumnFamilyName(entry.first));
+    if (indexIt != columnFamilyMap_.end()) queue->enableIndex(indexIt->second);
+    if (!mergeCounter) queue->disableTaskCounter();
+    // and configuring its dead-letter column family enables its retry policy
+    auto deadLetterIt = columnFamilyMap_.find(infra::ScheduledTaskQueue::deadLetterColumnFamilyName(entry.first));
+    if (maxAttempts > 0 && deadLetterIt != columnFamilyMap_.end()) {
+      queue->setRetryPolicy(retryBackoffMs, maxRetryBackoffMs, maxAttempts, deadLetterIt->second);
+    }
+    scheduledTaskQueueMap_[entry.first] = queue;
+  }
+  RedisHandler::setScheduledTaskQueues(scheduledTaskQueueMap_);
+
+  if (metricsRegistry_ == nullptr || scheduledTaskQueueMap_.empty()) return;
+  auto& dispatchDelayFamily = prometheus::BuildHistogram()
+                                  .Name("scheduled_task_dispatch_delay_seconds")
+                                  .Help("Time from when scheduled tasks are due until they are processed")
+                                  .Register(*metricsRegistry_);
+  for (auto& entry : scheduledTaskQueueMap_) {
+    entry.second->setDispatchDelayHistogram(
+        &dispatchDelayFamily.Add({{"queue", entry.first}}, infra::ScheduledTaskQueue::dispatchDelayBucketsSeconds()));
   }
 }
 
@@ -465,6 +953,7 @@ void RedisPipelineBootstrap::initializeKafkaConsumer(const std::string& brokerLi
     KafkaConsumerConfig config = KafkaConsumerConfig::createFromJson(configEntry);
     KafkaConsumerFactory factory = config_.kafkaConsumerFactoryMap[config.consumerName];
     CHECK(factory) << "Kafka consumer factory for " << config.consumerName << " is not defined";
+    checkKafkaConsumerColumnFamilyGroups(config);
 
     const std::string offsetKey =
         kafkaConsumerHelper_->linkTopicPartition(config.topic, config.partition, config.offsetKeySuffix);
@@ -499,13 +988,101 @@ void RedisPipelineBootstrap::initializeKafkaConsumer(const std::string& brokerLi
     LOG(INFO) << "Launching kafka consumer for partition " << config.partition << " of " << config.topic << " as "
               << config.groupId;
     kafkaConsumers_.push_back(factory(brokerList, config, offsetKey, this));
+    if (writeStallController_) kafkaConsumers_.back()->setWriteStallController(writeStallController_);
   }
 }
 
+void RedisPipelineBootstrap::checkKafkaConsumerColumnFamilyGroups(const KafkaConsumerConfig& config) {
+  if (rocksDbInstances_.empty()) return;
+  CHECK(config.columnFamilyGroupsSpecified)
+      << "Kafka consumer of " << config.topic << " must list the column family groups it writes in "
+      << "column_family_groups when there are secondary RocksDB instances";
+  for (const auto& groupName : config.columnFamilyGroups) {
+    for (const auto& instance : rocksDbInstances_) {
+      CHECK(std::find(instance.columnFamilyGroups.begin(), instance.columnFamilyGroups.end(), groupName) ==
+            instance.columnFamilyGroups.end())
+          << "Column family group " << groupName << " consumed from " << config.topic << " cannot be in RocksDB "
+          << "instance " << instance.name << ", because kafka offsets are committed in the primary instance";
+    }
+  }
+}
+
+void RedisPipelineBootstrap::registerServerOptions() {
+  CHECK_NOTNULL(databaseManager_.get());
+  databaseManager_->registerServerOption(
+      "max_connections",
+      {[]() { return folly::to<std::string>(RedisHandler::getMaxConnections()); },
+       [](const std::string& value) {
+         int64_t maxConnections;
+         if (!DatabaseManager::parseInt(value, &maxConnections) || maxConnections < 0) return false;
+         RedisHandler::setMaxConnections(maxConnections);
+         return true;
+       }});
+
+  if (backupManager_) {
+    databaseManager_->registerServerOption(
+        "backup_rate_limit_bytes_per_sec",
+        {[this]() { return folly::to<std::string>(backupManager_->rateLimitBytesPerSec()); },
+         [this](const std::string& value) {
+           int64_t rateLimitBytesPerSec;
+           if (!DatabaseManager::parseInt(value, &rateLimitBytesPerSec) || rateLimitBytesPerSec < 0) return false;
+           backupManager_->setRateLimitBytesPerSec(rateLimitBytesPerSec);
+           return true;
+         }});
+  }
+
+  if (hotKeyPersistIntervalMs_ > 0) {
+    auto hotKeySampler = databaseManager_->hotKeySampler();
+    databaseManager_->registerServerOption(
+        "hot_key_sample_rate",
+        {[hotKeySampler]() { return folly::to<std::string>(hotKeySampler->sampleRate()); },
+         [hotKeySampler](const std::string& value) {
+           int64_t sampleRate;
+           if (!DatabaseManager::parseInt(value, &sampleRate) || sampleRate < 0 ||
+               sampleRate > std::numeric_limits<int>::max()) {
+             return false;
+           }
+           hotKeySampler->setSampleRate(sampleRate);
+           return true;
+         }});
+  }
+
+  if (scheduledTaskQueueMap_.empty()) return;
+  databaseManager_->registerServerOption(
+      "scheduled_task_check_interval_ms",
+      {[this]() { return folly::to<std::string>(scheduledTaskQueueMap_.begin()->second->checkIntervalMs()); },
+       [this](const std::string& value) {
+         int64_t checkIntervalMs;
+         if (!DatabaseManager::parseInt(value, &checkIntervalMs) || checkIntervalMs <= 0) return false;
+         for (auto& entry : scheduledTaskQueueMap_) {
+           entry.second->setCheckIntervalMs(checkIntervalMs);
+         }
+         return true;
+       }});
+}
+
 void RedisPipelineBootstrap::initializeRegistry() {
   metricsRegistry_ = std::make_shared<prometheus::Registry>();
 }
 
+void RedisPipelineBootstrap::initializeRocksDbMetrics(int64_t collectionIntervalMs) {
+  CHECK(rocksDb_ == nullptr) << "RocksDB metrics must be initialized before opening the database";
+  if (collectionIntervalMs <= 0) return;
+  rocksDbMetrics_ = std::make_shared<RocksDbMetrics>(getMetricsRegistry());
+  rocksDbMetricsIntervalMs_ = collectionIntervalMs;
+}
+
+void RedisPipelineBootstrap::initializeWriteStallController(int64_t pollIntervalMs, int64_t maxConsumerDelayMs,
+                                                            int64_t maxClientDelayMs) {
+  CHECK(rocksDb_ == nullptr) << "Write stall controller must be initialized before opening the database";
+  if (pollIntervalMs <= 0) return;
+  infra::WriteStallController::Config config;
+  config.maxConsumerDelayMs = maxConsumerDelayMs;
+  config.maxClientDelayMs = maxClientDelayMs;
+  writeStallController_ = std::make_shared<infra::WriteStallController>(config);
+  writeStallPollIntervalMs_ = pollIntervalMs;
+}
+
 void RedisPipelineBootstrap::initializeEmbeddedHttpServer(int httpPort, int redisServerPort) {
   embeddedHttpServer_ = std::make_shared<EmbeddedHttpServer>(httpPort);
 
@@ -550,7 +1127,7 @@ void RedisPipelineBootstrap::initializeEmbeddedHttpServer(int httpPort, int redi
       }));
 }
 
-void RedisPipelineBootstrap::launchServer(int port, int connectionIdleTimeoutMs) {
+void RedisPipelineBootstrap::launchServer(int port, int connectionIdleTimeoutMs, int shardAffinityIoThreads) {
   LOG(INFO) << "Launching server on port " << port;
   server_ = new wangle::ServerBootstrap<RedisPipeline>();
   auto socketConfig = wangle::ServerSocketConfig();
@@ -562,6 +1139,21 @@ void RedisPipelineBootstrap::launchServer(int port, int connectionIdleTimeoutMs)
   CHECK_NOTNULL(databaseManager_.get());
   CHECK_EQ(config_.scheduledTaskProcessorFactoryMap.size(), scheduledTaskQueueMap_.size());
 
+  if (shardAffinityIoThreads > 0) {
+    auto ioThreadPool = std::make_shared<folly::IOThreadPoolExecutor>(
+        shardAffinityIoThreads, std::make_shared<folly::NamedThreadFactory>("IO Thread"));
+    auto shardAffinity = std::make_shared<ShardAffinity>(ShardAffinity::getEventBases(ioThreadPool.get()));
+    // forwarded commands run with a handler of their own on each thread, never with the handler of a connection
+    std::vector<std::shared_ptr<RedisHandler>> ownerHandlers;
+    for (size_t i = 0; i < shardAffinity->threadCount(); i++) {
+      ownerHandlers.push_back(config_.redisHandlerFactory(this));
+      CHECK(ownerHandlers.back());
+    }
+    RedisHandler::setShardAffinity(shardAffinity, std::move(ownerHandlers));
+    server_->group(ioThreadPool);
+    LOG(INFO) << "Virtual shards are owned by " << shardAffinityIoThreads << " IO threads";
+  }
+
   server_->childPipeline(std::make_shared<pipeline::RedisPipelineFactory>(std::make_shared<DefaultRedisHandlerBuilder>(
       config_.redisHandlerFactory, config_.singletonRedisHandler, this)));
 
@@ -598,32 +1190,80 @@ int main(int argc, char** argv) {
 
   LOG(INFO) << "Initializing RedisPipeline";
   redisPipelineBootstrap->initializeRegistry();
-  redisPipelineBootstrap->initializeRocksDb(FLAGS_rocksdb_db_path, FLAGS_rocksdb_db_paths,
-                                            FLAGS_rocksdb_cf_group_configs, FLAGS_rocksdb_drop_cf_group_configs,
-                                            FLAGS_rocksdb_parallelism, FLAGS_rocksdb_block_cache_size_mb,
-                                            FLAGS_rocksdb_create_if_missing, FLAGS_rocksdb_create_if_missing_one_off,
-                                            FLAGS_version_timestamp_ms);
-
+  redisPipelineBootstrap->initializeRocksDbMetrics(FLAGS_rocksdb_metrics_interval_ms);
+  redisPipelineBootstrap->initializeWriteStallController(FLAGS_write_stall_poll_interval_ms,
+                                                         FLAGS_write_stall_max_consumer_delay_ms,
+                                                         FLAGS_write_stall_max_client_delay_ms);
+  redisPipelineBootstrap->initializeRocksDbInstances(FLAGS_rocksdb_instances);
+  pipeline::StartupTimer& startupTimer = redisPipelineBootstrap->startupTimer();
+  if (FLAGS_rocksdb_restore_backup_one_off) {
+    startupTimer.time("restore_rocksdb_backup", [&]() {
+      redisPipelineBootstrap->restoreRocksDbFromBackup(FLAGS_rocksdb_db_path, FLAGS_rocksdb_backup_dir,
+                                                       FLAGS_rocksdb_restore_backup_id,
+                                                       FLAGS_rocksdb_restore_instance_backup_ids,
+                                                       FLAGS_rocksdb_backup_rate_limit_bytes_per_sec,
+                                                       FLAGS_rocksdb_backup_parallelism, FLAGS_version_timestamp_ms);
+    });
+  }
+  // kafka producers do not depend on the database, so connect them while RocksDB opens. The timer is not thread-safe,
+  // so the phase is recorded from the main thread once the producers are connected.
+  int64_t kafkaProducerDurationMs = 0;
+  std::thread kafkaProducerThread([&]() {
+    auto startTime = std::chrono::steady_clock::now();
+    redisPipelineBootstrap->initializeKafkaProducers(FLAGS_kafka_broker_list, FLAGS_kafka_producer_configs);
+    kafkaProducerDurationMs =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+  });
+  startupTimer.time("initialize_rocksdb", [&]() {
+    redisPipelineBootstrap->initializeRocksDb(FLAGS_rocksdb_db_path, FLAGS_rocksdb_db_paths,
+                                              FLAGS_rocksdb_cf_group_configs, FLAGS_rocksdb_drop_cf_group_configs,
+                                              FLAGS_rocksdb_compression_profiles, FLAGS_rocksdb_parallelism,
+                                              FLAGS_rocksdb_block_cache_size_mb, FLAGS_rocksdb_partition_index_filters,
+                                              FLAGS_rocksdb_create_if_missing, FLAGS_rocksdb_create_if_missing_one_off,
+                                              FLAGS_version_timestamp_ms);
+  });
+  kafkaProducerThread.join();
+  startupTimer.record("initialize_kafka_producers", kafkaProducerDurationMs);
 
   // initialize optional components
-  // NOTE: order matters here because both the database manager and kafka producers maybe used by other components to
-  // write data, so they should be initialized first
-  redisPipelineBootstrap->initializeKafkaProducers(FLAGS_kafka_broker_list, FLAGS_kafka_producer_configs);
-  redisPipelineBootstrap->initializeDatabaseManager(FLAGS_master_replica);
-  redisPipelineBootstrap->initializeScheduledTaskQueues();
-  redisPipelineBootstrap->initializeKafkaConsumer(FLAGS_kafka_broker_list, FLAGS_kafka_consumer_configs,
-                                                  FLAGS_version_timestamp_ms);
-  if (FLAGS_http_port > 0) {
-    redisPipelineBootstrap->initializeEmbeddedHttpServer(FLAGS_http_port, FLAGS_port);
-  }
+  // NOTE: order matters here because the database manager may be used by other components to write data, so it should
+  // be initialized first
+  startupTimer.time("initialize_components", [&]() {
+    redisPipelineBootstrap->initializeDatabaseManager(FLAGS_master_replica);
+    redisPipelineBootstrap->initializeShardMappings(FLAGS_rocksdb_cf_group_shard_mappings);
+    redisPipelineBootstrap->initializeBackupManager(FLAGS_rocksdb_backup_dir,
+                                                    FLAGS_rocksdb_backup_rate_limit_bytes_per_sec,
+                                                    FLAGS_rocksdb_backup_parallelism);
+    redisPipelineBootstrap->initializeHotKeySampler(FLAGS_hot_key_persist_interval_ms, FLAGS_hot_key_sample_rate,
+                                                    FLAGS_hot_key_max_keys, FLAGS_cache_warm_up_budget_ms,
+                                                    FLAGS_cache_warm_up_parallelism);
+    redisPipelineBootstrap->initializeShardedExecutor(FLAGS_sharded_executor_threads);
+    redisPipelineBootstrap->initializeClusterTopology(FLAGS_cluster_cf_group, FLAGS_cluster_nodes,
+                                                      FLAGS_cluster_announce_address, FLAGS_port);
+    redisPipelineBootstrap->initializeScheduledTaskQueues(FLAGS_scheduled_task_workers,
+                                                          FLAGS_scheduled_task_max_attempts,
+                                                          FLAGS_scheduled_task_retry_backoff_ms,
+                                                          FLAGS_scheduled_task_max_retry_backoff_ms,
+                                                          FLAGS_scheduled_task_merge_counter);
+    redisPipelineBootstrap->initializeKafkaConsumer(FLAGS_kafka_broker_list, FLAGS_kafka_consumer_configs,
+                                                    FLAGS_version_timestamp_ms);
+    if (FLAGS_http_port > 0) {
+      redisPipelineBootstrap->initializeEmbeddedHttpServer(FLAGS_http_port, FLAGS_port);
+    }
+    pipeline::RedisHandler::setMaxConnections(FLAGS_max_connections);
+    redisPipelineBootstrap->registerServerOptions();
+  });
 
-  redisPipelineBootstrap->startOptionalComponents();
+  startupTimer.time("start_components", [&]() { redisPipelineBootstrap->startOptionalComponents(); });
 
   redisPipelineBootstrap->persistVersionTimestamp(FLAGS_version_timestamp_ms);
 
+  startupTimer.logBreakdown();
+  startupTimer.exportMetrics(redisPipelineBootstrap->getMetricsRegistry().get());
+
   // start the server with all optional components initialized and started
   // NOTE: launchServer method cannot use any one-off flags
-  redisPipelineBootstrap->launchServer(FLAGS_port, FLAGS_connection_idle_timeout_ms);
+  redisPipelineBootstrap->launchServer(FLAGS_port, FLAGS_connection_idle_timeout_ms, FLAGS_shard_affinity_io_threads);
 
   redisPipelineBootstrap->stopOptionalComponents();
   redisPipelineBootstrap->stopRocksDb();
@@ -2,8 +2,10 @@
 #define PIPELINE_REDISPIPELINEBOOTSTRAP_H_
 
 #include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -14,15 +16,22 @@
 #include "infra/kafka/Producer.h"
 #include "infra/ScheduledTaskProcessor.h"
 #include "infra/ScheduledTaskQueue.h"
+#include "infra/WriteStallController.h"
 #include "librdkafka/rdkafkacpp.h"
+#include "rocksdb/cache.h"
 #include "rocksdb/db.h"
 #include "rocksdb/options.h"
+#include "rocksdb/table.h"
+#include "pipeline/BackupManager.h"
 #include "pipeline/DatabaseManager.h"
 #include "pipeline/EmbeddedHttpServer.h"
+#include "pipeline/HotKeySampler.h"
 #include "pipeline/KafkaConsumerConfig.h"
 #include "pipeline/RedisHandler.h"
 #include "pipeline/RedisHandlerBuilder.h"
 #include "pipeline/RedisPipelineFactory.h"
+#include "pipeline/RocksDbMetrics.h"
+#include "pipeline/StartupTimer.h"
 #include "prometheus/exposer.h"
 #include "prometheus/registry.h"
 #include "wangle/bootstrap/ServerBootstrap.h"
@@ -115,6 +124,12 @@ class RedisPipelineBootstrap {
     // Allow client code to set DB-level options for RocksDB
     RocksDbConfigurator rocksDbConfigurator = nullptr;
 
+    // Optional
+    // Column family groups shard their keys by the whole key unless a function extracting the shard key is given
+    // here. The members of a group are chosen with the shard key and the mapping of the group, see
+    // DatabaseManager::getGroupShardNum.
+    DatabaseManager::ShardKeyFunctionMap shardKeyFunctionMap;
+
     // Optional
     // Indicate whether a singleton RedisHandler instance is sufficient for the pipeline
     // It is an optimization for the pipelines that do not save states to the handler instance
@@ -155,8 +170,9 @@ class RedisPipelineBootstrap {
     CHECK_NOTNULL(databaseManager_.get());
     return databaseManager_;
   }
-  const DatabaseManager::ColumnFamilyGroupMap& getColumnFamilyGroupMap() const {
-    return columnFamilyGroupMap_;
+  // The current column family groups, including members created or dropped at runtime
+  std::shared_ptr<const DatabaseManager::ColumnFamilyGroupMap> getColumnFamilyGroupMap() const {
+    return getDatabaseManager()->columnFamilyGroupMap();
   }
   std::shared_ptr<infra::kafka::ConsumerHelper> getKafkaConsumerHelper() const {
     CHECK_NOTNULL(kafkaConsumerHelper_.get());
@@ -171,6 +187,9 @@ class RedisPipelineBootstrap {
     auto it = kafkaProducers_.find(name);
     return it == kafkaProducers_.end() ? std::shared_ptr<infra::kafka::Producer>() : it->second;
   }
+  // Startup phases are timed from the construction of the bootstrap
+  StartupTimer& startupTimer() { return startupTimer_; }
+
   std::shared_ptr<prometheus::Registry> getMetricsRegistry() const {
     CHECK_NOTNULL(metricsRegistry_.get());
     return metricsRegistry_;
@@ -178,27 +197,77 @@ class RedisPipelineBootstrap {
 
   void initializeRocksDb(const std::string& dbPath, const std::string& dbPaths,
                          const std::string& cfGroupConfigs,
-                         const std::string& dropCfGroupConfigs, int parallelism, int blockCacheSizeMb,
+                         const std::string& dropCfGroupConfigs, const std::string& compressionProfiles,
+                         int parallelism, int blockCacheSizeMb, bool partitionIndexFilters,
                          bool createIfMissing, bool createIfMissingOneOff, int64_t versionMimestampMs);
 
+  // Parse the secondary RocksDB instances given in JSON, each holding whole column family groups in its own database:
+  // {"<name>": {"db_path": "...", "wal_dir": "...", "cf_groups": ["<group>", ...]}}. wal_dir is optional and lets
+  // instances write their WAL to separate devices. Must be called before restoreRocksDbFromBackup and
+  // initializeRocksDb.
+  void initializeRocksDbInstances(const std::string& instanceConfigs);
+
+  // Restore a backup into dbPath before the database is opened. It is a one-off operation guarded by
+  // versionTimestampMs because it overwrites the current content of the database. Secondary instances are restored
+  // from their own backup directories under backupDir, with the backup ids given for each of them in JSON:
+  // {"<name>": <backup id>, ...}, where 0 restores the latest backup of the instance.
+  void restoreRocksDbFromBackup(const std::string& dbPath, const std::string& backupDir, uint32_t backupId,
+                                const std::string& instanceBackupIds, uint64_t rateLimitBytesPerSec, int parallelism,
+                                int64_t versionTimestampMs);
+
   void stopRocksDb() {
-    for (auto& entry : columnFamilyMap_) {
-      rocksDb_->DestroyColumnFamilyHandle(entry.second);
+    if (databaseManager_) {
+      // the database manager knows about column families created or dropped at runtime
+      databaseManager_->destroyColumnFamilyHandles();
+    } else {
+      for (auto& entry : columnFamilyMap_) {
+        rocksDb_->DestroyColumnFamilyHandle(entry.second);
+      }
+    }
+    for (auto& instance : rocksDbInstances_) {
+      instance.db->DestroyColumnFamilyHandle(instance.defaultColumnFamily);
+      delete instance.db;
     }
     delete rocksDb_;
     LOG(INFO) << "RocksDB has shutdown gracefully";
   }
 
   // optimize block-based table after all options are initialized
-  void optimizeBlockedBasedTable();
+  void optimizeBlockedBasedTable(bool partitionIndexFilters);
 
   // Initialize optional components
   void initializeDatabaseManager(bool masterReplica);
   void initializeKafkaProducers(const std::string& brokerList, const std::string& kafkaProducerConfigs);
   void initializeKafkaConsumer(const std::string& brokerList, const std::string& kafkaConsumerConfigs,
                                int64_t versionTimestampMs);
-  void initializeScheduledTaskQueues();
+  // Failed tasks of queues with a `<column family>-dead-letter` column family configured are retried with a backoff
+  // and then moved there when maxAttempts is positive. Other queues retry failed tasks at every check. Without the
+  // merge counter, queues count their tasks in memory, see ScheduledTaskQueue::disableTaskCounter.
+  void initializeScheduledTaskQueues(int workerCount, int maxAttempts, int64_t retryBackoffMs,
+                                     int64_t maxRetryBackoffMs, bool mergeCounter);
+  // Enable the BACKUP command when a backup directory is given
+  void initializeBackupManager(const std::string& backupDir, uint64_t rateLimitBytesPerSec, int parallelism);
+  // Sample hot keys from client reads and warm up the block cache with the keys persisted by the previous run. Both
+  // stay off when persistIntervalMs is 0.
+  void initializeHotKeySampler(int64_t persistIntervalMs, int sampleRate, int maxKeys, int64_t warmUpBudgetMs,
+                               int warmUpParallelism);
+  // Run multi-key requests over column family group members on a thread pool
+  void initializeShardedExecutor(int threadCount);
+  // Select the shard mapping of column family groups given in JSON, e.g., {"<group>": "jump"}, and record it
+  void initializeShardMappings(const std::string& shardMappings);
+  // Enable the CLUSTER command and MOVED redirects when a column family group is given
+  void initializeClusterTopology(const std::string& groupName, const std::string& nodesJson,
+                                 const std::string& announceAddress, int port);
   void initializeRegistry();
+  // Export RocksDB statistics and events to the metrics registry. Must be called before initializeRocksDb so that the
+  // event listener can be installed when opening the database.
+  void initializeRocksDbMetrics(int64_t collectionIntervalMs);
+  // Apply backpressure to kafka consumers and client writes under RocksDB write pressure. Must be called before
+  // initializeRocksDb for the same reason as initializeRocksDbMetrics.
+  void initializeWriteStallController(int64_t pollIntervalMs, int64_t maxConsumerDelayMs, int64_t maxClientDelayMs);
+
+  // Expose server-side tunables through CONFIG GET/SET once all the optional components are initialized
+  void registerServerOptions();
 
   void initializeEmbeddedHttpServer(int httpPort, int redisServerPort);
 
@@ -206,8 +275,40 @@ class RedisPipelineBootstrap {
     if (databaseManager_) {
       databaseManager_->start();
     }
+    if (databaseManager_ && hotKeyPersistIntervalMs_ > 0) {
+      auto hotKeySampler = databaseManager_->hotKeySampler();
+      // warm up in the background so that the server listens meanwhile, READY reports 0 until it finishes
+      HotKeySampler::ColumnFamilyMap warmUpColumnFamilyMap;
+      for (const auto& entry : columnFamilyMap_) {
+        if (entry.first != DatabaseManager::metadataColumnFamilyName()) warmUpColumnFamilyMap.insert(entry);
+      }
+      hotKeySampler->startWarmUp(warmUpColumnFamilyMap, cacheWarmUpParallelism_, cacheWarmUpBudgetMs_);
+      hotKeySampler->start(hotKeyPersistIntervalMs_);
+    }
+    if (rocksDbMetrics_) {
+      rocksDbMetrics_->start(databaseManager_, rocksDbMetricsIntervalMs_);
+    }
+    if (writeStallController_) {
+      auto databaseManager = databaseManager_;
+      writeStallController_->start(rocksDb_, [databaseManager]() {
+        std::vector<rocksdb::ColumnFamilyHandle*> columnFamilies;
+        auto columnFamilyMap = databaseManager->columnFamilyMap();
+        for (const auto& entry : *columnFamilyMap) {
+          columnFamilies.push_back(entry.second);
+        }
+        return columnFamilies;
+      }, writeStallPollIntervalMs_, [databaseManager](rocksdb::ColumnFamilyHandle* columnFamily) {
+        return databaseManager->db(columnFamily);
+      });
+    }
+    // task queues may have to scan their column families for the outstanding task count, so start them in parallel
+    std::vector<std::thread> taskQueueStartThreads;
     for (auto& taskQueueEntry : scheduledTaskQueueMap_) {
-      taskQueueEntry.second->start();
+      auto taskQueue = taskQueueEntry.second;
+      taskQueueStartThreads.emplace_back([taskQueue]() { taskQueue->start(); });
+    }
+    for (auto& thread : taskQueueStartThreads) {
+      thread.join();
     }
     // First initialize all consumers then start their consumer loops
     // Initialization may panic on verification failures. Panic before starting any consumer loops reduces the
@@ -243,13 +344,33 @@ class RedisPipelineBootstrap {
     for (auto& producerEntry : kafkaProducers_) {
       if (producerEntry.second) producerEntry.second->destroy();
     }
+    if (writeStallController_) {
+      writeStallController_->stop();
+    }
+    if (rocksDbMetrics_) {
+      rocksDbMetrics_->stop();
+    }
+    if (backupManager_) {
+      // a running backup must finish before the database closes
+      backupManager_->waitForBackup();
+    }
+    for (auto& instance : rocksDbInstances_) {
+      if (instance.backupManager) instance.backupManager->waitForBackup();
+    }
     if (databaseManager_) {
+      databaseManager_->hotKeySampler()->stop();
+      databaseManager_->hotKeySampler()->waitForWarmUp();
+    }
+    if (databaseManager_) {
+      // a running export or import must finish before the database closes
+      databaseManager_->backgroundJobRunner()->waitForJob();
       databaseManager_->destroy();
     }
   }
 
-  // Create server and block on listening
-  void launchServer(int port, int connectionIdleTimeoutMs);
+  // Create server and block on listening. With shard affinity IO threads, commands with keys run on the IO thread
+  // owning the virtual shard of the key.
+  void launchServer(int port, int connectionIdleTimeoutMs, int shardAffinityIoThreads = 0);
 
   // Stop server
   void stopServer() {
@@ -286,8 +407,22 @@ class RedisPipelineBootstrap {
 
   using RocksDbColumnFamilyGroupConfigMap = std::unordered_map<std::string, RocksDbColumnFamilyGroupConfig>;
 
+  // A secondary RocksDB instance. Its default column family is opened because RocksDB requires it, but not served.
+  struct RocksDbInstance {
+    std::string name;
+    std::string dbPath;
+    std::string walDir;
+    std::vector<std::string> columnFamilyGroups;
+    rocksdb::DB* db = nullptr;
+    rocksdb::ColumnFamilyHandle* defaultColumnFamily = nullptr;
+    std::shared_ptr<BackupManager> backupManager;
+  };
+
   static constexpr int64_t kMaxVersionTimestampAgeMs = 30 * 60 * 1000;  // 30 minutes
   static constexpr char kVersionTimestampKey[] = "VersionTimestamp";
+  // settings for partitioned index and filter blocks
+  static constexpr uint64_t kMetadataBlockSize = 4 * 1024;
+  static constexpr double kHighPriPoolRatio = 0.5;
 
   explicit RedisPipelineBootstrap(Config config) : config_(std::move(config)), rocksDb_(nullptr) {}
 
@@ -297,20 +432,64 @@ class RedisPipelineBootstrap {
   // Update ColumnFamilyOptions with block cache config for RocksDB
   void setRocksDbBlockCache(int blockCacheSizeMb, rocksdb::ColumnFamilyOptions* options);
 
+  // Switch column families using a binary search index to two-level index and filter blocks that are charged to the
+  // block cache. Other index types, such as the hash index of OptimizeForPointLookup, are kept. The configured filter
+  // policy is kept too, and its filters are partitioned when it builds full filters. Block caches are replaced by ones
+  // with the same settings and a high priority pool for index and filter blocks.
+  void partitionIndexAndFilterBlocks(
+      const std::string& columnFamilyName, rocksdb::BlockBasedTableOptions* tableOptions,
+      std::unordered_map<rocksdb::Cache*, std::shared_ptr<rocksdb::Cache>>* replacedBlockCaches);
+
+  // Number of shard bits of an LRU cache, or -1 when the cache does not report it
+  static int getBlockCacheNumShardBits(const rocksdb::Cache& cache);
+
   // Set db_paths from json string
   void setDbPaths(const std::string& json, rocksdb::Options* options);
 
   // Parse configurations for rocksdb column family groups
   RocksDbColumnFamilyGroupConfigMap parseRocksDbColumnFamilyGroupConfigs(const std::string& configs);
 
+  // Apply compression profiles to column families or column family groups given in JSON
+  void applyCompressionProfiles(const std::string& json, const RocksDbColumnFamilyGroupConfigMap& cfGroupConfigMap);
+
   // Process column family group by call the given callback with each column family name in the group in order
   void processRocksDbColumnFamilyGroup(const std::string& groupName, const RocksDbColumnFamilyGroupConfig& groupConfig,
                                        std::function<void(const std::string&)> callback);
+
+  // Group members created at runtime by shard number for each group
+  using AdoptedGroupMemberMap = std::unordered_map<std::string, std::map<int, std::string>>;
+
+  // Column families created at runtime with CFGROUP CREATE are not covered by the group configs. Recognize them by
+  // their `<group>-<position>` names and open them with the options of the first configured member of the group.
+  bool adoptColumnFamilyGroupMember(const std::string& name, const RocksDbColumnFamilyGroupConfigMap& cfGroupConfigMap,
+                                    AdoptedGroupMemberMap* adoptedGroupMembers);
+
+  // Open the database in dbPath with the existing column families, and create the missing column families among the
+  // configured ones accepted by ownsColumnFamily. Existing column families must either be configured, be listed in
+  // dropColumnFamilyOptionsMap or be group members created at runtime.
+  rocksdb::DB* openRocksDb(
+      rocksdb::Options options, const std::string& dbPath, const std::string& phaseSuffix,
+      const std::function<bool(const std::string&)>& ownsColumnFamily,
+      const std::unordered_map<std::string, rocksdb::ColumnFamilyOptions>& dropColumnFamilyOptionsMap,
+      const RocksDbColumnFamilyGroupConfigMap& cfGroupConfigMap, int parallelism, bool createIfMissing,
+      bool createIfMissingOneOff, int64_t versionTimestampMs, AdoptedGroupMemberMap* adoptedGroupMembers,
+      std::vector<rocksdb::ColumnFamilyHandle*>* columnFamilyHandles);
+
+  // Consumers commit their data along with the offsets in the primary instance, so none of the column family groups
+  // they write may be in a secondary instance
+  void checkKafkaConsumerColumnFamilyGroups(const KafkaConsumerConfig& config);
+
+  // Create the given column families with up to parallelism threads and append their handles
+  void createColumnFamilies(rocksdb::DB* db, const std::vector<std::string>& names, int parallelism,
+                            std::vector<rocksdb::ColumnFamilyHandle*>* columnFamilyHandles);
+
   // Configurations for the RedisPipeline
   Config config_;
+  StartupTimer startupTimer_;
 
   // rocksdb pointers here are raw pointers since we want to deleted them explicitly for graceful shutdown
   rocksdb::DB* rocksDb_;
+  std::vector<RocksDbInstance> rocksDbInstances_;
   DatabaseManager::ColumnFamilyMap columnFamilyMap_;
   DatabaseManager::ColumnFamilyGroupMap columnFamilyGroupMap_;
   std::unordered_map<std::string, rocksdb::ColumnFamilyOptions> columnFamilyOptionsMap_;
@@ -327,6 +506,16 @@ class RedisPipelineBootstrap {
   // Prometheus metrics
   std::shared_ptr<prometheus::Exposer> metricsExposer_;
   std::shared_ptr<prometheus::Registry> metricsRegistry_;
+  std::shared_ptr<RocksDbMetrics> rocksDbMetrics_;
+  int64_t rocksDbMetricsIntervalMs_ = 0;
+  // Backpressure for writers under RocksDB write stalls
+  std::shared_ptr<infra::WriteStallController> writeStallController_;
+  int64_t writeStallPollIntervalMs_ = 0;
+  std::shared_ptr<BackupManager> backupManager_;
+  // hot key sampling and the cache warm-up are off when it is 0
+  int64_t hotKeyPersistIntervalMs_ = 0;
+  int64_t cacheWarmUpBudgetMs_ = 0;
+  int cacheWarmUpParallelism_ = 0;
   // Embedded http server for health check and metrics
   std::shared_ptr<EmbeddedHttpServer> embeddedHttpServer_;
   // require component
@@ -33,7 +33,8 @@ class RedisPipelineFactory : public wangle::PipelineFactory<RedisPipeline> {
     pipeline->addBack(redisDecoder_);
     pipeline->addBack(redisEncoder_);
     auto redisHandler = redisHandlerBuilder_->newHandler();
-    if (redisHandler->allowAsyncCommandHandler()) {
+    // commands forwarded to other IO threads under shard affinity complete out of order as well
+    if (redisHandler->allowAsyncCommandHandler() || RedisHandler::getShardAffinity()) {
       pipeline->addBack(std::make_shared<OrderedRedisMessageAdapter>());
     }
     pipeline->addBack(std::move(redisHandler));
@@ -0,0 +1,270 @@
+#include "pipeline/RocksDbMetrics.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <string>
+
+#include "glog/logging.h"
+#include "prometheus/counter_builder.h"
+#include "prometheus/gauge_builder.h"
+#include "prometheus/histogram_builder.h"
+
+namespace pipeline {
+
+namespace {
+
+// Per column family integer properties exported as gauges
+const char* const kColumnFamilyIntProperties[] = {
+    "rocksdb.estimate-pending-compaction-bytes",
+    "rocksdb.num-files-at-level0",
+    "rocksdb.num-immutable-mem-table",
+    "rocksdb.mem-table-flush-pending",
+    "rocksdb.compaction-pending",
+    "rocksdb.num-running-compactions",
+    "rocksdb.num-running-flushes",
+    "rocksdb.cur-size-active-mem-table",
+    "rocksdb.cur-size-all-mem-tables",
+    "rocksdb.size-all-mem-tables",
+    "rocksdb.estimate-num-keys",
+    "rocksdb.estimate-live-data-size",
+    "rocksdb.estimate-table-readers-mem",
+    "rocksdb.total-sst-files-size",
+    "rocksdb.actual-delayed-write-rate",
+    "rocksdb.is-write-stopped",
+};
+
+const prometheus::Histogram::BucketBoundaries kDurationBucketsSeconds = {0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300};
+
+}  // namespace
+
+std::string RocksDbMetrics::normalizeName(const std::string& name) {
+  std::string normalized = name;
+  if (normalized.compare(0, 8, "rocksdb.") == 0) normalized.erase(0, 8);
+  std::replace_if(normalized.begin(), normalized.end(), [](char c) { return !std::isalnum(c); }, '_');
+  return normalized;
+}
+
+template <typename T, typename... Args>
+T& RocksDbMetrics::getOrAdd(prometheus::Family<T>& family, const Labels& labels, Args&&... args) {
+  std::lock_guard<std::mutex> guard(metricCacheMutex_);
+  void*& metric = metricCache_[std::make_pair(static_cast<void*>(&family), labels)];
+  if (metric == nullptr) {
+    metric = &family.Add(labels, std::forward<Args>(args)...);
+  }
+  return *static_cast<T*>(metric);
+}
+
+RocksDbMetrics::RocksDbMetrics(std::shared_ptr<prometheus::Registry> registry)
+    : registry_(registry),
+      tickerFamily_(prometheus::BuildCounter()
+                        .Name("rocksdb_ticker_total")
+                        .Help("RocksDB statistics tickers")
+                        .Register(*registry)),
+      histogramFamily_(prometheus::BuildGauge()
+                           .Name("rocksdb_histogram")
+                           .Help("RocksDB statistics histograms by statistic, e.g., p99 and average")
+                           .Register(*registry)),
+      columnFamilyPropertyFamily_(prometheus::BuildGauge()
+                                      .Name("rocksdb_cf_property")
+                                      .Help("RocksDB column family integer properties")
+                                      .Register(*registry)),
+      flushCountFamily_(prometheus::BuildCounter()
+                            .Name("rocksdb_flush_total")
+                            .Help("Number of completed memtable flushes")
+                            .Register(*registry)),
+      flushBytesFamily_(prometheus::BuildCounter()
+                            .Name("rocksdb_flush_bytes_total")
+                            .Help("Bytes written to L0 by memtable flushes")
+                            .Register(*registry)),
+      flushDurationFamily_(prometheus::BuildHistogram()
+                               .Name("rocksdb_flush_duration_seconds")
+                               .Help("Duration of memtable flushes")
+                               .Register(*registry)),
+      compactionCountFamily_(prometheus::BuildCounter()
+                                 .Name("rocksdb_compaction_total")
+                                 .Help("Number of completed compactions")
+                                 .Register(*registry)),
+      compactionInputBytesFamily_(prometheus::BuildCounter()
+                                      .Name("rocksdb_compaction_input_bytes_total")
+                                      .Help("Bytes read by compactions")
+                                      .Register(*registry)),
+      compactionOutputBytesFamily_(prometheus::BuildCounter()
+                                       .Name("rocksdb_compaction_output_bytes_total")
+                                       .Help("Bytes written by compactions")
+                                       .Register(*registry)),
+      compactionDurationFamily_(prometheus::BuildHistogram()
+                                    .Name("rocksdb_compaction_duration_seconds")
+                                    .Help("Duration of compactions")
+                                    .Register(*registry)),
+      stallConditionFamily_(prometheus::BuildGauge()
+                                .Name("rocksdb_write_stall_condition")
+                                .Help("Current write stall condition: 0 normal, 1 delayed, 2 stopped")
+                                .Register(*registry)),
+      stallChangeFamily_(prometheus::BuildCounter()
+                             .Name("rocksdb_write_stall_changes_total")
+                             .Help("Number of write stall condition changes by new condition")
+                             .Register(*registry)),
+      run_(false) {}
+
+void RocksDbMetrics::start(std::shared_ptr<DatabaseManager> databaseManager, int64_t intervalMs) {
+  CHECK(!run_) << "RocksDB metrics collection is already running";
+  CHECK_GT(intervalMs, 0);
+  databaseManager_ = databaseManager;
+  run_ = true;
+  collectionThread_.reset(new std::thread([this, intervalMs]() {
+    pthread_setname_np(pthread_self(), "rocksdb-metrics");
+    while (run_) {
+      collect();
+      // sleep in small steps so that stop() does not have to wait for a full interval
+      for (int64_t sleptMs = 0; run_ && sleptMs < intervalMs; sleptMs += 100) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min<int64_t>(100, intervalMs - sleptMs)));
+      }
+    }
+  }));
+  LOG(INFO) << "Started RocksDB metrics collection every " << intervalMs << "ms";
+}
+
+void RocksDbMetrics::stop() {
+  if (!run_) return;
+  run_ = false;
+  collectionThread_->join();
+  collectionThread_.reset();
+}
+
+void RocksDbMetrics::collect() {
+  if (statistics_) {
+    collectTickers();
+    collectHistograms();
+  }
+  if (databaseManager_) {
+    collectColumnFamilyProperties();
+  }
+}
+
+void RocksDbMetrics::collectTickers() {
+  for (const auto& entry : rocksdb::TickersNameMap) {
+    uint64_t count = statistics_->getTickerCount(entry.first);
+    uint64_t& lastCount = lastTickerCounts_[entry.first];
+    // tickers may be reset by `statistics_->Reset()`, in which case we start over from the new value
+    uint64_t delta = count >= lastCount ? count - lastCount : count;
+    lastCount = count;
+    if (delta > 0) {
+      getOrAdd(tickerFamily_, {{"name", normalizeName(entry.second)}}).Increment(delta);
+    }
+  }
+}
+
+void RocksDbMetrics::collectHistograms() {
+  for (const auto& entry : rocksdb::HistogramsNameMap) {
+    rocksdb::HistogramData data;
+    statistics_->histogramData(entry.first, &data);
+    const std::string name = normalizeName(entry.second);
+    getOrAdd(histogramFamily_, {{"name", name}, {"stat", "p50"}}).Set(data.median);
+    getOrAdd(histogramFamily_, {{"name", name}, {"stat", "p95"}}).Set(data.percentile95);
+    getOrAdd(histogramFamily_, {{"name", name}, {"stat", "p99"}}).Set(data.percentile99);
+    getOrAdd(histogramFamily_, {{"name", name}, {"stat", "average"}}).Set(data.average);
+  }
+}
+
+void RocksDbMetrics::collectColumnFamilyProperties() {
+  auto columnFamilyMap = databaseManager_->columnFamilyMap();
+  for (const auto& entry : *columnFamilyMap) {
+    rocksdb::DB* db = databaseManager_->db(entry.second);
+    for (const char* property : kColumnFamilyIntProperties) {
+      uint64_t value;
+      if (db->GetIntProperty(entry.second, property, &value)) {
+        getOrAdd(columnFamilyPropertyFamily_, {{"cf", entry.first}, {"property", normalizeName(property)}}).Set(value);
+      }
+    }
+  }
+}
+
+void RocksDbMetrics::OnFlushBegin(rocksdb::DB* db, const rocksdb::FlushJobInfo& info) {
+  std::lock_guard<std::mutex> guard(flushMutex_);
+  flushStartMicros_[info.job_id] = nowMicros();
+}
+
+void RocksDbMetrics::OnFlushCompleted(rocksdb::DB* db, const rocksdb::FlushJobInfo& info) {
+  // FlushJobInfo carries no flush reason in this RocksDB version, so use whether the flush was triggered by a stall
+  const char* trigger =
+      info.triggered_writes_stop ? "writes_stop" : (info.triggered_writes_slowdown ? "writes_slowdown" : "normal");
+  const uint64_t bytes = info.table_properties.data_size + info.table_properties.index_size +
+                         info.table_properties.filter_size;
+
+  getOrAdd(flushCountFamily_, {{"cf", info.cf_name}, {"trigger", trigger}}).Increment();
+  getOrAdd(flushBytesFamily_, {{"cf", info.cf_name}}).Increment(bytes);
+
+  std::lock_guard<std::mutex> guard(flushMutex_);
+  auto it = flushStartMicros_.find(info.job_id);
+  if (it != flushStartMicros_.end()) {
+    getOrAdd(flushDurationFamily_, {{"cf", info.cf_name}}, kDurationBucketsSeconds)
+        .Observe((nowMicros() - it->second) / 1e6);
+    flushStartMicros_.erase(it);
+  }
+}
+
+void RocksDbMetrics::OnCompactionCompleted(rocksdb::DB* db, const rocksdb::CompactionJobInfo& info) {
+  if (!info.status.ok()) {
+    LOG(WARNING) << "Compaction of `" << info.cf_name << "` failed: " << info.status.ToString();
+    return;
+  }
+  const Labels labels = {{"cf", info.cf_name}, {"reason", compactionReasonName(info.compaction_reason)}};
+  getOrAdd(compactionCountFamily_, labels).Increment();
+  getOrAdd(compactionInputBytesFamily_, labels).Increment(info.stats.total_input_bytes);
+  getOrAdd(compactionOutputBytesFamily_, labels).Increment(info.stats.total_output_bytes);
+  getOrAdd(compactionDurationFamily_, {{"cf", info.cf_name}}, kDurationBucketsSeconds)
+      .Observe(info.stats.elapsed_micros / 1e6);
+}
+
+void RocksDbMetrics::OnStallConditionsChanged(const rocksdb::WriteStallInfo& info) {
+  const char* condition;
+  switch (info.condition.cur) {
+    case rocksdb::WriteStallCondition::kNormal:
+      condition = "normal";
+      break;
+    case rocksdb::WriteStallCondition::kDelayed:
+      condition = "delayed";
+      break;
+    case rocksdb::WriteStallCondition::kStopped:
+      condition = "stopped";
+      break;
+    default:
+      condition = "unknown";
+  }
+  LOG(INFO) << "Write stall condition of `" << info.cf_name << "` changed to " << condition;
+  getOrAdd(stallConditionFamily_, {{"cf", info.cf_name}}).Set(static_cast<double>(info.condition.cur));
+  getOrAdd(stallChangeFamily_, {{"cf", info.cf_name}, {"condition", condition}}).Increment();
+}
+
+const char* RocksDbMetrics::compactionReasonName(rocksdb::CompactionReason reason) {
+  switch (reason) {
+    case rocksdb::CompactionReason::kLevelL0FilesNum:
+      return "level_l0_files_num";
+    case rocksdb::CompactionReason::kLevelMaxLevelSize:
+      return "level_max_level_size";
+    case rocksdb::CompactionReason::kUniversalSizeAmplification:
+      return "universal_size_amplification";
+    case rocksdb::CompactionReason::kUniversalSizeRatio:
+      return "universal_size_ratio";
+    case rocksdb::CompactionReason::kUniversalSortedRunNum:
+      return "universal_sorted_run_num";
+    case rocksdb::CompactionReason::kFIFOMaxSize:
+      return "fifo_max_size";
+    case rocksdb::CompactionReason::kManualCompaction:
+      return "manual";
+    case rocksdb::CompactionReason::kFilesMarkedForCompaction:
+      return "files_marked_for_compaction";
+    default:
+      return "unknown";
+  }
+}
+
+int64_t RocksDbMetrics::nowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace pipeline
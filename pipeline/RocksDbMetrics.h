@@ -0,0 +1,106 @@
+#ifndef PIPELINE_ROCKSDBMETRICS_H_
+#define PIPELINE_ROCKSDBMETRICS_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "pipeline/DatabaseManager.h"
+#include "prometheus/counter.h"
+#include "prometheus/family.h"
+#include "prometheus/gauge.h"
+#include "prometheus/histogram.h"
+#include "prometheus/registry.h"
+#include "rocksdb/db.h"
+#include "rocksdb/listener.h"
+#include "rocksdb/statistics.h"
+
+namespace pipeline {
+
+// Export RocksDB tickers, histograms, column family properties, and flush/compaction/stall events to prometheus.
+// Events are recorded as they arrive from RocksDB background threads; everything else is collected periodically.
+class RocksDbMetrics : public rocksdb::EventListener {
+ public:
+  // Convert a RocksDB name such as `rocksdb.block.cache.miss` into a valid prometheus label value
+  static std::string normalizeName(const std::string& name);
+
+  explicit RocksDbMetrics(std::shared_ptr<prometheus::Registry> registry);
+
+  ~RocksDbMetrics() {
+    stop();
+  }
+
+  // Tickers and histograms are only collected when statistics are enabled in the DB options
+  void setStatistics(std::shared_ptr<rocksdb::Statistics> statistics) {
+    statistics_ = statistics;
+  }
+
+  // Start the background thread that collects metrics every intervalMs
+  void start(std::shared_ptr<DatabaseManager> databaseManager, int64_t intervalMs);
+
+  // Stop the background thread and wait for it to exit
+  void stop();
+
+  // Collect tickers, histograms, and column family properties once
+  void collect();
+
+  void OnFlushBegin(rocksdb::DB* db, const rocksdb::FlushJobInfo& info) override;
+  void OnFlushCompleted(rocksdb::DB* db, const rocksdb::FlushJobInfo& info) override;
+  void OnCompactionCompleted(rocksdb::DB* db, const rocksdb::CompactionJobInfo& info) override;
+  void OnStallConditionsChanged(const rocksdb::WriteStallInfo& info) override;
+
+ private:
+  using Labels = std::map<std::string, std::string>;
+
+  static const char* compactionReasonName(rocksdb::CompactionReason reason);
+  static int64_t nowMicros();
+
+  // Family::Add does not dedupe labels in this prometheus-cpp version, so metrics are looked up in a local cache first
+  template <typename T, typename... Args>
+  T& getOrAdd(prometheus::Family<T>& family, const Labels& labels, Args&&... args);
+
+  void collectTickers();
+  void collectHistograms();
+  void collectColumnFamilyProperties();
+
+  std::shared_ptr<prometheus::Registry> registry_;
+  std::shared_ptr<rocksdb::Statistics> statistics_;
+  std::shared_ptr<DatabaseManager> databaseManager_;
+
+  // periodically collected metrics
+  prometheus::Family<prometheus::Counter>& tickerFamily_;
+  prometheus::Family<prometheus::Gauge>& histogramFamily_;
+  prometheus::Family<prometheus::Gauge>& columnFamilyPropertyFamily_;
+  // event metrics
+  prometheus::Family<prometheus::Counter>& flushCountFamily_;
+  prometheus::Family<prometheus::Counter>& flushBytesFamily_;
+  prometheus::Family<prometheus::Histogram>& flushDurationFamily_;
+  prometheus::Family<prometheus::Counter>& compactionCountFamily_;
+  prometheus::Family<prometheus::Counter>& compactionInputBytesFamily_;
+  prometheus::Family<prometheus::Counter>& compactionOutputBytesFamily_;
+  prometheus::Family<prometheus::Histogram>& compactionDurationFamily_;
+  prometheus::Family<prometheus::Gauge>& stallConditionFamily_;
+  prometheus::Family<prometheus::Counter>& stallChangeFamily_;
+
+  // Last ticker values so that prometheus counters only move forward by the delta
+  std::unordered_map<uint32_t, uint64_t> lastTickerCounts_;
+  // Metrics are added from both the collection thread and RocksDB background threads
+  std::map<std::pair<void*, Labels>, void*> metricCache_;
+  std::mutex metricCacheMutex_;
+  // Start time of in-flight flushes by job id
+  std::unordered_map<int, int64_t> flushStartMicros_;
+  std::mutex flushMutex_;
+
+  std::atomic<bool> run_;
+  std::unique_ptr<std::thread> collectionThread_;
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_ROCKSDBMETRICS_H_
@@ -0,0 +1,80 @@
+#include "pipeline/RocksDbMetrics.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "prometheus/registry.h"
+#include "rocksdb/statistics.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+static std::shared_ptr<prometheus::Registry> registry;
+static std::shared_ptr<RocksDbMetrics> rocksDbMetrics;
+
+static void configureRocksDb(rocksdb::DBOptions* options) {
+  options->statistics = rocksdb::CreateDBStatistics();
+  rocksDbMetrics->setStatistics(options->statistics);
+  options->listeners.push_back(rocksDbMetrics);
+}
+
+class RocksDbMetricsTest : public stesting::TestWithRocksDb {
+ protected:
+  RocksDbMetricsTest() : stesting::TestWithRocksDb({}, {}, {}, &configureRocksDb) {
+    registry = std::make_shared<prometheus::Registry>();
+    rocksDbMetrics = std::make_shared<RocksDbMetrics>(registry);
+  }
+
+  ~RocksDbMetricsTest() {
+    rocksDbMetrics.reset();
+    registry.reset();
+  }
+
+  // Return the number of metrics in the family with the given name, or -1 when the family does not exist
+  int metricCount(const std::string& familyName) {
+    for (const auto& family : registry->Collect()) {
+      if (family.name() == familyName) return family.metric_size();
+    }
+    return -1;
+  }
+};
+
+TEST(RocksDbMetrics, NormalizeName) {
+  EXPECT_EQ("block_cache_miss", RocksDbMetrics::normalizeName("rocksdb.block.cache.miss"));
+  EXPECT_EQ("estimate_pending_compaction_bytes",
+            RocksDbMetrics::normalizeName("rocksdb.estimate-pending-compaction-bytes"));
+  EXPECT_EQ("db_get", RocksDbMetrics::normalizeName("db_get"));
+}
+
+TEST_F(RocksDbMetricsTest, CollectAndEvents) {
+  EXPECT_EQ(0, metricCount("rocksdb_ticker_total"));
+  EXPECT_EQ(0, metricCount("rocksdb_flush_total"));
+
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), "key", "value").ok());
+  ASSERT_TRUE(db()->Flush(rocksdb::FlushOptions()).ok());
+  std::string value;
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), "key", &value).ok());
+
+  rocksDbMetrics->start(databaseManager(), 60000);
+  rocksDbMetrics->stop();
+  // the background thread may not have collected before stopping, so collect explicitly
+  rocksDbMetrics->collect();
+
+  EXPECT_GT(metricCount("rocksdb_ticker_total"), 0);
+  EXPECT_GT(metricCount("rocksdb_histogram"), 0);
+  // both `default` and `smyte-metadata` export their properties
+  EXPECT_GT(metricCount("rocksdb_cf_property"), 0);
+  EXPECT_EQ(1, metricCount("rocksdb_flush_total"));
+  EXPECT_EQ(1, metricCount("rocksdb_flush_bytes_total"));
+  EXPECT_EQ(1, metricCount("rocksdb_flush_duration_seconds"));
+
+  // collecting again must reuse the existing metrics instead of adding duplicates
+  int tickerCount = metricCount("rocksdb_ticker_total");
+  int propertyCount = metricCount("rocksdb_cf_property");
+  rocksDbMetrics->collect();
+  EXPECT_EQ(tickerCount, metricCount("rocksdb_ticker_total"));
+  EXPECT_EQ(propertyCount, metricCount("rocksdb_cf_property"));
+}
+
+}  // namespace pipeline
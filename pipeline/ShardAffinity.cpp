@@ -0,0 +1,45 @@
+#include "pipeline/ShardAffinity.h"
+
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "folly/executors/IOThreadPoolExecutor.h"
+#include "glog/logging.h"
+#include "infra/SmyteId.h"
+#include "pipeline/DatabaseManager.h"
+
+namespace pipeline {
+
+int ShardAffinity::defaultShardFunction(const std::string& key) {
+  return DatabaseManager::getShardNum(key, infra::SmyteId::kVirtualShardCount);
+}
+
+std::vector<folly::EventBase*> ShardAffinity::getEventBases(folly::IOThreadPoolExecutor* ioThreadPool) {
+  // event bases are handed out round-robin, so asking once per thread visits every thread before serving requests
+  size_t threadCount = ioThreadPool->numThreads();
+  std::vector<folly::EventBase*> eventBases;
+  std::set<folly::EventBase*> seen;
+  for (size_t i = 0; i < threadCount; i++) {
+    folly::EventBase* eventBase = ioThreadPool->getEventBase();
+    CHECK(seen.insert(eventBase).second) << "IO thread pool did not hand out distinct event bases";
+    eventBases.push_back(eventBase);
+  }
+  return eventBases;
+}
+
+ShardAffinity::ShardAffinity(std::vector<folly::EventBase*> eventBases, ShardFunction shardFunction)
+    : eventBases_(std::move(eventBases)),
+      shardFunction_(std::move(shardFunction)),
+      localCommands_(0),
+      forwardedCommands_(0) {
+  CHECK(!eventBases_.empty());
+}
+
+void ShardAffinity::appendStatsInRedisInfoFormat(std::stringstream* ss) const {
+  (*ss) << "shard_affinity_io_threads:" << eventBases_.size() << std::endl;
+  (*ss) << "shard_affinity_local_commands:" << localCommands_ << std::endl;
+  (*ss) << "shard_affinity_forwarded_commands:" << forwardedCommands_ << std::endl;
+}
+
+}  // namespace pipeline
@@ -0,0 +1,70 @@
+#ifndef PIPELINE_SHARDAFFINITY_H_
+#define PIPELINE_SHARDAFFINITY_H_
+
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "folly/io/async/EventBase.h"
+
+namespace folly {
+class IOThreadPoolExecutor;
+}  // namespace folly
+
+namespace pipeline {
+
+// Assign every virtual shard to one IO thread so that all the client commands for a shard run on the same thread.
+// Commands received on other threads hop to the owner with runInEventBaseThread, which keeps the data of a shard hot
+// in the caches of one core. Kafka consumers, scheduled tasks and background jobs still write from their own threads,
+// so read-modify-write commands must stay safe under concurrent writes, e.g., by using merges.
+class ShardAffinity {
+ public:
+  // Map a key to its virtual shard
+  using ShardFunction = std::function<int(const std::string& key)>;
+
+  // Map a key to one of SmyteId::kVirtualShardCount virtual shards with murmurhash32
+  static int defaultShardFunction(const std::string& key);
+
+  // Return the event bases of all the threads of the pool
+  static std::vector<folly::EventBase*> getEventBases(folly::IOThreadPoolExecutor* ioThreadPool);
+
+  // Virtual shard i is owned by the event base i % eventBases.size()
+  explicit ShardAffinity(std::vector<folly::EventBase*> eventBases,
+                         ShardFunction shardFunction = &defaultShardFunction);
+
+  int getShard(const std::string& key) const { return shardFunction_(key); }
+
+  // Index of the thread owning a virtual shard
+  size_t getShardThread(int shard) const { return shard % eventBases_.size(); }
+
+  folly::EventBase* getThreadEventBase(size_t thread) const { return eventBases_[thread]; }
+
+  folly::EventBase* getShardEventBase(int shard) const { return eventBases_[getShardThread(shard)]; }
+
+  folly::EventBase* getKeyEventBase(const std::string& key) const { return getShardEventBase(getShard(key)); }
+
+  size_t threadCount() const { return eventBases_.size(); }
+
+  // Count commands run on the receiving thread and commands forwarded to the owner thread
+  void recordCommand(bool forwarded) {
+    if (forwarded) {
+      forwardedCommands_++;
+    } else {
+      localCommands_++;
+    }
+  }
+
+  void appendStatsInRedisInfoFormat(std::stringstream* ss) const;
+
+ private:
+  const std::vector<folly::EventBase*> eventBases_;
+  const ShardFunction shardFunction_;
+  std::atomic<uint64_t> localCommands_;
+  std::atomic<uint64_t> forwardedCommands_;
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_SHARDAFFINITY_H_
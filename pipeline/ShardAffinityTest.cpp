@@ -0,0 +1,50 @@
+#include "pipeline/ShardAffinity.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "folly/executors/IOThreadPoolExecutor.h"
+#include "gtest/gtest.h"
+#include "infra/SmyteId.h"
+
+namespace pipeline {
+
+TEST(ShardAffinity, GetEventBases) {
+  folly::IOThreadPoolExecutor ioThreadPool(4);
+  auto eventBases = ShardAffinity::getEventBases(&ioThreadPool);
+  EXPECT_EQ(4, eventBases.size());
+  ioThreadPool.join();
+}
+
+TEST(ShardAffinity, Ownership) {
+  folly::EventBase eventBase0;
+  folly::EventBase eventBase1;
+  ShardAffinity shardAffinity({&eventBase0, &eventBase1}, [](const std::string& key) { return std::stoi(key); });
+  EXPECT_EQ(2, shardAffinity.threadCount());
+  EXPECT_EQ(&eventBase0, shardAffinity.getShardEventBase(0));
+  EXPECT_EQ(&eventBase1, shardAffinity.getShardEventBase(1));
+  EXPECT_EQ(1, shardAffinity.getShardThread(3));
+  EXPECT_EQ(&eventBase1, shardAffinity.getThreadEventBase(1));
+  EXPECT_EQ(&eventBase0, shardAffinity.getKeyEventBase("4"));
+  EXPECT_EQ(&eventBase1, shardAffinity.getKeyEventBase("7"));
+
+  shardAffinity.recordCommand(false);
+  shardAffinity.recordCommand(true);
+  shardAffinity.recordCommand(true);
+  std::stringstream ss;
+  shardAffinity.appendStatsInRedisInfoFormat(&ss);
+  EXPECT_EQ("shard_affinity_io_threads:2\nshard_affinity_local_commands:1\nshard_affinity_forwarded_commands:2\n",
+            ss.str());
+}
+
+TEST(ShardAffinity, DefaultShardFunction) {
+  for (int i = 0; i < 1000; i++) {
+    int shard = ShardAffinity::defaultShardFunction(std::to_string(i));
+    EXPECT_GE(shard, 0);
+    EXPECT_LT(shard, infra::SmyteId::kVirtualShardCount);
+    EXPECT_EQ(shard, ShardAffinity::defaultShardFunction(std::to_string(i)));
+  }
+}
+
+}  // namespace pipeline
@@ -0,0 +1,84 @@
+#include "pipeline/ShardMapper.h"
+
+#include <memory>
+
+#include "folly/Format.h"
+#include "glog/logging.h"
+#include "murmurhash3/MurmurHash3.h"
+
+namespace pipeline {
+
+bool ShardMapper::parseMapping(const std::string& name, Mapping* mapping) {
+  if (name == "modulo") {
+    *mapping = Mapping::kModulo;
+  } else if (name == "jump") {
+    *mapping = Mapping::kJumpConsistentHash;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* ShardMapper::getMappingName(Mapping mapping) {
+  switch (mapping) {
+    case Mapping::kModulo:
+      return "modulo";
+    case Mapping::kJumpConsistentHash:
+      return "jump";
+  }
+  LOG(FATAL) << "Unknown shard mapping: " << static_cast<int>(mapping);
+  return nullptr;
+}
+
+int ShardMapper::getShardNum(Mapping mapping, const rocksdb::Slice& shardKey, int shardCount) {
+  if (mapping == Mapping::kModulo) {
+    uint32_t hash = 0;
+    MurmurHash3_x86_32(shardKey.data(), shardKey.size(), 0, &hash);
+    return hash % shardCount;
+  }
+  uint64_t hash[2];
+  MurmurHash3_x64_128(shardKey.data(), shardKey.size(), 0, hash);
+  return jumpConsistentHash(hash[0], shardCount);
+}
+
+int ShardMapper::jumpConsistentHash(uint64_t key, int bucketCount) {
+  int64_t bucket = -1;
+  int64_t next = 0;
+  while (next < bucketCount) {
+    bucket = next;
+    key = key * 2862933555777941757ULL + 1;
+    double scale = static_cast<double>(1LL << 31) / static_cast<double>((key >> 33) + 1);
+    next = static_cast<int64_t>((bucket + 1) * scale);
+  }
+  return static_cast<int>(bucket);
+}
+
+bool ShardMapper::planReshard(rocksdb::DB* db, const std::vector<rocksdb::ColumnFamilyHandle*>& columnFamilyGroup,
+                              Mapping mapping, int newShardCount, ReshardPlan* plan, std::string* error,
+                              ShardKeyFunction shardKeyFunction) {
+  CHECK_GT(newShardCount, 0);
+  *plan = ReshardPlan();
+  rocksdb::ReadOptions readOptions;
+  // a full scan should not evict the working set from the block cache
+  readOptions.fill_cache = false;
+  for (size_t member = 0; member < columnFamilyGroup.size(); member++) {
+    std::unique_ptr<rocksdb::Iterator> iter(db->NewIterator(readOptions, columnFamilyGroup[member]));
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      rocksdb::Slice shardKey = shardKeyFunction ? shardKeyFunction(iter->key()) : iter->key();
+      int target = getShardNum(mapping, shardKey, newShardCount);
+      plan->keyCount++;
+      if (target != static_cast<int>(member)) {
+        plan->movedKeyCount++;
+        plan->moves[std::make_pair(static_cast<int>(member), target)]++;
+      }
+    }
+    if (!iter->status().ok()) {
+      *error = folly::sformat("Scanning {} failed: {}", columnFamilyGroup[member]->GetName(),
+                              iter->status().ToString());
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace pipeline
@@ -0,0 +1,59 @@
+#ifndef PIPELINE_SHARDMAPPER_H_
+#define PIPELINE_SHARDMAPPER_H_
+
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rocksdb/db.h"
+#include "rocksdb/slice.h"
+
+namespace pipeline {
+
+// Map keys to the members of a column family group.
+//
+// The modulo mapping is murmurhash32 % shardCount, as in DatabaseManager::getShardNum. Changing the shard count remaps
+// almost every key. The jump mapping uses jump consistent hash over a 64-bit murmurhash. Growing a group from n to
+// n + 1 members only moves about 1/(n + 1) of the keys, all of them into the new member, and shrinking it only moves
+// the keys of the removed member.
+class ShardMapper {
+ public:
+  enum class Mapping {
+    kModulo,
+    kJumpConsistentHash,
+  };
+
+  // Extract the part of a stored key that decides its shard
+  using ShardKeyFunction = std::function<rocksdb::Slice(const rocksdb::Slice& key)>;
+
+  // Keys that would move when resharding a group
+  struct ReshardPlan {
+    uint64_t keyCount = 0;
+    uint64_t movedKeyCount = 0;
+    // moved keys by source member index and target member index
+    std::map<std::pair<int, int>, uint64_t> moves;
+  };
+
+  // Parse `modulo` or `jump`
+  static bool parseMapping(const std::string& name, Mapping* mapping);
+
+  static const char* getMappingName(Mapping mapping);
+
+  static int getShardNum(Mapping mapping, const rocksdb::Slice& shardKey, int shardCount);
+
+  // Jump consistent hash by Lamping and Veach: map a 64-bit key to one of bucketCount buckets
+  static int jumpConsistentHash(uint64_t key, int bucketCount);
+
+  // Scan the members of a group and find the keys that would live in another member if the group had newShardCount
+  // members. Keys are expected in the member chosen by the mapping for the current group size, but the plan is based
+  // on where they actually are. The whole key decides the shard unless a shard key function is given.
+  static bool planReshard(rocksdb::DB* db, const std::vector<rocksdb::ColumnFamilyHandle*>& columnFamilyGroup,
+                          Mapping mapping, int newShardCount, ReshardPlan* plan, std::string* error,
+                          ShardKeyFunction shardKeyFunction = nullptr);
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_SHARDMAPPER_H_
@@ -0,0 +1,130 @@
+#include "pipeline/ShardMapper.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "pipeline/DatabaseManager.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+class ShardMapperTest : public stesting::TestWithRocksDb {
+ protected:
+  ShardMapperTest() : stesting::TestWithRocksDb({"group", "empty"}, {}, {{"group", 2}, {"empty", 2}}) {}
+};
+
+TEST(ShardMapper, ParseMapping) {
+  ShardMapper::Mapping mapping;
+  EXPECT_TRUE(ShardMapper::parseMapping("jump", &mapping));
+  EXPECT_EQ(ShardMapper::Mapping::kJumpConsistentHash, mapping);
+  EXPECT_STREQ("jump", ShardMapper::getMappingName(mapping));
+  EXPECT_TRUE(ShardMapper::parseMapping("modulo", &mapping));
+  EXPECT_EQ(ShardMapper::Mapping::kModulo, mapping);
+  EXPECT_STREQ("modulo", ShardMapper::getMappingName(mapping));
+  EXPECT_FALSE(ShardMapper::parseMapping("rendezvous", &mapping));
+}
+
+TEST(ShardMapper, Modulo) {
+  for (int i = 0; i < 1000; i++) {
+    std::string key = std::to_string(i);
+    EXPECT_EQ(DatabaseManager::getShardNum(key, 7), ShardMapper::getShardNum(ShardMapper::Mapping::kModulo, key, 7));
+  }
+}
+
+TEST(ShardMapper, JumpConsistentHash) {
+  const int keyCount = 100000;
+  int movedKeyCount = 0;
+  std::vector<int> shardKeyCounts(11);
+  for (int i = 0; i < keyCount; i++) {
+    std::string key = std::to_string(i);
+    int before = ShardMapper::getShardNum(ShardMapper::Mapping::kJumpConsistentHash, key, 10);
+    int after = ShardMapper::getShardNum(ShardMapper::Mapping::kJumpConsistentHash, key, 11);
+    ASSERT_GE(after, 0);
+    ASSERT_LT(after, 11);
+    shardKeyCounts[after]++;
+    if (before != after) {
+      movedKeyCount++;
+      // keys only move into the new shard
+      EXPECT_EQ(10, after);
+    }
+  }
+  // about 1/11 of the keys move and shards stay balanced
+  EXPECT_NEAR(keyCount / 11, movedKeyCount, keyCount / 100);
+  for (int count : shardKeyCounts) {
+    EXPECT_NEAR(keyCount / 11, count, keyCount / 100);
+  }
+  EXPECT_EQ(0, ShardMapper::jumpConsistentHash(12345, 1));
+}
+
+TEST_F(ShardMapperTest, PlanReshard) {
+  const auto mapping = ShardMapper::Mapping::kJumpConsistentHash;
+  std::vector<rocksdb::ColumnFamilyHandle*> group = {columnFamily("group", 0), columnFamily("group", 1)};
+  uint64_t expectedMovedKeyCount = 0;
+  for (int i = 0; i < 1000; i++) {
+    std::string key = std::to_string(i);
+    ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), group[ShardMapper::getShardNum(mapping, key, 2)], key, "").ok());
+    if (ShardMapper::getShardNum(mapping, key, 3) == 2) expectedMovedKeyCount++;
+  }
+
+  ShardMapper::ReshardPlan plan;
+  std::string error;
+  ASSERT_TRUE(ShardMapper::planReshard(db(), group, mapping, 3, &plan, &error)) << error;
+  EXPECT_EQ(1000, plan.keyCount);
+  EXPECT_EQ(expectedMovedKeyCount, plan.movedKeyCount);
+  // keys only move into the new member
+  for (const auto& move : plan.moves) {
+    EXPECT_EQ(2, move.first.second);
+  }
+  EXPECT_EQ(expectedMovedKeyCount, plan.moves[std::make_pair(0, 2)] + plan.moves[std::make_pair(1, 2)]);
+
+  // nothing moves for the current size, while modulo would move about half of the keys
+  ASSERT_TRUE(ShardMapper::planReshard(db(), group, mapping, 2, &plan, &error)) << error;
+  EXPECT_EQ(0, plan.movedKeyCount);
+  ASSERT_TRUE(ShardMapper::planReshard(db(), group, ShardMapper::Mapping::kModulo, 2, &plan, &error)) << error;
+  EXPECT_NEAR(500, plan.movedKeyCount, 100);
+}
+
+TEST_F(ShardMapperTest, InitializeShardMappings) {
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), columnFamily("group", 0), "key", "value").ok());
+  std::string error;
+  ASSERT_TRUE(databaseManager()->initializeShardMappings({}, {}, &error)) << error;
+  EXPECT_EQ(ShardMapper::Mapping::kModulo, databaseManager()->getShardMapping("group"));
+  std::string value;
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(),
+                        DatabaseManager::getShardMappingMetadataKey("group"), &value).ok());
+  EXPECT_EQ("modulo", value);
+
+  // groups with data keep their recorded mapping, empty groups can switch
+  EXPECT_FALSE(databaseManager()->initializeShardMappings({{"group", ShardMapper::Mapping::kJumpConsistentHash}}, {},
+                                                          &error));
+  ASSERT_TRUE(databaseManager()->initializeShardMappings({{"empty", ShardMapper::Mapping::kJumpConsistentHash}}, {},
+                                                         &error)) << error;
+  EXPECT_EQ(ShardMapper::Mapping::kJumpConsistentHash, databaseManager()->getShardMapping("empty"));
+  EXPECT_EQ(DatabaseManager::getShardNum("key", 2), databaseManager()->getGroupShardNum("group", "key", 2));
+
+  // the recorded mapping is used when none is given
+  ASSERT_TRUE(databaseManager()->initializeShardMappings({}, {}, &error)) << error;
+  EXPECT_EQ(ShardMapper::Mapping::kJumpConsistentHash, databaseManager()->getShardMapping("empty"));
+
+  EXPECT_FALSE(databaseManager()->initializeShardMappings({{"nonexistent", ShardMapper::Mapping::kModulo}}, {},
+                                                          &error));
+
+  // keys of the group are sharded by the part before the first colon
+  DatabaseManager::ShardKeyFunctionMap shardKeyFunctions = {{"group", [](const rocksdb::Slice& key) {
+    const char* end = static_cast<const char*>(memchr(key.data(), ':', key.size()));
+    return end ? rocksdb::Slice(key.data(), end - key.data()) : key;
+  }}};
+  ASSERT_TRUE(databaseManager()->initializeShardMappings({}, shardKeyFunctions, &error)) << error;
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(DatabaseManager::getShardNum("user", 3),
+              databaseManager()->getGroupShardNum("group", "user:" + std::to_string(i), 3));
+  }
+  EXPECT_FALSE(databaseManager()->getShardKeyFunction("empty"));
+  EXPECT_FALSE(databaseManager()->initializeShardMappings({}, {{"nonexistent", nullptr}}, &error));
+}
+
+}  // namespace pipeline
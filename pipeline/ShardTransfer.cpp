@@ -0,0 +1,204 @@
+#include "pipeline/ShardTransfer.h"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "folly/Conv.h"
+#include "folly/Format.h"
+#include "glog/logging.h"
+#include "rocksdb/env.h"
+#include "rocksdb/snapshot.h"
+#include "rocksdb/sst_file_writer.h"
+
+namespace pipeline {
+
+bool ShardTransfer::exportShard(rocksdb::DB* db, rocksdb::ColumnFamilyHandle* columnFamily, rocksdb::DB* metadataDb,
+                                rocksdb::ColumnFamilyHandle* metadataColumnFamily, const std::string& offsetKey,
+                                const std::string& dir, infra::kafka::store::IngestManifest* manifest,
+                                std::string* error, uint64_t targetFileSizeBytes) {
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(dir, ec);
+  if (ec || !boost::filesystem::is_empty(dir, ec)) {
+    *error = folly::sformat("Export directory must be a new or empty directory: {}", dir);
+    return false;
+  }
+
+  manifest->sstFiles.clear();
+  manifest->committedOffset.clear();
+  rocksdb::Status status;
+  // Read the data and the offset from the same snapshot, as consumers commit both in the same write batch. When the
+  // column family lives in another instance than the metadata, read the offset first so that replaying from it
+  // only repeats messages already in the data.
+  if (!offsetKey.empty() && metadataDb != db) {
+    status = metadataDb->Get(rocksdb::ReadOptions(), metadataColumnFamily, offsetKey, &manifest->committedOffset);
+  }
+  const rocksdb::Snapshot* snapshot = db->GetSnapshot();
+  rocksdb::ReadOptions readOptions;
+  readOptions.snapshot = snapshot;
+  if (!offsetKey.empty() && metadataDb == db) {
+    status = db->Get(readOptions, metadataColumnFamily, offsetKey, &manifest->committedOffset);
+  }
+  if (status.IsNotFound()) {
+    status = rocksdb::Status::InvalidArgument("offset not found", offsetKey);
+  }
+
+  // only the comparator matters for the SST files, which get the target column family's options when ingested
+  rocksdb::Options options(db->GetDBOptions(), db->GetOptions(columnFamily));
+  std::unique_ptr<rocksdb::SstFileWriter> writer;
+  rocksdb::ExternalSstFileInfo fileInfo;
+  readOptions.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> iter(db->NewIterator(readOptions, columnFamily));
+  uint64_t keyCount = 0;
+  for (iter->SeekToFirst(); status.ok() && iter->Valid(); iter->Next()) {
+    if (writer && writer->FileSize() >= targetFileSizeBytes) {
+      status = writer->Finish(&fileInfo);
+      writer.reset();
+      if (!status.ok()) break;
+    }
+    if (!writer) {
+      std::string fileName = folly::sformat("{:06d}.sst", manifest->sstFiles.size());
+      writer.reset(new rocksdb::SstFileWriter(rocksdb::EnvOptions(), options));
+      status = writer->Open(dir + "/" + fileName);
+      if (!status.ok()) break;
+      manifest->sstFiles.push_back(fileName);
+    }
+    status = writer->Put(iter->key(), iter->value());
+    keyCount++;
+  }
+  if (status.ok()) status = iter->status();
+  if (status.ok() && writer) status = writer->Finish(&fileInfo);
+  iter.reset();
+  db->ReleaseSnapshot(snapshot);
+
+  if (!status.ok()) {
+    *error = folly::sformat("Exporting {} failed: {}", columnFamily->GetName(), status.ToString());
+    return false;
+  }
+  if (!manifest->write(dir)) {
+    *error = folly::sformat("Writing manifest failed in {}", dir);
+    return false;
+  }
+  LOG(INFO) << "Exported " << keyCount << " keys of " << columnFamily->GetName() << " into "
+            << manifest->sstFiles.size() << " SST files in " << dir;
+  return true;
+}
+
+bool ShardTransfer::importShard(std::shared_ptr<DatabaseManager> databaseManager, const std::string& groupName,
+                                const std::string& columnFamilyName, const std::string& dir,
+                                const std::string& offsetKey, std::string* error) {
+  infra::kafka::store::IngestManifest manifest;
+  if (!manifest.read(dir)) {
+    *error = folly::sformat("Cannot read manifest in {}", dir);
+    return false;
+  }
+  if (!offsetKey.empty() && manifest.committedOffset.empty()) {
+    *error = folly::sformat("No consumer offset exported in {}", dir);
+    return false;
+  }
+
+  // Decide the offset to commit before ingesting anything, so that a refusal changes nothing
+  std::string offset;
+  if (!offsetKey.empty() &&
+      !getImportedOffset(databaseManager, offsetKey, manifest.committedOffset, &offset, error)) {
+    return false;
+  }
+
+  auto columnFamilyGroupMap = databaseManager->columnFamilyGroupMap();
+  auto groupIt = columnFamilyGroupMap->find(groupName);
+  if (groupIt == columnFamilyGroupMap->end()) {
+    *error = folly::sformat("Column family group not found: {}", groupName);
+    return false;
+  }
+  rocksdb::ColumnFamilyHandle* columnFamily = databaseManager->getColumnFamily(columnFamilyName);
+  if (columnFamily) {
+    if (std::find(groupIt->second.begin(), groupIt->second.end(), columnFamily) == groupIt->second.end()) {
+      *error = folly::sformat("Column family {} is not a member of group {}", columnFamilyName, groupName);
+      return false;
+    }
+  } else {
+    if (!databaseManager->createColumnFamilyGroupMember(groupName, columnFamilyName, error)) return false;
+    columnFamily = databaseManager->getColumnFamily(columnFamilyName);
+  }
+
+  rocksdb::DB* db = databaseManager->db(columnFamily);
+  if (!manifest.sstFiles.empty()) {
+    std::vector<std::string> sstPaths;
+    for (const auto& sstFile : manifest.sstFiles) {
+      sstPaths.push_back(folly::sformat("{}/{}", dir, sstFile));
+    }
+    rocksdb::IngestExternalFileOptions options;
+    // Copy the files so that they stay in the directory until the offset is committed, and a failed import can be
+    // retried. Ingesting the same files again is harmless while no consumer writes to the column family.
+    options.move_files = false;
+    rocksdb::Status status = db->IngestExternalFile(columnFamily, sstPaths, options);
+    if (!status.ok()) {
+      *error = folly::sformat("Ingesting SST files failed: {}", status.ToString());
+      return false;
+    }
+  }
+
+  if (!offset.empty()) {
+    // Like INGEST, this is not atomic with the ingestion, so a failure here is fixed by importing again
+    rocksdb::Status status =
+        databaseManager->db()->Put(rocksdb::WriteOptions(), databaseManager->getMetadataColumnFamily(), offsetKey,
+                                   offset);
+    if (!status.ok()) {
+      *error = folly::sformat("Committing offset failed: {}", status.ToString());
+      return false;
+    }
+  }
+  LOG(INFO) << "Imported " << manifest.sstFiles.size() << " SST files from " << dir << " into " << columnFamilyName;
+  return true;
+}
+
+bool ShardTransfer::getImportedOffset(std::shared_ptr<DatabaseManager> databaseManager, const std::string& offsetKey,
+                                      const std::string& importedOffset, std::string* offset, std::string* error) {
+  std::string committedOffset;
+  rocksdb::Status status = databaseManager->db()->Get(
+      rocksdb::ReadOptions(), databaseManager->getMetadataColumnFamily(), offsetKey, &committedOffset);
+  if (status.IsNotFound()) {
+    *offset = importedOffset;
+    return true;
+  }
+  if (!status.ok()) {
+    *error = folly::sformat("Reading committed offset failed: {}", status.ToString());
+    return false;
+  }
+  if (committedOffset == importedOffset) {
+    offset->clear();
+    return true;
+  }
+
+  // The consumer may serve other shards on this node, which must not skip the messages between the two offsets.
+  // Kafka offsets are committed as decimal numbers, so only rewind the offset and never move it forward.
+  int64_t committed, imported;
+  try {
+    committed = folly::to<int64_t>(committedOffset);
+    imported = folly::to<int64_t>(importedOffset);
+  } catch (const std::exception& e) {
+    *error = folly::sformat("Committed offset {} differs from the exported offset {} and they cannot be compared",
+                            committedOffset, importedOffset);
+    return false;
+  }
+  if (committed < 0 || imported < 0) {
+    // special offsets such as the beginning or the end of a partition have no order
+    *error = folly::sformat("Committed offset {} differs from the exported offset {} and they cannot be compared",
+                            committedOffset, importedOffset);
+    return false;
+  }
+  if (imported < committed) {
+    *offset = importedOffset;
+  } else {
+    // the shard catches up from the earlier committed offset along with the other shards
+    offset->clear();
+  }
+  return true;
+}
+
+constexpr uint64_t ShardTransfer::kTargetFileSizeBytes;
+
+}  // namespace pipeline
@@ -0,0 +1,49 @@
+#ifndef PIPELINE_SHARDTRANSFER_H_
+#define PIPELINE_SHARDTRANSFER_H_
+
+#include <memory>
+#include <string>
+
+#include "infra/kafka/store/IngestManifest.h"
+#include "pipeline/DatabaseManager.h"
+#include "rocksdb/db.h"
+
+namespace pipeline {
+
+// Move a virtual shard, i.e., a member of a column family group, between nodes without replaying kafka from scratch.
+//
+// Exporting writes a consistent snapshot of the column family into sorted SST files in a directory, together with an
+// ingest manifest recording the consumer offset committed as of the same snapshot. Once the directory is copied or
+// mounted on the target node, importing ingests the files into the group member and rewinds the consumer offset to
+// the exported one, so that the consumer catches up with messages written after the export. Both scan or copy whole
+// column families, so commands run them with the database manager's BackgroundJobRunner.
+class ShardTransfer {
+ public:
+  static constexpr uint64_t kTargetFileSizeBytes = 256L * 1024 * 1024;
+
+  // Export a column family into a new or empty directory. offsetKey is the metadata key of the consumer offset to
+  // export, or empty for none. db and metadataDb are the instances of the column family and the metadata column
+  // family. Return false and fill the error message on failure.
+  static bool exportShard(rocksdb::DB* db, rocksdb::ColumnFamilyHandle* columnFamily, rocksdb::DB* metadataDb,
+                          rocksdb::ColumnFamilyHandle* metadataColumnFamily, const std::string& offsetKey,
+                          const std::string& dir, infra::kafka::store::IngestManifest* manifest, std::string* error,
+                          uint64_t targetFileSizeBytes = kTargetFileSizeBytes);
+
+  // Import an exported directory into a member of a column family group, which is created when missing. The files are
+  // copied, so the directory can be imported again when the import fails, and removed once it succeeds. Unless
+  // offsetKey is empty, the consumer offset committed under it is rewound to the exported one, but never moved
+  // forward. Return false and fill the error message on failure.
+  static bool importShard(std::shared_ptr<DatabaseManager> databaseManager, const std::string& groupName,
+                          const std::string& columnFamilyName, const std::string& dir, const std::string& offsetKey,
+                          std::string* error);
+
+ private:
+  // Pick the offset to commit when importing importedOffset, or leave it empty when the committed offset is not
+  // after it. Return false and fill the error message when the offsets differ but cannot be compared.
+  static bool getImportedOffset(std::shared_ptr<DatabaseManager> databaseManager, const std::string& offsetKey,
+                                const std::string& importedOffset, std::string* offset, std::string* error);
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_SHARDTRANSFER_H_
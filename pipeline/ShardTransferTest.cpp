@@ -0,0 +1,85 @@
+#include "pipeline/ShardTransfer.h"
+
+#include <string>
+
+#include "boost/filesystem.hpp"
+#include "gtest/gtest.h"
+#include "rocksdb/db.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+class ShardTransferTest : public stesting::TestWithRocksDb {
+ protected:
+  ShardTransferTest() : stesting::TestWithRocksDb({"group"}, {}, {{"group", 2}}) {}
+
+  void SetUp() override {
+    stesting::TestWithRocksDb::SetUp();
+    exportDir_ = boost::filesystem::unique_path("shard_transfer_test.%%%%%%%%");
+  }
+
+  void TearDown() override {
+    boost::filesystem::remove_all(exportDir_);
+    stesting::TestWithRocksDb::TearDown();
+  }
+
+  boost::filesystem::path exportDir_;
+};
+
+TEST_F(ShardTransferTest, ExportAndImport) {
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), columnFamily("group", 0), std::to_string(i), "value").ok());
+  }
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), metadataColumnFamily(), "offset", "42").ok());
+
+  infra::kafka::store::IngestManifest manifest;
+  std::string error;
+  // a tiny target file size splits the export into multiple files
+  ASSERT_TRUE(ShardTransfer::exportShard(db(), columnFamily("group", 0), db(), metadataColumnFamily(), "offset",
+                                         exportDir_.native(), &manifest, &error, 1024))
+      << error;
+  EXPECT_GT(manifest.sstFiles.size(), 1);
+  EXPECT_EQ("42", manifest.committedOffset);
+  // the directory must be empty
+  EXPECT_FALSE(ShardTransfer::exportShard(db(), columnFamily("group", 0), db(), metadataColumnFamily(), "",
+                                          exportDir_.native(), &manifest, &error));
+
+  EXPECT_FALSE(
+      ShardTransfer::importShard(databaseManager(), "nonexistent", "group-2", exportDir_.native(), "", &error));
+  ASSERT_TRUE(ShardTransfer::importShard(databaseManager(), "group", "group-2", exportDir_.native(), "imported",
+                                         &error))
+      << error;
+  rocksdb::ColumnFamilyHandle* imported = databaseManager()->getColumnFamily("group-2");
+  ASSERT_NE(nullptr, imported);
+  EXPECT_EQ(100, totalKeyCount(imported));
+  std::string value;
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), "imported", &value).ok());
+  EXPECT_EQ("42", value);
+
+  // the files are copied, so a failed import can be retried from the same directory
+  ASSERT_TRUE(ShardTransfer::importShard(databaseManager(), "group", "group-2", exportDir_.native(), "imported",
+                                         &error))
+      << error;
+  EXPECT_EQ(100, totalKeyCount(imported));
+
+  // the offset is only rewound, as the consumer may serve other shards
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), metadataColumnFamily(), "imported", "10").ok());
+  ASSERT_TRUE(ShardTransfer::importShard(databaseManager(), "group", "group-2", exportDir_.native(), "imported",
+                                         &error))
+      << error;
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), "imported", &value).ok());
+  EXPECT_EQ("10", value);
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), metadataColumnFamily(), "imported", "100").ok());
+  ASSERT_TRUE(ShardTransfer::importShard(databaseManager(), "group", "group-2", exportDir_.native(), "imported",
+                                         &error))
+      << error;
+  ASSERT_TRUE(db()->Get(rocksdb::ReadOptions(), metadataColumnFamily(), "imported", &value).ok());
+  EXPECT_EQ("42", value);
+  // special offsets cannot be compared
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), metadataColumnFamily(), "imported", "-2").ok());
+  EXPECT_FALSE(ShardTransfer::importShard(databaseManager(), "group", "group-2", exportDir_.native(), "imported",
+                                          &error));
+  db()->DestroyColumnFamilyHandle(imported);
+}
+
+}  // namespace pipeline
@@ -0,0 +1,127 @@
+#include "pipeline/ShardedExecutor.h"
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "folly/executors/CPUThreadPoolExecutor.h"
+#include "folly/executors/NamedThreadFactory.h"
+#include "folly/futures/Future.h"
+#include "glog/logging.h"
+
+namespace pipeline {
+
+constexpr size_t ShardedExecutor::kDefaultMinParallelKeys;
+
+ShardedExecutor::ShardedExecutor(int threadCount, size_t minParallelKeys)
+    : threadCount_(threadCount), minParallelKeys_(minParallelKeys) {
+  CHECK_GE(threadCount, 0);
+  if (threadCount > 0) {
+    executor_.reset(new folly::CPUThreadPoolExecutor(
+        threadCount, std::make_shared<folly::NamedThreadFactory>("sharded-exec")));
+  }
+}
+
+ShardedExecutor::~ShardedExecutor() {
+  if (executor_) executor_->join();
+}
+
+void ShardedExecutor::forEachShard(size_t count, size_t shardCount, const ShardFunction& shardFunction,
+                                   const ShardTask& task) {
+  std::vector<std::vector<size_t>> shardPositions(shardCount);
+  for (size_t position = 0; position < count; position++) {
+    size_t shard = shardFunction(position);
+    CHECK_LT(shard, shardCount);
+    shardPositions[shard].push_back(position);
+  }
+
+  std::vector<std::function<void()>> tasks;
+  for (size_t shard = 0; shard < shardCount; shard++) {
+    if (shardPositions[shard].empty()) continue;
+    tasks.push_back([&task, &shardPositions, shard]() { task(shard, shardPositions[shard]); });
+  }
+  run(tasks, count >= minParallelKeys_);
+}
+
+void ShardedExecutor::run(const std::vector<std::function<void()>>& tasks, bool parallel) {
+  if (!executor_ || !parallel || tasks.size() < 2) {
+    for (const auto& task : tasks) {
+      task();
+    }
+    return;
+  }
+
+  std::vector<folly::Future<folly::Unit>> futures;
+  futures.reserve(tasks.size() - 1);
+  std::exception_ptr exception;
+  try {
+    for (size_t i = 1; i < tasks.size(); i++) {
+      futures.push_back(folly::via(executor_.get(), tasks[i]));
+    }
+    // the calling thread takes the first task instead of idling while waiting for the others
+    tasks[0]();
+  } catch (...) {
+    exception = std::current_exception();
+  }
+  // wait for every task scheduled before propagating any failure, since they reference the state of the caller
+  auto results = folly::collectAll(futures).get();
+  if (exception) std::rethrow_exception(exception);
+  for (auto& result : results) {
+    // tasks are not expected to throw, surface it on the calling thread if they do
+    result.throwIfFailed();
+  }
+}
+
+std::vector<rocksdb::Status> ShardedExecutor::multiGet(
+    rocksdb::DB* db, const rocksdb::ReadOptions& readOptions,
+    const std::vector<rocksdb::ColumnFamilyHandle*>& columnFamilyGroup, const std::vector<rocksdb::Slice>& keys,
+    std::vector<std::string>* values, const std::function<size_t(const rocksdb::Slice& key)>& shardFunction) {
+  CHECK(!columnFamilyGroup.empty());
+
+  std::vector<rocksdb::Status> statuses(keys.size());
+  values->clear();
+  values->resize(keys.size());
+  auto keyShardFunction = [&keys, &shardFunction](size_t position) { return shardFunction(keys[position]); };
+  auto readShard = [db, &readOptions, &columnFamilyGroup, &keys, values, &statuses](
+      size_t shard, const std::vector<size_t>& positions) {
+    std::vector<rocksdb::ColumnFamilyHandle*> columnFamilies(positions.size(), columnFamilyGroup[shard]);
+    std::vector<rocksdb::Slice> shardKeys;
+    shardKeys.reserve(positions.size());
+    for (size_t position : positions) {
+      shardKeys.push_back(keys[position]);
+    }
+    std::vector<std::string> shardValues;
+    std::vector<rocksdb::Status> shardStatuses = db->MultiGet(readOptions, columnFamilies, shardKeys, &shardValues);
+    for (size_t i = 0; i < positions.size(); i++) {
+      statuses[positions[i]] = std::move(shardStatuses[i]);
+      (*values)[positions[i]] = std::move(shardValues[i]);
+    }
+  };
+  forEachShard(keys.size(), columnFamilyGroup.size(), keyShardFunction, readShard);
+  return statuses;
+}
+
+rocksdb::Status ShardedExecutor::write(rocksdb::DB* db, const rocksdb::WriteOptions& writeOptions,
+                                       std::vector<rocksdb::WriteBatch>* writeBatches) {
+  std::vector<rocksdb::Status> statuses(writeBatches->size());
+  std::vector<std::function<void()>> tasks;
+  size_t updateCount = 0;
+  for (size_t i = 0; i < writeBatches->size(); i++) {
+    rocksdb::WriteBatch* writeBatch = &(*writeBatches)[i];
+    if (writeBatch->Count() == 0) continue;
+    updateCount += writeBatch->Count();
+    rocksdb::Status* status = &statuses[i];
+    tasks.push_back([db, &writeOptions, writeBatch, status]() { *status = db->Write(writeOptions, writeBatch); });
+  }
+  run(tasks, updateCount >= minParallelKeys_);
+
+  for (const auto& status : statuses) {
+    if (!status.ok()) return status;
+  }
+  return rocksdb::Status::OK();
+}
+
+}  // namespace pipeline
@@ -0,0 +1,71 @@
+#ifndef PIPELINE_SHARDEDEXECUTOR_H_
+#define PIPELINE_SHARDEDEXECUTOR_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rocksdb/db.h"
+#include "rocksdb/options.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/status.h"
+#include "rocksdb/write_batch.h"
+
+namespace folly {
+class CPUThreadPoolExecutor;
+}  // namespace folly
+
+namespace pipeline {
+
+// Fan out multi-key requests over the members of a column family group. Keys are partitioned by shard index, each
+// shard is processed on a bounded thread pool, and results are merged back in the order of the keys.
+//
+// Small requests and requests touching a single shard run on the calling thread to avoid the cost of a thread hop.
+class ShardedExecutor {
+ public:
+  static constexpr size_t kDefaultMinParallelKeys = 16;
+
+  // Map the position of a key in a request to a shard index
+  using ShardFunction = std::function<size_t(size_t position)>;
+  // Process the keys of a shard given their positions in the request in ascending order
+  using ShardTask = std::function<void(size_t shard, const std::vector<size_t>& positions)>;
+
+  // With no threads, every shard runs serially on the calling thread
+  explicit ShardedExecutor(int threadCount, size_t minParallelKeys = kDefaultMinParallelKeys);
+  ~ShardedExecutor();
+
+  int threadCount() const { return threadCount_; }
+
+  // Partition positions [0, count) into shardCount shards and run the task once for every non-empty shard. It
+  // returns after all the tasks finish. Tasks of different shards may run concurrently, so they must only write to
+  // the results of their own positions.
+  void forEachShard(size_t count, size_t shardCount, const ShardFunction& shardFunction, const ShardTask& task);
+
+  // Read the keys from the members of a column family group, each key from the member at the index returned by the
+  // shard function, which must agree with how the group is written, see DatabaseManager::multiGetFromGroup. Values
+  // and statuses are in the order of the keys. db must be the instance holding the group, see
+  // DatabaseManager::db(columnFamily).
+  std::vector<rocksdb::Status> multiGet(rocksdb::DB* db, const rocksdb::ReadOptions& readOptions,
+                                        const std::vector<rocksdb::ColumnFamilyHandle*>& columnFamilyGroup,
+                                        const std::vector<rocksdb::Slice>& keys, std::vector<std::string>* values,
+                                        const std::function<size_t(const rocksdb::Slice& key)>& shardFunction);
+
+  // Write per-shard batches in parallel and return the first failure. Batches are independent, so a failure of one
+  // does not roll back the others. All the batches go to db, so they must only write column families of that instance.
+  rocksdb::Status write(rocksdb::DB* db, const rocksdb::WriteOptions& writeOptions,
+                        std::vector<rocksdb::WriteBatch>* writeBatches);
+
+ private:
+  // Run the tasks and return after all of them finish, in parallel unless told otherwise or there are no threads.
+  // Tasks may reference the state of the caller, so an exception is only rethrown once every task has finished.
+  void run(const std::vector<std::function<void()>>& tasks, bool parallel);
+
+  const int threadCount_;
+  const size_t minParallelKeys_;
+  std::unique_ptr<folly::CPUThreadPoolExecutor> executor_;
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_SHARDEDEXECUTOR_H_
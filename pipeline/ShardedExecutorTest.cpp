@@ -0,0 +1,87 @@
+#include "pipeline/ShardedExecutor.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+class ShardedExecutorTest : public stesting::TestWithRocksDb {
+ protected:
+  ShardedExecutorTest() : stesting::TestWithRocksDb({"group"}, {}, {{"group", 4}}) {}
+
+  std::vector<rocksdb::ColumnFamilyHandle*> group() {
+    return {columnFamily("group", 0), columnFamily("group", 1), columnFamily("group", 2), columnFamily("group", 3)};
+  }
+};
+
+TEST_F(ShardedExecutorTest, ForEachShard) {
+  for (int threadCount : {0, 4}) {
+    ShardedExecutor executor(threadCount, 1);
+    std::mutex mutex;
+    std::vector<std::vector<size_t>> shardPositions(4);
+    executor.forEachShard(10, 4, [](size_t position) { return position % 3; },
+                          [&mutex, &shardPositions](size_t shard, const std::vector<size_t>& positions) {
+                            std::lock_guard<std::mutex> guard(mutex);
+                            shardPositions[shard] = positions;
+                          });
+    EXPECT_EQ(std::vector<size_t>({0, 3, 6, 9}), shardPositions[0]);
+    EXPECT_EQ(std::vector<size_t>({1, 4, 7}), shardPositions[1]);
+    EXPECT_EQ(std::vector<size_t>({2, 5, 8}), shardPositions[2]);
+    // empty shards are skipped
+    EXPECT_TRUE(shardPositions[3].empty());
+  }
+}
+
+TEST_F(ShardedExecutorTest, MultiGetAndWrite) {
+  ShardedExecutor executor(4, 1);
+  std::vector<std::string> keys;
+  std::vector<rocksdb::WriteBatch> writeBatches(4);
+  for (int i = 0; i < 100; i++) {
+    keys.push_back(std::to_string(i));
+    // write only even keys so that odd keys are not found
+    if (i % 2 == 0) writeBatches[i % 4].Put(group()[i % 4], keys.back(), "value" + keys.back());
+  }
+  ASSERT_TRUE(executor.write(db(), rocksdb::WriteOptions(), &writeBatches).ok());
+  EXPECT_EQ(50, totalKeyCount(columnFamily("group", 0)));
+  EXPECT_EQ(0, totalKeyCount(columnFamily("group", 1)));
+  EXPECT_EQ(50, totalKeyCount(columnFamily("group", 2)));
+
+  std::vector<rocksdb::Slice> keySlices(keys.begin(), keys.end());
+  std::vector<std::string> values;
+  auto statuses = executor.multiGet(db(), rocksdb::ReadOptions(), group(), keySlices, &values,
+                                    [](const rocksdb::Slice& key) { return std::stoi(key.ToString()) % 4; });
+  ASSERT_EQ(100, statuses.size());
+  ASSERT_EQ(100, values.size());
+  for (int i = 0; i < 100; i++) {
+    if (i % 2 == 0) {
+      ASSERT_TRUE(statuses[i].ok()) << statuses[i].ToString();
+      EXPECT_EQ("value" + keys[i], values[i]);
+    } else {
+      EXPECT_TRUE(statuses[i].IsNotFound());
+    }
+  }
+}
+
+TEST_F(ShardedExecutorTest, WaitForAllShardsBeforeThrowing) {
+  ShardedExecutor executor(4, 1);
+  std::atomic<int> finished(0);
+  // the first shard runs on the calling thread and fails while the others are still running
+  EXPECT_THROW(executor.forEachShard(4, 4, [](size_t position) { return position; },
+                                     [&finished](size_t shard, const std::vector<size_t>& positions) {
+                                       if (shard == 0) throw std::runtime_error("failed");
+                                       std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                                       finished++;
+                                     }),
+               std::runtime_error);
+  EXPECT_EQ(3, finished);
+}
+
+}  // namespace pipeline
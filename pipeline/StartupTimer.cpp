@@ -0,0 +1,28 @@
+#include "pipeline/StartupTimer.h"
+
+#include <string>
+
+#include "glog/logging.h"
+#include "prometheus/gauge_builder.h"
+
+namespace pipeline {
+
+void StartupTimer::logBreakdown() const {
+  for (const auto& phase : phases_) {
+    LOG(INFO) << "Startup phase " << phase.first << " took " << phase.second << "ms";
+  }
+  LOG(INFO) << "Startup took " << totalMs() << "ms";
+}
+
+void StartupTimer::exportMetrics(prometheus::Registry* registry) const {
+  auto& family = prometheus::BuildGauge()
+                     .Name("startup_phase_duration_ms")
+                     .Help("Duration of each startup phase in milliseconds")
+                     .Register(*registry);
+  for (const auto& phase : phases_) {
+    family.Add({{"phase", phase.first}}).Set(phase.second);
+  }
+  family.Add({{"phase", "total"}}).Set(totalMs());
+}
+
+}  // namespace pipeline
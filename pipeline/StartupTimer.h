@@ -0,0 +1,55 @@
+#ifndef PIPELINE_STARTUPTIMER_H_
+#define PIPELINE_STARTUPTIMER_H_
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "prometheus/registry.h"
+
+namespace pipeline {
+
+// Break down the startup time into phases so that slow startups can be attributed, e.g., to opening RocksDB with
+// hundreds of column families. Phases are recorded in order from the main thread, so it is not thread-safe.
+class StartupTimer {
+ public:
+  using Phase = std::pair<std::string, int64_t>;
+
+  StartupTimer() : startTime_(std::chrono::steady_clock::now()) {}
+
+  // Run the given function and record its duration as a phase
+  void time(const std::string& phase, const std::function<void()>& func) {
+    auto startTime = std::chrono::steady_clock::now();
+    func();
+    record(phase, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime)
+                      .count());
+  }
+
+  void record(const std::string& phase, int64_t durationMs) {
+    phases_.emplace_back(phase, durationMs);
+  }
+
+  const std::vector<Phase>& phases() const { return phases_; }
+
+  // Time elapsed since the timer was created
+  int64_t totalMs() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime_)
+        .count();
+  }
+
+  // Log the duration of every phase and the total
+  void logBreakdown() const;
+
+  // Export the duration of every phase and the total as the startup_phase_duration_ms gauge labeled by phase
+  void exportMetrics(prometheus::Registry* registry) const;
+
+ private:
+  const std::chrono::steady_clock::time_point startTime_;
+  std::vector<Phase> phases_;
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_STARTUPTIMER_H_
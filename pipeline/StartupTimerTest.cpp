@@ -0,0 +1,31 @@
+#include "pipeline/StartupTimer.h"
+
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "prometheus/registry.h"
+
+namespace pipeline {
+
+TEST(StartupTimer, TimeAndExport) {
+  StartupTimer timer;
+  timer.time("sleep", []() { std::this_thread::sleep_for(std::chrono::milliseconds(10)); });
+  timer.record("recorded", 5);
+  ASSERT_EQ(2, timer.phases().size());
+  EXPECT_EQ("sleep", timer.phases()[0].first);
+  EXPECT_GE(timer.phases()[0].second, 10);
+  EXPECT_EQ("recorded", timer.phases()[1].first);
+  EXPECT_EQ(5, timer.phases()[1].second);
+  EXPECT_GE(timer.totalMs(), 10);
+
+  prometheus::Registry registry;
+  timer.exportMetrics(&registry);
+  auto families = registry.Collect();
+  ASSERT_EQ(1, families.size());
+  EXPECT_EQ("startup_phase_duration_ms", families[0].name());
+  // one gauge for each phase and one for the total
+  EXPECT_EQ(3, families[0].metric_size());
+}
+
+}  // namespace pipeline
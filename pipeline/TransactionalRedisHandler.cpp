@@ -31,7 +31,7 @@ bool TransactionalRedisHandler::handleCommandWithTransactionalHandlerTable(
         writeError(key, "Transaction discarded because of previous errors", ctx);
       } else {
         std::vector<codec::RedisValue> results;
-        rocksdb::WriteBatch writeBatch;
+        DatabaseManager::InstanceWriteBatch writeBatch(databaseManager().get());
         for (const auto& cmd : queuedCommands_) {
           codec::RedisValue result = (this->*(cmd.first))(cmd.second, &writeBatch, ctx);
           if (result.type() == codec::RedisValue::Type::kError) {
@@ -64,12 +64,23 @@ bool TransactionalRedisHandler::handleCommandWithTransactionalHandlerTable(
       return true;
     }
 
+    if (handlerEntry->second.keyIndex > 0 && getClusterTopology() &&
+        !admitKey(key, cmd[handlerEntry->second.keyIndex], ctx)) {
+      errorEncountered_ = true;
+      return true;
+    }
+
+    if (handlerEntry->second.isWrite && !admitWrite(key, cmdNameLower, ctx)) {
+      errorEncountered_ = true;
+      return true;
+    }
+
     if (inTransaction_) {
       queuedCommands_.emplace_back(std::make_pair(handlerEntry->second.handlerFunc, std::move(cmd)));
       write(ctx, codec::RedisMessage(key, {codec::RedisValue::Type::kSimpleString, "QUEUED"}));
     } else {
       // execute it right away when it's not part of the transaction
-      rocksdb::WriteBatch writeBatch;
+      DatabaseManager::InstanceWriteBatch writeBatch(databaseManager().get());
       writeResult(key, (this->*(handlerEntry->second.handlerFunc))(cmd, &writeBatch, ctx), &writeBatch, ctx);
     }
   }
@@ -77,11 +88,11 @@ bool TransactionalRedisHandler::handleCommandWithTransactionalHandlerTable(
   return true;
 }
 
-void TransactionalRedisHandler::writeResult(int64_t key, codec::RedisValue result, rocksdb::WriteBatch* writeBatch,
-                                            Context* ctx) {
+void TransactionalRedisHandler::writeResult(int64_t key, codec::RedisValue result,
+                                            DatabaseManager::InstanceWriteBatch* writeBatch, Context* ctx) {
   if (writeBatch->Count() > 0) {
     // commit updates first
-    rocksdb::Status status = db()->Write(rocksdb::WriteOptions(), writeBatch);
+    rocksdb::Status status = writeBatch->db()->Write(rocksdb::WriteOptions(), writeBatch);
     if (!status.ok()) {
       writeError(key, folly::sformat("RocksDB error: {}", status.ToString()), ctx);
       return;
@@ -49,7 +49,7 @@ class TransactionalRedisHandler : public RedisHandler {
     for (const auto& handlerEntry : baseCommandHandlerTable()) {
       baseTable.insert({handlerEntry.first,
                         {&TransactionalRedisHandler::handleNonTransactionalCommand, handlerEntry.second.minArgs,
-                         handlerEntry.second.maxArgs}});
+                         handlerEntry.second.maxArgs, handlerEntry.second.isWrite, handlerEntry.second.keyIndex}});
     }
 
     baseTable.insert(newTable.begin(), newTable.end());
@@ -80,7 +80,9 @@ class TransactionalRedisHandler : public RedisHandler {
   }
 
  private:
-  void writeResult(int64_t key, codec::RedisValue result, rocksdb::WriteBatch* writeBatch, Context* ctx);
+  // Commit the updates to the RocksDB instance of the column families they belong to and write the result back
+  void writeResult(int64_t key, codec::RedisValue result, DatabaseManager::InstanceWriteBatch* writeBatch,
+                   Context* ctx);
 
   bool inTransaction_;
   bool errorEncountered_;
@@ -0,0 +1,95 @@
+#include "pipeline/TtlCompactionFilter.h"
+
+#include <cstring>
+#include <string>
+
+#include "folly/Bits.h"
+
+namespace pipeline {
+
+constexpr char TtlEnvelope::kMagic;
+constexpr char TtlEnvelope::kFormatVersion;
+constexpr size_t TtlEnvelope::kHeaderSize;
+constexpr int64_t TtlEnvelope::kNoExpiration;
+
+namespace {
+
+void appendTimestamp(int64_t timestampMs, std::string* output) {
+  uint64_t bigEndian = folly::Endian::big(static_cast<uint64_t>(timestampMs));
+  output->append(reinterpret_cast<const char*>(&bigEndian), sizeof(bigEndian));
+}
+
+int64_t readTimestamp(const char* data) {
+  uint64_t bigEndian;
+  std::memcpy(&bigEndian, data, sizeof(bigEndian));
+  return static_cast<int64_t>(folly::Endian::big(bigEndian));
+}
+
+}  // namespace
+
+std::string TtlEnvelope::encode(const rocksdb::Slice& value, int64_t expireAtMs) {
+  std::string envelope;
+  envelope.reserve(kHeaderSize + value.size());
+  envelope.push_back(kMagic);
+  envelope.push_back(kFormatVersion);
+  appendTimestamp(expireAtMs, &envelope);
+  envelope.append(value.data(), value.size());
+  return envelope;
+}
+
+bool TtlEnvelope::decode(const rocksdb::Slice& envelope, int64_t* expireAtMs, rocksdb::Slice* value) {
+  if (envelope.size() < kHeaderSize || envelope[0] != kMagic || envelope[1] != kFormatVersion) return false;
+
+  *expireAtMs = readTimestamp(envelope.data() + 2);
+  *value = rocksdb::Slice(envelope.data() + kHeaderSize, envelope.size() - kHeaderSize);
+  return true;
+}
+
+std::string TtlEnvelope::encodeExpiration(int64_t issuedAtMs, int64_t expireAtMs) {
+  std::string operand;
+  operand.reserve(2 * sizeof(int64_t));
+  appendTimestamp(issuedAtMs, &operand);
+  appendTimestamp(expireAtMs, &operand);
+  return operand;
+}
+
+bool TtlEnvelope::decodeExpiration(const rocksdb::Slice& operand, int64_t* issuedAtMs, int64_t* expireAtMs) {
+  if (operand.size() != 2 * sizeof(int64_t)) return false;
+
+  *issuedAtMs = readTimestamp(operand.data());
+  *expireAtMs = readTimestamp(operand.data() + sizeof(int64_t));
+  return true;
+}
+
+bool TtlMergeOperator::FullMergeV2(const MergeOperationInput& mergeIn, MergeOperationOutput* mergeOut) const {
+  if (!mergeIn.existing_value) {
+    // the value was deleted before the expiration changed, so it stays missing
+    mergeOut->new_value = TtlEnvelope::encode("", 1);
+    return true;
+  }
+
+  int64_t expireAtMs;
+  rocksdb::Slice value;
+  if (!TtlEnvelope::decode(*mergeIn.existing_value, &expireAtMs, &value)) {
+    // written before TTL was enabled
+    expireAtMs = TtlEnvelope::kNoExpiration;
+    value = *mergeIn.existing_value;
+  }
+  for (const auto& operand : mergeIn.operand_list) {
+    int64_t issuedAtMs, newExpireAtMs;
+    if (!TtlEnvelope::decodeExpiration(operand, &issuedAtMs, &newExpireAtMs)) return false;
+    if (!TtlEnvelope::isExpired(expireAtMs, issuedAtMs)) expireAtMs = newExpireAtMs;
+  }
+  mergeOut->new_value = TtlEnvelope::encode(value, expireAtMs);
+  return true;
+}
+
+bool TtlCompactionFilter::Filter(int level, const rocksdb::Slice& key, const rocksdb::Slice& existingValue,
+                                 std::string* newValue, bool* valueChanged) const {
+  int64_t expireAtMs;
+  rocksdb::Slice value;
+  if (!TtlEnvelope::decode(existingValue, &expireAtMs, &value)) return false;
+  return TtlEnvelope::isExpired(expireAtMs, TtlEnvelope::nowMs());
+}
+
+}  // namespace pipeline
@@ -0,0 +1,91 @@
+#ifndef PIPELINE_TTLCOMPACTIONFILTER_H_
+#define PIPELINE_TTLCOMPACTIONFILTER_H_
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "rocksdb/compaction_filter.h"
+#include "rocksdb/merge_operator.h"
+#include "rocksdb/options.h"
+#include "rocksdb/slice.h"
+
+namespace pipeline {
+
+// Values in TTL-enabled column families are wrapped in an envelope: a magic byte, a format version byte, an 8-byte
+// big-endian expiration timestamp in milliseconds since epoch, and the raw value. An expiration timestamp of 0 means
+// the value never expires. The magic byte never starts valid UTF-8 text, so values written before TTL was enabled
+// are told apart and read as values that never expire, until they are written again in an envelope.
+class TtlEnvelope {
+ public:
+  static constexpr char kMagic = '\xf7';
+  static constexpr char kFormatVersion = 1;
+  static constexpr size_t kHeaderSize = 2 + sizeof(int64_t);
+  static constexpr int64_t kNoExpiration = 0;
+
+  static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static std::string encode(const rocksdb::Slice& value, int64_t expireAtMs);
+
+  // Split an envelope into its expiration timestamp and the raw value, which points into the envelope.
+  // Return false when the value is not an envelope of a known format version.
+  static bool decode(const rocksdb::Slice& envelope, int64_t* expireAtMs, rocksdb::Slice* value);
+
+  // A merge operand of TtlMergeOperator changing the expiration of the value as of issuedAtMs
+  static std::string encodeExpiration(int64_t issuedAtMs, int64_t expireAtMs);
+
+  static bool decodeExpiration(const rocksdb::Slice& operand, int64_t* issuedAtMs, int64_t* expireAtMs);
+
+  static bool isExpired(int64_t expireAtMs, int64_t nowMs) {
+    return expireAtMs != kNoExpiration && expireAtMs <= nowMs;
+  }
+};
+
+// Change expirations with merges instead of read-modify-writes, so that a concurrent write is never overwritten
+// with a stale value. An expiration only applies when the value was live at the time it was issued, which keeps the
+// result independent of when the merge is evaluated. Expiring a missing value leaves an expired empty envelope.
+class TtlMergeOperator : public rocksdb::MergeOperator {
+ public:
+  static std::shared_ptr<rocksdb::MergeOperator> getInstance() {
+    static std::shared_ptr<rocksdb::MergeOperator> instance = std::make_shared<TtlMergeOperator>();
+    return instance;
+  }
+
+  bool FullMergeV2(const MergeOperationInput& mergeIn, MergeOperationOutput* mergeOut) const override;
+
+  const char* Name() const override {
+    return "smyte.TtlMergeOperator";
+  }
+};
+
+// Drop expired values during compaction so that expiry needs neither extra deletes nor tombstones.
+// Malformed envelopes are always kept to avoid losing data written without an envelope.
+class TtlCompactionFilter : public rocksdb::CompactionFilter {
+ public:
+  // The filter is stateless, so a single instance is shared by all column families
+  static const TtlCompactionFilter* instance() {
+    static const TtlCompactionFilter filter;
+    return &filter;
+  }
+
+  // Enable TTL for a column family, which takes its merge operator. Call it from the RocksDbCfConfigurator of the
+  // column family.
+  static void configure(rocksdb::ColumnFamilyOptions* options) {
+    options->compaction_filter = instance();
+    options->merge_operator = TtlMergeOperator::getInstance();
+  }
+
+  bool Filter(int level, const rocksdb::Slice& key, const rocksdb::Slice& existingValue, std::string* newValue,
+              bool* valueChanged) const override;
+
+  const char* Name() const override {
+    return "smyte.TtlCompactionFilter";
+  }
+};
+
+}  // namespace pipeline
+
+#endif  // PIPELINE_TTLCOMPACTIONFILTER_H_
@@ -0,0 +1,157 @@
+#include "pipeline/TtlCompactionFilter.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "pipeline/DatabaseManager.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/status.h"
+#include "rocksdb/write_batch.h"
+#include "stesting/TestWithRocksDb.h"
+
+namespace pipeline {
+
+static void configureTtlColumnFamily(int blockCacheSizeMb, rocksdb::ColumnFamilyOptions* options) {
+  TtlCompactionFilter::configure(options);
+}
+
+class TtlCompactionFilterTest : public stesting::TestWithRocksDb {
+ protected:
+  TtlCompactionFilterTest() : stesting::TestWithRocksDb({"ttl"}, {{"ttl", &configureTtlColumnFamily}}) {}
+
+  void put(const std::string& key, const std::string& value, int64_t expireAtMs) {
+    rocksdb::WriteBatch writeBatch;
+    databaseManager()->putWithTtl(&writeBatch, columnFamily("ttl"), key, value, expireAtMs);
+    commitWriteBatch(&writeBatch);
+  }
+};
+
+TEST(TtlEnvelope, EncodeAndDecode) {
+  std::string envelope = TtlEnvelope::encode("value", 0x0102030405060708L);
+  ASSERT_EQ(TtlEnvelope::kHeaderSize + 5, envelope.size());
+  // big-endian so that the header is readable in raw dumps
+  EXPECT_EQ(std::string("\xf7\x01\x01\x02\x03\x04\x05\x06\x07\x08", 10), envelope.substr(0, 10));
+
+  int64_t expireAtMs;
+  rocksdb::Slice value;
+  ASSERT_TRUE(TtlEnvelope::decode(envelope, &expireAtMs, &value));
+  EXPECT_EQ(0x0102030405060708L, expireAtMs);
+  EXPECT_EQ("value", value.ToString());
+
+  // empty values are valid
+  envelope = TtlEnvelope::encode("", TtlEnvelope::kNoExpiration);
+  ASSERT_TRUE(TtlEnvelope::decode(envelope, &expireAtMs, &value));
+  EXPECT_EQ(TtlEnvelope::kNoExpiration, expireAtMs);
+  EXPECT_TRUE(value.empty());
+
+  EXPECT_FALSE(TtlEnvelope::decode("short", &expireAtMs, &value));
+  // values without the magic byte or of an unknown version are not envelopes
+  EXPECT_FALSE(TtlEnvelope::decode("plain value", &expireAtMs, &value));
+  envelope[1] = 2;
+  EXPECT_FALSE(TtlEnvelope::decode(envelope, &expireAtMs, &value));
+}
+
+TEST(TtlEnvelope, IsExpired) {
+  EXPECT_FALSE(TtlEnvelope::isExpired(TtlEnvelope::kNoExpiration, 1000));
+  EXPECT_FALSE(TtlEnvelope::isExpired(1001, 1000));
+  EXPECT_TRUE(TtlEnvelope::isExpired(1000, 1000));
+  EXPECT_TRUE(TtlEnvelope::isExpired(999, 1000));
+}
+
+TEST_F(TtlCompactionFilterTest, ReadPathFiltering) {
+  int64_t now = nowMs();
+  put("forever", "value1", TtlEnvelope::kNoExpiration);
+  put("later", "value2", now + 3600000);
+  put("expired", "value3", now - 1);
+
+  std::string value;
+  int64_t expireAtMs;
+  ASSERT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "forever", &value, &expireAtMs).ok());
+  EXPECT_EQ("value1", value);
+  EXPECT_EQ(TtlEnvelope::kNoExpiration, expireAtMs);
+  ASSERT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "later", &value, &expireAtMs).ok());
+  EXPECT_EQ("value2", value);
+  EXPECT_EQ(now + 3600000, expireAtMs);
+  EXPECT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "expired", &value).IsNotFound());
+  EXPECT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "missing", &value).IsNotFound());
+
+  // values written before TTL was enabled never expire
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), columnFamily("ttl"), "raw", "x").ok());
+  ASSERT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "raw", &value, &expireAtMs).ok());
+  EXPECT_EQ("x", value);
+  EXPECT_EQ(TtlEnvelope::kNoExpiration, expireAtMs);
+}
+
+TEST_F(TtlCompactionFilterTest, Expire) {
+  int64_t now = nowMs();
+  put("key", "value", TtlEnvelope::kNoExpiration);
+
+  ASSERT_TRUE(databaseManager()->expireWithTtl(columnFamily("ttl"), "key", now + 1000).ok());
+  std::string value;
+  int64_t expireAtMs;
+  ASSERT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "key", &value, &expireAtMs).ok());
+  EXPECT_EQ("value", value);
+  EXPECT_EQ(now + 1000, expireAtMs);
+
+  ASSERT_TRUE(databaseManager()->expireWithTtl(columnFamily("ttl"), "key", now - 1).ok());
+  EXPECT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "key", &value).IsNotFound());
+  // an expired value cannot be revived
+  EXPECT_TRUE(databaseManager()->expireWithTtl(columnFamily("ttl"), "key", now + 1000).IsNotFound());
+  EXPECT_TRUE(databaseManager()->expireWithTtl(columnFamily("ttl"), "missing", now + 1000).IsNotFound());
+
+  // values written before TTL was enabled can be expired too
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), columnFamily("ttl"), "raw", "x").ok());
+  ASSERT_TRUE(databaseManager()->expireWithTtl(columnFamily("ttl"), "raw", now + 1000).ok());
+  ASSERT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "raw", &value, &expireAtMs).ok());
+  EXPECT_EQ("x", value);
+  EXPECT_EQ(now + 1000, expireAtMs);
+}
+
+TEST_F(TtlCompactionFilterTest, MergeExpirations) {
+  int64_t now = nowMs();
+  std::string value;
+  int64_t expireAtMs;
+  // a write after the expiration replaces it
+  put("key", "value1", TtlEnvelope::kNoExpiration);
+  ASSERT_TRUE(db()->Merge(rocksdb::WriteOptions(), columnFamily("ttl"), "key",
+                          TtlEnvelope::encodeExpiration(now, now + 1000)).ok());
+  put("key", "value2", TtlEnvelope::kNoExpiration);
+  ASSERT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "key", &value, &expireAtMs).ok());
+  EXPECT_EQ("value2", value);
+  EXPECT_EQ(TtlEnvelope::kNoExpiration, expireAtMs);
+
+  // an expiration issued after the value expired does not revive it, however late the merge is evaluated
+  put("key", "value3", now - 1000);
+  ASSERT_TRUE(db()->Merge(rocksdb::WriteOptions(), columnFamily("ttl"), "key",
+                          TtlEnvelope::encodeExpiration(now, now + 1000)).ok());
+  EXPECT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "key", &value).IsNotFound());
+  // but one issued while the value was live applies
+  put("key", "value4", now + 1000);
+  ASSERT_TRUE(db()->Merge(rocksdb::WriteOptions(), columnFamily("ttl"), "key",
+                          TtlEnvelope::encodeExpiration(now - 1, now + 2000)).ok());
+  ASSERT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "key", &value, &expireAtMs).ok());
+  EXPECT_EQ(now + 2000, expireAtMs);
+
+  // expiring a deleted value leaves it missing
+  ASSERT_TRUE(db()->Delete(rocksdb::WriteOptions(), columnFamily("ttl"), "key").ok());
+  ASSERT_TRUE(db()->Merge(rocksdb::WriteOptions(), columnFamily("ttl"), "key",
+                          TtlEnvelope::encodeExpiration(now, now + 1000)).ok());
+  EXPECT_TRUE(databaseManager()->getWithTtl(columnFamily("ttl"), "key", &value).IsNotFound());
+}
+
+TEST_F(TtlCompactionFilterTest, CompactionDropsExpiredValues) {
+  int64_t now = nowMs();
+  put("forever", "value1", TtlEnvelope::kNoExpiration);
+  put("later", "value2", now + 3600000);
+  put("expired", "value3", now - 1);
+  ASSERT_TRUE(db()->Put(rocksdb::WriteOptions(), columnFamily("ttl"), "raw", "x").ok());
+  EXPECT_EQ(4, totalKeyCount(columnFamily("ttl")));
+
+  ASSERT_TRUE(databaseManager()->forceCompaction(columnFamily("ttl"), nullptr, nullptr));
+  EXPECT_EQ(3, totalKeyCount(columnFamily("ttl")));
+  std::string value;
+  EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), columnFamily("ttl"), "expired", &value).IsNotFound());
+  EXPECT_TRUE(db()->Get(rocksdb::ReadOptions(), columnFamily("ttl"), "raw", &value).ok());
+}
+
+}  // namespace pipeline
@@ -12,6 +12,7 @@
 #include "folly/Format.h"
 #include "glog/logging.h"
 #include "gtest/gtest.h"
+#include "pipeline/CounterMergeOperator.h"
 #include "pipeline/DatabaseManager.h"
 #include "rocksdb/db.h"
 #include "rocksdb/options.h"
@@ -90,6 +91,10 @@ class TestWithRocksDb : public ::testing::Test {
       if (name == "default") continue;
 
       rocksdb::ColumnFamilyOptions columnFamilyOptions(options);
+      if (name == pipeline::DatabaseManager::metadataColumnFamilyName()) {
+        // same as RedisPipelineBootstrap, for the counters kept in the metadata column family
+        columnFamilyOptions.merge_operator = pipeline::CounterMergeOperator::getInstance();
+      }
       if (rocksDbCfConfiguratorMap_.count(name) > 0) {
         // 1MB default cache, it makes no difference for testing really
         rocksDbCfConfiguratorMap_[name](1, &columnFamilyOptions);
@@ -443,6 +443,19 @@ def smyte_workspace(workspace_name):
         name = "zlib",
         actual = "@zlib_archive//:zlib",
     )
+
+    # zstd
+    native.new_git_repository(
+        name = "zstd_git",
+        remote = "https://github.com/facebook/zstd.git",
+        tag = "v1.3.1",
+        build_file = workspace_name + "//third_party:zstd.BUILD",
+    )
+    native.bind(
+        name = "zstd",
+        actual = "@zstd_git//:zstd",
+    )
+
     # tdigest
     native.git_repository(
         name = "tdigest_git",